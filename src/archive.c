@@ -0,0 +1,558 @@
+#include "archive.h"
+
+#include <errno.h>
+#include <fcntl.h> /* open */
+#include <stdatomic.h>
+#include <stdlib.h> /* malloc, realloc, free */
+#include <string.h> /* memcpy, memcmp, memset, strlen */
+#include <sys/file.h> /* flock */
+#include <sys/mman.h> /* mmap, madvise, munmap */
+#include <sys/stat.h> /* fstat */
+#include <sys/uio.h> /* pwritev */
+#include <unistd.h> /* close, ftruncate, pread, pwrite, fdatasync, sysconf */
+
+#include "be-bytes.h"
+#include "compact.h"
+#include "verifier.h"
+
+/* Records per chunk of work for one audit thread */
+#define AUDIT_CHUNK 1024
+/* Fixed-width certificates per spow_verify_batch() call */
+#define AUDIT_BATCH 64
+
+typedef struct record_t {
+    const unsigned char *init_hash;
+    const unsigned char *token;
+    uint32_t difficulty;
+    uint32_t safety;
+    uint32_t steps;
+    uint32_t cert_size;
+    uint32_t format;
+    const unsigned char *cert;
+} record_t;
+
+/* Header and certificate, padded */
+static uint64_t record_span(uint32_t cert_size) {
+    return SPOW_ARCHIVE_RECORD_HEADER_BYTES + (((uint64_t)cert_size + 7) & ~(uint64_t)7);
+}
+
+static void fill_file_header(unsigned char *header, const char *magic) {
+    memset(header, 0, SPOW_ARCHIVE_FILE_HEADER_BYTES);
+    memcpy(header, magic, 8);
+    spow_store_be32(header + 8, SPOW_ARCHIVE_VERSION);
+}
+
+static int file_header_ok(const unsigned char *header, const char *magic) {
+    return 0 == memcmp(header, magic, 8) && spow_load_be32(header + 8) == SPOW_ARCHIVE_VERSION;
+}
+
+/* The record at 'offset' of the archive in 'data', if all of it is there. */
+static int parse_record(const unsigned char *data, uint64_t size, uint64_t offset, record_t *out) {
+    if (offset < SPOW_ARCHIVE_FILE_HEADER_BYTES || offset > size
+            || size - offset < SPOW_ARCHIVE_RECORD_HEADER_BYTES) {
+        return 0;
+    }
+    const unsigned char *header = data + offset;
+    out->init_hash = header;
+    out->token = header + 32;
+    out->difficulty = spow_load_be32(header + 40);
+    out->safety = spow_load_be32(header + 44);
+    out->steps = spow_load_be32(header + 48);
+    out->cert_size = spow_load_be32(header + 52);
+    out->format = spow_load_be32(header + 56);
+    out->cert = header + SPOW_ARCHIVE_RECORD_HEADER_BYTES;
+    return size - offset >= record_span(out->cert_size);
+}
+
+static char *index_path(const char *path) {
+    const size_t len = strlen(path);
+    char *result = malloc(len + 5);
+    if (result != NULL) {
+        memcpy(result, path, len);
+        memcpy(result + len, ".idx", 5);
+    }
+    return result;
+}
+
+static int pwrite_all(int fd, const unsigned char *data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        const ssize_t written = pwrite(fd, data, size, (off_t)offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        data += written;
+        size -= (size_t)written;
+        offset += (uint64_t)written;
+    }
+    return 0;
+}
+
+/* The offset just after the last complete record, counted in *out_records,
+ * found by reading through the archive.  If 'index_fd' isn't -1, the index
+ * is rewritten on the way. */
+static int scan_records(int fd, uint64_t file_size, int index_fd,
+                        uint64_t *out_end, uint64_t *out_records) {
+    unsigned char header[SPOW_ARCHIVE_FILE_HEADER_BYTES];
+    if (index_fd >= 0) {
+        fill_file_header(header, SPOW_ARCHIVE_INDEX_MAGIC);
+        if (pwrite_all(index_fd, header, sizeof(header), 0) != 0) {
+            return -1;
+        }
+    }
+    uint64_t offset = SPOW_ARCHIVE_FILE_HEADER_BYTES;
+    uint64_t records = 0;
+    unsigned char record[SPOW_ARCHIVE_RECORD_HEADER_BYTES];
+    while (file_size - offset >= sizeof(record)
+            && pread(fd, record, sizeof(record), (off_t)offset) == (ssize_t)sizeof(record)) {
+        const uint64_t span = record_span(spow_load_be32(record + 52));
+        if (file_size - offset < span) {
+            break;
+        }
+        if (index_fd >= 0) {
+            unsigned char entry[8];
+            spow_store_be64(entry, offset);
+            if (pwrite_all(index_fd, entry, sizeof(entry),
+                           SPOW_ARCHIVE_FILE_HEADER_BYTES + records * 8) != 0) {
+                return -1;
+            }
+        }
+        offset += span;
+        records += 1;
+    }
+    *out_end = offset;
+    *out_records = records;
+    return 0;
+}
+
+/* Trust the index up to its last entry that points at a complete record. */
+static int check_index(int fd, uint64_t file_size, int index_fd,
+                       uint64_t *out_end, uint64_t *out_records) {
+    struct stat st;
+    unsigned char header[SPOW_ARCHIVE_FILE_HEADER_BYTES];
+    if (fstat(index_fd, &st) != 0 || (uint64_t)st.st_size < sizeof(header)
+            || pread(index_fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)
+            || !file_header_ok(header, SPOW_ARCHIVE_INDEX_MAGIC)) {
+        return 0;
+    }
+    uint64_t records = ((uint64_t)st.st_size - sizeof(header)) / 8;
+    for (; records > 0; --records) {
+        unsigned char entry[8];
+        unsigned char record[SPOW_ARCHIVE_RECORD_HEADER_BYTES];
+        if (pread(index_fd, entry, sizeof(entry),
+                  (off_t)(sizeof(header) + (records - 1) * 8)) != (ssize_t)sizeof(entry)) {
+            return 0;
+        }
+        const uint64_t offset = spow_load_be64(entry);
+        if (offset < SPOW_ARCHIVE_FILE_HEADER_BYTES || offset > file_size
+                || file_size - offset < sizeof(record)
+                || pread(fd, record, sizeof(record), (off_t)offset) != (ssize_t)sizeof(record)) {
+            continue;
+        }
+        const uint64_t span = record_span(spow_load_be32(record + 52));
+        if (file_size - offset >= span) {
+            *out_end = offset + span;
+            *out_records = records;
+            return 1;
+        }
+    }
+    *out_end = SPOW_ARCHIVE_FILE_HEADER_BYTES;
+    *out_records = 0;
+    return 1;
+}
+
+int spow_archive_open(spow_archive_t *archive, const char *path) {
+    archive->fd = -1;
+    archive->index_fd = -1;
+    char *idx = index_path(path);
+    if (idx == NULL) {
+        return -1;
+    }
+    archive->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (archive->fd >= 0) {
+        archive->index_fd = open(idx, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    }
+    free(idx);
+    if (archive->index_fd < 0) {
+        if (archive->fd >= 0) {
+            close(archive->fd);
+            archive->fd = -1;
+        }
+        return -1;
+    }
+    /* From here on, spow_archive_close() cleans up, and destroys this. */
+    pthread_mutex_init(&archive->lock, NULL);
+    struct stat st;
+    if (flock(archive->fd, LOCK_EX | LOCK_NB) != 0 || fstat(archive->fd, &st) != 0) {
+        spow_archive_close(archive);
+        return -1;
+    }
+
+    const uint64_t file_size = (uint64_t)st.st_size;
+    unsigned char header[SPOW_ARCHIVE_FILE_HEADER_BYTES];
+    int ok;
+    if (file_size == 0) {
+        fill_file_header(header, SPOW_ARCHIVE_MAGIC);
+        ok = pwrite_all(archive->fd, header, sizeof(header), 0) == 0
+            && scan_records(archive->fd, sizeof(header), archive->index_fd,
+                            &archive->size, &archive->records) == 0;
+    } else if (file_size < sizeof(header)
+            || pread(archive->fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)
+            || !file_header_ok(header, SPOW_ARCHIVE_MAGIC)) {
+        errno = EINVAL;
+        ok = 0;
+    } else {
+        ok = check_index(archive->fd, file_size, archive->index_fd, &archive->size, &archive->records)
+            || scan_records(archive->fd, file_size, archive->index_fd,
+                            &archive->size, &archive->records) == 0;
+    }
+    /* Cut off a torn record, and index entries for it. */
+    if (!ok || ftruncate(archive->fd, (off_t)archive->size) != 0
+            || ftruncate(archive->index_fd,
+                         (off_t)(SPOW_ARCHIVE_FILE_HEADER_BYTES + archive->records * 8)) != 0) {
+        spow_archive_close(archive);
+        return -1;
+    }
+    return 0;
+}
+
+int spow_archive_append(spow_archive_t *archive,
+                        const unsigned char *init_hash,
+                        const unsigned char *token,
+                        uint32_t difficulty,
+                        uint32_t safety,
+                        uint32_t steps,
+                        uint32_t format,
+                        const unsigned char *cert,
+                        uint32_t cert_size) {
+    unsigned char header[SPOW_ARCHIVE_RECORD_HEADER_BYTES];
+    memset(header, 0, sizeof(header));
+    memcpy(header, init_hash, 32);
+    memcpy(header + 32, token, 8);
+    spow_store_be32(header + 40, difficulty);
+    spow_store_be32(header + 44, safety);
+    spow_store_be32(header + 48, steps);
+    spow_store_be32(header + 52, cert_size);
+    spow_store_be32(header + 56, format);
+    static const unsigned char PADDING[8];
+    const uint64_t span = record_span(cert_size);
+    struct iovec iov[3] = {
+        {header, sizeof(header)},
+        {(void *)cert, cert_size},
+        {(void *)PADDING, (size_t)(span - sizeof(header) - cert_size)},
+    };
+
+    pthread_mutex_lock(&archive->lock);
+    int result = 0;
+    const ssize_t written = pwritev(archive->fd, iov, 3, (off_t)archive->size);
+    if (written != (ssize_t)span) {
+        /* Short writes are only possible if something is wrong anyway. */
+        if (written >= 0) {
+            errno = EIO;
+        }
+        result = -1;
+    } else {
+        unsigned char entry[8];
+        spow_store_be64(entry, archive->size);
+        result = pwrite_all(archive->index_fd, entry, sizeof(entry),
+                            SPOW_ARCHIVE_FILE_HEADER_BYTES + archive->records * 8);
+    }
+    if (result == 0) {
+        archive->size += span;
+        archive->records += 1;
+    }
+    pthread_mutex_unlock(&archive->lock);
+    return result;
+}
+
+int spow_archive_sync(spow_archive_t *archive) {
+    /* The records first, so that a synced index never points at garbage. */
+    if (fdatasync(archive->fd) != 0 || fdatasync(archive->index_fd) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void spow_archive_close(spow_archive_t *archive) {
+    if (archive->index_fd >= 0) {
+        close(archive->index_fd);
+    }
+    if (archive->fd >= 0) {
+        /* Also releases the lock. */
+        close(archive->fd);
+        pthread_mutex_destroy(&archive->lock);
+    }
+    archive->fd = -1;
+    archive->index_fd = -1;
+}
+
+typedef struct audit_t {
+    const unsigned char *data;
+    uint64_t size;
+    /* Either the mapped index, or the offsets found by scanning */
+    const unsigned char *index;
+    uint64_t *offsets;
+    uint64_t records;
+    atomic_uint_least64_t next;
+    spow_archive_invalid_fn invalid;
+    void *invalid_ctx;
+    pthread_mutex_t lock;
+    /* Under the lock */
+    spow_archive_stats_t stats;
+} audit_t;
+
+static uint64_t offset_of(const audit_t *audit, uint64_t record) {
+    return (audit->index != NULL)
+        ? spow_load_be64(audit->index + SPOW_ARCHIVE_FILE_HEADER_BYTES + record * 8)
+        : audit->offsets[record];
+}
+
+typedef struct audit_local_t {
+    uint64_t valid;
+    uint64_t invalid;
+    uint64_t cert_bytes;
+    uint64_t steps;
+} audit_local_t;
+
+static void audit_report(audit_t *audit, audit_local_t *local, uint64_t record, int result) {
+    if (result == SPOW_VERIFY_OK) {
+        local->valid += 1;
+        return;
+    }
+    local->invalid += 1;
+    if (audit->invalid != NULL) {
+        pthread_mutex_lock(&audit->lock);
+        audit->invalid(audit->invalid_ctx, record, offset_of(audit, record), result);
+        pthread_mutex_unlock(&audit->lock);
+    }
+}
+
+static void audit_flush(audit_t *audit, audit_local_t *local,
+                        spow_verify_job_t *jobs, const uint64_t *job_records, size_t *jobs_num) {
+    spow_verify_batch(jobs, *jobs_num);
+    for (size_t i = 0; i < *jobs_num; ++i) {
+        audit_report(audit, local, job_records[i], jobs[i].result);
+    }
+    *jobs_num = 0;
+}
+
+/* Compact certificates are decoded, so that spow_verify_batch() can take
+ * them, too: spow_verify_compact() verifies one at a time, which is several
+ * times slower than all SIMD lanes at once, and decoding is cheap in
+ * comparison.  Only malformed ones (or those with
+ * nonces too wide to decode) are left to spow_verify_compact(), which also
+ * tells what is wrong with them.  Returns the fixed-width size, or 0. */
+static size_t audit_decode(const record_t *record, unsigned char **buf, size_t *buf_size) {
+    /* Each step takes at least Difficulty + 1 bits, so a short certificate
+     * can't make us allocate much. */
+    const uint64_t min_bits = (uint64_t)record->steps * ((uint64_t)record->difficulty + 1);
+    const uint64_t fixed_size = ((uint64_t)record->steps * ((uint64_t)record->difficulty + record->safety) + 7) / 8;
+    if (record->cert_size < SPOW_COMPACT_HEADER_BYTES
+            || min_bits > (uint64_t)(record->cert_size - SPOW_COMPACT_HEADER_BYTES) * 8
+            || fixed_size > SIZE_MAX) {
+        return 0;
+    }
+    if (*buf_size < fixed_size) {
+        unsigned char *grown = realloc(*buf, (size_t)fixed_size);
+        if (grown == NULL) {
+            return 0;
+        }
+        *buf = grown;
+        *buf_size = (size_t)fixed_size;
+    }
+    return spow_compact_decode(*buf, *buf_size, record->difficulty, record->safety, record->steps,
+        record->cert, record->cert_size);
+}
+
+static void *audit_main(void *arg) {
+    audit_t *audit = arg;
+    audit_local_t local;
+    memset(&local, 0, sizeof(local));
+    spow_verify_job_t jobs[AUDIT_BATCH];
+    uint64_t job_records[AUDIT_BATCH];
+    /* One for each job, for decoded compact certificates */
+    unsigned char *decoded[AUDIT_BATCH];
+    size_t decoded_size[AUDIT_BATCH];
+    memset(decoded, 0, sizeof(decoded));
+    memset(decoded_size, 0, sizeof(decoded_size));
+    size_t jobs_num = 0;
+    for (;;) {
+        const uint64_t first = atomic_fetch_add(&audit->next, AUDIT_CHUNK);
+        if (first >= audit->records) {
+            break;
+        }
+        const uint64_t last = (audit->records - first < AUDIT_CHUNK) ? audit->records : first + AUDIT_CHUNK;
+        for (uint64_t i = first; i < last; ++i) {
+            record_t record;
+            if (!parse_record(audit->data, audit->size, offset_of(audit, i), &record)) {
+                audit_report(audit, &local, i, SPOW_VERIFY_BAD_LENGTH);
+                continue;
+            }
+            local.cert_bytes += record.cert_size;
+            local.steps += record.steps;
+            spow_verify_job_t *job = &jobs[jobs_num];
+            job->cert = record.cert;
+            job->cert_size = record.cert_size;
+            if (record.format == SPOW_ARCHIVE_COMPACT) {
+                job->cert_size = audit_decode(&record, &decoded[jobs_num], &decoded_size[jobs_num]);
+                job->cert = decoded[jobs_num];
+                if (job->cert_size == 0) {
+                    audit_report(audit, &local, i, spow_verify_compact(record.init_hash, record.token,
+                        record.difficulty, record.safety, record.steps, record.cert, record.cert_size));
+                    continue;
+                }
+            } else if (record.format != SPOW_ARCHIVE_FIXED) {
+                audit_report(audit, &local, i, SPOW_VERIFY_BAD_ENCODING);
+                continue;
+            }
+            job->init_hash = record.init_hash;
+            job->token = record.token;
+            job->difficulty = record.difficulty;
+            job->safety = record.safety;
+            job->steps = record.steps;
+            job_records[jobs_num] = i;
+            jobs_num += 1;
+            if (jobs_num == AUDIT_BATCH) {
+                audit_flush(audit, &local, jobs, job_records, &jobs_num);
+            }
+        }
+    }
+    audit_flush(audit, &local, jobs, job_records, &jobs_num);
+    for (size_t i = 0; i < AUDIT_BATCH; ++i) {
+        free(decoded[i]);
+    }
+
+    pthread_mutex_lock(&audit->lock);
+    audit->stats.valid += local.valid;
+    audit->stats.invalid += local.invalid;
+    audit->stats.cert_bytes += local.cert_bytes;
+    audit->stats.steps += local.steps;
+    pthread_mutex_unlock(&audit->lock);
+    return NULL;
+}
+
+/* Collect the offsets of all complete records of the mapped archive. */
+static int scan_offsets(audit_t *audit) {
+    size_t capacity = 0;
+    uint64_t offset = SPOW_ARCHIVE_FILE_HEADER_BYTES;
+    record_t record;
+    while (parse_record(audit->data, audit->size, offset, &record)) {
+        if (audit->records == capacity) {
+            capacity = capacity ? 2 * capacity : 4096;
+            uint64_t *offsets = realloc(audit->offsets, capacity * sizeof(uint64_t));
+            if (offsets == NULL) {
+                return -1;
+            }
+            audit->offsets = offsets;
+        }
+        audit->offsets[audit->records++] = offset;
+        offset += record_span(record.cert_size);
+    }
+    return 0;
+}
+
+/* Map the whole file read-only, or set *out_data to NULL if it's empty. */
+static int map_file(const char *path, const unsigned char **out_data, uint64_t *out_size) {
+    *out_data = NULL;
+    *out_size = 0;
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    *out_size = (uint64_t)st.st_size;
+    if (*out_size > 0) {
+        void *map = mmap(NULL, (size_t)*out_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        *out_data = map;
+    }
+    /* The mapping stays valid without it. */
+    close(fd);
+    return 0;
+}
+
+int spow_archive_audit(const char *path,
+                       unsigned int threads,
+                       spow_archive_invalid_fn invalid,
+                       void *invalid_ctx,
+                       spow_archive_stats_t *out_stats) {
+    audit_t audit;
+    memset(&audit, 0, sizeof(audit));
+    if (map_file(path, &audit.data, &audit.size) != 0) {
+        return -1;
+    }
+    if (audit.size < SPOW_ARCHIVE_FILE_HEADER_BYTES || !file_header_ok(audit.data, SPOW_ARCHIVE_MAGIC)) {
+        if (audit.data != NULL) {
+            munmap((void *)audit.data, (size_t)audit.size);
+        }
+        errno = EINVAL;
+        return -1;
+    }
+    /* Each thread reads its chunks front to back. */
+    madvise((void *)audit.data, (size_t)audit.size, MADV_SEQUENTIAL);
+
+    int result = 0;
+    char *idx = index_path(path);
+    const unsigned char *index_data = NULL;
+    uint64_t index_size = 0;
+    if (idx != NULL && map_file(idx, &index_data, &index_size) == 0
+            && index_size >= SPOW_ARCHIVE_FILE_HEADER_BYTES
+            && file_header_ok(index_data, SPOW_ARCHIVE_INDEX_MAGIC)) {
+        audit.index = index_data;
+        audit.records = (index_size - SPOW_ARCHIVE_FILE_HEADER_BYTES) / 8;
+    } else {
+        audit.stats.scanned = 1;
+        if (scan_offsets(&audit) != 0) {
+            result = -1;
+        }
+    }
+    free(idx);
+
+    if (result == 0) {
+        if (threads == 0) {
+            const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            threads = (cpus > 0) ? (unsigned int)cpus : 1;
+        }
+        atomic_init(&audit.next, 0);
+        audit.invalid = invalid;
+        audit.invalid_ctx = invalid_ctx;
+        pthread_mutex_init(&audit.lock, NULL);
+        pthread_t *handles = malloc(threads * sizeof(pthread_t));
+        unsigned int started = 0;
+        if (handles != NULL) {
+            for (; started < threads; ++started) {
+                if (pthread_create(&handles[started], NULL, audit_main, &audit) != 0) {
+                    break;
+                }
+            }
+        }
+        /* With no thread at all, do it here. */
+        if (started == 0) {
+            audit_main(&audit);
+        }
+        for (unsigned int i = 0; i < started; ++i) {
+            pthread_join(handles[i], NULL);
+        }
+        free(handles);
+        pthread_mutex_destroy(&audit.lock);
+        audit.stats.records = audit.records;
+        audit.stats.archive_bytes = audit.size;
+        *out_stats = audit.stats;
+    }
+
+    free(audit.offsets);
+    if (index_data != NULL) {
+        munmap((void *)index_data, (size_t)index_size);
+    }
+    munmap((void *)audit.data, (size_t)audit.size);
+    return result;
+}
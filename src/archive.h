@@ -0,0 +1,119 @@
+/* An append-only archive of accepted certificates, and auditing it.
+ *
+ * The archive is one file of records, each a fixed 64-byte header followed
+ * by the certificate, padded to a multiple of 8 bytes:
+ *     offset  size
+ *          0    32  init_hash
+ *         32     8  token
+ *         40     4  difficulty
+ *         44     4  safety
+ *         48     4  steps
+ *         52     4  cert_size
+ *         56     4  format (SPOW_ARCHIVE_FIXED or SPOW_ARCHIVE_COMPACT)
+ *         60     4  reserved, zero
+ *         64        cert_size bytes of certificate, then zeros up to 8
+ * The file starts with a 16-byte header: the magic SPOW_ARCHIVE_MAGIC, the
+ * version, and 4 reserved bytes.  All numbers are big-endian, so archives
+ * can be moved between machines.
+ *
+ * Next to it, "PATH.idx" is the offset index: a 16-byte header
+ * (SPOW_ARCHIVE_INDEX_MAGIC, version, reserved), then the offset of each
+ * record as 8 bytes.  Records are self-delimiting, so the index is only
+ * needed to find record N without reading the ones before it, which lets
+ * the audit split the work between threads right away.  The archive
+ * without its index is still complete: spow_archive_open() rebuilds it.
+ *
+ * Each record is written with a single pwritev(), and only then its offset
+ * is appended to the index, so the index only ever points at complete
+ * records.  spow_archive_open() cuts off whatever follows the last indexed
+ * record, i.e. a record that was being written during a crash, and whose
+ * spow_archive_append() had therefore not returned yet.
+ *
+ * spow_archive_audit() maps both files and verifies every record in place
+ * (nothing is copied), with spow_verify_batch() for the fixed-width
+ * certificates and spow_verify_compact() for the compact ones, on all
+ * cores. */
+
+#ifndef STEPPOW_ARCHIVE_H
+#define STEPPOW_ARCHIVE_H
+
+#include <pthread.h>
+#include <stddef.h> /* size_t */
+#include <stdint.h>
+
+#define SPOW_ARCHIVE_MAGIC "SPOWARC1"
+#define SPOW_ARCHIVE_INDEX_MAGIC "SPOWIDX1"
+#define SPOW_ARCHIVE_VERSION 1
+#define SPOW_ARCHIVE_FILE_HEADER_BYTES 16
+#define SPOW_ARCHIVE_RECORD_HEADER_BYTES 64
+
+/* Certificate formats in a record */
+#define SPOW_ARCHIVE_FIXED 0
+/* See compact.h */
+#define SPOW_ARCHIVE_COMPACT 1
+
+/* For appending.  One process at a time (it's locked with flock()), but
+ * any number of threads. */
+typedef struct spow_archive_t {
+    int fd;
+    int index_fd;
+    pthread_mutex_t lock;
+    /* Where the next record goes */
+    uint64_t size;
+    uint64_t records;
+} spow_archive_t;
+
+/* Open 'path' for appending, and create it if it doesn't exist.  Repairs
+ * the end of the archive and the index after a crash, see above.  Returns 0
+ * on success, and -1 on failure (see errno), e.g. if it is not an archive,
+ * or another process has it open. */
+int spow_archive_open(spow_archive_t *archive, const char *path);
+
+/* Append a certificate.  init_hash has 32 bytes and token 8, as for
+ * spow_verify().  Returns 0 on success, and -1 on failure (see errno).  The
+ * record is not necessarily on disk yet, see spow_archive_sync(). */
+int spow_archive_append(spow_archive_t *archive,
+                        const unsigned char *init_hash,
+                        const unsigned char *token,
+                        uint32_t difficulty,
+                        uint32_t safety,
+                        uint32_t steps,
+                        uint32_t format,
+                        const unsigned char *cert,
+                        uint32_t cert_size);
+
+/* Flush everything appended so far to disk.  Returns 0 or -1. */
+int spow_archive_sync(spow_archive_t *archive);
+
+void spow_archive_close(spow_archive_t *archive);
+
+/* Called for every invalid record, from any audit thread, but never by two
+ * at the same time.  'result' is a SPOW_VERIFY_* result; a record that
+ * doesn't even fit into the file is SPOW_VERIFY_BAD_LENGTH, and an unknown
+ * format SPOW_VERIFY_BAD_ENCODING. */
+typedef void (*spow_archive_invalid_fn)(void *ctx, uint64_t record, uint64_t offset, int result);
+
+typedef struct spow_archive_stats_t {
+    uint64_t records;
+    uint64_t valid;
+    uint64_t invalid;
+    /* Certificate bytes verified, and all bytes of the archive */
+    uint64_t cert_bytes;
+    uint64_t archive_bytes;
+    /* Steps, i.e. hashes */
+    uint64_t steps;
+    /* Whether the index was missing or damaged, so the records were found
+     * by reading through the archive. */
+    int scanned;
+} spow_archive_stats_t;
+
+/* Verify all records of the archive 'path' with 'threads' threads (0 means
+ * one per online CPU).  Returns 0 if it could be read at all, whether or
+ * not all records are valid, and -1 otherwise (see errno). */
+int spow_archive_audit(const char *path,
+                       unsigned int threads,
+                       spow_archive_invalid_fn invalid,
+                       void *invalid_ctx,
+                       spow_archive_stats_t *out_stats);
+
+#endif /* STEPPOW_ARCHIVE_H */
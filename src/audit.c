@@ -0,0 +1,66 @@
+/* Compile:
+ * clang -Wall -O3 -pthread src/audit.c src/archive.c src/verifier.c src/kernel.c src/sha256.c src/sha256-simd.c src/sha256-shani.c -o bin/audit
+ * Run:
+ * ./bin/audit [--threads N] ARCHIVE
+ *
+ * Verifies every certificate of an archive written with spow_archive_append()
+ * (see src/archive.h), on all cores unless given --threads, lists the invalid
+ * ones, and exits with 1 if there are any.  The index ARCHIVE.idx is used if
+ * it is there; without it, the archive is read through once more to find the
+ * records. */
+
+#include <errno.h>
+#include <inttypes.h> /* PRIu64 and similar */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h> /* strtoul */
+#include <string.h> /* strcmp, strerror */
+
+#include "archive.h"
+#include "kernel.h" /* spow_seconds_now */
+#include "verifier.h"
+
+static void print_invalid(void *ctx, uint64_t record, uint64_t offset, int result) {
+    (void)ctx;
+    printf("Record %" PRIu64 " at offset %" PRIu64 ": %s\n", record, offset, spow_verify_strerror(result));
+}
+
+int main(int argc, char **argv) {
+    unsigned long threads = 0;
+    const char *path = NULL;
+    int ok = 1;
+    for (int i = 1; i < argc && ok; ++i) {
+        if (0 == strcmp(argv[i], "--threads") && i + 1 < argc) {
+            char *end = NULL;
+            const char *str = argv[++i];
+            threads = strtoul(str, &end, 10);
+            ok = *str != '\0' && *end == '\0' && threads <= 4096;
+        } else if (path == NULL) {
+            path = argv[i];
+        } else {
+            ok = 0;
+        }
+    }
+    if (!ok || path == NULL) {
+        fprintf(stderr, "USAGE: %s [--threads N] ARCHIVE\n"
+            "\tVerifies all certificates in ARCHIVE with N threads (default: one per CPU).\n",
+            argv[0]);
+        return 2;
+    }
+
+    spow_archive_stats_t stats;
+    const double start = spow_seconds_now();
+    if (spow_archive_audit(path, (unsigned int)threads, print_invalid, NULL, &stats) != 0) {
+        fprintf(stderr, "Cannot audit %s: %s\n", path, strerror(errno));
+        return 2;
+    }
+    const double seconds = spow_seconds_now() - start;
+    if (stats.scanned) {
+        printf("No usable index, found the records by reading through the archive.\n");
+    }
+    printf("Records: %" PRIu64 ", valid: %" PRIu64 ", invalid: %" PRIu64 "\n",
+        stats.records, stats.valid, stats.invalid);
+    printf("Time: %.3f s, %.3f GB/s, %.0f certificates/s, %.0f hashes/s\n", seconds,
+        stats.archive_bytes / seconds * 1e-9, stats.records / seconds, stats.steps / seconds);
+    return stats.invalid != 0;
+}
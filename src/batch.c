@@ -0,0 +1,521 @@
+#include "batch.h"
+
+#include <errno.h>
+#include <inttypes.h> /* PRIu64 and similar */
+#include <pthread.h>
+#include <stdlib.h> /* calloc, free */
+#include <string.h> /* strerror */
+#include <sys/types.h> /* ssize_t */
+
+#include "checkpoint.h"
+#include "compact.h"
+
+/* Per thread, so that the reader doesn't run too far ahead. */
+#define QUEUED_PER_THREAD 64
+/* How much work a crash may cost, at most */
+#define CHECKPOINT_INTERVAL_NS 1000000000ull
+
+typedef struct task_t {
+    uint64_t id;
+    config_t config;
+} task_t;
+
+/* Ring buffer of tasks.  The owner takes the oldest task, thieves take the
+ * newest one, i.e. the one the owner would have gotten to last. */
+typedef struct deque_t {
+    pthread_mutex_t lock;
+    task_t *tasks;
+    size_t capacity;
+    size_t head;
+    size_t size;
+} deque_t;
+
+typedef struct worker_t {
+    spow_batch_t *batch;
+    unsigned int index;
+    pthread_t thread;
+} worker_t;
+
+struct spow_batch_t {
+    prover_t prover;
+    /* NULL for no checkpoints */
+    const char *checkpoint_dir;
+    prover_done_fn done;
+    void *done_ctx;
+    unsigned int threads;
+    worker_t *workers;
+    unsigned int workers_started;
+    deque_t *deques;
+    /* Where spow_batch_submit() puts the next task */
+    unsigned int next_deque;
+
+    pthread_mutex_t lock;
+    /* Signalled when a task is queued (or on shutdown) */
+    pthread_cond_t wake;
+    /* Signalled when a task is taken */
+    pthread_cond_t room;
+    /* Tasks in all deques, minus those already claimed by a worker.  So a
+     * worker that decrements this is guaranteed to find a task somewhere. */
+    size_t queued;
+    int shutdown;
+};
+
+static int deque_push(deque_t *deque, const task_t *task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->size == deque->capacity) {
+        const size_t capacity = deque->capacity ? 2 * deque->capacity : 16;
+        task_t *tasks = malloc(capacity * sizeof(task_t));
+        if (tasks == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            return 0;
+        }
+        for (size_t i = 0; i < deque->size; ++i) {
+            tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+        deque->head = 0;
+    }
+    deque->tasks[(deque->head + deque->size) % deque->capacity] = *task;
+    deque->size += 1;
+    pthread_mutex_unlock(&deque->lock);
+    return 1;
+}
+
+static int deque_take(deque_t *deque, int steal, task_t *out_task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->size == 0) {
+        pthread_mutex_unlock(&deque->lock);
+        return 0;
+    }
+    if (steal) {
+        *out_task = deque->tasks[(deque->head + deque->size - 1) % deque->capacity];
+    } else {
+        *out_task = deque->tasks[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+    }
+    deque->size -= 1;
+    pthread_mutex_unlock(&deque->lock);
+    return 1;
+}
+
+/* Claim a task, own deque first, then steal from the others.  Returns 0 if
+ * there is none, which with 'wait' set means that the batch is shut down. */
+static int take_task(const worker_t *worker, int wait, task_t *out_task) {
+    spow_batch_t *batch = worker->batch;
+    pthread_mutex_lock(&batch->lock);
+    while (wait && batch->queued == 0 && !batch->shutdown) {
+        pthread_cond_wait(&batch->wake, &batch->lock);
+    }
+    if (batch->queued == 0) {
+        pthread_mutex_unlock(&batch->lock);
+        return 0;
+    }
+    batch->queued -= 1;
+    pthread_cond_signal(&batch->room);
+    pthread_mutex_unlock(&batch->lock);
+
+    for (unsigned int i = 0; ; i = (i + 1) % batch->threads) {
+        const unsigned int victim = (worker->index + i) % batch->threads;
+        if (deque_take(&batch->deques[victim], i != 0, out_task)) {
+            return 1;
+        }
+    }
+}
+
+static int next_config(void *arg, int wait, uint64_t *out_id, config_t *out_config) {
+    task_t task;
+    if (!take_task(arg, wait, &task)) {
+        return 0;
+    }
+    *out_id = task.id;
+    *out_config = task.config;
+    return 1;
+}
+
+/* Prove the config, and pass the result to 'done'. */
+static void prove_task(const spow_batch_t *batch, uint64_t id, const config_t *config) {
+    unsigned char *cert = NULL;
+    uint32_t cert_size = 0;
+    size_t hashes = 0;
+    if (find_cert(&batch->prover, config, &cert, &cert_size, &hashes)) {
+        batch->done(batch->done_ctx, id, config, cert, cert_size, hashes);
+        free(cert);
+    } else {
+        batch->done(batch->done_ctx, id, config, NULL, 0, 0);
+    }
+}
+
+/* Like prove_task(), but continues from and keeps a checkpoint file for the
+ * config.  Without a usable file, it's just prove_task(). */
+static void prove_task_checkpointed(const spow_batch_t *batch, uint64_t id, const config_t *config) {
+    char path[4096];
+    int len = snprintf(path, sizeof(path), "%s/", batch->checkpoint_dir);
+    for (unsigned int i = 0; i < SPOW_HASH_SIZE && len > 0 && (size_t)len < sizeof(path); ++i) {
+        len += snprintf(path + len, sizeof(path) - (size_t)len, "%02x", config->init_hash[i]);
+    }
+    for (unsigned int i = 0; i < SPOW_TOKEN_SIZE && len > 0 && (size_t)len < sizeof(path); ++i) {
+        len += snprintf(path + len, sizeof(path) - (size_t)len, "%02x", config->token[i]);
+    }
+    if (len > 0 && (size_t)len < sizeof(path)) {
+        len += snprintf(path + len, sizeof(path) - (size_t)len, "-%u-%u-%u.ckpt",
+                        config->difficulty, config->safety, config->steps);
+    }
+    if (len <= 0 || (size_t)len >= sizeof(path)) {
+        fprintf(stderr, "Checkpoint directory name too long, proving without.\n");
+        prove_task(batch, id, config);
+        return;
+    }
+
+    const uint32_t cert_size = prover_cert_size(config);
+    unsigned char *cert = malloc(cert_size);
+    if (cert == NULL) {
+        batch->done(batch->done_ctx, id, config, NULL, 0, 0);
+        return;
+    }
+    prover_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.prover = &batch->prover;
+    unsigned char last_hash[SPOW_HASH_SIZE];
+    spow_checkpoint_t checkpoint;
+    const int opened = spow_checkpoint_open(&checkpoint, path, config, CHECKPOINT_INTERVAL_NS,
+                                            &ctx.step, &ctx.hashes, last_hash, cert);
+    if (opened == SPOW_CHECKPOINT_ERROR) {
+        fprintf(stderr, "Cannot use checkpoint %s (%s), proving without.\n", path, strerror(errno));
+        free(cert);
+        prove_task(batch, id, config);
+        return;
+    }
+    ctx.save = spow_checkpoint_save;
+    ctx.save_ctx = &checkpoint;
+
+    int result;
+    if (opened == SPOW_CHECKPOINT_RESUMED) {
+        result = find_cert_resume(&ctx, config, last_hash, cert, cert_size);
+    } else {
+        result = find_cert_r(&ctx, config, cert, cert_size);
+    }
+    if (result == PROVER_OK) {
+        batch->done(batch->done_ctx, id, config, cert, cert_size, ctx.hashes);
+    } else {
+        fprintf(stderr, "Failed in step %u, would need to backtrack!\n", ctx.step);
+        batch->done(batch->done_ctx, id, config, NULL, 0, 0);
+    }
+    /* Only now that the result is out: Until then, a crash must not lose
+     * the proof.  A failed config would fail again, so there is nothing
+     * worth keeping either way. */
+    spow_checkpoint_close(&checkpoint, path, 1);
+    free(cert);
+}
+
+static void *worker_main(void *arg) {
+    const worker_t *worker = arg;
+    spow_batch_t *batch = worker->batch;
+    if (batch->prover.multi != NULL) {
+        find_certs_multi(&batch->prover, next_config, arg, batch->done, batch->done_ctx);
+        return NULL;
+    }
+
+    task_t task;
+    while (take_task(worker, 1, &task)) {
+        if (batch->checkpoint_dir != NULL) {
+            prove_task_checkpointed(batch, task.id, &task.config);
+        } else {
+            prove_task(batch, task.id, &task.config);
+        }
+    }
+    return NULL;
+}
+
+spow_batch_t *spow_batch_create(unsigned int threads,
+                                const prover_t *prover,
+                                const char *checkpoint_dir,
+                                prover_done_fn done,
+                                void *done_ctx) {
+    if (threads == 0 || (checkpoint_dir != NULL && prover->multi != NULL)) {
+        return NULL;
+    }
+    spow_batch_t *batch = calloc(1, sizeof(*batch));
+    if (batch == NULL) {
+        return NULL;
+    }
+    batch->prover = *prover;
+    /* Each config gets a single thread. */
+    batch->prover.parallel = NULL;
+    /* The counters belong to the thread that opened them, see perf.h. */
+    batch->prover.perf = NULL;
+    batch->checkpoint_dir = checkpoint_dir;
+    batch->done = done;
+    batch->done_ctx = done_ctx;
+    batch->threads = threads;
+    batch->workers = calloc(threads, sizeof(worker_t));
+    batch->deques = calloc(threads, sizeof(deque_t));
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->wake, NULL);
+    pthread_cond_init(&batch->room, NULL);
+    if (batch->workers == NULL || batch->deques == NULL) {
+        free(batch->workers);
+        free(batch->deques);
+        pthread_cond_destroy(&batch->room);
+        pthread_cond_destroy(&batch->wake);
+        pthread_mutex_destroy(&batch->lock);
+        free(batch);
+        return NULL;
+    }
+    for (unsigned int i = 0; i < threads; ++i) {
+        pthread_mutex_init(&batch->deques[i].lock, NULL);
+    }
+
+    for (unsigned int i = 0; i < threads; ++i) {
+        batch->workers[i].batch = batch;
+        batch->workers[i].index = i;
+        if (0 != pthread_create(&batch->workers[i].thread, NULL, worker_main, &batch->workers[i])) {
+            spow_batch_destroy(batch);
+            return NULL;
+        }
+        batch->workers_started += 1;
+    }
+    return batch;
+}
+
+void spow_batch_submit(spow_batch_t *batch, uint64_t id, const config_t *config) {
+    task_t task;
+    task.id = id;
+    task.config = *config;
+
+    pthread_mutex_lock(&batch->lock);
+    while (batch->queued >= (size_t)QUEUED_PER_THREAD * batch->threads) {
+        pthread_cond_wait(&batch->room, &batch->lock);
+    }
+    /* Round-robin; stealing evens out the rest. */
+    const unsigned int target = batch->next_deque;
+    batch->next_deque = (target + 1) % batch->threads;
+    pthread_mutex_unlock(&batch->lock);
+
+    if (!deque_push(&batch->deques[target], &task)) {
+        batch->done(batch->done_ctx, id, config, NULL, 0, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    batch->queued += 1;
+    pthread_cond_signal(&batch->wake);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+void spow_batch_destroy(spow_batch_t *batch) {
+    if (batch == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&batch->lock);
+    batch->shutdown = 1;
+    pthread_cond_broadcast(&batch->wake);
+    pthread_mutex_unlock(&batch->lock);
+    for (unsigned int i = 0; i < batch->workers_started; ++i) {
+        pthread_join(batch->workers[i].thread, NULL);
+    }
+    for (unsigned int i = 0; i < batch->threads; ++i) {
+        pthread_mutex_destroy(&batch->deques[i].lock);
+        free(batch->deques[i].tasks);
+    }
+    pthread_cond_destroy(&batch->room);
+    pthread_cond_destroy(&batch->wake);
+    pthread_mutex_destroy(&batch->lock);
+    free(batch->deques);
+    free(batch->workers);
+    free(batch);
+}
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/* Returns the length of the next whitespace-separated field, and moves
+ * *pos to its start.  Returns 0 at the end of the line. */
+static size_t next_field(const char **pos) {
+    while (is_space(**pos)) {
+        *pos += 1;
+    }
+    size_t len = 0;
+    while ((*pos)[len] != '\0' && !is_space((*pos)[len])) {
+        len += 1;
+    }
+    return len;
+}
+
+static int parse_hex(const char *field, size_t len, unsigned char *out, size_t out_size) {
+    if (len != 2 * out_size) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        const char c = field[i];
+        unsigned int nibble;
+        if (c >= '0' && c <= '9') {
+            nibble = (unsigned int)(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            nibble = (unsigned int)(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            nibble = (unsigned int)(c - 'A' + 10);
+        } else {
+            return 0;
+        }
+        if (i % 2 == 0) {
+            out[i / 2] = (unsigned char)(nibble << 4);
+        } else {
+            out[i / 2] |= (unsigned char)nibble;
+        }
+    }
+    return 1;
+}
+
+static int parse_dec(const char *field, size_t len, uint32_t *out) {
+    if (len == 0 || len > 9) {
+        return 0;
+    }
+    uint32_t value = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (field[i] < '0' || field[i] > '9') {
+            return 0;
+        }
+        value = value * 10 + (uint32_t)(field[i] - '0');
+    }
+    *out = value;
+    return 1;
+}
+
+int spow_batch_parse_line(const char *line, config_t *out_config, const char **out_error) {
+    const char *pos = line;
+    size_t len = next_field(&pos);
+    if (len == 0 || pos[0] == '#') {
+        return 0;
+    }
+
+    config_t config;
+    if (!parse_hex(pos, len, config.init_hash, SPOW_HASH_SIZE)) {
+        *out_error = "Initial hash must be 64 hex digits";
+        return -1;
+    }
+    pos += len;
+    len = next_field(&pos);
+    if (!parse_hex(pos, len, config.token, SPOW_TOKEN_SIZE)) {
+        *out_error = "Token must be 16 hex digits";
+        return -1;
+    }
+    uint32_t *const numbers[3] = {&config.difficulty, &config.safety, &config.steps};
+    for (int i = 0; i < 3; ++i) {
+        pos += len;
+        len = next_field(&pos);
+        if (!parse_dec(pos, len, numbers[i])) {
+            *out_error = "Expected Difficulty, Safety, and Steps as decimal numbers";
+            return -1;
+        }
+    }
+    pos += len;
+    if (next_field(&pos) != 0) {
+        *out_error = "Trailing garbage";
+        return -1;
+    }
+
+    /* Same limits as extend_cert(). */
+    if (config.difficulty < 1 || config.difficulty > PROVER_DIFFICULTY_MAX) {
+        *out_error = "Difficulty must be between 1 and 32";
+        return -1;
+    }
+    if (config.difficulty + config.safety > PROVER_NONCE_BITS_MAX) {
+        *out_error = "Difficulty + Safety must be at most 57";
+        return -1;
+    }
+    if (config.steps < 1 || config.steps > (UINT32_MAX - 7) / (config.difficulty + config.safety)) {
+        *out_error = "Steps out of range";
+        return -1;
+    }
+    *out_config = config;
+    return 1;
+}
+
+typedef struct run_ctx_t {
+    FILE *out;
+    int compact;
+    pthread_mutex_t lock;
+    long failed;
+} run_ctx_t;
+
+static void run_done(void *arg, uint64_t id, const config_t *config,
+                     const unsigned char *cert, uint32_t cert_size,
+                     size_t hashes) {
+    run_ctx_t *ctx = arg;
+    /* Encoded outside the lock.  Only if it's shorter, so that the length
+     * tells the formats apart. */
+    unsigned char *compact = NULL;
+    if (cert != NULL && ctx->compact) {
+        const size_t max_size = spow_compact_max_size(config->difficulty, config->safety, config->steps);
+        compact = malloc(max_size);
+        const size_t compact_size = (compact == NULL) ? 0
+            : spow_compact_encode(compact, max_size, config->difficulty, config->safety,
+                                  config->steps, cert, cert_size);
+        if (compact_size > 0 && compact_size < cert_size) {
+            cert = compact;
+            cert_size = (uint32_t)compact_size;
+        }
+    }
+    pthread_mutex_lock(&ctx->lock);
+    if (cert == NULL) {
+        fprintf(ctx->out, "%" PRIu64 " fail\n", id);
+        ctx->failed += 1;
+    } else {
+        fprintf(ctx->out, "%" PRIu64 " ok %zu ", id, hashes);
+        for (uint32_t i = 0; i < cert_size; ++i) {
+            fprintf(ctx->out, "%02x", cert[i]);
+        }
+        fputc('\n', ctx->out);
+    }
+    /* Stream it out right away, even into a pipe. */
+    fflush(ctx->out);
+    pthread_mutex_unlock(&ctx->lock);
+    free(compact);
+}
+
+long spow_batch_run(FILE *in, FILE *out, const prover_t *prover, unsigned int threads,
+                    const char *checkpoint_dir, int compact) {
+    run_ctx_t ctx;
+    ctx.out = out;
+    ctx.compact = compact;
+    pthread_mutex_init(&ctx.lock, NULL);
+    ctx.failed = 0;
+
+    spow_batch_t *batch = spow_batch_create(threads, prover, checkpoint_dir, run_done, &ctx);
+    if (batch == NULL) {
+        pthread_mutex_destroy(&ctx.lock);
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+    uint64_t line_number = 0;
+    ssize_t line_len;
+    while ((line_len = getline(&line, &line_capacity, in)) >= 0) {
+        line_number += 1;
+        if (line_len > 0 && line[line_len - 1] == '\n') {
+            line[line_len - 1] = '\0';
+        }
+        config_t config;
+        const char *error = NULL;
+        const int parsed = spow_batch_parse_line(line, &config, &error);
+        if (parsed > 0) {
+            spow_batch_submit(batch, line_number, &config);
+        } else if (parsed < 0) {
+            fprintf(stderr, "Line %" PRIu64 ": %s.\n", line_number, error);
+            pthread_mutex_lock(&ctx.lock);
+            fprintf(out, "%" PRIu64 " invalid\n", line_number);
+            fflush(out);
+            ctx.failed += 1;
+            pthread_mutex_unlock(&ctx.lock);
+        }
+    }
+    free(line);
+
+    spow_batch_destroy(batch);
+    pthread_mutex_destroy(&ctx.lock);
+    return ctx.failed;
+}
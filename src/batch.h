@@ -0,0 +1,70 @@
+/* Proving many independent configs at once, e.g. to pre-solve challenges
+ * in bulk.
+ *
+ * Each config is a single task for a single thread.  The time to find a
+ * certificate follows an Erlang distribution, so handing out the configs
+ * evenly up front would leave threads idle while others are still stuck on
+ * unlucky configs.  Instead, every thread has its own queue, and steals from
+ * the others when its own queue runs dry.  If the prover has a multi-buffer
+ * kernel, each thread works on one config per lane instead, see
+ * find_certs_multi().
+ *
+ * spow_batch_run() is the line-based frontend.  The input has one config
+ * per line:
+ *     INIT_HASH TOKEN DIFFICULTY SAFETY STEPS
+ * where INIT_HASH and TOKEN are in hex, and the rest is decimal.  Empty lines
+ * and lines starting with '#' are ignored.  The output has one line per
+ * config, in the order in which they complete:
+ *     LINE ok HASHES CERT
+ *     LINE fail
+ *     LINE invalid
+ * where LINE is the line number in the input, and CERT is in hex.  With
+ * 'compact' set, CERT is in the compact format (see compact.h) whenever that
+ * is shorter, which it practically always is, and fixed-width otherwise;
+ * the receiver tells them apart by the length.
+ *
+ * With a checkpoint directory, each config that is being proven has a
+ * checkpoint file there (see checkpoint.h), named after the config, which
+ * is deleted once 'done' has returned for it.  If the batch is killed and started again,
+ * the configs in it continue where they were instead of from step 0. */
+
+#ifndef STEPPOW_BATCH_H
+#define STEPPOW_BATCH_H
+
+#include <stddef.h> /* size_t */
+#include <stdint.h>
+#include <stdio.h>
+
+#include "prover.h"
+
+typedef struct spow_batch_t spow_batch_t;
+
+/* Start 'threads' worker threads.  'done' is called by the worker threads
+ * for each finished config.  'checkpoint_dir' may be NULL, and must be NULL
+ * with a multi-buffer prover.  Returns NULL on failure. */
+spow_batch_t *spow_batch_create(unsigned int threads,
+                                const prover_t *prover,
+                                const char *checkpoint_dir,
+                                prover_done_fn done,
+                                void *done_ctx);
+
+/* Queue a config.  Blocks while too many configs are waiting already,
+ * so that reading a huge input doesn't need a huge amount of memory. */
+void spow_batch_submit(spow_batch_t *batch, uint64_t id, const config_t *config);
+
+/* Finish all queued configs, then stop the threads. */
+void spow_batch_destroy(spow_batch_t *batch);
+
+/* Parse one line of input (without the newline).  Returns 1 and writes
+ * *out_config if it's a config, 0 if it's empty or a comment, and -1 if it's
+ * malformed, in which case *out_error says why. */
+int spow_batch_parse_line(const char *line, config_t *out_config, const char **out_error);
+
+/* Read configs from 'in' until EOF, prove them with 'threads' threads,
+ * and write each result to 'out' as soon as it's done.
+ * Returns the number of configs that were invalid or could not be proven,
+ * or -1 if the threads could not be started. */
+long spow_batch_run(FILE *in, FILE *out, const prover_t *prover, unsigned int threads,
+                    const char *checkpoint_dir, int compact);
+
+#endif /* STEPPOW_BATCH_H */
@@ -0,0 +1,43 @@
+/* Big-endian integers at any byte offset.
+ *
+ * The archive format, the challenge context and SHA-256 blocks all store
+ * integers most significant byte first, and not necessarily aligned.
+ * memcpy() makes the unaligned access safe, and portable-endian.h does the
+ * byte order; compilers turn each of these into a load or store and a
+ * byteswap.
+ *
+ * Header-only, like portable-endian.h itself. */
+
+#ifndef STEPPOW_BE_BYTES_H
+#define STEPPOW_BE_BYTES_H
+
+#include <stdint.h>
+#include <string.h> /* memcpy */
+
+#define PORTABLE_ENDIAN_NO_UINT_16_T
+
+#include "portable-endian.h"
+
+static inline uint32_t spow_load_be32(const unsigned char *bytes) {
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return pe_be32toh(word);
+}
+
+static inline void spow_store_be32(unsigned char *bytes, uint32_t value) {
+    const uint32_t word = pe_htobe32(value);
+    memcpy(bytes, &word, sizeof(word));
+}
+
+static inline uint64_t spow_load_be64(const unsigned char *bytes) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return pe_be64toh(word);
+}
+
+static inline void spow_store_be64(unsigned char *bytes, uint64_t value) {
+    const uint64_t word = pe_htobe64(value);
+    memcpy(bytes, &word, sizeof(word));
+}
+
+#endif /* STEPPOW_BE_BYTES_H */
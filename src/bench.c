@@ -0,0 +1,307 @@
+/* Compile:
+ * clang -Wall -O3 src/bench.c src/prover.c src/parallel.c src/perf.c src/verifier.c src/challenge.c src/kernel.c src/sha256.c src/sha256-simd.c src/sha256-shani.c -pthread -o bin/bench
+ * Run:
+ * ./bin/bench [--seconds T] > bench.json
+ * Measures, on a single core:
+ * - the raw hashrate of each supported kernel,
+ * - find_cert() for the profiles S, M, L and XL from README.md,
+ * - spow_verify() and spow_verify_batch() on those certificates,
+ * - spow_challenge_derive() one at a time and in batches,
+ * and writes the results as JSON, so that they can be compared across
+ * machines, compilers and releases.  Progress goes to stderr. */
+
+#include <inttypes.h> /* PRIu32 and similar */
+#include <stddef.h> /* size_t */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h> /* malloc, free, strtod */
+#include <string.h> /* memset, strcmp, strlen */
+#include <time.h> /* time */
+
+#include "challenge.h"
+#include "kernel.h"
+#include "prover.h"
+#include "sha256.h"
+#include "verifier.h"
+
+typedef struct profile_t {
+    const char *name;
+    uint32_t difficulty;
+    uint32_t safety;
+    uint32_t steps;
+} profile_t;
+
+/* See "Recommendations" in README.md */
+static const profile_t PROFILES[] = {
+    {"S", 9, 7, 200},
+    {"M", 9, 7, 1000},
+    {"L", 12, 7, 1000},
+    {"XL", 13, 7, 5000},
+};
+#define PROFILES_NUM (sizeof(PROFILES) / sizeof(PROFILES[0]))
+
+/* Each measurement runs at least this long, and at least this often. */
+static double min_seconds = 1.0;
+#define MIN_CERTS 3
+/* spow_verify_batch() needs a few jobs per lane to be worth it. */
+#define BATCH_JOBS_MIN (4 * SPOW_SHA256_MULTI_LANES_MAX)
+
+/* Print 'str' as a JSON string. */
+static void print_json_string(const char *str) {
+    putchar('"');
+    for (; *str; ++str) {
+        const unsigned char c = (unsigned char)*str;
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+/* The "model name" from /proc/cpuinfo, or "unknown". */
+static void cpu_model(char *out, size_t out_size) {
+    snprintf(out, out_size, "unknown");
+    FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+    if (cpuinfo == NULL) {
+        return;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), cpuinfo)) {
+        if (0 != strncmp(line, "model name", 10)) {
+            continue;
+        }
+        const char *value = strchr(line, ':');
+        if (value == NULL) {
+            continue;
+        }
+        value += 1;
+        while (*value == ' ' || *value == '\t') {
+            value += 1;
+        }
+        snprintf(out, out_size, "%s", value);
+        const size_t len = strlen(out);
+        if (len > 0 && out[len - 1] == '\n') {
+            out[len - 1] = '\0';
+        }
+        break;
+    }
+    fclose(cpuinfo);
+}
+
+/* Challenges derived per second, 'batch' at a time. */
+static double bench_challenges(size_t batch) {
+    static spow_challenge_t challenges[1024];
+    const unsigned char secret[32] = {0};
+    spow_challenge_key_t key;
+    spow_challenge_key_init(&key, secret, sizeof(secret));
+    for (size_t i = 0; i < batch; ++i) {
+        memset(&challenges[i], 0, sizeof(challenges[i]));
+        challenges[i].client_id = i;
+    }
+
+    uint64_t derived = 0;
+    const double start = spow_seconds_now();
+    double elapsed;
+    do {
+        for (int i = 0; i < 64; ++i) {
+            for (size_t j = 0; j < batch; ++j) {
+                challenges[j].nonce = derived + j;
+            }
+            spow_challenge_derive(&key, challenges, batch);
+            derived += batch;
+        }
+        elapsed = spow_seconds_now() - start;
+    } while (elapsed < min_seconds);
+    return derived / elapsed;
+}
+
+/* A different config for every index. */
+static void make_config(const profile_t *profile, uint32_t index, config_t *out_config) {
+    for (uint32_t i = 0; i < SPOW_HASH_SIZE; ++i) {
+        out_config->init_hash[i] = (unsigned char)(i * 7 + index * 13 + 1);
+    }
+    for (uint32_t i = 0; i < SPOW_TOKEN_SIZE; ++i) {
+        out_config->token[i] = (unsigned char)(i + (index >> (8 * (i % 4))));
+    }
+    out_config->difficulty = profile->difficulty;
+    out_config->safety = profile->safety;
+    out_config->steps = profile->steps;
+}
+
+typedef struct profile_result_t {
+    uint32_t certs;
+    double prove_seconds;
+    double prove_hashes;
+    double verify_per_second;
+    double verify_batch_per_second;
+    int failed;
+} profile_result_t;
+
+static void bench_profile(const prover_t *prover, const profile_t *profile, profile_result_t *result) {
+    memset(result, 0, sizeof(*result));
+    uint32_t capacity = 16;
+    config_t *configs = malloc(capacity * sizeof(*configs));
+    unsigned char **certs = malloc(capacity * sizeof(*certs));
+    uint32_t cert_size = 0;
+
+    /* Proving */
+    const double start = spow_seconds_now();
+    while (result->certs < MIN_CERTS || spow_seconds_now() - start < min_seconds) {
+        if (result->certs == capacity) {
+            capacity *= 2;
+            configs = realloc(configs, capacity * sizeof(*configs));
+            certs = realloc(certs, capacity * sizeof(*certs));
+        }
+        config_t *config = &configs[result->certs];
+        make_config(profile, result->certs, config);
+        size_t hashes = 0;
+        if (!find_cert(prover, config, &certs[result->certs], &cert_size, &hashes)) {
+            result->failed = 1;
+            break;
+        }
+        result->prove_hashes += hashes;
+        result->certs += 1;
+    }
+    result->prove_seconds = spow_seconds_now() - start;
+
+    /* Verifying, one at a time */
+    uint64_t verified = 0;
+    double verify_start = spow_seconds_now();
+    double elapsed;
+    do {
+        for (uint32_t i = 0; i < result->certs; ++i) {
+            const config_t *config = &configs[i];
+            if (SPOW_VERIFY_OK != spow_verify(config->init_hash, config->token, config->difficulty,
+                                              config->safety, config->steps, certs[i], cert_size)) {
+                result->failed = 1;
+            }
+        }
+        verified += result->certs;
+        elapsed = spow_seconds_now() - verify_start;
+    } while (result->certs && elapsed < min_seconds);
+    result->verify_per_second = verified / elapsed;
+
+    /* Verifying, all at once.  Repeat the certificates so that even for XL,
+     * there are enough to fill all lanes. */
+    const uint32_t jobs_num = (result->certs == 0) ? 0
+        : (result->certs >= BATCH_JOBS_MIN) ? result->certs
+        : (BATCH_JOBS_MIN + result->certs - 1) / result->certs * result->certs;
+    spow_verify_job_t *jobs = malloc((jobs_num ? jobs_num : 1) * sizeof(*jobs));
+    for (uint32_t i = 0; i < jobs_num; ++i) {
+        const config_t *config = &configs[i % result->certs];
+        const spow_verify_job_t job = {
+            config->init_hash, config->token, config->difficulty, config->safety, config->steps,
+            certs[i % result->certs], cert_size, SPOW_VERIFY_PENDING,
+        };
+        jobs[i] = job;
+    }
+    verified = 0;
+    verify_start = spow_seconds_now();
+    do {
+        spow_verify_batch(jobs, jobs_num);
+        for (uint32_t i = 0; i < jobs_num; ++i) {
+            if (jobs[i].result != SPOW_VERIFY_OK) {
+                result->failed = 1;
+            }
+        }
+        verified += jobs_num;
+        elapsed = spow_seconds_now() - verify_start;
+    } while (jobs_num && elapsed < min_seconds);
+    result->verify_batch_per_second = verified / elapsed;
+
+    for (uint32_t i = 0; i < result->certs; ++i) {
+        free(certs[i]);
+    }
+    free(jobs);
+    free(certs);
+    free(configs);
+}
+
+static const char *compiler(void) {
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#else
+    return "unknown";
+#endif
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "--seconds") && i + 1 < argc) {
+            char *end = NULL;
+            min_seconds = strtod(argv[++i], &end);
+            if (*end != '\0' || !(min_seconds >= 0)) {
+                fprintf(stderr, "Not a duration: \"%s\".\n", argv[i]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "USAGE: %s [--seconds T]\n"
+                "\tRuns each measurement for at least T seconds (default 1).\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const spow_kernel_t *best = spow_kernel_best();
+    const prover_t prover = {best->search, NULL, 16, NULL, 0, NULL, NULL, NULL};
+    char cpu[128];
+    cpu_model(cpu, sizeof(cpu));
+
+    printf("{\n  \"cpu\": ");
+    print_json_string(cpu);
+    printf(",\n  \"compiler\": ");
+    print_json_string(compiler());
+    printf(",\n  \"timestamp\": %lld,\n  \"kernel\": ", (long long)time(NULL));
+    print_json_string(best->name);
+    printf(",\n  \"kernels\": [");
+    int first = 1;
+    for (unsigned int i = 0; i < SPOW_KERNELS_NUM; ++i) {
+        const spow_kernel_t *kernel = &SPOW_KERNELS[i];
+        if (!spow_kernel_supported(kernel)) {
+            continue;
+        }
+        fprintf(stderr, "Kernel %s ...\n", kernel->name);
+        const double rate = spow_kernel_hashrate(kernel, min_seconds);
+        printf("%s\n    {\"name\": ", first ? "" : ",");
+        print_json_string(kernel->name);
+        printf(", \"hashes_per_second\": %.0f}", rate);
+        first = 0;
+        fflush(stdout);
+    }
+    printf("\n  ],\n  \"profiles\": [");
+    int failed = 0;
+    for (size_t i = 0; i < PROFILES_NUM; ++i) {
+        const profile_t *profile = &PROFILES[i];
+        fprintf(stderr, "Profile %s ...\n", profile->name);
+        profile_result_t result;
+        bench_profile(&prover, profile, &result);
+        failed |= result.failed;
+        printf("%s\n    {\"name\": ", i ? "," : "");
+        print_json_string(profile->name);
+        printf(", \"difficulty\": %" PRIu32 ", \"safety\": %" PRIu32 ", \"steps\": %" PRIu32
+            ", \"certs\": %" PRIu32 ", \"prove_seconds_per_cert\": %.6f"
+            ", \"prove_hashes_per_cert\": %.0f, \"prove_hashes_per_second\": %.0f"
+            ", \"verify_per_second\": %.1f, \"verify_batch_per_second\": %.1f, \"ok\": %s}",
+            profile->difficulty, profile->safety, profile->steps,
+            result.certs, result.certs ? result.prove_seconds / result.certs : 0,
+            result.certs ? result.prove_hashes / result.certs : 0,
+            result.prove_seconds > 0 ? result.prove_hashes / result.prove_seconds : 0,
+            result.verify_per_second, result.verify_batch_per_second,
+            result.failed ? "false" : "true");
+        fflush(stdout);
+    }
+    fprintf(stderr, "Challenges ...\n");
+    const double challenges_single = bench_challenges(1);
+    const double challenges_batch = bench_challenges(1024);
+    printf("\n  ],\n  \"challenges_per_second\": %.0f,\n  \"challenges_batch_per_second\": %.0f\n}\n",
+        challenges_single, challenges_batch);
+    if (failed) {
+        fprintf(stderr, "Some certificates could not be proven or verified!\n");
+    }
+    return failed;
+}
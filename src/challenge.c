@@ -0,0 +1,206 @@
+#include "challenge.h"
+
+#include <string.h> /* memcpy, memset */
+
+#include "be-bytes.h"
+#include "kernel.h"
+#include "verifier.h"
+
+/* The message lengths in bits, for the padding: the context alone for the
+ * Token, and after a key block for the inner and outer hash of HMAC. */
+#define TOKEN_BITS (SPOW_CHALLENGE_CONTEXT_BYTES * 8)
+#define INNER_BITS ((64 + SPOW_CHALLENGE_CONTEXT_BYTES) * 8)
+#define OUTER_BITS ((64 + 32) * 8)
+
+/* The padding must fit into the same block. */
+typedef char assert_context_fits_block[(SPOW_CHALLENGE_CONTEXT_BYTES + 9 <= 64) ? 1 : -1];
+
+static void load_block(uint32_t block[SPOW_SHA256_BLOCK_WORDS], const unsigned char *bytes) {
+    for (int i = 0; i < SPOW_SHA256_BLOCK_WORDS; ++i) {
+        block[i] = spow_load_be32(bytes + 4 * i);
+    }
+}
+
+static void store_state(unsigned char *bytes, const uint32_t *state, int words) {
+    for (int i = 0; i < words; ++i) {
+        spow_store_be32(bytes + 4 * i, state[i]);
+    }
+}
+
+/* memset() to zero, but through a volatile pointer, so that the compiler
+ * can't drop it as a store to memory that is never read again. */
+static void wipe(void *buf, size_t size) {
+    volatile unsigned char *bytes = buf;
+    for (size_t i = 0; i < size; ++i) {
+        bytes[i] = 0;
+    }
+}
+
+int spow_challenge_key_init(spow_challenge_key_t *key, const unsigned char *secret, size_t secret_size) {
+    if (secret_size > SPOW_CHALLENGE_KEY_BYTES_MAX) {
+        return -1;
+    }
+    unsigned char pad[64];
+    uint32_t block[SPOW_SHA256_BLOCK_WORDS];
+    for (int outer = 0; outer < 2; ++outer) {
+        memset(pad, outer ? 0x5C : 0x36, sizeof(pad));
+        for (size_t i = 0; i < secret_size; ++i) {
+            pad[i] ^= secret[i];
+        }
+        load_block(block, pad);
+        uint32_t *state = outer ? key->outer : key->inner;
+        memcpy(state, SPOW_SHA256_IV, sizeof(SPOW_SHA256_IV));
+        spow_sha256_compress(state, block);
+    }
+    /* Don't leave the key on the stack. */
+    wipe(pad, sizeof(pad));
+    wipe(block, sizeof(block));
+    return 0;
+}
+
+void spow_challenge_encode(unsigned char *out, const spow_challenge_t *challenge) {
+    out[0] = SPOW_CHALLENGE_VERSION;
+    spow_store_be64(out + 1, challenge->timestamp);
+    spow_store_be64(out + 9, challenge->client_id);
+    spow_store_be64(out + 17, challenge->nonce);
+    spow_store_be32(out + 25, challenge->difficulty);
+    spow_store_be32(out + 29, challenge->safety);
+    spow_store_be32(out + 33, challenge->steps);
+}
+
+int spow_challenge_decode(spow_challenge_t *out_challenge, const unsigned char *context, size_t context_size) {
+    if (context_size != SPOW_CHALLENGE_CONTEXT_BYTES || context[0] != SPOW_CHALLENGE_VERSION) {
+        return -1;
+    }
+    out_challenge->timestamp = spow_load_be64(context + 1);
+    out_challenge->client_id = spow_load_be64(context + 9);
+    out_challenge->nonce = spow_load_be64(context + 17);
+    out_challenge->difficulty = spow_load_be32(context + 25);
+    out_challenge->safety = spow_load_be32(context + 29);
+    out_challenge->steps = spow_load_be32(context + 33);
+    return 0;
+}
+
+/* The block with the context and its padding, but without the length, which
+ * differs between the Token and the inner hash. */
+static void context_block(uint32_t block[SPOW_SHA256_BLOCK_WORDS], const spow_challenge_t *challenge) {
+    unsigned char bytes[64];
+    memset(bytes, 0, sizeof(bytes));
+    spow_challenge_encode(bytes, challenge);
+    bytes[SPOW_CHALLENGE_CONTEXT_BYTES] = 0x80;
+    load_block(block, bytes);
+}
+
+/* The second block of the outer hash: the inner digest, then padding. */
+static void outer_block(uint32_t block[SPOW_SHA256_BLOCK_WORDS], const uint32_t inner[SPOW_SHA256_STATE_WORDS]) {
+    memcpy(block, inner, SPOW_SHA256_STATE_WORDS * sizeof(uint32_t));
+    block[8] = 0x80000000;
+    memset(&block[9], 0, 6 * sizeof(uint32_t));
+    block[15] = OUTER_BITS;
+}
+
+static void derive_one(const spow_challenge_key_t *key, spow_challenge_t *challenge) {
+    uint32_t block[SPOW_SHA256_BLOCK_WORDS];
+    uint32_t token[SPOW_SHA256_STATE_WORDS];
+    uint32_t state[SPOW_SHA256_STATE_WORDS];
+    context_block(block, challenge);
+    block[15] = TOKEN_BITS;
+    memcpy(token, SPOW_SHA256_IV, sizeof(SPOW_SHA256_IV));
+    spow_sha256_compress(token, block);
+    block[15] = INNER_BITS;
+    memcpy(state, key->inner, sizeof(state));
+    spow_sha256_compress(state, block);
+    outer_block(block, state);
+    memcpy(state, key->outer, sizeof(state));
+    spow_sha256_compress(state, block);
+    store_state(challenge->init_hash, state, SPOW_SHA256_STATE_WORDS);
+    store_state(challenge->token, token, 2);
+}
+
+void spow_challenge_derive(const spow_challenge_key_t *key, spow_challenge_t *challenges, size_t num) {
+    const spow_kernel_t *kernel = spow_kernel_best_multi();
+    /* Fewer than half of the lanes wouldn't pay off. */
+    if (kernel == NULL || num < kernel->multi_lanes / 2) {
+        for (size_t i = 0; i < num; ++i) {
+            derive_one(key, &challenges[i]);
+        }
+        return;
+    }
+
+    const unsigned int lanes = kernel->multi_lanes;
+    uint32_t block[SPOW_SHA256_BLOCK_WORDS][SPOW_SHA256_MULTI_LANES_MAX];
+    uint32_t token[SPOW_SHA256_STATE_WORDS][SPOW_SHA256_MULTI_LANES_MAX];
+    uint32_t state[SPOW_SHA256_STATE_WORDS][SPOW_SHA256_MULTI_LANES_MAX];
+    /* Unused lanes compute garbage from whatever is there. */
+    memset(block, 0, sizeof(block));
+    for (size_t first = 0; first < num; first += lanes) {
+        const unsigned int used = (num - first < lanes) ? (unsigned int)(num - first) : lanes;
+        for (unsigned int i = 0; i < used; ++i) {
+            uint32_t lane_block[SPOW_SHA256_BLOCK_WORDS];
+            context_block(lane_block, &challenges[first + i]);
+            for (int t = 0; t < SPOW_SHA256_BLOCK_WORDS; ++t) {
+                block[t][i] = lane_block[t];
+            }
+        }
+        /* The Token and the inner hash only differ in the length. */
+        for (int j = 0; j < SPOW_SHA256_STATE_WORDS; ++j) {
+            for (unsigned int i = 0; i < lanes; ++i) {
+                token[j][i] = SPOW_SHA256_IV[j];
+                state[j][i] = key->inner[j];
+            }
+        }
+        for (unsigned int i = 0; i < lanes; ++i) {
+            block[15][i] = TOKEN_BITS;
+        }
+        kernel->compress_lanes(token, (const uint32_t (*)[SPOW_SHA256_MULTI_LANES_MAX])block);
+        for (unsigned int i = 0; i < lanes; ++i) {
+            block[15][i] = INNER_BITS;
+        }
+        kernel->compress_lanes(state, (const uint32_t (*)[SPOW_SHA256_MULTI_LANES_MAX])block);
+
+        for (int j = 0; j < SPOW_SHA256_STATE_WORDS; ++j) {
+            for (unsigned int i = 0; i < lanes; ++i) {
+                block[j][i] = state[j][i];
+                state[j][i] = key->outer[j];
+            }
+        }
+        for (unsigned int i = 0; i < lanes; ++i) {
+            block[8][i] = 0x80000000;
+            for (int t = 9; t < 15; ++t) {
+                block[t][i] = 0;
+            }
+            block[15][i] = OUTER_BITS;
+        }
+        kernel->compress_lanes(state, (const uint32_t (*)[SPOW_SHA256_MULTI_LANES_MAX])block);
+
+        for (unsigned int i = 0; i < used; ++i) {
+            spow_challenge_t *challenge = &challenges[first + i];
+            for (int j = 0; j < SPOW_SHA256_STATE_WORDS; ++j) {
+                spow_store_be32(challenge->init_hash + 4 * j, state[j][i]);
+            }
+            spow_store_be32(challenge->token, token[0][i]);
+            spow_store_be32(challenge->token + 4, token[1][i]);
+        }
+    }
+}
+
+int spow_challenge_verify(const spow_challenge_key_t *key,
+                          const unsigned char *context,
+                          size_t context_size,
+                          uint64_t now,
+                          uint64_t max_age,
+                          const unsigned char *cert,
+                          size_t cert_size) {
+    spow_challenge_t challenge;
+    if (spow_challenge_decode(&challenge, context, context_size) != 0) {
+        return SPOW_VERIFY_BAD_CONTEXT;
+    }
+    /* Timestamps in the future are fine: Only the key holder can make
+     * them, and the clocks of several servers may differ a bit. */
+    if (now > challenge.timestamp && now - challenge.timestamp > max_age) {
+        return SPOW_VERIFY_EXPIRED;
+    }
+    derive_one(key, &challenge);
+    return spow_verify(challenge.init_hash, challenge.token, challenge.difficulty, challenge.safety,
+        challenge.steps, cert, cert_size);
+}
@@ -0,0 +1,97 @@
+/* Issuing challenges without remembering them.
+ *
+ * "Recommendations" in README.md suggests deriving both the Initial Hash and
+ * the Token from a context held by the verifier:
+ *     Initial_Hash := HMAC-SHA256(key, context)
+ *     Token := SHA256(context)[:8]
+ * This does exactly that, for a compact context of SPOW_CHALLENGE_CONTEXT_BYTES
+ * bytes, big-endian:
+ *     offset  size
+ *          0     1  version, SPOW_CHALLENGE_VERSION
+ *          1     8  timestamp, e.g. seconds since the epoch
+ *          9     8  client_id, anything that identifies the client
+ *         17     8  nonce, so that each challenge is different
+ *         25     4  difficulty
+ *         29     4  safety
+ *         33     4  steps
+ * The server sends the context to the client together with the Initial Hash
+ * and the Token, and the client sends it back with the certificate.  The
+ * server then derives both again, so it doesn't store anything per
+ * challenge.  A client that changes the context (say, to easier parameters,
+ * or a newer timestamp) can't know the Initial Hash that goes with it without
+ * the key, so it can't prove anything for it.
+ *
+ * A valid certificate stays valid until the challenge expires, so a server
+ * that must accept each challenge only once still needs to remember the
+ * accepted ones for that long, e.g. with spow_replay_claim() (see
+ * replay-cache.h).  But that's only for the solved challenges, and only until
+ * they expire, instead of all issued ones.
+ *
+ * Each derivation is three single-block SHA-256 compressions, because the
+ * key's own blocks are compressed once in spow_challenge_key_init().
+ * spow_challenge_derive() does these for many challenges at once, one
+ * challenge per SIMD lane. */
+
+#ifndef STEPPOW_CHALLENGE_H
+#define STEPPOW_CHALLENGE_H
+
+#include <stddef.h> /* size_t */
+#include <stdint.h>
+
+#include "sha256.h"
+
+#define SPOW_CHALLENGE_VERSION 1
+#define SPOW_CHALLENGE_CONTEXT_BYTES 37
+/* HMAC-SHA256 takes longer keys, but hashes them down to this anyway. */
+#define SPOW_CHALLENGE_KEY_BYTES_MAX 64
+
+/* The key, as the SHA-256 states after the inner and the outer key block of
+ * HMAC.  Just as secret as the key itself. */
+typedef struct spow_challenge_key_t {
+    uint32_t inner[SPOW_SHA256_STATE_WORDS];
+    uint32_t outer[SPOW_SHA256_STATE_WORDS];
+} spow_challenge_key_t;
+
+typedef struct spow_challenge_t {
+    /* The context */
+    uint64_t timestamp;
+    uint64_t client_id;
+    uint64_t nonce;
+    uint32_t difficulty;
+    uint32_t safety;
+    uint32_t steps;
+    /* Derived from it */
+    unsigned char init_hash[32];
+    unsigned char token[8];
+} spow_challenge_t;
+
+/* Returns 0, or -1 if 'secret' is longer than SPOW_CHALLENGE_KEY_BYTES_MAX.
+ * It should be at least 32 random bytes. */
+int spow_challenge_key_init(spow_challenge_key_t *key, const unsigned char *secret, size_t secret_size);
+
+/* Fill in init_hash and token of 'challenges' from their contexts. */
+void spow_challenge_derive(const spow_challenge_key_t *key, spow_challenge_t *challenges, size_t num);
+
+/* Write the context, SPOW_CHALLENGE_CONTEXT_BYTES bytes. */
+void spow_challenge_encode(unsigned char *out, const spow_challenge_t *challenge);
+
+/* Read the context back (but not init_hash and token, see
+ * spow_challenge_derive()).  Returns 0, or -1 if it has the wrong size or
+ * version. */
+int spow_challenge_decode(spow_challenge_t *out_challenge, const unsigned char *context, size_t context_size);
+
+/* Verify a certificate for the challenge with this context: Returns
+ * SPOW_VERIFY_BAD_CONTEXT if the context is malformed,
+ * SPOW_VERIFY_EXPIRED if its timestamp is more than 'max_age' before 'now',
+ * and otherwise the same as spow_verify() for the derived challenge.  For
+ * many certificates at once, decode and derive them together, and use
+ * spow_verify_batch(). */
+int spow_challenge_verify(const spow_challenge_key_t *key,
+                          const unsigned char *context,
+                          size_t context_size,
+                          uint64_t now,
+                          uint64_t max_age,
+                          const unsigned char *cert,
+                          size_t cert_size);
+
+#endif /* STEPPOW_CHALLENGE_H */
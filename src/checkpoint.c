@@ -0,0 +1,205 @@
+#include "checkpoint.h"
+
+#include <fcntl.h> /* open */
+#include <stdio.h> /* remove */
+#include <string.h> /* memcpy, memcmp, memset */
+#include <sys/file.h> /* flock */
+#include <sys/mman.h> /* mmap, msync, munmap */
+#include <sys/stat.h> /* fstat */
+#include <unistd.h> /* close, ftruncate, sysconf */
+
+#define CHECKPOINT_MAGIC "SPOWCKP1"
+
+/* The start of the file.  Written once, when the file is (re)started. */
+typedef struct file_header_t {
+    char magic[8];
+    uint32_t header_size;
+    uint32_t cert_size;
+    unsigned char init_hash[SPOW_HASH_SIZE];
+    unsigned char token[SPOW_TOKEN_SIZE];
+    uint32_t difficulty;
+    uint32_t safety;
+    uint32_t steps;
+    uint32_t reserved;
+} file_header_t;
+
+/* Followed by two of these, each followed by cert_size bytes of
+ * certificate.  The checksum covers everything after itself. */
+typedef struct slot_header_t {
+    uint64_t checksum;
+    /* 0 means never written */
+    uint64_t sequence;
+    uint64_t hashes;
+    uint32_t steps_done;
+    uint32_t reserved;
+    unsigned char last_hash[SPOW_HASH_SIZE];
+} slot_header_t;
+
+/* FNV-1a: It only needs to catch torn writes, not attackers. */
+static uint64_t checksum(const unsigned char *data, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+static size_t slot_size(uint32_t cert_size) {
+    /* Keep the slots 8-byte aligned */
+    return (sizeof(slot_header_t) + cert_size + 7) & ~(size_t)7;
+}
+
+static unsigned char *slot_at(const spow_checkpoint_t *checkpoint, unsigned int index) {
+    return checkpoint->map + sizeof(file_header_t) + index * slot_size(checkpoint->cert_size);
+}
+
+static uint64_t slot_checksum(const spow_checkpoint_t *checkpoint, const unsigned char *slot) {
+    const size_t skip = sizeof(uint64_t);
+    return checksum(slot + skip, sizeof(slot_header_t) - skip + checkpoint->cert_size);
+}
+
+/* Whether the slot holds a plausible state for this config. */
+static int slot_valid(const spow_checkpoint_t *checkpoint, const config_t *config, const unsigned char *slot) {
+    slot_header_t header;
+    memcpy(&header, slot, sizeof(header));
+    return header.sequence != 0
+        && header.checksum == slot_checksum(checkpoint, slot)
+        && header.steps_done <= config->steps;
+}
+
+static void fill_file_header(file_header_t *header, const config_t *config, uint32_t cert_size) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+    header->header_size = sizeof(file_header_t);
+    header->cert_size = cert_size;
+    memcpy(header->init_hash, config->init_hash, SPOW_HASH_SIZE);
+    memcpy(header->token, config->token, SPOW_TOKEN_SIZE);
+    header->difficulty = config->difficulty;
+    header->safety = config->safety;
+    header->steps = config->steps;
+}
+
+/* msync() wants page-aligned addresses. */
+static void flush(const unsigned char *start, size_t size) {
+    const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    const uintptr_t first = (uintptr_t)start & ~(page - 1);
+    msync((void *)first, (uintptr_t)start + size - first, MS_SYNC);
+}
+
+int spow_checkpoint_open(spow_checkpoint_t *checkpoint,
+                         const char *path,
+                         const config_t *config,
+                         uint64_t interval_ns,
+                         uint32_t *out_steps_done,
+                         size_t *out_hashes,
+                         unsigned char *last_hash,
+                         unsigned char *cert) {
+    memset(checkpoint, 0, sizeof(*checkpoint));
+    checkpoint->fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (checkpoint->fd < 0) {
+        return SPOW_CHECKPOINT_ERROR;
+    }
+    /* Two provers on the same file would destroy each other's state. */
+    if (0 != flock(checkpoint->fd, LOCK_EX | LOCK_NB)) {
+        close(checkpoint->fd);
+        return SPOW_CHECKPOINT_ERROR;
+    }
+    checkpoint->cert_size = prover_cert_size(config);
+    checkpoint->interval_ns = interval_ns;
+    checkpoint->map_size = sizeof(file_header_t) + 2 * slot_size(checkpoint->cert_size);
+
+    struct stat st;
+    if (0 != fstat(checkpoint->fd, &st)) {
+        close(checkpoint->fd);
+        return SPOW_CHECKPOINT_ERROR;
+    }
+    const int right_size = ((uint64_t)st.st_size == checkpoint->map_size);
+    if (!right_size && 0 != ftruncate(checkpoint->fd, (off_t)checkpoint->map_size)) {
+        close(checkpoint->fd);
+        return SPOW_CHECKPOINT_ERROR;
+    }
+    void *map = mmap(NULL, checkpoint->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, checkpoint->fd, 0);
+    if (map == MAP_FAILED) {
+        close(checkpoint->fd);
+        return SPOW_CHECKPOINT_ERROR;
+    }
+    checkpoint->map = map;
+
+    file_header_t expected;
+    fill_file_header(&expected, config, checkpoint->cert_size);
+    if (right_size && 0 == memcmp(checkpoint->map, &expected, sizeof(expected))) {
+        /* Resume from the newest intact slot. */
+        const unsigned char *best = NULL;
+        uint64_t best_sequence = 0;
+        for (unsigned int i = 0; i < 2; ++i) {
+            const unsigned char *slot = slot_at(checkpoint, i);
+            slot_header_t header;
+            memcpy(&header, slot, sizeof(header));
+            if (slot_valid(checkpoint, config, slot) && header.sequence > best_sequence) {
+                best = slot;
+                best_sequence = header.sequence;
+            }
+        }
+        if (best != NULL) {
+            slot_header_t header;
+            memcpy(&header, best, sizeof(header));
+            checkpoint->sequence = header.sequence;
+            *out_steps_done = header.steps_done;
+            *out_hashes = (size_t)header.hashes;
+            memcpy(last_hash, header.last_hash, SPOW_HASH_SIZE);
+            memcpy(cert, best + sizeof(slot_header_t), checkpoint->cert_size);
+            return SPOW_CHECKPOINT_RESUMED;
+        }
+    }
+
+    /* Start over: Both slots empty, then the header. */
+    memset(checkpoint->map, 0, checkpoint->map_size);
+    memcpy(checkpoint->map, &expected, sizeof(expected));
+    flush(checkpoint->map, checkpoint->map_size);
+    return SPOW_CHECKPOINT_NEW;
+}
+
+void spow_checkpoint_save(void *ctx,
+                          const config_t *config,
+                          uint32_t steps_done,
+                          size_t hashes,
+                          const unsigned char *last_hash,
+                          const unsigned char *cert) {
+    spow_checkpoint_t *checkpoint = ctx;
+    const uint64_t now_ns = prover_now_ns();
+    if (steps_done != config->steps && now_ns - checkpoint->last_save_ns < checkpoint->interval_ns) {
+        return;
+    }
+    checkpoint->last_save_ns = now_ns;
+    checkpoint->sequence += 1;
+
+    /* Overwrite the older slot; the newer one stays intact until this one
+     * is on disk. */
+    unsigned char *slot = slot_at(checkpoint, (unsigned int)(checkpoint->sequence % 2));
+    slot_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.sequence = checkpoint->sequence;
+    header.hashes = hashes;
+    header.steps_done = steps_done;
+    memcpy(header.last_hash, last_hash, SPOW_HASH_SIZE);
+    memcpy(slot, &header, sizeof(header));
+    memcpy(slot + sizeof(slot_header_t), cert, checkpoint->cert_size);
+    header.checksum = slot_checksum(checkpoint, slot);
+    memcpy(slot, &header.checksum, sizeof(header.checksum));
+    flush(slot, slot_size(checkpoint->cert_size));
+}
+
+void spow_checkpoint_close(spow_checkpoint_t *checkpoint, const char *path, int remove_file) {
+    if (checkpoint->map != NULL) {
+        munmap(checkpoint->map, checkpoint->map_size);
+        checkpoint->map = NULL;
+    }
+    if (checkpoint->fd >= 0) {
+        close(checkpoint->fd);
+        checkpoint->fd = -1;
+    }
+    if (remove_file) {
+        remove(path);
+    }
+}
@@ -0,0 +1,72 @@
+/* Checkpoints, so that a long proof survives a crash or preemption.
+ *
+ * A checkpoint is a small file, mapped into memory, that holds the config
+ * and the state after the last saved step: the number of steps done, the
+ * hashes so far, last_hash, and the certificate so far.  Resuming from it
+ * with find_cert_resume() gives exactly the certificate and hash count that
+ * an uninterrupted proof would have given.
+ *
+ * The state is kept in two slots, which are written alternately, each with
+ * a sequence number and a checksum.  If the process dies while writing one
+ * slot, the other one is still intact, so the worst case is losing the
+ * steps since the previous save.  The file uses the byte order of the host,
+ * so it is not meant to be moved between machines. */
+
+#ifndef STEPPOW_CHECKPOINT_H
+#define STEPPOW_CHECKPOINT_H
+
+#include <stddef.h> /* size_t */
+#include <stdint.h>
+
+#include "prover.h"
+
+/* Results of spow_checkpoint_open() */
+#define SPOW_CHECKPOINT_ERROR (-1)
+/* There was no (usable) checkpoint for this config, so start from step 0. */
+#define SPOW_CHECKPOINT_NEW 0
+/* Resume from the state in the spow_checkpoint_open() outputs. */
+#define SPOW_CHECKPOINT_RESUMED 1
+
+typedef struct spow_checkpoint_t {
+    int fd;
+    unsigned char *map;
+    size_t map_size;
+    uint32_t cert_size;
+    /* Save at most this often, see spow_checkpoint_save() */
+    uint64_t interval_ns;
+    uint64_t last_save_ns;
+    uint64_t sequence;
+} spow_checkpoint_t;
+
+/* Open or create the checkpoint file 'path' for 'config'.  If it holds a
+ * valid checkpoint for exactly this config, returns SPOW_CHECKPOINT_RESUMED
+ * and writes the saved state: cert must have prover_cert_size(config) bytes,
+ * and last_hash SPOW_HASH_SIZE bytes.  If it is empty, or for another config,
+ * or damaged beyond repair, it is started over and SPOW_CHECKPOINT_NEW is
+ * returned.  SPOW_CHECKPOINT_ERROR means the file could not be used at all,
+ * e.g. because another prover has it open (see errno).
+ * The state is saved at most every 'interval_ns' nanoseconds. */
+int spow_checkpoint_open(spow_checkpoint_t *checkpoint,
+                         const char *path,
+                         const config_t *config,
+                         uint64_t interval_ns,
+                         uint32_t *out_steps_done,
+                         size_t *out_hashes,
+                         unsigned char *last_hash,
+                         unsigned char *cert);
+
+/* For prover_ctx_t.save, with a spow_checkpoint_t as the context.  Writes
+ * the state if the interval has passed (or the proof is complete), and
+ * flushes it to disk before returning. */
+void spow_checkpoint_save(void *ctx,
+                          const config_t *config,
+                          uint32_t steps_done,
+                          size_t hashes,
+                          const unsigned char *last_hash,
+                          const unsigned char *cert);
+
+/* Unmap and close the file.  If 'remove_file' is set, e.g. because the proof
+ * is finished, also delete it. */
+void spow_checkpoint_close(spow_checkpoint_t *checkpoint, const char *path, int remove_file);
+
+#endif /* STEPPOW_CHECKPOINT_H */
@@ -0,0 +1,224 @@
+/* The optional compact certificate format.
+ *
+ * Each nonce in a certificate is the smallest good one, so it is
+ * geometrically distributed with a mean of about 2^Difficulty, and its
+ * Safety bits are almost always zero.  The compact format Rice-codes each
+ * nonce with parameter Difficulty (Golomb coding with a power of two, see
+ * "Design Considerations" in README.md): first nonce >> Difficulty in unary,
+ * i.e. that many 1 bits and a 0 bit, then the low Difficulty bits of the
+ * nonce.  That is about Difficulty + 1.6 bits per step, instead of
+ * Difficulty + Safety.
+ *
+ * Layout: One version byte (SPOW_COMPACT_VERSION), then the codes of all
+ * steps back to back, most significant bit first, then zero bits up to the
+ * next byte.  Each certificate has exactly one compact encoding.
+ *
+ * The length is variable, so the decoder must not trust it:
+ * - A compact certificate is never longer than spow_compact_max_size(),
+ *   the fixed-width size plus the header.  The encoder gives up instead
+ *   (and the fixed-width format has to be used), and the verifier rejects
+ *   longer ones before decoding anything.
+ * - A unary part that would make the nonce wider than Difficulty + Safety
+ *   bits is rejected as soon as it gets there.
+ * So decoding never costs more than reading the fixed-width certificate.
+ *
+ * Header-only, like nonce.h, because the prover encodes and the verifier
+ * decodes.  spow_verify_compact() verifies straight from the compact
+ * encoding, without building the fixed-width certificate. */
+
+#ifndef STEPPOW_COMPACT_H
+#define STEPPOW_COMPACT_H
+
+#include <stddef.h> /* size_t */
+#include <stdint.h>
+#include <string.h> /* memcpy, memset */
+
+#define PORTABLE_ENDIAN_NO_UINT_16_T
+
+#include "nonce.h"
+#include "portable-endian.h"
+
+#define SPOW_COMPACT_VERSION 1
+#define SPOW_COMPACT_HEADER_BYTES 1
+
+/* The most bytes a compact certificate for these parameters may have. */
+static inline size_t spow_compact_max_size(uint32_t difficulty, uint32_t safety, uint32_t steps) {
+    return SPOW_COMPACT_HEADER_BYTES + (size_t)((((uint64_t)difficulty + safety) * steps + 7) / 8);
+}
+
+/* The largest allowed unary part, so that the nonce fits into
+ * Difficulty + Safety bits. */
+static inline uint64_t spow_compact_quotient_max(uint32_t safety) {
+    return (safety >= 64) ? UINT64_MAX : (((uint64_t)1 << safety) - 1);
+}
+
+/* Appends bits to a byte buffer, most significant first. */
+typedef struct spow_compact_writer_t {
+    unsigned char *out;
+    size_t out_size;
+    size_t size;
+    /* The lowest 'acc_bits' bits are not written yet; always fewer than 8
+     * between calls. */
+    uint64_t acc;
+    uint32_t acc_bits;
+    int overflow;
+} spow_compact_writer_t;
+
+/* Append the lowest 'bits' bits of 'value', for 'bits' up to 32. */
+static inline void spow_compact_write(spow_compact_writer_t *writer, uint64_t value, uint32_t bits) {
+    if (bits == 0) {
+        return;
+    }
+    writer->acc = (writer->acc << bits) | (value & ((((uint64_t)1) << bits) - 1));
+    writer->acc_bits += bits;
+    while (writer->acc_bits >= 8) {
+        writer->acc_bits -= 8;
+        if (writer->size == writer->out_size) {
+            writer->overflow = 1;
+            continue;
+        }
+        writer->out[writer->size++] = (unsigned char)(writer->acc >> writer->acc_bits);
+    }
+}
+
+/* Encode a fixed-width certificate.  Returns the size of the compact one, or
+ * 0 if it needs more than 'out_size' bytes.  With 'out_size' at least
+ * spow_compact_max_size() that only happens if the compact encoding would be
+ * longer than allowed. */
+static inline size_t spow_compact_encode(unsigned char *out, size_t out_size,
+                                         uint32_t difficulty, uint32_t safety, uint32_t steps,
+                                         const unsigned char *cert, size_t cert_size) {
+    const size_t max_size = spow_compact_max_size(difficulty, safety, steps);
+    spow_compact_writer_t writer = {out, out_size < max_size ? out_size : max_size, 0, 0, 0, 0};
+    const uint32_t bits = difficulty + safety;
+    const spow_nonce_get_fn get = spow_nonce_get_for(bits);
+    spow_compact_write(&writer, SPOW_COMPACT_VERSION, 8);
+    for (uint32_t step = 0; step < steps && !writer.overflow; ++step) {
+        const uint64_t nonce = get(cert, cert_size, bits, step);
+        uint64_t quotient = (difficulty >= 64) ? 0 : (nonce >> difficulty);
+        /* With high Safety bits set, the unary code alone can be 2^48 bits
+         * long, so check that it fits before writing any of it. */
+        if (quotient + writer.acc_bits >= (uint64_t)(writer.out_size - writer.size) * 8) {
+            writer.overflow = 1;
+            break;
+        }
+        /* Usually 0 or 1, so this is a single write: 1…10 */
+        for (; quotient >= 31; quotient -= 31) {
+            spow_compact_write(&writer, 0x7FFFFFFF, 31);
+        }
+        spow_compact_write(&writer, ((((uint64_t)1) << quotient) - 1) << 1, (uint32_t)quotient + 1);
+        if (difficulty > 32) {
+            spow_compact_write(&writer, nonce >> 32, difficulty - 32);
+            spow_compact_write(&writer, nonce, 32);
+        } else {
+            spow_compact_write(&writer, nonce, difficulty);
+        }
+    }
+    if (writer.acc_bits > 0) {
+        spow_compact_write(&writer, 0, 8 - writer.acc_bits);
+    }
+    return writer.overflow ? 0 : writer.size;
+}
+
+/* Reads the codes of a compact certificate, one step at a time. */
+typedef struct spow_compact_reader_t {
+    const unsigned char *data;
+    size_t size;
+    /* In bits, from the start of 'data'.  Past the end means the
+     * certificate was truncated. */
+    uint64_t pos;
+} spow_compact_reader_t;
+
+/* The 64 bits at bit offset 'pos'; bits past the end are zero. */
+static inline uint64_t spow_compact_peek(const spow_compact_reader_t *reader, uint64_t pos) {
+    const uint64_t first = pos / 8;
+    if (first >= reader->size) {
+        return 0;
+    }
+    const uint32_t shift = (uint32_t)(pos % 8);
+    const size_t avail = reader->size - (size_t)first;
+    const unsigned char *p = reader->data + first;
+    uint64_t word;
+    if (avail >= 9) {
+        /* Away from the end, which is nearly always */
+        memcpy(&word, p, sizeof(word));
+        word = pe_be64toh(word);
+        return shift ? ((word << shift) | (p[8] >> (8 - shift))) : word;
+    }
+    unsigned char buf[9];
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, p, avail);
+    memcpy(&word, buf, sizeof(word));
+    word = pe_be64toh(word);
+    return shift ? ((word << shift) | (buf[8] >> (8 - shift))) : word;
+}
+
+/* Decode the nonce of the next step.  Returns 0 if it would be wider than
+ * Difficulty + Safety bits.  Afterwards, reader->pos past the end of the
+ * data means that the certificate is truncated. */
+static inline int spow_compact_next(spow_compact_reader_t *reader,
+                                    uint32_t difficulty, uint32_t safety, uint64_t *out_nonce) {
+    const uint64_t quotient_max = spow_compact_quotient_max(safety);
+    uint64_t quotient = 0;
+    for (;;) {
+        const uint64_t ones = ~spow_compact_peek(reader, reader->pos);
+        if (ones == 0) {
+            /* 64 ones, which are really there, as missing bits are zeros */
+            quotient += 64;
+            reader->pos += 64;
+            if (quotient > quotient_max) {
+                return 0;
+            }
+            continue;
+        }
+        const uint32_t run = (uint32_t)__builtin_clzll(ones);
+        quotient += run;
+        reader->pos += run + 1;
+        break;
+    }
+    if (quotient > quotient_max) {
+        return 0;
+    }
+    uint64_t remainder = 0;
+    if (difficulty > 0) {
+        remainder = spow_compact_peek(reader, reader->pos) >> (64 - difficulty);
+        reader->pos += difficulty;
+    }
+    *out_nonce = ((difficulty >= 64) ? 0 : (quotient << difficulty)) | remainder;
+    return 1;
+}
+
+/* Decode into the fixed-width certificate, e.g. to verify many of them with
+ * spow_verify_batch().  Returns its size, or 0 if the compact certificate is
+ * malformed, if it needs more than 'out_size' bytes, or if the nonces are
+ * wider than 57 bits (see spow_nonce_put_any()).  spow_verify_compact() tells
+ * which it is. */
+static inline size_t spow_compact_decode(unsigned char *out, size_t out_size,
+                                         uint32_t difficulty, uint32_t safety, uint32_t steps,
+                                         const unsigned char *compact, size_t compact_size) {
+    const uint32_t bits = difficulty + safety;
+    const size_t fixed_size = (size_t)(((uint64_t)bits * steps + 7) / 8);
+    if (bits < 1 || bits > 57 || steps < 1 || fixed_size > out_size
+            || compact_size < SPOW_COMPACT_HEADER_BYTES
+            || compact_size > spow_compact_max_size(difficulty, safety, steps)
+            || compact[0] != SPOW_COMPACT_VERSION) {
+        return 0;
+    }
+    memset(out, 0, fixed_size);
+    const spow_nonce_put_fn put = spow_nonce_put_for(bits);
+    spow_compact_reader_t reader = {compact, compact_size, SPOW_COMPACT_HEADER_BYTES * 8};
+    const uint64_t end = (uint64_t)compact_size * 8;
+    for (uint32_t step = 0; step < steps; ++step) {
+        uint64_t nonce;
+        if (!spow_compact_next(&reader, difficulty, safety, &nonce) || reader.pos > end) {
+            return 0;
+        }
+        put(out, bits, step, nonce);
+    }
+    if ((end - reader.pos) >= 8 || spow_compact_peek(&reader, reader.pos) != 0) {
+        return 0;
+    }
+    return fixed_size;
+}
+
+#endif /* STEPPOW_COMPACT_H */
@@ -0,0 +1,483 @@
+#include "daemon.h"
+
+#include <errno.h>
+#include <inttypes.h> /* PRIu64 and similar */
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h> /* malloc, free */
+#include <string.h> /* memcpy, strlen, strerror */
+#include <sys/select.h> /* pselect */
+#include <sys/socket.h>
+#include <sys/stat.h> /* lstat */
+#include <sys/un.h> /* sockaddr_un */
+#include <time.h> /* clock_gettime */
+#include <unistd.h> /* read, write, close, unlink */
+
+#include "batch.h"
+
+/* One line of output, waiting to be written. */
+typedef struct answer_t {
+    struct answer_t *next;
+    size_t size;
+    char text[];
+} answer_t;
+
+typedef struct daemon_t daemon_t;
+
+typedef struct connection_t {
+    daemon_t *daemon;
+    int fd;
+    pthread_t reader;
+    pthread_t writer;
+
+    pthread_mutex_t lock;
+    /* Signalled when an answer is queued, or one was written */
+    pthread_cond_t changed;
+    answer_t *head;
+    answer_t *tail;
+    /* Configs being proven plus answers not written yet */
+    unsigned int inflight;
+    /* The reader is done, so once inflight is 0, so is the writer. */
+    int eof;
+    /* The daemon is stopping: Don't take any more configs. */
+    int stopping;
+    /* The writer is in send(), and has written 'sent' answers so far.
+     * The '_checked' ones are what the stopping daemon saw last time, see
+     * cut_stalled(). */
+    int sending;
+    uint64_t sent;
+    int sending_checked;
+    uint64_t sent_checked;
+
+    /* In the daemon's list, under the daemon's lock */
+    struct connection_t *prev;
+    struct connection_t *next;
+} connection_t;
+
+/* The batch id of each config points to one of these. */
+typedef struct request_t {
+    connection_t *connection;
+    uint64_t line;
+} request_t;
+
+struct daemon_t {
+    spow_batch_t *batch;
+    pthread_mutex_t lock;
+    /* Signalled when a connection is gone */
+    pthread_cond_t changed;
+    connection_t *connections;
+    unsigned int clients;
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_stop_signal(int signum) {
+    (void)signum;
+    stop_requested = 1;
+}
+
+/* Queue an answer.  Never blocks on the client, so workers can call this. */
+static void send_answer(connection_t *connection, const char *text, size_t size) {
+    answer_t *answer = malloc(sizeof(answer_t) + size);
+    pthread_mutex_lock(&connection->lock);
+    if (answer == NULL) {
+        /* Can't tell the client, but at least don't wait for it forever. */
+        connection->inflight -= 1;
+    } else {
+        answer->next = NULL;
+        answer->size = size;
+        memcpy(answer->text, text, size);
+        if (connection->tail == NULL) {
+            connection->head = answer;
+        } else {
+            connection->tail->next = answer;
+        }
+        connection->tail = answer;
+    }
+    pthread_cond_broadcast(&connection->changed);
+    pthread_mutex_unlock(&connection->lock);
+}
+
+static void send_status(connection_t *connection, uint64_t line, const char *status) {
+    char text[64];
+    const int size = snprintf(text, sizeof(text), "%" PRIu64 " %s\n", line, status);
+    send_answer(connection, text, (size_t)size);
+}
+
+static void on_done(void *arg, uint64_t id, const config_t *config,
+                    const unsigned char *cert, uint32_t cert_size,
+                    size_t hashes) {
+    (void)arg;
+    (void)config;
+    request_t *request = (request_t *)(uintptr_t)id;
+    connection_t *connection = request->connection;
+    const uint64_t line = request->line;
+    free(request);
+    if (cert == NULL) {
+        send_status(connection, line, "fail");
+        return;
+    }
+    /* "LINE ok HASHES " and two digits per byte and '\n' */
+    const size_t capacity = 64 + 2 * (size_t)cert_size + 1;
+    char *text = malloc(capacity);
+    if (text == NULL) {
+        send_status(connection, line, "fail");
+        return;
+    }
+    size_t size = (size_t)snprintf(text, capacity, "%" PRIu64 " ok %zu ", line, hashes);
+    static const char HEX[] = "0123456789abcdef";
+    for (uint32_t i = 0; i < cert_size; ++i) {
+        text[size++] = HEX[cert[i] >> 4];
+        text[size++] = HEX[cert[i] & 0xF];
+    }
+    text[size++] = '\n';
+    send_answer(connection, text, size);
+    free(text);
+}
+
+/* Wait until another config (or answer) may be in flight, and count it.
+ * Returns 0 without counting it if the daemon is stopping. */
+static int reserve_inflight(connection_t *connection) {
+    pthread_mutex_lock(&connection->lock);
+    while (connection->inflight >= SPOW_DAEMON_INFLIGHT && !connection->stopping) {
+        pthread_cond_wait(&connection->changed, &connection->lock);
+    }
+    const int reserved = !connection->stopping;
+    if (reserved) {
+        connection->inflight += 1;
+    }
+    pthread_mutex_unlock(&connection->lock);
+    return reserved;
+}
+
+static void handle_line(connection_t *connection, uint64_t line_number, const char *line, int too_long) {
+    config_t config;
+    const char *error = NULL;
+    const int parsed = too_long ? -1 : spow_batch_parse_line(line, &config, &error);
+    if (parsed == 0) {
+        return;
+    }
+    if (!reserve_inflight(connection)) {
+        /* Stopping: Lines that were not taken yet don't get an answer. */
+        return;
+    }
+    if (parsed < 0) {
+        send_status(connection, line_number, "invalid");
+        return;
+    }
+    request_t *request = malloc(sizeof(*request));
+    if (request == NULL) {
+        send_status(connection, line_number, "fail");
+        return;
+    }
+    request->connection = connection;
+    request->line = line_number;
+    /* Blocks while the pool is full, which stops reading from this client. */
+    spow_batch_submit(connection->daemon->batch, (uint64_t)(uintptr_t)request, &config);
+}
+
+static void *writer_main(void *arg) {
+    connection_t *connection = arg;
+    int broken = 0;
+    pthread_mutex_lock(&connection->lock);
+    for (;;) {
+        while (connection->head == NULL && !(connection->eof && connection->inflight == 0)) {
+            pthread_cond_wait(&connection->changed, &connection->lock);
+        }
+        answer_t *answer = connection->head;
+        if (answer == NULL) {
+            break;
+        }
+        connection->head = answer->next;
+        if (connection->head == NULL) {
+            connection->tail = NULL;
+        }
+        connection->sending = 1;
+        pthread_mutex_unlock(&connection->lock);
+
+        for (size_t written = 0; !broken && written < answer->size; ) {
+            const ssize_t result = send(connection->fd, answer->text + written,
+                                        answer->size - written, MSG_NOSIGNAL);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                /* The client is gone.  Stop reading from it, and drop the
+                 * remaining answers. */
+                broken = 1;
+                shutdown(connection->fd, SHUT_RDWR);
+                break;
+            }
+            written += (size_t)result;
+        }
+        free(answer);
+
+        pthread_mutex_lock(&connection->lock);
+        connection->sending = 0;
+        connection->sent += 1;
+        connection->inflight -= 1;
+        pthread_cond_broadcast(&connection->changed);
+    }
+    pthread_mutex_unlock(&connection->lock);
+    return NULL;
+}
+
+static void free_connection(connection_t *connection) {
+    close(connection->fd);
+    pthread_cond_destroy(&connection->changed);
+    pthread_mutex_destroy(&connection->lock);
+    free(connection);
+}
+
+static void *reader_main(void *arg) {
+    connection_t *connection = arg;
+    char line[SPOW_DAEMON_LINE_MAX + 1];
+    size_t line_size = 0;
+    int too_long = 0;
+    uint64_t line_number = 0;
+    char chunk[4096];
+    for (;;) {
+        const ssize_t result = read(connection->fd, chunk, sizeof(chunk));
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break;
+        }
+        for (ssize_t i = 0; i < result; ++i) {
+            if (chunk[i] != '\n') {
+                if (line_size < SPOW_DAEMON_LINE_MAX) {
+                    line[line_size++] = chunk[i];
+                } else {
+                    too_long = 1;
+                }
+                continue;
+            }
+            line[line_size] = '\0';
+            line_number += 1;
+            handle_line(connection, line_number, line, too_long);
+            line_size = 0;
+            too_long = 0;
+        }
+    }
+    /* Like getline(), accept a last line without '\n'. */
+    if (line_size > 0 || too_long) {
+        line[line_size] = '\0';
+        handle_line(connection, line_number + 1, line, too_long);
+    }
+
+    pthread_mutex_lock(&connection->lock);
+    connection->eof = 1;
+    pthread_cond_broadcast(&connection->changed);
+    pthread_mutex_unlock(&connection->lock);
+    pthread_join(connection->writer, NULL);
+
+    daemon_t *daemon = connection->daemon;
+    pthread_mutex_lock(&daemon->lock);
+    if (connection->prev != NULL) {
+        connection->prev->next = connection->next;
+    } else {
+        daemon->connections = connection->next;
+    }
+    if (connection->next != NULL) {
+        connection->next->prev = connection->prev;
+    }
+    daemon->clients -= 1;
+    pthread_cond_broadcast(&daemon->changed);
+    pthread_mutex_unlock(&daemon->lock);
+
+    free_connection(connection);
+    return NULL;
+}
+
+static void start_connection(daemon_t *daemon, int fd) {
+    connection_t *connection = calloc(1, sizeof(*connection));
+    if (connection == NULL) {
+        close(fd);
+        return;
+    }
+    connection->daemon = daemon;
+    connection->fd = fd;
+    pthread_mutex_init(&connection->lock, NULL);
+    pthread_cond_init(&connection->changed, NULL);
+
+    if (0 != pthread_create(&connection->writer, NULL, writer_main, connection)) {
+        fprintf(stderr, "Could not start a thread for a new client.\n");
+        free_connection(connection);
+        return;
+    }
+    /* Add it to the list before the reader can remove it again. */
+    pthread_mutex_lock(&daemon->lock);
+    connection->next = daemon->connections;
+    if (daemon->connections != NULL) {
+        daemon->connections->prev = connection;
+    }
+    daemon->connections = connection;
+    daemon->clients += 1;
+    /* The reader cleans up after itself, see reader_main(). */
+    if (0 != pthread_create(&connection->reader, NULL, reader_main, connection)) {
+        fprintf(stderr, "Could not start a thread for a new client.\n");
+        daemon->connections = connection->next;
+        if (connection->next != NULL) {
+            connection->next->prev = NULL;
+        }
+        daemon->clients -= 1;
+        pthread_mutex_unlock(&daemon->lock);
+        pthread_mutex_lock(&connection->lock);
+        connection->eof = 1;
+        pthread_cond_broadcast(&connection->changed);
+        pthread_mutex_unlock(&connection->lock);
+        pthread_join(connection->writer, NULL);
+        free_connection(connection);
+        return;
+    }
+    pthread_detach(connection->reader);
+    pthread_mutex_unlock(&daemon->lock);
+}
+
+static int listen_on(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path \"%s\" is too long.\n", path);
+        return -1;
+    }
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+
+    /* Replace a stale socket from an earlier run, but nothing else. */
+    struct stat st;
+    if (0 == lstat(path, &st) && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot create socket: %s\n", strerror(errno));
+        return -1;
+    }
+    if (0 != bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) || 0 != listen(fd, 16)) {
+        fprintf(stderr, "Cannot listen on \"%s\": %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* While stopping, under the daemon's lock: Cut off each client whose writer
+ * has been stuck in send() since the last call, i.e. that doesn't read its
+ * answers.  Its writer then drops the rest, so it can't keep the daemon
+ * from exiting.  Clients that are merely waiting for their configs are
+ * left alone. */
+static void cut_stalled(daemon_t *daemon) {
+    for (connection_t *connection = daemon->connections; connection != NULL; connection = connection->next) {
+        pthread_mutex_lock(&connection->lock);
+        /* In the same send() both times, not just in some send() now */
+        if (connection->sending && connection->sending_checked
+                && connection->sent == connection->sent_checked) {
+            shutdown(connection->fd, SHUT_RDWR);
+        }
+        connection->sending_checked = connection->sending;
+        connection->sent_checked = connection->sent;
+        pthread_mutex_unlock(&connection->lock);
+    }
+}
+
+int spow_daemon_run(const char *path, const prover_t *prover, unsigned int threads) {
+    /* From an earlier run in the same process, e.g. in the selftests */
+    stop_requested = 0;
+    /* Only this thread handles SIGINT and SIGTERM, and only in pselect(),
+     * so that no request to stop gets lost.  All other threads inherit the
+     * blocked signals. */
+    sigset_t stop_signals;
+    sigset_t old_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_stop_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigset_t wait_mask = old_mask;
+    sigdelset(&wait_mask, SIGINT);
+    sigdelset(&wait_mask, SIGTERM);
+
+    const int listen_fd = listen_on(path);
+    if (listen_fd < 0) {
+        pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+        return 1;
+    }
+    daemon_t daemon;
+    memset(&daemon, 0, sizeof(daemon));
+    pthread_mutex_init(&daemon.lock, NULL);
+    pthread_cond_init(&daemon.changed, NULL);
+    daemon.batch = spow_batch_create(threads, prover, NULL, on_done, NULL);
+    if (daemon.batch == NULL) {
+        fprintf(stderr, "Could not start %u threads.\n", threads);
+        close(listen_fd);
+        unlink(path);
+        pthread_cond_destroy(&daemon.changed);
+        pthread_mutex_destroy(&daemon.lock);
+        pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+        return 1;
+    }
+    fprintf(stderr, "Listening on \"%s\" with %u threads.\n", path, threads);
+
+    while (!stop_requested) {
+        /* Don't even accept more clients than allowed; the rest wait in
+         * the listen backlog. */
+        pthread_mutex_lock(&daemon.lock);
+        const int full = (daemon.clients >= SPOW_DAEMON_MAX_CLIENTS);
+        pthread_mutex_unlock(&daemon.lock);
+
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(listen_fd, &readable);
+        /* When full, just check for signals every now and then. */
+        const struct timespec timeout = {0, 100 * 1000 * 1000};
+        const int ready = pselect(listen_fd + 1, full ? NULL : &readable, NULL, NULL,
+                                  full ? &timeout : NULL, &wait_mask);
+        if (ready <= 0 || full) {
+            continue;
+        }
+        const int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        start_connection(&daemon, fd);
+    }
+
+    close(listen_fd);
+    unlink(path);
+    /* Don't read anything new; the clients still get their answers.  Wake
+     * up readers that wait for room, so that they notice. */
+    pthread_mutex_lock(&daemon.lock);
+    fprintf(stderr, "Stopping: finishing the configs of %u clients.\n", daemon.clients);
+    for (connection_t *connection = daemon.connections; connection != NULL; connection = connection->next) {
+        shutdown(connection->fd, SHUT_RD);
+        pthread_mutex_lock(&connection->lock);
+        connection->stopping = 1;
+        connection->sending_checked = connection->sending;
+        connection->sent_checked = connection->sent;
+        pthread_cond_broadcast(&connection->changed);
+        pthread_mutex_unlock(&connection->lock);
+    }
+    while (daemon.clients > 0) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += SPOW_DAEMON_STALL_SECONDS;
+        if (ETIMEDOUT == pthread_cond_timedwait(&daemon.changed, &daemon.lock, &deadline)) {
+            cut_stalled(&daemon);
+        }
+    }
+    pthread_mutex_unlock(&daemon.lock);
+
+    spow_batch_destroy(daemon.batch);
+    pthread_cond_destroy(&daemon.changed);
+    pthread_mutex_destroy(&daemon.lock);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    return 0;
+}
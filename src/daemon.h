@@ -0,0 +1,41 @@
+/* A long-running prover, serving challenges over a Unix socket.
+ *
+ * Starting bin/prove for every challenge pays for the process, gcrypt and
+ * the kernel selection every time.  Instead, the daemon keeps a fixed pool
+ * of worker threads (see batch.h), and any number of clients send configs
+ * over a local socket, in the same line format as with spow_batch_run():
+ *     INIT_HASH TOKEN DIFFICULTY SAFETY STEPS
+ * Each connection gets one line back per config, in the order in which they
+ * complete, where LINE counts the lines on that connection:
+ *     LINE ok HASHES CERT
+ *     LINE fail
+ *     LINE invalid
+ * A client may send many lines without waiting for the answers.
+ *
+ * Memory stays bounded: Each connection has at most SPOW_DAEMON_INFLIGHT configs
+ * (or answers) in flight, beyond that the daemon stops reading from it until
+ * the client has read some answers.  The worker pool itself also only queues
+ * so much, see spow_batch_submit(), and there are at most
+ * SPOW_DAEMON_MAX_CLIENTS connections at once. */
+
+#ifndef STEPPOW_DAEMON_H
+#define STEPPOW_DAEMON_H
+
+#include "prover.h"
+
+#define SPOW_DAEMON_INFLIGHT 256
+#define SPOW_DAEMON_MAX_CLIENTS 64
+/* Longer lines are answered with "invalid". */
+#define SPOW_DAEMON_LINE_MAX 256
+/* When stopping, a client that doesn't read any answer for this long is
+ * cut off, and loses the rest of its answers. */
+#define SPOW_DAEMON_STALL_SECONDS 1
+
+/* Serve on the Unix socket 'path' with 'threads' worker threads, until
+ * SIGINT or SIGTERM.  Then stops accepting and reading, finishes the configs
+ * that were already taken, and removes the socket.  Clients that don't read
+ * their answers can't delay this, see SPOW_DAEMON_STALL_SECONDS.  Returns 0 on a clean shutdown,
+ * and 1 if the daemon could not be started. */
+int spow_daemon_run(const char *path, const prover_t *prover, unsigned int threads);
+
+#endif /* STEPPOW_DAEMON_H */
@@ -0,0 +1,199 @@
+#include "kernel.h"
+
+#include <pthread.h> /* pthread_once */
+#include <string.h> /* memset, strcmp */
+#include <time.h> /* clock_gettime */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define SPOW_KERNEL_X86 1
+#endif
+
+const spow_kernel_t SPOW_KERNELS[] = {
+#ifdef SPOW_KERNEL_X86
+    {"shani", spow_sha256_search_shani, NULL, NULL, NULL, 0},
+    {"avx512", spow_sha256_search_avx512, spow_sha256_multi_avx512, spow_sha256_hash_lanes_avx512,
+        spow_sha256_compress_lanes_avx512, 16},
+    {"avx2", spow_sha256_search_avx2, spow_sha256_multi_avx2, spow_sha256_hash_lanes_avx2,
+        spow_sha256_compress_lanes_avx2, 8},
+#endif
+    {"scalar", spow_sha256_search_scalar, NULL, NULL, NULL, 0}
+};
+const unsigned int SPOW_KERNELS_NUM = sizeof(SPOW_KERNELS) / sizeof(SPOW_KERNELS[0]);
+
+#ifdef SPOW_KERNEL_X86
+typedef struct cpu_features_t {
+    int avx2;
+    int avx512f;
+    int sha;
+} cpu_features_t;
+
+/* Written once by detect_cpu_features(), under cpu_features_once, so that
+ * threads asking at the same time all see the complete result. */
+static cpu_features_t cpu_features;
+static pthread_once_t cpu_features_once = PTHREAD_ONCE_INIT;
+
+static void detect_cpu_features(void) {
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return;
+    }
+    const int sse41 = (ecx >> 19) & 1;
+    const int osxsave = (ecx >> 27) & 1;
+    /* The CPU supporting AVX is not enough, the OS must also save the
+     * registers on context switches. */
+    uint64_t xcr0 = 0;
+    if (osxsave) {
+        uint32_t xcr0_lo = 0, xcr0_hi = 0;
+        __asm__ volatile ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+        xcr0 = (((uint64_t)xcr0_hi) << 32) | xcr0_lo;
+    }
+    /* XMM and YMM state */
+    const int os_avx = (xcr0 & 0x06) == 0x06;
+    /* Additionally opmask and ZMM state */
+    const int os_avx512 = (xcr0 & 0xE6) == 0xE6;
+
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    cpu_features.avx2 = os_avx && ((ebx >> 5) & 1);
+    cpu_features.avx512f = os_avx512 && ((ebx >> 16) & 1);
+    cpu_features.sha = sse41 && ((ebx >> 29) & 1);
+}
+#endif /* SPOW_KERNEL_X86 */
+
+int spow_kernel_supported(const spow_kernel_t *kernel) {
+#ifdef SPOW_KERNEL_X86
+    pthread_once(&cpu_features_once, detect_cpu_features);
+    if (kernel->search == spow_sha256_search_shani) {
+        return cpu_features.sha;
+    }
+    if (kernel->search == spow_sha256_search_avx512) {
+        return cpu_features.avx512f;
+    }
+    if (kernel->search == spow_sha256_search_avx2) {
+        return cpu_features.avx2;
+    }
+#endif /* SPOW_KERNEL_X86 */
+    return kernel->search == spow_sha256_search_scalar;
+}
+
+const spow_kernel_t *spow_kernel_find(const char *name) {
+    for (unsigned int i = 0; i < SPOW_KERNELS_NUM; ++i) {
+        if (0 == strcmp(SPOW_KERNELS[i].name, name)) {
+            return &SPOW_KERNELS[i];
+        }
+    }
+    return NULL;
+}
+
+double spow_seconds_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+uint64_t spow_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec) * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* Nonces per search call: Short enough for the calibration, long enough
+ * that reading the clock in between costs nothing. */
+#define HASHRATE_CHUNK (1u << 14)
+
+double spow_kernel_hashrate(const spow_kernel_t *kernel, double seconds) {
+    /* A step where practically no nonce is good, so the whole range is
+     * searched. */
+    unsigned char msg[SPOW_SHA256_MSG_BYTES];
+    memset(msg, 0x5A, sizeof(msg));
+    spow_sha256_step_t step;
+    spow_sha256_step_init(&step, msg, 32);
+
+    uint64_t hashes = 0;
+    uint32_t hi = 0;
+    const double start = spow_seconds_now();
+    double elapsed;
+    do {
+        spow_sha256_step_set_hi(&step, hi++);
+        uint32_t lo = 0;
+        if (kernel->search(&step, 0, HASHRATE_CHUNK - 1, &lo)) {
+            hashes += lo + 1;
+        } else {
+            hashes += HASHRATE_CHUNK;
+        }
+        elapsed = spow_seconds_now() - start;
+    } while (elapsed < seconds);
+    return hashes / elapsed;
+}
+
+/* Which kernel is fastest depends a lot on the microarchitecture: Some CPUs
+ * have a fast SHA unit, others have it only as an afterthought but have two
+ * full-width AVX-512 units.  So don't guess, just try each for a moment:
+ * one chunk at a time, best of a few. */
+#define CALIBRATION_RUNS 3
+
+static double calibrate_kernel(const spow_kernel_t *kernel) {
+    double best = 0;
+    for (int i = 0; i < CALIBRATION_RUNS; ++i) {
+        const double hashrate = spow_kernel_hashrate(kernel, 0);
+        if (hashrate > best) {
+            best = hashrate;
+        }
+    }
+    return best;
+}
+
+/* Set once by choose_best(), under best_once: Other threads calling
+ * spow_kernel_best() meanwhile wait for the calibration to finish, instead
+ * of seeing a kernel that is merely the fastest so far. */
+static const spow_kernel_t *best_kernel = NULL;
+static pthread_once_t best_once = PTHREAD_ONCE_INIT;
+
+static void choose_best(void) {
+    const spow_kernel_t *best = NULL;
+    double best_hashrate = 0;
+    for (unsigned int i = 0; i < SPOW_KERNELS_NUM; ++i) {
+        const spow_kernel_t *kernel = &SPOW_KERNELS[i];
+        if (!spow_kernel_supported(kernel)) {
+            continue;
+        }
+        const double hashrate = calibrate_kernel(kernel);
+        if (best == NULL || hashrate > best_hashrate) {
+            best = kernel;
+            best_hashrate = hashrate;
+        }
+    }
+    best_kernel = best;
+}
+
+const spow_kernel_t *spow_kernel_best(void) {
+    pthread_once(&best_once, choose_best);
+    return best_kernel;
+}
+
+/* The same for choose_best_multi(), which is cheap but on the hot path of
+ * spow_verify_batch() and spow_challenge_derive(). */
+static const spow_kernel_t *best_multi_kernel = NULL;
+static pthread_once_t best_multi_once = PTHREAD_ONCE_INIT;
+
+static void choose_best_multi(void) {
+    const spow_kernel_t *best = NULL;
+    for (unsigned int i = 0; i < SPOW_KERNELS_NUM; ++i) {
+        const spow_kernel_t *kernel = &SPOW_KERNELS[i];
+        if (kernel->multi == NULL || !spow_kernel_supported(kernel)) {
+            continue;
+        }
+        if (best == NULL || kernel->multi_lanes > best->multi_lanes) {
+            best = kernel;
+        }
+    }
+    best_multi_kernel = best;
+}
+
+const spow_kernel_t *spow_kernel_best_multi(void) {
+    pthread_once(&best_multi_once, choose_best_multi);
+    return best_multi_kernel;
+}
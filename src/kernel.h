@@ -0,0 +1,55 @@
+/* Choosing a nonce search implementation at runtime.
+ *
+ * A portable build contains all of them, and asks the CPU (cpuid) which
+ * ones it can actually run.  All kernels find the same nonces, so the choice
+ * only affects speed, never certificates or hash counts. */
+
+#ifndef STEPPOW_KERNEL_H
+#define STEPPOW_KERNEL_H
+
+#include "sha256.h"
+
+typedef struct spow_kernel_t {
+    const char *name;
+    spow_sha256_search_fn search;
+    /* NULL if there is no multi-buffer variant */
+    spow_sha256_multi_fn multi;
+    /* Both with the same number of lanes as 'multi' */
+    spow_sha256_hash_lanes_fn hash_lanes;
+    spow_sha256_compress_lanes_fn compress_lanes;
+    unsigned int multi_lanes;
+} spow_kernel_t;
+
+/* All kernels in this build.  The last one is always "scalar", which
+ * runs everywhere. */
+extern const spow_kernel_t SPOW_KERNELS[];
+extern const unsigned int SPOW_KERNELS_NUM;
+
+/* Whether this CPU (and OS) can run the kernel. */
+int spow_kernel_supported(const spow_kernel_t *kernel);
+
+/* The kernel with this name, or NULL if there is no such kernel. */
+const spow_kernel_t *spow_kernel_find(const char *name);
+
+/* Hashes per second of the kernel on this core, measured for at least
+ * 'seconds' (or a single short search, for 0) on a step where practically
+ * no nonce is good. */
+double spow_kernel_hashrate(const spow_kernel_t *kernel, double seconds);
+
+/* Seconds on a monotonic clock, for measuring how long something takes. */
+double spow_seconds_now(void);
+
+/* The same clock in nanoseconds, for timestamps and deadlines. */
+uint64_t spow_now_ns(void);
+
+/* The fastest supported kernel on this machine.  The first call measures
+ * all supported kernels for a few milliseconds, later calls are free.  Safe
+ * to call from any thread: Concurrent first calls wait for the one
+ * measurement. */
+const spow_kernel_t *spow_kernel_best(void);
+
+/* The supported kernel with the widest multi-buffer variant, or NULL if
+ * there is none.  Decided on the first call, safe from any thread. */
+const spow_kernel_t *spow_kernel_best_multi(void);
+
+#endif /* STEPPOW_KERNEL_H */
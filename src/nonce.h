@@ -0,0 +1,172 @@
+/* Reading and writing the nonce of one step in a certificate.
+ *
+ * The nonces are packed back to back, most significant bit first, with
+ * Difficulty + Safety bits each.  In general a nonce starts at any bit
+ * offset and straddles up to nine bytes, which takes a 64-bit shift and a
+ * loop.  The widths from the recommended profiles don't: With 16, 24 and 32
+ * bits each nonce is whole bytes, and with 20 bits it starts either on a byte
+ * or in the middle of one.  These get their own functions with constant
+ * masks and direct stores.
+ *
+ * Pick the functions once per certificate with spow_nonce_get_for() and
+ * spow_nonce_put_for(), which fall back to the generic ones for any other
+ * width.  Calling them through a constant (e.g. in a switch on the width)
+ * lets the compiler inline them into the step loop.
+ *
+ * Header-only, because both the prover and the verifier use it. */
+
+#ifndef STEPPOW_NONCE_H
+#define STEPPOW_NONCE_H
+
+#include <stddef.h> /* size_t */
+#include <stdint.h>
+#include <string.h> /* memcpy, memset */
+
+#define PORTABLE_ENDIAN_NO_UINT_16_T
+
+#include "portable-endian.h"
+
+/* The nonce of 'step', where each nonce has 'bits' bits.  Reads nothing at
+ * or beyond cert[cert_size]; missing bits count as zero. */
+typedef uint64_t (*spow_nonce_get_fn)(const unsigned char *cert, size_t cert_size,
+                                      uint32_t bits, uint32_t step);
+/* Write the nonce of 'step'.  The bits of that nonce in 'cert' must still
+ * be zero, and those of the other nonces are left alone. */
+typedef void (*spow_nonce_put_fn)(unsigned char *cert, uint32_t bits, uint32_t step, uint64_t nonce);
+
+static inline uint64_t spow_nonce_get_any(const unsigned char *cert, size_t cert_size,
+                                          uint32_t bits, uint32_t step) {
+    const uint64_t offset = (uint64_t)bits * step;
+    const size_t first = (size_t)(offset / 8);
+    const uint32_t shift = (uint32_t)(offset % 8);
+    /* At most 64 + 7 bits, so at most 9 bytes.  Missing bytes are zero. */
+    unsigned char buf[9];
+    memset(buf, 0, sizeof(buf));
+    const size_t avail = cert_size - first;
+    memcpy(buf, cert + first, avail < sizeof(buf) ? avail : sizeof(buf));
+
+    uint64_t word;
+    memcpy(&word, buf, sizeof(word));
+    word = pe_be64toh(word);
+    if (shift != 0) {
+        word = (word << shift) | (buf[8] >> (8 - shift));
+    }
+    return word >> (64 - bits);
+}
+
+/* Only up to 57 bits, so that the nonce and its offset in the first byte
+ * fit into 64 bits. */
+static inline void spow_nonce_put_any(unsigned char *cert, uint32_t bits, uint32_t step, uint64_t nonce) {
+    const uint32_t fixed_bits = bits * step;
+    /* Left-align the nonce, i.e.: 0bNNN…NNN0000…00000 */
+    const uint64_t aligned_nonce = nonce << (64 - (bits + fixed_bits % 8));
+    const uint32_t first_touched_byte = fixed_bits / 8;
+    const uint32_t touch_bytes = (bits + fixed_bits % 8 + 7) / 8;
+    for (uint32_t i = 0; i < touch_bytes; ++i) {
+        cert[first_touched_byte + i] |= (aligned_nonce >> (64 - (i + 1) * 8)) & 0xFF;
+    }
+}
+
+static inline uint64_t spow_nonce_get_16(const unsigned char *cert, size_t cert_size,
+                                         uint32_t bits, uint32_t step) {
+    (void)cert_size;
+    (void)bits;
+    const unsigned char *p = cert + 2 * (size_t)step;
+    return ((uint64_t)p[0] << 8) | p[1];
+}
+
+static inline void spow_nonce_put_16(unsigned char *cert, uint32_t bits, uint32_t step, uint64_t nonce) {
+    (void)bits;
+    unsigned char *p = cert + 2 * (size_t)step;
+    p[0] = (unsigned char)(nonce >> 8);
+    p[1] = (unsigned char)nonce;
+}
+
+/* Two steps share five bytes: 0xAAAAAB 0xBBBB */
+static inline uint64_t spow_nonce_get_20(const unsigned char *cert, size_t cert_size,
+                                         uint32_t bits, uint32_t step) {
+    (void)cert_size;
+    (void)bits;
+    const unsigned char *p = cert + 5 * (size_t)(step / 2) + 2 * (step % 2);
+    if (step % 2 == 0) {
+        return ((uint64_t)p[0] << 12) | ((uint64_t)p[1] << 4) | (p[2] >> 4);
+    }
+    return ((uint64_t)(p[0] & 0x0F) << 16) | ((uint64_t)p[1] << 8) | p[2];
+}
+
+static inline void spow_nonce_put_20(unsigned char *cert, uint32_t bits, uint32_t step, uint64_t nonce) {
+    (void)bits;
+    unsigned char *p = cert + 5 * (size_t)(step / 2) + 2 * (step % 2);
+    if (step % 2 == 0) {
+        p[0] = (unsigned char)(nonce >> 12);
+        p[1] = (unsigned char)(nonce >> 4);
+        p[2] |= (unsigned char)((nonce & 0x0F) << 4);
+    } else {
+        p[0] |= (unsigned char)(nonce >> 16);
+        p[1] = (unsigned char)(nonce >> 8);
+        p[2] = (unsigned char)nonce;
+    }
+}
+
+static inline uint64_t spow_nonce_get_24(const unsigned char *cert, size_t cert_size,
+                                         uint32_t bits, uint32_t step) {
+    (void)cert_size;
+    (void)bits;
+    const unsigned char *p = cert + 3 * (size_t)step;
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[1] << 8) | p[2];
+}
+
+static inline void spow_nonce_put_24(unsigned char *cert, uint32_t bits, uint32_t step, uint64_t nonce) {
+    (void)bits;
+    unsigned char *p = cert + 3 * (size_t)step;
+    p[0] = (unsigned char)(nonce >> 16);
+    p[1] = (unsigned char)(nonce >> 8);
+    p[2] = (unsigned char)nonce;
+}
+
+static inline uint64_t spow_nonce_get_32(const unsigned char *cert, size_t cert_size,
+                                         uint32_t bits, uint32_t step) {
+    (void)cert_size;
+    (void)bits;
+    uint32_t word;
+    memcpy(&word, cert + 4 * (size_t)step, sizeof(word));
+    return pe_be32toh(word);
+}
+
+static inline void spow_nonce_put_32(unsigned char *cert, uint32_t bits, uint32_t step, uint64_t nonce) {
+    (void)bits;
+    const uint32_t word = pe_htobe32((uint32_t)nonce);
+    memcpy(cert + 4 * (size_t)step, &word, sizeof(word));
+}
+
+static inline spow_nonce_get_fn spow_nonce_get_for(uint32_t bits) {
+    switch (bits) {
+    case 16:
+        return spow_nonce_get_16;
+    case 20:
+        return spow_nonce_get_20;
+    case 24:
+        return spow_nonce_get_24;
+    case 32:
+        return spow_nonce_get_32;
+    default:
+        return spow_nonce_get_any;
+    }
+}
+
+static inline spow_nonce_put_fn spow_nonce_put_for(uint32_t bits) {
+    switch (bits) {
+    case 16:
+        return spow_nonce_put_16;
+    case 20:
+        return spow_nonce_put_20;
+    case 24:
+        return spow_nonce_put_24;
+    case 32:
+        return spow_nonce_put_32;
+    default:
+        return spow_nonce_put_any;
+    }
+}
+
+#endif /* STEPPOW_NONCE_H */
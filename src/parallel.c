@@ -0,0 +1,211 @@
+#include "parallel.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h> /* calloc, free */
+
+/* Chunks must not cross a multiple of 2^32, so they are powers of two.
+ * Small chunks waste less work after the good nonce is found (at most one
+ * chunk per thread), large chunks mean less contention.  Aim for a few
+ * chunks per thread per step. */
+#define CHUNK_BITS_MIN 8
+#define CHUNK_BITS_MAX 16
+
+struct spow_parallel_t {
+    spow_sha256_search_fn search;
+    unsigned int threads;
+    pthread_t *workers;
+    unsigned int workers_started;
+
+    pthread_mutex_t lock;
+    /* Signalled when there is a new job (or shutdown) */
+    pthread_cond_t wake;
+    /* Signalled when the last worker finishes the job */
+    pthread_cond_t done;
+    uint64_t generation;
+    unsigned int busy;
+    int shutdown;
+
+    /* The current job.  Only written while no worker is busy. */
+    const spow_sha256_step_t *step;
+    uint64_t nonce_first;
+    uint64_t nonce_max;
+    uint32_t chunk_bits;
+    _Atomic uint64_t next_chunk;
+    _Atomic uint64_t best;
+};
+
+static void run_job(spow_parallel_t *parallel) {
+    /* Each thread might need a different high half of the nonce. */
+    spow_sha256_step_t step = *parallel->step;
+    const uint64_t nonce_first = parallel->nonce_first;
+    const uint64_t nonce_max = parallel->nonce_max;
+    const uint32_t chunk_bits = parallel->chunk_bits;
+    const uint64_t chunk_last = nonce_max >> chunk_bits;
+
+    for (;;) {
+        const uint64_t chunk = atomic_fetch_add_explicit(&parallel->next_chunk, 1,
+                                                         memory_order_relaxed);
+        if (chunk > chunk_last) {
+            return;
+        }
+        const uint64_t first = (chunk == (nonce_first >> chunk_bits)) ? nonce_first : chunk << chunk_bits;
+        if (first >= atomic_load_explicit(&parallel->best, memory_order_relaxed)) {
+            /* A lower nonce already won. */
+            return;
+        }
+        uint64_t last = first + (((uint64_t)1) << chunk_bits) - 1;
+        if (last > nonce_max) {
+            last = nonce_max;
+        }
+
+        const uint32_t hi = (uint32_t)(first >> 32);
+        if (step.block[8] != hi) {
+            spow_sha256_step_set_hi(&step, hi);
+        }
+        uint32_t lo = 0;
+        if (parallel->search(&step, (uint32_t)first, (uint32_t)last, &lo)) {
+            const uint64_t nonce = (((uint64_t)hi) << 32) | lo;
+            uint64_t best = atomic_load_explicit(&parallel->best, memory_order_relaxed);
+            while (nonce < best
+                   && !atomic_compare_exchange_weak_explicit(&parallel->best, &best, nonce,
+                                                             memory_order_relaxed,
+                                                             memory_order_relaxed)) {
+                /* 'best' was updated, try again. */
+            }
+            /* All later chunks only have larger nonces. */
+            return;
+        }
+    }
+}
+
+static void *worker_main(void *arg) {
+    spow_parallel_t *parallel = arg;
+    uint64_t seen_generation = 0;
+
+    pthread_mutex_lock(&parallel->lock);
+    for (;;) {
+        while (parallel->generation == seen_generation && !parallel->shutdown) {
+            pthread_cond_wait(&parallel->wake, &parallel->lock);
+        }
+        if (parallel->shutdown) {
+            break;
+        }
+        seen_generation = parallel->generation;
+        pthread_mutex_unlock(&parallel->lock);
+
+        run_job(parallel);
+
+        pthread_mutex_lock(&parallel->lock);
+        parallel->busy -= 1;
+        if (parallel->busy == 0) {
+            pthread_cond_signal(&parallel->done);
+        }
+    }
+    pthread_mutex_unlock(&parallel->lock);
+    return NULL;
+}
+
+spow_parallel_t *spow_parallel_create(unsigned int threads,
+                                      spow_sha256_search_fn search) {
+    if (threads == 0) {
+        return NULL;
+    }
+    spow_parallel_t *parallel = calloc(1, sizeof(*parallel));
+    if (parallel == NULL) {
+        return NULL;
+    }
+    parallel->search = search;
+    parallel->threads = threads;
+    parallel->workers = calloc(threads, sizeof(pthread_t));
+    pthread_mutex_init(&parallel->lock, NULL);
+    pthread_cond_init(&parallel->wake, NULL);
+    pthread_cond_init(&parallel->done, NULL);
+    atomic_init(&parallel->next_chunk, 0);
+    atomic_init(&parallel->best, UINT64_MAX);
+    if (parallel->workers == NULL) {
+        spow_parallel_destroy(parallel);
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i + 1 < threads; ++i) {
+        if (0 != pthread_create(&parallel->workers[i], NULL, worker_main, parallel)) {
+            spow_parallel_destroy(parallel);
+            return NULL;
+        }
+        parallel->workers_started += 1;
+    }
+    return parallel;
+}
+
+void spow_parallel_destroy(spow_parallel_t *parallel) {
+    if (parallel == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&parallel->lock);
+    parallel->shutdown = 1;
+    pthread_cond_broadcast(&parallel->wake);
+    pthread_mutex_unlock(&parallel->lock);
+    for (unsigned int i = 0; i < parallel->workers_started; ++i) {
+        pthread_join(parallel->workers[i], NULL);
+    }
+    pthread_cond_destroy(&parallel->done);
+    pthread_cond_destroy(&parallel->wake);
+    pthread_mutex_destroy(&parallel->lock);
+    free(parallel->workers);
+    free(parallel);
+}
+
+int spow_parallel_find_nonce(spow_parallel_t *parallel,
+                             const spow_sha256_step_t *step,
+                             uint64_t nonce_max,
+                             uint64_t *out_nonce) {
+    return spow_parallel_find_nonce_range(parallel, step, 0, nonce_max, out_nonce);
+}
+
+int spow_parallel_find_nonce_range(spow_parallel_t *parallel,
+                                   const spow_sha256_step_t *step,
+                                   uint64_t nonce_first,
+                                   uint64_t nonce_last,
+                                   uint64_t *out_nonce) {
+    /* A step takes about 2^Difficulty hashes.  Aim for 8 chunks per thread. */
+    const uint32_t difficulty = (uint32_t)__builtin_popcount(step->zero_mask);
+    uint32_t threads_bits = 0;
+    while ((1u << threads_bits) < parallel->threads) {
+        threads_bits += 1;
+    }
+    uint32_t chunk_bits = (difficulty > threads_bits + 3) ? difficulty - threads_bits - 3 : 0;
+    if (chunk_bits < CHUNK_BITS_MIN) {
+        chunk_bits = CHUNK_BITS_MIN;
+    }
+    if (chunk_bits > CHUNK_BITS_MAX) {
+        chunk_bits = CHUNK_BITS_MAX;
+    }
+
+    pthread_mutex_lock(&parallel->lock);
+    parallel->step = step;
+    parallel->nonce_first = nonce_first;
+    parallel->nonce_max = nonce_last;
+    parallel->chunk_bits = chunk_bits;
+    atomic_store_explicit(&parallel->next_chunk, nonce_first >> chunk_bits, memory_order_relaxed);
+    atomic_store_explicit(&parallel->best, UINT64_MAX, memory_order_relaxed);
+    parallel->busy = parallel->workers_started;
+    parallel->generation += 1;
+    pthread_cond_broadcast(&parallel->wake);
+    pthread_mutex_unlock(&parallel->lock);
+
+    run_job(parallel);
+
+    pthread_mutex_lock(&parallel->lock);
+    while (parallel->busy != 0) {
+        pthread_cond_wait(&parallel->done, &parallel->lock);
+    }
+    pthread_mutex_unlock(&parallel->lock);
+
+    const uint64_t best = atomic_load_explicit(&parallel->best, memory_order_relaxed);
+    if (best == UINT64_MAX) {
+        return 0;
+    }
+    *out_nonce = best;
+    return 1;
+}
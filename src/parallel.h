@@ -0,0 +1,42 @@
+/* Searching the nonces of a single step with several threads.
+ *
+ * The README argues that this doesn't help, and for low Difficulty that's
+ * true: a step only takes about 2^Difficulty hashes, and waking up threads
+ * costs more than that.  But for high Difficulty (say, 16 and up), a step
+ * takes milliseconds, and splitting it across cores pays off.
+ *
+ * The nonce range is cut into chunks, which the threads claim in increasing
+ * order.  Each thread stops as soon as it finds a good nonce, or the next
+ * chunk starts after the best nonce found so far.  Every chunk before the
+ * best nonce is searched completely, so the result is always the *smallest*
+ * good nonce, exactly like spow_sha256_find_nonce().  Certificates and hash
+ * counts therefore don't depend on the number of threads. */
+
+#ifndef STEPPOW_PARALLEL_H
+#define STEPPOW_PARALLEL_H
+
+#include "sha256.h"
+
+typedef struct spow_parallel_t spow_parallel_t;
+
+/* Start 'threads - 1' worker threads; the caller is the last one.
+ * Returns NULL on failure. */
+spow_parallel_t *spow_parallel_create(unsigned int threads,
+                                      spow_sha256_search_fn search);
+
+void spow_parallel_destroy(spow_parallel_t *parallel);
+
+/* Same contract as spow_sha256_find_nonce(). */
+int spow_parallel_find_nonce(spow_parallel_t *parallel,
+                             const spow_sha256_step_t *step,
+                             uint64_t nonce_max,
+                             uint64_t *out_nonce);
+
+/* Same contract as spow_sha256_find_nonce_range(). */
+int spow_parallel_find_nonce_range(spow_parallel_t *parallel,
+                                   const spow_sha256_step_t *step,
+                                   uint64_t nonce_first,
+                                   uint64_t nonce_last,
+                                   uint64_t *out_nonce);
+
+#endif /* STEPPOW_PARALLEL_H */
@@ -0,0 +1,98 @@
+#include "perf.h"
+
+#include <string.h> /* memset */
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h> /* SYS_perf_event_open */
+#include <unistd.h> /* syscall, read, close */
+#endif
+
+const char *const SPOW_PERF_NAMES[SPOW_PERF_COUNTERS] = {
+    "cycles", "instructions", "branch misses", "L1d misses",
+};
+
+#ifdef __linux__
+
+static int open_counter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    /* Only the prover itself, not the kernel */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    /* If there are more counters than the PMU has, the kernel multiplexes
+     * them, and these say for how long each one actually counted. */
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    /* This thread, any CPU, no group */
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+unsigned int spow_perf_open(spow_perf_t *perf) {
+    perf->fds[SPOW_PERF_CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    perf->fds[SPOW_PERF_INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    perf->fds[SPOW_PERF_BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    perf->fds[SPOW_PERF_L1_MISSES] = open_counter(PERF_TYPE_HW_CACHE,
+        PERF_COUNT_HW_CACHE_L1D
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    perf->available = 0;
+    for (unsigned int i = 0; i < SPOW_PERF_COUNTERS; ++i) {
+        if (perf->fds[i] >= 0) {
+            perf->available |= 1u << i;
+        } else {
+            perf->fds[i] = -1;
+        }
+    }
+    return perf->available;
+}
+
+void spow_perf_read(const spow_perf_t *perf, uint64_t values[SPOW_PERF_COUNTERS]) {
+    for (unsigned int i = 0; i < SPOW_PERF_COUNTERS; ++i) {
+        /* value, time enabled, time running */
+        uint64_t data[3];
+        values[i] = 0;
+        if (perf->fds[i] < 0 || read(perf->fds[i], data, sizeof(data)) != (ssize_t)sizeof(data)) {
+            continue;
+        }
+        if (data[2] != 0 && data[2] < data[1]) {
+            /* Multiplexed: extrapolate to the whole time. */
+            values[i] = (uint64_t)((double)data[0] * (double)data[1] / (double)data[2]);
+        } else {
+            values[i] = data[0];
+        }
+    }
+}
+
+void spow_perf_close(spow_perf_t *perf) {
+    for (unsigned int i = 0; i < SPOW_PERF_COUNTERS; ++i) {
+        if (perf->fds[i] >= 0) {
+            close(perf->fds[i]);
+            perf->fds[i] = -1;
+        }
+    }
+    perf->available = 0;
+}
+
+#else /* __linux__ */
+
+unsigned int spow_perf_open(spow_perf_t *perf) {
+    for (unsigned int i = 0; i < SPOW_PERF_COUNTERS; ++i) {
+        perf->fds[i] = -1;
+    }
+    perf->available = 0;
+    return 0;
+}
+
+void spow_perf_read(const spow_perf_t *perf, uint64_t values[SPOW_PERF_COUNTERS]) {
+    (void)perf;
+    memset(values, 0, SPOW_PERF_COUNTERS * sizeof(values[0]));
+}
+
+void spow_perf_close(spow_perf_t *perf) {
+    (void)perf;
+}
+
+#endif /* __linux__ */
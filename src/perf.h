@@ -0,0 +1,42 @@
+/* Hardware performance counters (Linux perf_event_open) for the prover.
+ *
+ * Hashes per second alone doesn't say why one kernel or compiler is faster
+ * than another.  Cycles per hash, instructions per cycle, and the branch and
+ * L1 misses around the nonce search do.
+ *
+ * The counters only count the thread that opened them.  Many machines
+ * (especially VMs) don't have all of them, or don't allow them, see
+ * /proc/sys/kernel/perf_event_paranoid; missing counters just read as 0. */
+
+#ifndef STEPPOW_PERF_H
+#define STEPPOW_PERF_H
+
+#include <stdint.h>
+
+#define SPOW_PERF_CYCLES 0
+#define SPOW_PERF_INSTRUCTIONS 1
+#define SPOW_PERF_BRANCH_MISSES 2
+#define SPOW_PERF_L1_MISSES 3
+#define SPOW_PERF_COUNTERS 4
+
+/* Human-readable names, indexed by SPOW_PERF_* */
+extern const char *const SPOW_PERF_NAMES[SPOW_PERF_COUNTERS];
+
+typedef struct spow_perf_t {
+    /* -1 if the counter is not available */
+    int fds[SPOW_PERF_COUNTERS];
+    /* Bit i is set iff counter i is available */
+    unsigned int available;
+} spow_perf_t;
+
+/* Open the counters for the calling thread.  Returns perf->available,
+ * which may be 0. */
+unsigned int spow_perf_open(spow_perf_t *perf);
+
+/* The current value of each counter, or 0 if it is not available.
+ * Only differences between two reads are meaningful. */
+void spow_perf_read(const spow_perf_t *perf, uint64_t values[SPOW_PERF_COUNTERS]);
+
+void spow_perf_close(spow_perf_t *perf);
+
+#endif /* STEPPOW_PERF_H */
@@ -0,0 +1,282 @@
+/* Compile:
+ * clang -Wall -O3 -pthread src/plan.c src/kernel.c src/sha256.c src/sha256-simd.c src/sha256-shani.c -lm -o bin/plan
+ * Run:
+ * ./bin/plan [--hashrate H | --seconds T] [--quantile Q] [--max-seconds S] [--max-bytes B] [--safety S]
+ * ./bin/plan [--hashrate H | --seconds T] --params DIFFICULTY SAFETY STEPS
+ *
+ * Picks parameters from a latency target instead of from the expected work
+ * alone.  The number of hashes of a proof is Erlang(k=Steps,
+ * lambda=2^-Difficulty) distributed (see "Amount of Work" in README.md), so
+ * its Q-quantile is 2^Difficulty times the Q-quantile of Gamma(Steps, 1).
+ * Those are computed exactly (up to double precision), not by a normal
+ * approximation, which is too optimistic in the upper tail for few steps.
+ *
+ * The hashrate is measured with the best kernel on one core, as find_cert()
+ * uses it, unless given with --hashrate, e.g. for a slower class of clients.
+ * It does not include the work per step outside the kernel, which only
+ * matters for difficulties below 8 or so. */
+
+#include <inttypes.h> /* PRIu32 and similar */
+#include <math.h> /* exp, fabs, ldexp, lgamma, log */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h> /* strtod, strtoul */
+#include <string.h> /* strcmp */
+
+#include "kernel.h"
+#include "prover.h" /* PROVER_DIFFICULTY_MAX, PROVER_NONCE_BITS_MAX */
+
+/* The quantiles asked for by README.md */
+static const double QUANTILES[] = {0.001, 0.01, 0.1, 0.5, 0.9, 0.99, 0.999};
+#define QUANTILES_NUM (sizeof(QUANTILES) / sizeof(QUANTILES[0]))
+
+/* Both lower and upper regularized incomplete gamma function, P(k, x) and
+ * Q(k, x) = 1 - P(k, x), each computed directly, so that the small one is
+ * accurate even when the other one is close to 1.  P(k, x) is the CDF of
+ * Gamma(k, 1) at x. */
+static void gamma_pq(double k, double x, double *out_p, double *out_q) {
+    if (x <= 0) {
+        *out_p = 0;
+        *out_q = 1;
+        return;
+    }
+    const double log_prefix = k * log(x) - x - lgamma(k);
+    if (x < k + 1) {
+        /* Series: P = x^k e^-x / Gamma(k+1) * sum_n x^n / ((k+1)...(k+n)) */
+        double term = 1 / k;
+        double sum = term;
+        for (int n = 1; n < 100000; ++n) {
+            term *= x / (k + n);
+            sum += term;
+            if (term < sum * 1e-16) {
+                break;
+            }
+        }
+        *out_p = sum * exp(log_prefix);
+        *out_q = 1 - *out_p;
+    } else {
+        /* Continued fraction for Q, evaluated with the modified Lentz method */
+        const double tiny = 1e-300;
+        double b = x + 1 - k;
+        double c = 1 / tiny;
+        double d = 1 / b;
+        double h = d;
+        for (int n = 1; n < 100000; ++n) {
+            const double a = -n * (n - k);
+            b += 2;
+            d = a * d + b;
+            if (fabs(d) < tiny) {
+                d = tiny;
+            }
+            c = b + a / c;
+            if (fabs(c) < tiny) {
+                c = tiny;
+            }
+            d = 1 / d;
+            const double delta = d * c;
+            h *= delta;
+            if (fabs(delta - 1) < 1e-16) {
+                break;
+            }
+        }
+        *out_q = h * exp(log_prefix);
+        *out_p = 1 - *out_q;
+    }
+}
+
+/* The x with P(k, x) = q, i.e. the q-quantile of Gamma(k, 1).  Bisection,
+ * on whichever tail is the small one. */
+static double gamma_quantile(double k, double q) {
+    double lo = 0;
+    double hi = k + 1;
+    for (;;) {
+        double p, upper;
+        gamma_pq(k, hi, &p, &upper);
+        if (p >= q) {
+            break;
+        }
+        lo = hi;
+        hi *= 2;
+    }
+    for (int i = 0; i < 200 && hi - lo > hi * 1e-13; ++i) {
+        const double mid = (lo + hi) / 2;
+        double p, upper;
+        gamma_pq(k, mid, &p, &upper);
+        const int below = (q <= 0.5) ? (p < q) : (upper > 1 - q);
+        if (below) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo + hi) / 2;
+}
+
+/* The q-quantile of the number of hashes for these parameters */
+static double hashes_quantile(uint32_t difficulty, uint32_t steps, double q) {
+    return ldexp(gamma_quantile(steps, q), (int)difficulty);
+}
+
+static uint64_t cert_bytes(uint32_t difficulty, uint32_t safety, uint64_t steps) {
+    return (steps * (difficulty + safety) + 7) / 8;
+}
+
+/* The most steps the prover takes, see spow_batch_parse_line(). */
+static uint32_t steps_max(uint32_t difficulty, uint32_t safety) {
+    return (UINT32_MAX - 7) / (difficulty + safety);
+}
+
+static void print_quantiles(double hashrate, uint32_t difficulty, uint32_t safety, uint32_t steps) {
+    printf("Difficulty %" PRIu32 ", Safety %" PRIu32 ", Steps %" PRIu32 ": %" PRIu64
+        " bytes, E[hashes] = %.0f (%.3f s)\n",
+        difficulty, safety, steps, cert_bytes(difficulty, safety, steps),
+        ldexp(steps, (int)difficulty), ldexp(steps, (int)difficulty) / hashrate);
+    printf("%9s %16s %12s %12s\n", "Quantile", "Hashes", "x E[hashes]", "Seconds");
+    for (size_t i = 0; i < QUANTILES_NUM; ++i) {
+        const double hashes = hashes_quantile(difficulty, steps, QUANTILES[i]);
+        printf("%8.1f%% %16.0f %12.4f %12.3f\n", QUANTILES[i] * 100, hashes,
+            hashes / ldexp(steps, (int)difficulty), hashes / hashrate);
+    }
+}
+
+/* For every difficulty, the most steps that meet both targets. */
+static int print_plan(double hashrate, double quantile, double max_seconds, uint64_t max_bytes,
+                      uint32_t safety) {
+    const double max_hashes = max_seconds * hashrate;
+    printf("p%g proving time <= %g s, certificate <= %" PRIu64 " bytes, Safety %" PRIu32
+        " (probability of impossibility < 2^(log2(Steps) - %.0f)):\n",
+        quantile * 100, max_seconds, max_bytes, safety, ldexp(1, (int)safety));
+    char target[32];
+    snprintf(target, sizeof(target), "p%g (s)", quantile * 100);
+    printf("%10s %6s %10s %7s %14s %10s %10s %10s\n", "Difficulty", "Safety", "Steps", "Bytes",
+        "E[hashes]", "p50 (s)", target, "p99.9 (s)");
+    int found = 0;
+    uint32_t best_difficulty = 0;
+    uint32_t best_steps = 0;
+    /* Only what bin/prove accepts */
+    for (uint32_t difficulty = 1;
+            difficulty <= PROVER_DIFFICULTY_MAX && difficulty + safety <= PROVER_NONCE_BITS_MAX;
+            ++difficulty) {
+        /* Neither more steps than fit into the certificate, nor more than
+         * fit into the time on average. */
+        uint64_t hi = (max_bytes * 8) / (difficulty + safety);
+        const double mean_cap = ldexp(max_hashes, -(int)difficulty);
+        if (mean_cap < hi) {
+            hi = (uint64_t)mean_cap;
+        }
+        if (hi > steps_max(difficulty, safety)) {
+            hi = steps_max(difficulty, safety);
+        }
+        if (hi == 0 || hashes_quantile(difficulty, 1, quantile) > max_hashes) {
+            continue;
+        }
+        /* The quantile grows with the steps, so bisect for the last good one. */
+        uint64_t lo = 1;
+        while (lo < hi) {
+            const uint64_t mid = lo + (hi - lo + 1) / 2;
+            if (hashes_quantile(difficulty, (uint32_t)mid, quantile) <= max_hashes) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        const uint32_t steps = (uint32_t)lo;
+        printf("%10" PRIu32 " %6" PRIu32 " %10" PRIu32 " %7" PRIu64 " %14.0f %10.3f %10.3f %10.3f\n",
+            difficulty, safety, steps, cert_bytes(difficulty, safety, steps),
+            ldexp(steps, (int)difficulty),
+            hashes_quantile(difficulty, steps, 0.5) / hashrate,
+            hashes_quantile(difficulty, steps, quantile) / hashrate,
+            hashes_quantile(difficulty, steps, 0.999) / hashrate);
+        if (!found || ldexp(steps, (int)difficulty) > ldexp(best_steps, (int)best_difficulty)) {
+            best_difficulty = difficulty;
+            best_steps = steps;
+        }
+        found = 1;
+    }
+    if (!found) {
+        printf("Nothing meets the target.\n");
+        return 1;
+    }
+    /* More steps make the tail relatively thinner, so the most expected
+     * work usually comes from the smallest difficulty the certificate size
+     * allows. */
+    printf("Most expected work: Difficulty %" PRIu32 ", Safety %" PRIu32 ", Steps %" PRIu32 "\n",
+        best_difficulty, safety, best_steps);
+    return 0;
+}
+
+static int parse_double(const char *str, double *out) {
+    char *end = NULL;
+    *out = strtod(str, &end);
+    return *str != '\0' && *end == '\0' && *out > 0;
+}
+
+static int parse_u32(const char *str, uint32_t *out) {
+    char *end = NULL;
+    const unsigned long value = strtoul(str, &end, 10);
+    *out = (uint32_t)value;
+    return *str != '\0' && *end == '\0' && value <= UINT32_MAX;
+}
+
+int main(int argc, char **argv) {
+    double hashrate = 0;
+    double calibrate_seconds = 3;
+    double quantile = 0.99;
+    double max_seconds = 2;
+    double max_bytes = 4096;
+    uint32_t safety = 7;
+    int params = 0;
+    uint32_t difficulty = 0;
+    uint32_t steps = 0;
+    int ok = 1;
+    for (int i = 1; i < argc && ok; ++i) {
+        if (0 == strcmp(argv[i], "--hashrate") && i + 1 < argc) {
+            ok = parse_double(argv[++i], &hashrate);
+        } else if (0 == strcmp(argv[i], "--seconds") && i + 1 < argc) {
+            ok = parse_double(argv[++i], &calibrate_seconds);
+        } else if (0 == strcmp(argv[i], "--quantile") && i + 1 < argc) {
+            ok = parse_double(argv[++i], &quantile) && quantile < 1;
+        } else if (0 == strcmp(argv[i], "--max-seconds") && i + 1 < argc) {
+            ok = parse_double(argv[++i], &max_seconds);
+        } else if (0 == strcmp(argv[i], "--max-bytes") && i + 1 < argc) {
+            ok = parse_double(argv[++i], &max_bytes) && max_bytes < 1e15;
+        } else if (0 == strcmp(argv[i], "--safety") && i + 1 < argc) {
+            ok = parse_u32(argv[++i], &safety) && safety < PROVER_NONCE_BITS_MAX;
+        } else if (0 == strcmp(argv[i], "--params") && i + 3 < argc) {
+            params = 1;
+            ok = parse_u32(argv[i + 1], &difficulty) && parse_u32(argv[i + 2], &safety)
+                && parse_u32(argv[i + 3], &steps)
+                && difficulty >= 1 && difficulty <= PROVER_DIFFICULTY_MAX
+                && safety < PROVER_NONCE_BITS_MAX && difficulty + safety <= PROVER_NONCE_BITS_MAX
+                && steps >= 1 && steps <= steps_max(difficulty, safety);
+            i += 3;
+        } else {
+            ok = 0;
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "USAGE: %s [--hashrate H | --seconds T] [--quantile Q] [--max-seconds S] "
+            "[--max-bytes B] [--safety S]\n"
+            "       %s [--hashrate H | --seconds T] --params DIFFICULTY SAFETY STEPS\n"
+            "\tH: hashes per second of the slowest prover to plan for.  Default: measure\n"
+            "\t   the best kernel on this core for T seconds (default 3).\n"
+            "\tLists the parameters whose Q-quantile (default 0.99) of the proving time is\n"
+            "\tat most S seconds (default 2) with certificates of at most B bytes\n"
+            "\t(default 4096), or the quantiles of the proving time for the given ones.\n",
+            argv[0], argv[0]);
+        return 1;
+    }
+
+    if (hashrate == 0) {
+        const spow_kernel_t *kernel = spow_kernel_best();
+        fprintf(stderr, "Measuring kernel %s for %g s ...\n", kernel->name, calibrate_seconds);
+        hashrate = spow_kernel_hashrate(kernel, calibrate_seconds);
+    }
+    printf("Hashrate: %.0f H/s\n", hashrate);
+
+    if (params) {
+        print_quantiles(hashrate, difficulty, safety, steps);
+        return 0;
+    }
+    return print_plan(hashrate, quantile, max_seconds, (uint64_t)max_bytes, safety);
+}
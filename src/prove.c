@@ -1,7 +1,7 @@
 /* Compile:
- * clang -Wall -O3 -march=native src/prove.c -lgcrypt -o bin/prove
+ * clang -Wall -O3 -pthread src/prove.c src/prover.c src/batch.c src/checkpoint.c src/daemon.c src/telemetry.c src/perf.c src/kernel.c src/parallel.c src/sha256.c src/sha256-simd.c src/sha256-shani.c -lgcrypt -lm -o bin/prove
  * Run:
- * ./bin/prove config.txt
+ * ./bin/prove [--kernel NAME] [--threads N] [--parallel-difficulty D] [--batch FILE [--checkpoint DIR] [--compact] | --daemon SOCKET] [--multi-buffer] [--telemetry] [--perf]
  * Yay. */
 
 /* Marginally speed up compilation */
@@ -13,57 +13,38 @@
 #include <errno.h>
 #include <gcrypt.h>
 #include <inttypes.h> /* PRIu32 and similar */
-#include <stddef.h> /* size_t, offsetof */
+#include <stddef.h> /* size_t */
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h> /* malloc, free */
+#include <pthread.h>
+#include <signal.h> /* pthread_kill, SIGTERM */
 #include <string.h> /* memcmp, memcpy */
+#include <sys/socket.h>
+#include <sys/time.h> /* struct timeval */
+#include <sys/un.h> /* sockaddr_un */
+#include <unistd.h> /* access, rmdir, sysconf, unlink, usleep */
 
 #define PORTABLE_ENDIAN_NO_UINT_16_T
 
+#include "batch.h"
+#include "checkpoint.h"
+#include "compact.h"
+#include "daemon.h"
+#include "kernel.h"
+#include "parallel.h"
+#include "perf.h"
 #include "portable-endian.h"
+#include "prover.h"
+#include "sha256.h"
+#include "telemetry.h"
 
-/* I don't think this will ever change.  But just in case.
- * However, you may want to choose a hash which has block size at least
- * SPOW_HASHBYTES + 1 + 8, because then it probably fits in a block. */
-#define SPOW_HASH_SIZE (256 / 8)
+/* The prover needs the same hash as gcrypt's: */
 #define SPOW_HASH_ALGO (GCRY_MD_SHA256)
-#define SPOW_TOKEN_SIZE 8
-#define SPOW_DUMMY_BYTES 4
 
-/* hashbuf = last_hash || nonce || token || step */
-typedef struct hashbuf_t {
-    unsigned char last_hash[SPOW_HASH_SIZE];
-    uint64_t nonce;
-    unsigned char token[SPOW_TOKEN_SIZE];
-    uint32_t step;
-#if SPOW_DUMMY_BYTES != 0
-    unsigned char dummy[SPOW_DUMMY_BYTES];
-#endif
-} hashbuf_t;
-#define SPOW_HASHBYTES (SPOW_HASH_SIZE + 8 + SPOW_TOKEN_SIZE + 4)
-typedef char assert_SPOW_hashbuf_size[
-    (sizeof(hashbuf_t) == SPOW_HASHBYTES + SPOW_DUMMY_BYTES) ? 1 : -1];
-typedef char assert_SPOW_hashbuf_offset_last_hash[
-    (offsetof(hashbuf_t, last_hash) == 0) ? 1 : -1];
-typedef char assert_SPOW_hashbuf_offset_nonce[
-    (offsetof(hashbuf_t, nonce) == SPOW_HASH_SIZE) ? 1 : -1];
-typedef char assert_SPOW_hashbuf_offset_token[
-    (offsetof(hashbuf_t, token) == SPOW_HASH_SIZE + 8) ? 1 : -1];
-typedef char assert_SPOW_hashbuf_offset_step[
-    (offsetof(hashbuf_t, step) == SPOW_HASH_SIZE + 8 + SPOW_TOKEN_SIZE) ? 1 : -1];
-#if SPOW_DUMMY_BYTES != 0
-typedef char assert_SPOW_hashbuf_offset_dummy[
-    (offsetof(hashbuf_t, dummy) == SPOW_HASHBYTES) ? 1 : -1];
-#endif
-
-typedef struct config_t {
-    unsigned char init_hash[SPOW_HASH_SIZE];
-    unsigned char token[SPOW_TOKEN_SIZE];
-    uint32_t difficulty;
-    uint32_t safety;
-    uint32_t steps;
-} config_t;
+/* Chosen once at startup, see main() */
+static prover_t prover = {NULL, NULL, 16, NULL, 0, NULL, NULL, NULL};
+static const spow_kernel_t *search_kernel = NULL;
 
 static void dump_bytes(const unsigned char *buf, size_t num_bytes) {
     for (size_t i = 0; i < num_bytes; ++i) {
@@ -71,102 +52,6 @@ static void dump_bytes(const unsigned char *buf, size_t num_bytes) {
     }
 }
 
-static size_t extend_cert(const config_t *config,
-                          unsigned char *cert,
-                          uint32_t step,
-                          unsigned char *last_hash) {
-    /* Check alignment: */
-    assert((((intptr_t)last_hash) & 0x3) == 0);
-    /* Check whether it fits in one block.  This is not a requirement,
-     * but why would you need such a high Difficulty/Safety? */
-    assert(SPOW_HASHBYTES <= 55);
-    /* TODO: This implementation can't handle too large nonces: */
-    assert(config->difficulty + config->safety <= 57);
-
-    const uint64_t nonce_max = (((uint64_t)1) << (config->difficulty + config->safety)) - 1;
-    const uint32_t difficulty_mask =
-        pe_htobe32(((((uint32_t)1) << config->difficulty) - 1) << (32 - config->difficulty));
-
-    /* hashbuf = last_hash || nonce || token || step */
-    hashbuf_t hashbuf;
-    memcpy(hashbuf.last_hash, last_hash, SPOW_HASH_SIZE);
-    hashbuf.nonce = 0;
-    memcpy(hashbuf.token, config->token, SPOW_TOKEN_SIZE);
-    hashbuf.step = pe_htobe32(step);
-
-    uint64_t nonce = 0;
-    for (; ; ++nonce) {
-        /* Write nonce. */
-        hashbuf.nonce = pe_htobe64(nonce);
-        /* Compute digest. */
-        gcry_md_hash_buffer(SPOW_HASH_ALGO, last_hash, &hashbuf, SPOW_HASHBYTES);
-        /* Are we done yet? */
-        uint32_t relevant_digest = ((uint32_t *)last_hash)[0] & difficulty_mask;
-        if (relevant_digest == 0) {
-            /* All required-zero bits are zero: */
-            break;
-        }
-        if (nonce == nonce_max) {
-            /* The impossible happened: Backtracking needed, but not implemented.
-             * See README.md, topics "Safety" and "Recommendations". */
-            return 0;
-        }
-    }
-
-    const uint32_t fixed_bits = (config->difficulty + config->safety) * step;
-    /* Left-align the nonce, i.e.: 0bNNN…NNN0000…00000 */
-    const uint64_t aligned_nonce = nonce << (64 - (config->difficulty + config->safety + fixed_bits % 8));
-
-    /* Prepare copying */
-    const uint32_t first_touched_byte = (fixed_bits) / 8;
-    const uint32_t last_touched_byte = (fixed_bits + config->difficulty + config->safety - 1) / 8;
-    const uint32_t touch_bytes = last_touched_byte - first_touched_byte + 1;
-    assert(touch_bytes == (config->difficulty + config->safety + fixed_bits % 8 + 7) / 8);
-    assert(touch_bytes <= 8);
-    assert(last_touched_byte < (config->steps * (config->difficulty + config->safety) + 7) / 8);
-
-    for (uint32_t i = 0; i < touch_bytes; ++i) {
-        cert[first_touched_byte + i] |= (aligned_nonce >> (64 - (i + 1) * 8)) & 0xFF;
-    }
-
-    /* This can't overflow because difficulty + safety <= 63 */
-    return nonce + 1;
-}
-
-static int find_cert(const struct config_t *config,
-                     unsigned char **out_cert,
-                     uint32_t *out_cert_size,
-                     size_t *out_hashes) {
-    const uint32_t cert_size = (config->steps * (config->difficulty + config->safety) + 7) / 8;
-    unsigned char *cert = malloc(cert_size);
-    /* All nonces are or'd into the certificate, so first clear the memory: */
-    memset(cert, 0, cert_size);
-    assert(cert);
-    size_t hashes = 0;
-
-    unsigned char last_hash[SPOW_HASH_SIZE];
-    memcpy(last_hash, config->init_hash, sizeof(last_hash));
-
-    for (uint32_t step = 0; step < config->steps; ++step) {
-        const size_t step_hashes = extend_cert(config, cert, step, last_hash);
-        if (step_hashes == 0) {
-            printf("Failed in step %u, would need to backtrack!\n", step);
-            /* However, this is sufficiently unlikely.
-             * See README.md, topics "Safety" and "Recommendations". */
-            free(cert);
-            return 0;
-        }
-        /* Theoretically this can overflow.
-         * Practically, this costs 2^64 hash computations. See you in 2080. */
-        hashes += step_hashes;
-    }
-
-    *out_cert = cert;
-    *out_cert_size = cert_size;
-    *out_hashes = hashes;
-    return 1;
-}
-
 typedef struct selftest_t {
     const char *name;
     config_t config;
@@ -181,7 +66,7 @@ static int run_selftest(const selftest_t *selftest) {
     uint32_t actual_cert_size = 0;
     unsigned char *actual_cert = NULL;
 
-    if (!find_cert(&selftest->config, &actual_cert, &actual_cert_size, &actual_hashes)) {
+    if (!find_cert(&prover, &selftest->config, &actual_cert, &actual_cert_size, &actual_hashes)) {
         printf("Selftest \"%s\" failed: No cert found!\n\n", selftest->name);
         return 0;
     }
@@ -233,6 +118,132 @@ static int run_selftest(const selftest_t *selftest) {
     return 1;
 }
 
+/* Cross-check the in-tree SHA-256 against libgcrypt.  The buffers look
+ * like the real thing, but are otherwise arbitrary. */
+static int run_kernel_selftest(void) {
+    const char *name = "sha256.c vs. gcrypt";
+    hashbuf_t hashbuf;
+    unsigned char expected[SPOW_HASH_SIZE];
+    unsigned char actual[SPOW_HASH_SIZE];
+    memset(&hashbuf, 0, sizeof(hashbuf));
+
+    for (uint32_t i = 0; i < 1000; ++i) {
+        hashbuf.nonce = pe_htobe64(i * UINT64_C(0x9E3779B97F4A7C15));
+        memcpy(hashbuf.token, hashbuf.last_hash + SPOW_TOKEN_SIZE, SPOW_TOKEN_SIZE);
+        hashbuf.step = pe_htobe32(i);
+        gcry_md_hash_buffer(SPOW_HASH_ALGO, expected, &hashbuf, SPOW_HASHBYTES);
+        spow_sha256_hash52(actual, (const unsigned char *)&hashbuf);
+        if (0 != memcmp(actual, expected, SPOW_HASH_SIZE)) {
+            printf("Selftest \"%s\" failed: digest mismatch in round %" PRIu32 "!\n"
+                "\tActual: ",
+                name, i);
+            dump_bytes(actual, SPOW_HASH_SIZE);
+            printf("\n\tExpect: ");
+            dump_bytes(expected, SPOW_HASH_SIZE);
+            printf("\n\n");
+            return 0;
+        }
+
+        /* The search must find exactly the first nonce (starting at some
+         * arbitrary one) for which the full digest is good.  Use a large
+         * high half, because the known answers never get there. */
+        const uint32_t zero_bits = 6;
+        const uint32_t hi = i * 0x01000193;
+        const uint32_t lo_first = i * 0x9E3779B9;
+        spow_sha256_step_t precomp;
+        spow_sha256_step_init(&precomp, (const unsigned char *)&hashbuf, zero_bits);
+        spow_sha256_step_set_hi(&precomp, hi);
+        uint32_t lo_found = 0;
+        if (!spow_sha256_search_scalar(&precomp, lo_first, lo_first + 100000, &lo_found)) {
+            printf("Selftest \"%s\" failed: search found nothing in round %" PRIu32 "!\n\n",
+                name, i);
+            return 0;
+        }
+        for (uint32_t lo = lo_first; ; ++lo) {
+            hashbuf.nonce = pe_htobe64((((uint64_t)hi) << 32) | lo);
+            gcry_md_hash_buffer(SPOW_HASH_ALGO, expected, &hashbuf, SPOW_HASHBYTES);
+            const int good = (expected[0] >> (8 - zero_bits)) == 0;
+            if (good != (lo == lo_found)) {
+                printf("Selftest \"%s\" failed: search disagrees on nonce %" PRIu32 ":%" PRIu32
+                    " in round %" PRIu32 "!\n\n",
+                    name, hi, lo, i);
+                return 0;
+            }
+            if (good) {
+                break;
+            }
+        }
+
+        /* All other kernels must agree with the scalar one, also about
+         * where the range ends.  Make the range end in every possible
+         * lane, on both sides of the good nonce. */
+        const uint32_t lo_last = lo_found - 8 + (i % 24);
+        uint32_t lo_scalar = 0;
+        const int found_scalar = spow_sha256_search_scalar(&precomp, lo_first, lo_last, &lo_scalar);
+        for (unsigned int j = 0; j < SPOW_KERNELS_NUM; ++j) {
+            const spow_kernel_t *kernel = &SPOW_KERNELS[j];
+            if (!spow_kernel_supported(kernel)) {
+                continue;
+            }
+            uint32_t lo_kernel = 0;
+            const int found_kernel = kernel->search(&precomp, lo_first, lo_last, &lo_kernel);
+            if (found_kernel != found_scalar || (found_kernel && lo_kernel != lo_scalar)) {
+                printf("Selftest \"%s\" failed: kernel \"%s\" disagrees in round %" PRIu32 "!\n"
+                    "\tActual %d/%" PRIu32 "\n"
+                    "\tExpect %d/%" PRIu32 "\n\n",
+                    name, kernel->name, i, found_kernel, lo_kernel, found_scalar, lo_scalar);
+                return 0;
+            }
+        }
+
+        /* Chain, so that last_hash sees lots of different values. */
+        memcpy(hashbuf.last_hash, actual, SPOW_HASH_SIZE);
+    }
+
+    printf("Selftest \"%s\" passed.\n\n", name);
+    return 1;
+}
+
+/* The threaded search must find exactly what the sequential one finds.
+ * Run a tiny thread pool, whether or not there are several cores. */
+static int run_parallel_selftest(void) {
+    const char *name = "parallel.c vs. sha256.c";
+    spow_parallel_t *parallel = spow_parallel_create(3, prover.search);
+    if (parallel == NULL) {
+        printf("Selftest \"%s\" failed: Could not start threads!\n\n", name);
+        return 0;
+    }
+
+    hashbuf_t hashbuf;
+    memset(&hashbuf, 0, sizeof(hashbuf));
+    for (uint32_t i = 0; i < 300; ++i) {
+        /* Difficulties 0 to 14, and sometimes not enough nonces. */
+        const uint32_t difficulty = i % 15;
+        const uint64_t nonce_max = (i % 7 == 0) ? (((uint64_t)1) << difficulty) : UINT64_MAX >> 7;
+        hashbuf.step = pe_htobe32(i);
+        spow_sha256_step_t precomp;
+        spow_sha256_step_init(&precomp, (const unsigned char *)&hashbuf, difficulty);
+
+        uint64_t expected = 0;
+        uint64_t actual = 0;
+        const int found_expected = spow_sha256_find_nonce(&precomp, prover.search, nonce_max, &expected);
+        const int found_actual = spow_parallel_find_nonce(parallel, &precomp, nonce_max, &actual);
+        if (found_actual != found_expected || (found_actual && actual != expected)) {
+            printf("Selftest \"%s\" failed: disagreement in round %" PRIu32 "!\n"
+                "\tActual %d/%" PRIu64 "\n"
+                "\tExpect %d/%" PRIu64 "\n\n",
+                name, i, found_actual, actual, found_expected, expected);
+            spow_parallel_destroy(parallel);
+            return 0;
+        }
+        hashbuf.last_hash[i % SPOW_HASH_SIZE] += 1;
+    }
+
+    spow_parallel_destroy(parallel);
+    printf("Selftest \"%s\" passed.\n\n", name);
+    return 1;
+}
+
 #define STEPPOW_STRING_AND_SIZE(x) ((const unsigned char *)x), ((uint32_t)(sizeof(x)-1))
 static const selftest_t BASIC_SELFTESTS[] = {
     /*
@@ -305,15 +316,796 @@ static const selftest_t BASIC_SELFTESTS[] = {
     }
 };
 
-int main() {
-    const uint32_t tests_total = sizeof(BASIC_SELFTESTS)/sizeof(BASIC_SELFTESTS[0]);
+typedef struct multi_selftest_t {
+    const selftest_t *tests[3 * sizeof(BASIC_SELFTESTS) / sizeof(BASIC_SELFTESTS[0])];
+    uint32_t tests_num;
+    uint32_t next;
+    uint32_t done;
+    uint32_t failed;
+} multi_selftest_t;
+
+static int multi_selftest_next(void *arg, int wait, uint64_t *out_id, config_t *out_config) {
+    multi_selftest_t *ctx = arg;
+    (void)wait;
+    if (ctx->next == ctx->tests_num) {
+        return 0;
+    }
+    *out_id = ctx->next;
+    *out_config = ctx->tests[ctx->next]->config;
+    ctx->next += 1;
+    return 1;
+}
+
+static void multi_selftest_done(void *arg, uint64_t id, const config_t *config,
+                                const unsigned char *cert, uint32_t cert_size,
+                                size_t hashes) {
+    (void)config;
+    multi_selftest_t *ctx = arg;
+    const selftest_t *selftest = ctx->tests[id];
+    ctx->done += 1;
+    if (cert == NULL
+            || cert_size != selftest->expected_cert_size
+            || 0 != memcmp(cert, selftest->expected_cert, cert_size)
+            || hashes != selftest->expected_hashes) {
+        printf("\tDisagreement on \"%s\" (lane task %" PRIu64 ")\n", selftest->name, id);
+        ctx->failed += 1;
+    }
+}
+
+static int run_multi_selftest(void) {
+    const char *name = "find_certs_multi vs. known answers";
+    const spow_kernel_t *kernel = (search_kernel->multi != NULL) ? search_kernel : spow_kernel_best_multi();
+    if (kernel == NULL) {
+        printf("Selftest \"%s\" skipped: No multi-buffer kernel.\n\n", name);
+        return 1;
+    }
+    prover_t multi_prover = prover;
+    multi_prover.multi = kernel->multi;
+    multi_prover.multi_lanes = kernel->multi_lanes;
+
+    /* More configs than lanes, so that lanes get refilled.  The two big
+     * ones would take too long in a single lane. */
+    multi_selftest_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    const uint32_t basic_total = sizeof(BASIC_SELFTESTS)/sizeof(BASIC_SELFTESTS[0]);
+    for (uint32_t round = 0; round < 3; ++round) {
+        for (uint32_t i = 0; i < basic_total; ++i) {
+            if (BASIC_SELFTESTS[i].known_answer && BASIC_SELFTESTS[i].config.difficulty <= 12) {
+                ctx.tests[ctx.tests_num++] = &BASIC_SELFTESTS[i];
+            }
+        }
+    }
+    find_certs_multi(&multi_prover, multi_selftest_next, &ctx, multi_selftest_done, &ctx);
+
+    if (ctx.failed != 0 || ctx.done != ctx.tests_num) {
+        printf("Selftest \"%s\" failed: %" PRIu32 " of %" PRIu32 " done, %" PRIu32 " wrong!\n\n",
+            name, ctx.done, ctx.tests_num, ctx.failed);
+        return 0;
+    }
+    printf("Selftest \"%s\" passed.\n\n", name);
+    return 1;
+}
+
+static const selftest_t *find_known_answer(uint32_t difficulty) {
+    const uint32_t basic_total = sizeof(BASIC_SELFTESTS)/sizeof(BASIC_SELFTESTS[0]);
+    for (uint32_t i = 0; i < basic_total; ++i) {
+        if (BASIC_SELFTESTS[i].known_answer && BASIC_SELFTESTS[i].config.difficulty == difficulty) {
+            return &BASIC_SELFTESTS[i];
+        }
+    }
+    return NULL;
+}
+
+static int run_reentrant_selftest(void) {
+    const char *name = "find_cert_r with buffers, cancellation and deadlines";
+    /* Long enough that the steps are searched in several runs. */
+    const selftest_t *slow = find_known_answer(17);
+    /* Several times as long as the deadline below, already in step 0. */
+    const selftest_t *slower = find_known_answer(24);
+    assert(slow != NULL && slower != NULL);
+    unsigned char cert[4096];
+    assert(prover_cert_size(&slow->config) <= sizeof(cert));
+    atomic_int cancel;
+    atomic_init(&cancel, 0);
+    prover_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.prover = &prover;
+
+    int result = find_cert_r(&ctx, &slow->config, cert, prover_cert_size(&slow->config) - 1);
+    if (result != PROVER_BAD_BUFFER) {
+        printf("Selftest \"%s\" failed: Small buffer gave \"%s\"!\n\n", name, prover_strerror(result));
+        return 0;
+    }
+
+    ctx.cancel = &cancel;
+    ctx.deadline_ns = prover_now_ns() + 3600 * (uint64_t)1000000000;
+    result = find_cert_r(&ctx, &slow->config, cert, sizeof(cert));
+    if (result != PROVER_OK
+            || ctx.step != slow->config.steps
+            || ctx.hashes != slow->expected_hashes
+            || 0 != memcmp(cert, slow->expected_cert, slow->expected_cert_size)) {
+        printf("Selftest \"%s\" failed: \"%s\" at step %" PRIu32 " after %zu hashes, expected %zu!\n\n",
+            name, prover_strerror(result), ctx.step, ctx.hashes, slow->expected_hashes);
+        return 0;
+    }
+
+    atomic_store(&cancel, 1);
+    result = find_cert_r(&ctx, &slow->config, cert, sizeof(cert));
+    if (result != PROVER_CANCELLED || ctx.step != 0 || ctx.hashes != 0) {
+        printf("Selftest \"%s\" failed: Cancelled proof gave \"%s\" at step %" PRIu32 "!\n\n",
+            name, prover_strerror(result), ctx.step);
+        return 0;
+    }
+
+    atomic_store(&cancel, 0);
+    const uint64_t start_ns = prover_now_ns();
+    ctx.deadline_ns = start_ns + 20 * 1000 * 1000;
+    result = find_cert_r(&ctx, &slower->config, cert, sizeof(cert));
+    const uint64_t late_ns = prover_now_ns() - ctx.deadline_ns;
+    if (result != PROVER_TIMED_OUT || ctx.step >= slower->config.steps) {
+        printf("Selftest \"%s\" failed: Deadline gave \"%s\" at step %" PRIu32 "!\n\n",
+            name, prover_strerror(result), ctx.step);
+        return 0;
+    }
+    printf("Selftest \"%s\" passed (timed out at step %" PRIu32 " after %zu hashes, %.1f ms late).\n\n",
+        name, ctx.step, ctx.hashes, (double)late_ns * 1e-6);
+    return 1;
+}
+
+typedef struct checkpoint_selftest_t {
+    spow_checkpoint_t checkpoint;
+    atomic_int *cancel;
+    uint32_t cancel_at;
+} checkpoint_selftest_t;
+
+/* Save, then "crash" at a given step. */
+static void checkpoint_selftest_save(void *arg, const config_t *config, uint32_t steps_done,
+                                     size_t hashes, const unsigned char *last_hash,
+                                     const unsigned char *cert) {
+    checkpoint_selftest_t *ctx = arg;
+    spow_checkpoint_save(&ctx->checkpoint, config, steps_done, hashes, last_hash, cert);
+    if (steps_done == ctx->cancel_at) {
+        atomic_store(ctx->cancel, 1);
+    }
+}
+
+static int run_checkpoint_selftest(void) {
+    const char *name = "Interrupt, checkpoint and resume";
+    const selftest_t *selftest = find_known_answer(17);
+    assert(selftest != NULL);
+    const config_t *config = &selftest->config;
+    const uint32_t cert_size = prover_cert_size(config);
+    unsigned char cert[4096];
+    unsigned char last_hash[SPOW_HASH_SIZE];
+    assert(cert_size <= sizeof(cert));
+    char path[] = "/tmp/steppow-selftest-XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("Selftest \"%s\" skipped: Cannot create a file in /tmp.\n\n", name);
+        return 1;
+    }
+    close(fd);
+
+    atomic_int cancel;
+    atomic_init(&cancel, 0);
+    checkpoint_selftest_t save_ctx;
+    save_ctx.cancel = &cancel;
+    save_ctx.cancel_at = config->steps / 2;
+    prover_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.prover = &prover;
+    ctx.cancel = &cancel;
+    ctx.save = checkpoint_selftest_save;
+    ctx.save_ctx = &save_ctx;
+    int opened = spow_checkpoint_open(&save_ctx.checkpoint, path, config, 0,
+                                      &ctx.step, &ctx.hashes, last_hash, cert);
+    int result = find_cert_r(&ctx, config, cert, sizeof(cert));
+    spow_checkpoint_close(&save_ctx.checkpoint, path, 0);
+    if (opened != SPOW_CHECKPOINT_NEW || result != PROVER_CANCELLED) {
+        printf("Selftest \"%s\" failed: Checkpoint %d, then \"%s\"!\n\n",
+            name, opened, prover_strerror(result));
+        unlink(path);
+        return 0;
+    }
+
+    /* The next process starts from scratch. */
+    atomic_store(&cancel, 0);
+    memset(&ctx, 0, sizeof(ctx));
+    memset(cert, 0, sizeof(cert));
+    ctx.prover = &prover;
+    ctx.save = spow_checkpoint_save;
+    ctx.save_ctx = &save_ctx.checkpoint;
+    opened = spow_checkpoint_open(&save_ctx.checkpoint, path, config, 0,
+                                  &ctx.step, &ctx.hashes, last_hash, cert);
+    const uint32_t resumed_at = ctx.step;
+    result = (opened == SPOW_CHECKPOINT_RESUMED)
+        ? find_cert_resume(&ctx, config, last_hash, cert, sizeof(cert))
+        : PROVER_FAILED;
+    spow_checkpoint_close(&save_ctx.checkpoint, path, 1);
+    if (resumed_at != save_ctx.cancel_at
+            || result != PROVER_OK
+            || ctx.hashes != selftest->expected_hashes
+            || 0 != memcmp(cert, selftest->expected_cert, selftest->expected_cert_size)) {
+        printf("Selftest \"%s\" failed: Resumed at step %" PRIu32 " (expected %" PRIu32 "), then \"%s\" after %zu hashes!\n\n",
+            name, resumed_at, save_ctx.cancel_at, prover_strerror(result), ctx.hashes);
+        return 0;
+    }
+    printf("Selftest \"%s\" passed (resumed at step %" PRIu32 ").\n\n", name, resumed_at);
+    return 1;
+}
+
+/* Encode each known answer, and decode it again.  (The verifier checks the
+ * compact certificates themselves, see src/verify.c.) */
+static int run_compact_selftest(void) {
+    const char *name = "Compact encoding round trip";
+    const uint32_t basic_total = sizeof(BASIC_SELFTESTS)/sizeof(BASIC_SELFTESTS[0]);
+    size_t fixed_total = 0;
+    size_t compact_total = 0;
+    for (uint32_t i = 0; i < basic_total; ++i) {
+        const selftest_t *selftest = &BASIC_SELFTESTS[i];
+        const config_t *config = &selftest->config;
+        const size_t max_size = spow_compact_max_size(config->difficulty, config->safety, config->steps);
+        unsigned char *compact = malloc(max_size);
+        if (compact == NULL) {
+            printf("Selftest \"%s\" failed: Out of memory!\n\n", name);
+            return 0;
+        }
+        const size_t compact_size = spow_compact_encode(compact, max_size, config->difficulty,
+            config->safety, config->steps, selftest->expected_cert, selftest->expected_cert_size);
+
+        const uint32_t bits = config->difficulty + config->safety;
+        spow_compact_reader_t reader = {compact, compact_size, SPOW_COMPACT_HEADER_BYTES * 8};
+        uint32_t step = 0;
+        for (; compact_size > 0 && step < config->steps; ++step) {
+            uint64_t nonce;
+            if (!spow_compact_next(&reader, config->difficulty, config->safety, &nonce)
+                    || nonce != spow_nonce_get_any(selftest->expected_cert,
+                                                   selftest->expected_cert_size, bits, step)) {
+                break;
+            }
+        }
+        const int ok = compact_size > 0 && compact[0] == SPOW_COMPACT_VERSION && step == config->steps
+            && reader.pos <= compact_size * 8 && reader.pos > (compact_size - 1) * 8;
+        free(compact);
+        if (!ok) {
+            printf("Selftest \"%s\" failed: \"%s\" at step %" PRIu32 " of %zu bytes!\n\n",
+                name, selftest->name, step, compact_size);
+            return 0;
+        }
+        fixed_total += selftest->expected_cert_size;
+        compact_total += compact_size;
+    }
+    /* A nonce far above 2^Difficulty doesn't fit, and must not take ages
+     * to find out. */
+    static const unsigned char WIDE[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x80};
+    unsigned char wide_compact[64];
+    if (spow_compact_encode(wide_compact, sizeof(wide_compact), 8, 49, 1, WIDE, sizeof(WIDE)) != 0) {
+        printf("Selftest \"%s\" failed: Encoded a 57-bit nonce with Difficulty 8!\n\n", name);
+        return 0;
+    }
+    printf("Selftest \"%s\" passed (%zu bytes instead of %zu).\n\n", name, compact_total, fixed_total);
+    return 1;
+}
+
+/* Counts the calls, which must not happen for an extension. */
+static void extend_selftest_save(void *ctx, const config_t *config, uint32_t steps_done,
+                                 size_t hashes, const unsigned char *last_hash,
+                                 const unsigned char *cert) {
+    (void)config;
+    (void)steps_done;
+    (void)hashes;
+    (void)last_hash;
+    (void)cert;
+    *(uint32_t *)ctx += 1;
+}
+
+/* Prove some steps, then extend them to the known answer: The nonces must be
+ * the same, bit by bit, and so must the hashes spent. */
+static int run_extend_selftest(void) {
+    const char *name = "Extend a certificate";
+    /* 19 bits per nonce, so the extension doesn't start at a byte */
+    const selftest_t *selftest = find_known_answer(12);
+    assert(selftest != NULL);
+    const config_t *config = &selftest->config;
+    const uint32_t bits = config->difficulty + config->safety;
+    config_t first = *config;
+    first.steps = 45;
+    unsigned char cert[4096];
+    unsigned char extension[4096];
+    assert(prover_cert_size(config) <= sizeof(cert));
+
+    prover_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.prover = &prover;
+    int result = find_cert_r(&ctx, &first, cert, sizeof(cert));
+    const uint32_t extension_size = prover_extension_size(config, first.steps);
+    if (result == PROVER_OK) {
+        unsigned char last_hash[SPOW_HASH_SIZE];
+        memcpy(last_hash, ctx.last_hash, sizeof(last_hash));
+        result = find_cert_extend(&ctx, config, last_hash, extension, extension_size);
+    }
+    uint32_t step = 0;
+    for (; result == PROVER_OK && step < config->steps; ++step) {
+        const uint64_t nonce = (step < first.steps)
+            ? spow_nonce_get_any(cert, prover_cert_size(&first), bits, step)
+            : spow_nonce_get_any(extension, extension_size, bits, step - first.steps);
+        if (nonce != spow_nonce_get_any(selftest->expected_cert, selftest->expected_cert_size, bits, step)) {
+            break;
+        }
+    }
+    if (result != PROVER_OK || step != config->steps || ctx.step != config->steps
+            || ctx.hashes != selftest->expected_hashes) {
+        printf("Selftest \"%s\" failed: \"%s\", differs at step %" PRIu32 " after %zu hashes!\n\n",
+            name, prover_strerror(result), step, ctx.hashes);
+        return 0;
+    }
+
+    /* An extension of nothing is the whole certificate, but still not one
+     * to save. */
+    uint32_t saves = 0;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.prover = &prover;
+    ctx.save = extend_selftest_save;
+    ctx.save_ctx = &saves;
+    result = find_cert_extend(&ctx, &first, first.init_hash, extension, prover_cert_size(&first));
+    if (result != PROVER_OK || saves != 0
+            || memcmp(extension, cert, prover_cert_size(&first)) != 0) {
+        printf("Selftest \"%s\" failed: \"%s\" from step 0, with %" PRIu32 " saves!\n\n",
+            name, prover_strerror(result), saves);
+        return 0;
+    }
+    printf("Selftest \"%s\" passed (%" PRIu32 " + %" PRIu32 " steps).\n\n",
+        name, first.steps, config->steps - first.steps);
+    return 1;
+}
+
+/* The daemon runs in a thread of its own, until it gets SIGTERM. */
+typedef struct daemon_selftest_t {
+    char path[64];
+    int result;
+    atomic_int done;
+} daemon_selftest_t;
+
+static void *daemon_selftest_main(void *arg) {
+    daemon_selftest_t *ctx = arg;
+    ctx->result = spow_daemon_run(ctx->path, &prover, 1);
+    atomic_store(&ctx->done, 1);
+    return NULL;
+}
+
+static int daemon_selftest_connect(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+    /* The daemon may not be listening yet. */
+    for (int i = 0; i < 500; ++i) {
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && 0 == connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+            return fd;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        usleep(10 * 1000);
+    }
+    return -1;
+}
+
+/* The line for 'config', as clients send it */
+static size_t daemon_selftest_line(char *out, size_t out_size, const config_t *config) {
+    size_t size = 0;
+    for (size_t i = 0; i < SPOW_HASH_SIZE; ++i) {
+        size += (size_t)snprintf(out + size, out_size - size, "%02x", config->init_hash[i]);
+    }
+    size += (size_t)snprintf(out + size, out_size - size, " ");
+    for (size_t i = 0; i < SPOW_TOKEN_SIZE; ++i) {
+        size += (size_t)snprintf(out + size, out_size - size, "%02x", config->token[i]);
+    }
+    size += (size_t)snprintf(out + size, out_size - size, " %" PRIu32 " %" PRIu32 " %" PRIu32 "\n",
+        config->difficulty, config->safety, config->steps);
+    return size;
+}
+
+/* The answer the daemon must give for a known answer */
+static void daemon_selftest_answer(char *out, size_t out_size, uint64_t line, const selftest_t *selftest) {
+    size_t size = (size_t)snprintf(out, out_size, "%" PRIu64 " ok %zu ", line, selftest->expected_hashes);
+    for (uint32_t i = 0; i < selftest->expected_cert_size; ++i) {
+        size += (size_t)snprintf(out + size, out_size - size, "%02x", selftest->expected_cert[i]);
+    }
+}
+
+/* One client pipelines several lines and reads all answers, another floods
+ * the daemon without ever reading, until the daemon stops reading from it.
+ * Then SIGTERM must still stop the daemon, and remove the socket. */
+static int run_daemon_selftest(void) {
+    const char *name = "Daemon: pipelining, back-pressure and shutdown";
+    char dir[] = "/tmp/steppow-selftest-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        printf("Selftest \"%s\" skipped: Cannot create a directory in /tmp.\n\n", name);
+        return 1;
+    }
+    static daemon_selftest_t ctx;
+    snprintf(ctx.path, sizeof(ctx.path), "%s/socket", dir);
+    atomic_init(&ctx.done, 0);
+    pthread_t thread;
+    if (0 != pthread_create(&thread, NULL, daemon_selftest_main, &ctx)) {
+        printf("Selftest \"%s\" failed: Cannot start the daemon!\n\n", name);
+        rmdir(dir);
+        return 0;
+    }
+    const char *error = NULL;
+    const int reader = daemon_selftest_connect(ctx.path);
+    const int flooder = daemon_selftest_connect(ctx.path);
+    if (reader < 0 || flooder < 0) {
+        error = "Cannot connect";
+    }
+
+    /* Pipelined: answered in any order, but each exactly once */
+    const selftest_t *first = &BASIC_SELFTESTS[0];
+    const selftest_t *second = &BASIC_SELFTESTS[1];
+    char expected[3][256];
+    daemon_selftest_answer(expected[0], sizeof(expected[0]), 1, first);
+    snprintf(expected[1], sizeof(expected[1]), "2 invalid");
+    daemon_selftest_answer(expected[2], sizeof(expected[2]), 3, second);
+    if (error == NULL) {
+        char lines[512];
+        size_t size = daemon_selftest_line(lines, sizeof(lines), &first->config);
+        size += (size_t)snprintf(lines + size, sizeof(lines) - size, "garbage\n");
+        size += daemon_selftest_line(lines + size, sizeof(lines) - size, &second->config);
+        const struct timeval timeout = {10, 0};
+        setsockopt(reader, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if ((ssize_t)size != send(reader, lines, size, MSG_NOSIGNAL)) {
+            error = "Cannot send";
+        }
+    }
+    char answers[1024];
+    size_t answers_size = 0;
+    int answers_num = 0;
+    while (error == NULL && answers_num < 3) {
+        const ssize_t result = recv(reader, answers + answers_size, sizeof(answers) - 1 - answers_size, 0);
+        if (result <= 0) {
+            error = "No answer";
+            break;
+        }
+        for (ssize_t i = 0; i < result; ++i) {
+            answers_num += (answers[answers_size + (size_t)i] == '\n');
+        }
+        answers_size += (size_t)result;
+    }
+    answers[answers_size] = '\0';
+    for (char *line = answers; error == NULL && *line != '\0'; ) {
+        char *end = strchr(line, '\n');
+        *end = '\0';
+        const unsigned long number = strtoul(line, NULL, 10);
+        if (number < 1 || number > 3 || 0 != strcmp(line, expected[number - 1])) {
+            error = "Wrong answer";
+        }
+        expected[number < 1 || number > 3 ? 0 : number - 1][0] = '\0';
+        line = end + 1;
+    }
+
+    /* Answers of 4000 hex digits fill the socket long before 256 configs
+     * are in flight.  Then the daemon must stop reading: Sending gets stuck
+     * for half a second. */
+    config_t flood = first->config;
+    flood.difficulty = 1;
+    flood.safety = 15;
+    flood.steps = 1000;
+    char flood_line[256];
+    const size_t flood_size = daemon_selftest_line(flood_line, sizeof(flood_line), &flood);
+    uint32_t flood_lines = 0;
+    for (int stuck = 0; error == NULL && stuck < 10; ) {
+        const ssize_t result = send(flooder, flood_line, flood_size, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            stuck += 1;
+            usleep(50 * 1000);
+        } else if (result != (ssize_t)flood_size) {
+            /* A partial line is fine, the rest is never read anyway. */
+            stuck = 10;
+        } else if (++flood_lines > 100000) {
+            error = "No back-pressure";
+        } else {
+            stuck = 0;
+        }
+    }
+
+    /* Only the daemon's thread takes SIGTERM, see spow_daemon_run(). */
+    pthread_kill(thread, SIGTERM);
+    const double stop_start = spow_seconds_now();
+    while (!atomic_load(&ctx.done) && spow_seconds_now() - stop_start < SPOW_DAEMON_STALL_SECONDS + 10) {
+        usleep(10 * 1000);
+    }
+    const double stop_seconds = spow_seconds_now() - stop_start;
+    const int stopped = atomic_load(&ctx.done);
+    if (stopped) {
+        pthread_join(thread, NULL);
+    }
+    if (error == NULL && (!stopped || ctx.result != 0)) {
+        error = "Did not stop";
+    }
+    if (error == NULL && access(ctx.path, F_OK) == 0) {
+        error = "Socket left behind";
+    }
+    if (reader >= 0) {
+        close(reader);
+    }
+    if (flooder >= 0) {
+        close(flooder);
+    }
+    if (stopped) {
+        unlink(ctx.path);
+        rmdir(dir);
+    }
+    if (error != NULL) {
+        printf("Selftest \"%s\" failed: %s!\n\n", name, error);
+        return 0;
+    }
+    printf("Selftest \"%s\" passed (%" PRIu32 " lines until the daemon stopped reading, stopped in %.1f s).\n\n",
+        name, flood_lines, stop_seconds);
+    return 1;
+}
+
+static void print_usage(const char *argv0) {
+    fprintf(stderr, "USAGE: %s [--kernel NAME] [--threads N] [--parallel-difficulty D] [--batch FILE [--checkpoint DIR] [--compact] | --daemon SOCKET] [--multi-buffer] [--telemetry] [--perf]\n"
+        "\tNAME is \"auto\" (the default) or one of:", argv0);
+    for (unsigned int i = 0; i < SPOW_KERNELS_NUM; ++i) {
+        fprintf(stderr, " %s%s", SPOW_KERNELS[i].name,
+            spow_kernel_supported(&SPOW_KERNELS[i]) ? "" : "(unsupported)");
+    }
+    fprintf(stderr, "\n"
+        "\tN threads search each step with Difficulty at least D (default %" PRIu32 ").\n"
+        "\tN is 1 by default, and 0 means one per online CPU.\n"
+        "\t--batch proves each config in FILE (\"-\" for stdin) instead of running the\n"
+        "\tselftests, one config per thread, with one thread per online CPU by default.\n"
+        "\tSee src/batch.h for the format.  With --multi-buffer, each thread works on\n"
+        "\tseveral configs at once, one per SIMD lane.  Otherwise, --checkpoint keeps\n"
+        "\tthe state of each config in DIR, so that an interrupted batch can be resumed,\n"
+        "\tsee src/checkpoint.h.  --compact writes the certificates in the compact\n"
+        "\tformat, see src/compact.h.\n"
+        "\t--daemon is like --batch, but serves any number of clients on the Unix socket\n"
+        "\tSOCKET until SIGINT or SIGTERM, see src/daemon.h.\n"
+        "\t--telemetry logs each step to stderr, and prints a summary at the end.\n"
+        "\t--perf adds hardware counters (cycles/hash, IPC, ...) to that, see src/perf.h.\n"
+        "\tIt implies --telemetry, and only works with a single thread, without --batch or --daemon.\n",
+        prover.parallel_min_difficulty);
+}
+
+static int parse_uint32(const char *str, uint32_t *out) {
+    char *end = NULL;
+    errno = 0;
+    const unsigned long value = strtoul(str, &end, 10);
+    if (errno != 0 || end == str || *end != '\0' || value > UINT32_MAX) {
+        fprintf(stderr, "Not a number: \"%s\".\n", str);
+        return 0;
+    }
+    *out = (uint32_t)value;
+    return 1;
+}
+
+static int select_kernel(const char *name) {
+    if (0 == strcmp(name, "auto")) {
+        search_kernel = spow_kernel_best();
+        return 1;
+    }
+    const spow_kernel_t *kernel = spow_kernel_find(name);
+    if (kernel == NULL) {
+        fprintf(stderr, "Unknown kernel \"%s\".\n", name);
+        return 0;
+    }
+    if (!spow_kernel_supported(kernel)) {
+        fprintf(stderr, "Kernel \"%s\" is not supported by this CPU.\n", name);
+        return 0;
+    }
+    search_kernel = kernel;
+    return 1;
+}
+
+static int run_batch(const char *name, uint32_t threads, const char *checkpoint_dir, int compact) {
+    FILE *in = stdin;
+    if (0 != strcmp(name, "-")) {
+        in = fopen(name, "r");
+        if (in == NULL) {
+            fprintf(stderr, "Cannot open \"%s\": %s\n", name, strerror(errno));
+            return 1;
+        }
+    }
+    fprintf(stderr, "Proving batch with %" PRIu32 " threads.\n", threads);
+    const long failed = spow_batch_run(in, stdout, &prover, threads, checkpoint_dir, compact);
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (failed < 0) {
+        fprintf(stderr, "Could not start %" PRIu32 " threads.\n", threads);
+        return 1;
+    }
+    if (failed > 0) {
+        fprintf(stderr, "%ld configs failed.\n", failed);
+    }
+    return failed != 0;
+}
+
+int main(int argc, char **argv) {
+    const char *kernel_name = "auto";
+    const char *batch_name = NULL;
+    const char *daemon_name = NULL;
+    const char *checkpoint_dir = NULL;
+    uint32_t threads = 1;
+    int threads_given = 0;
+    int multi_buffer = 0;
+    int compact = 0;
+    int use_telemetry = 0;
+    int use_perf = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "--kernel") && i + 1 < argc) {
+            kernel_name = argv[++i];
+        } else if (0 == strcmp(argv[i], "--threads") && i + 1 < argc) {
+            if (!parse_uint32(argv[++i], &threads)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            threads_given = 1;
+        } else if (0 == strcmp(argv[i], "--parallel-difficulty") && i + 1 < argc) {
+            if (!parse_uint32(argv[++i], &prover.parallel_min_difficulty)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (0 == strcmp(argv[i], "--batch") && i + 1 < argc) {
+            batch_name = argv[++i];
+        } else if (0 == strcmp(argv[i], "--checkpoint") && i + 1 < argc) {
+            checkpoint_dir = argv[++i];
+        } else if (0 == strcmp(argv[i], "--daemon") && i + 1 < argc) {
+            daemon_name = argv[++i];
+        } else if (0 == strcmp(argv[i], "--compact")) {
+            compact = 1;
+        } else if (0 == strcmp(argv[i], "--multi-buffer")) {
+            multi_buffer = 1;
+        } else if (0 == strcmp(argv[i], "--telemetry")) {
+            use_telemetry = 1;
+        } else if (0 == strcmp(argv[i], "--perf")) {
+            use_perf = 1;
+            use_telemetry = 1;
+        } else {
+            fprintf(stderr, "Unrecognized argument \"%s\".\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (batch_name != NULL && daemon_name != NULL) {
+        fprintf(stderr, "Either --batch or --daemon, not both.\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (checkpoint_dir != NULL && (batch_name == NULL || multi_buffer)) {
+        fprintf(stderr, "--checkpoint only works with --batch, and without --multi-buffer.\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (compact && batch_name == NULL) {
+        fprintf(stderr, "--compact only works with --batch.\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    /* Both prove each config with a single thread. */
+    const int one_per_thread = (batch_name != NULL || daemon_name != NULL);
+    if (multi_buffer && !one_per_thread) {
+        fprintf(stderr, "--multi-buffer only makes sense with --batch or --daemon.\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (multi_buffer && 0 == strcmp(kernel_name, "auto")) {
+        /* The fastest kernel might not have a multi-buffer variant. */
+        search_kernel = spow_kernel_best_multi();
+        if (search_kernel == NULL) {
+            fprintf(stderr, "No kernel with multi-buffer support on this CPU.\n");
+            return 1;
+        }
+    } else if (!select_kernel(kernel_name)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (multi_buffer && search_kernel->multi == NULL) {
+        fprintf(stderr, "Kernel \"%s\" has no multi-buffer variant.\n", search_kernel->name);
+        return 1;
+    }
+    fprintf(stderr, "Using kernel \"%s\".\n", search_kernel->name);
+    prover.search = search_kernel->search;
+    if (multi_buffer) {
+        prover.multi = search_kernel->multi;
+        prover.multi_lanes = search_kernel->multi_lanes;
+        fprintf(stderr, "Using %u lanes per thread.\n", prover.multi_lanes);
+    }
+    if (one_per_thread && !threads_given) {
+        threads = 0;
+    }
+    if (threads == 0) {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0) ? (uint32_t)cpus : 1;
+    }
+    if (use_perf && (one_per_thread || threads > 1)) {
+        fprintf(stderr, "--perf only counts the main thread, so it needs a single thread, and no --batch or --daemon.\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    spow_perf_t perf;
+    if (use_perf) {
+        if (spow_perf_open(&perf) == 0) {
+            fprintf(stderr, "No hardware counters available, see /proc/sys/kernel/perf_event_paranoid.\n");
+        }
+        for (unsigned int i = 0; i < SPOW_PERF_COUNTERS; ++i) {
+            if (!((perf.available >> i) & 1)) {
+                fprintf(stderr, "Counter \"%s\" is not available.\n", SPOW_PERF_NAMES[i]);
+            }
+        }
+        prover.perf = &perf;
+    }
+    spow_telemetry_t telemetry;
+    if (use_telemetry) {
+        spow_telemetry_init(&telemetry, stderr);
+        prover.on_step = spow_telemetry_on_step;
+        prover.on_step_ctx = &telemetry;
+    }
+    if (one_per_thread) {
+        const int ret = (batch_name != NULL)
+            ? run_batch(batch_name, threads, checkpoint_dir, compact)
+            : spow_daemon_run(daemon_name, &prover, threads);
+        if (use_telemetry) {
+            spow_telemetry_print(&telemetry, stderr);
+            spow_telemetry_destroy(&telemetry);
+        }
+        return ret;
+    }
+    if (threads > 1) {
+        prover.parallel = spow_parallel_create(threads, prover.search);
+        if (prover.parallel == NULL) {
+            fprintf(stderr, "Could not start %" PRIu32 " threads.\n", threads);
+            return 1;
+        }
+        fprintf(stderr, "Using %" PRIu32 " threads for Difficulty %" PRIu32 " and up.\n",
+            threads, prover.parallel_min_difficulty);
+    }
+
+    const uint32_t basic_total = sizeof(BASIC_SELFTESTS)/sizeof(BASIC_SELFTESTS[0]);
+    const uint32_t tests_total = 8 + basic_total;
     uint32_t tests_passed = 0;
-    for (uint32_t i = 0; i < tests_total; ++i) {
+    if (run_kernel_selftest()) {
+        tests_passed += 1;
+    }
+    if (run_parallel_selftest()) {
+        tests_passed += 1;
+    }
+    if (run_multi_selftest()) {
+        tests_passed += 1;
+    }
+    if (run_reentrant_selftest()) {
+        tests_passed += 1;
+    }
+    if (run_checkpoint_selftest()) {
+        tests_passed += 1;
+    }
+    if (run_compact_selftest()) {
+        tests_passed += 1;
+    }
+    if (run_extend_selftest()) {
+        tests_passed += 1;
+    }
+    if (run_daemon_selftest()) {
+        tests_passed += 1;
+    }
+    for (uint32_t i = 0; i < basic_total; ++i) {
         if (run_selftest(&BASIC_SELFTESTS[i])) {
             tests_passed += 1;
         }
     }
     printf("Test results: passed %" PRIu32 ", failed %" PRIu32 ", %" PRIu32 " total.\n",
         tests_passed, tests_total - tests_passed, tests_total);
+    if (use_telemetry) {
+        spow_telemetry_print(&telemetry, stderr);
+        spow_telemetry_destroy(&telemetry);
+    }
+    if (use_perf) {
+        spow_perf_close(&perf);
+    }
+    spow_parallel_destroy(prover.parallel);
     return tests_passed != tests_total;
 }
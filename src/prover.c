@@ -0,0 +1,435 @@
+#include "prover.h"
+
+#include <assert.h>
+#include <stdio.h> /* fprintf */
+#include <stdlib.h> /* malloc, free */
+#include <string.h> /* memcpy, memset */
+
+#define PORTABLE_ENDIAN_NO_UINT_16_T
+
+#include "kernel.h" /* spow_now_ns */
+#include "nonce.h"
+#include "portable-endian.h"
+
+/* Prepare the search for a step.  Returns the largest allowed nonce. */
+static uint64_t start_step(const config_t *config,
+                           uint32_t step,
+                           const unsigned char *last_hash,
+                           hashbuf_t *hashbuf,
+                           spow_sha256_step_t *precomp) {
+    /* Check alignment: */
+    assert((((intptr_t)last_hash) & 0x3) == 0);
+    /* Check whether it fits in one block.  This is not a requirement,
+     * but why would you need such a high Difficulty/Safety? */
+    assert(SPOW_HASHBYTES <= 55);
+    /* TODO: This implementation can't handle too large nonces: */
+    assert(config->difficulty + config->safety <= PROVER_NONCE_BITS_MAX);
+
+    /* hashbuf = last_hash || nonce || token || step */
+    memcpy(hashbuf->last_hash, last_hash, SPOW_HASH_SIZE);
+    hashbuf->nonce = 0;
+    memcpy(hashbuf->token, config->token, SPOW_TOKEN_SIZE);
+    hashbuf->step = pe_htobe32(step);
+
+    /* Only the nonce changes from here on, so do everything else once. */
+    spow_sha256_step_init(precomp, (const unsigned char *)hashbuf, config->difficulty);
+
+    return (((uint64_t)1) << (config->difficulty + config->safety)) - 1;
+}
+
+/* Record the good nonce of a step in the certificate, and update last_hash.
+ * 'put' is spow_nonce_put_for() the nonce width, chosen once per certificate.
+ * 'cert' starts with the nonce of step 'cert_first'. */
+static void commit_nonce(const config_t *config,
+                         spow_nonce_put_fn put,
+                         unsigned char *cert,
+                         uint32_t cert_first,
+                         uint32_t step,
+                         unsigned char *last_hash,
+                         hashbuf_t *hashbuf,
+                         uint64_t nonce) {
+    const uint32_t difficulty_mask =
+        pe_htobe32(((((uint32_t)1) << config->difficulty) - 1) << (32 - config->difficulty));
+
+    /* The search only computed the first word of the digest.
+     * Compute the full one, only once per step. */
+    hashbuf->nonce = pe_htobe64(nonce);
+    spow_sha256_hash52(last_hash, (const unsigned char *)hashbuf);
+    /* All required-zero bits are zero: */
+    assert((((uint32_t *)last_hash)[0] & difficulty_mask) == 0);
+    (void)difficulty_mask;
+
+    assert(step >= cert_first && step < config->steps);
+    put(cert, config->difficulty + config->safety, step - cert_first, nonce);
+}
+
+uint64_t prover_now_ns(void) {
+    return spow_now_ns();
+}
+
+/* Fill in and report a prover_step_t.  Only called if prover->on_step is set.
+ * 'counters' is NULL if nothing was counted. */
+static void report_step(const prover_t *prover, const config_t *config, uint32_t step,
+                        uint64_t hashes, uint64_t total_hashes,
+                        uint64_t step_start_ns, uint64_t cert_start_ns,
+                        const uint64_t *counters) {
+    const uint64_t end_ns = prover_now_ns();
+    prover_step_t info = {
+        step, config->steps, config->difficulty,
+        hashes, end_ns - step_start_ns,
+        total_hashes, end_ns - cert_start_ns,
+        0, {0},
+    };
+    if (counters != NULL) {
+        info.counters_valid = prover->perf->available;
+        memcpy(info.counters, counters, sizeof(info.counters));
+    }
+    prover->on_step(prover->on_step_ctx, &info);
+}
+
+/* With a cancel flag or deadline, a step is searched in runs of this many
+ * nonces, and both are checked in between.  That's a few milliseconds with
+ * a SIMD kernel.  With threads, a run must be long enough for all of them. */
+#define CHECK_NONCES (((uint64_t)1) << 18)
+#define CHECK_NONCES_PARALLEL (((uint64_t)1) << 22)
+
+static int check_stop(const prover_ctx_t *ctx) {
+    if (ctx->cancel != NULL && atomic_load_explicit(ctx->cancel, memory_order_relaxed)) {
+        return PROVER_CANCELLED;
+    }
+    if (ctx->deadline_ns != 0 && prover_now_ns() >= ctx->deadline_ns) {
+        return PROVER_TIMED_OUT;
+    }
+    return PROVER_OK;
+}
+
+/* Find the smallest good nonce in [0, nonce_max].  Returns a PROVER_*
+ * result, and in *out_hashes the number of nonces tried. */
+static int find_nonce(const prover_ctx_t *ctx,
+                      const config_t *config,
+                      spow_sha256_step_t *precomp,
+                      uint64_t nonce_max,
+                      uint64_t *out_nonce,
+                      uint64_t *out_hashes) {
+    const prover_t *prover = ctx->prover;
+    spow_parallel_t *parallel = (config->difficulty >= prover->parallel_min_difficulty)
+        ? prover->parallel : NULL;
+    /* Without anything to check, don't split the search at all. */
+    const uint64_t run = (ctx->cancel == NULL && ctx->deadline_ns == 0) ? nonce_max
+        : (parallel != NULL) ? CHECK_NONCES_PARALLEL - 1 : CHECK_NONCES - 1;
+
+    for (uint64_t first = 0; ; first += run + 1) {
+        const int stop = check_stop(ctx);
+        if (stop != PROVER_OK) {
+            *out_hashes = first;
+            return stop;
+        }
+        const uint64_t last = (nonce_max - first > run) ? first + run : nonce_max;
+        const int found = (parallel != NULL)
+            ? spow_parallel_find_nonce_range(parallel, precomp, first, last, out_nonce)
+            : spow_sha256_find_nonce_range(precomp, prover->search, first, last, out_nonce);
+        if (found) {
+            /* This can't overflow because difficulty + safety <= 63 */
+            *out_hashes = *out_nonce + 1;
+            return PROVER_OK;
+        }
+        if (last == nonce_max) {
+            *out_hashes = nonce_max + 1;
+            return PROVER_FAILED;
+        }
+    }
+}
+
+/* If ctx->prover->perf is set, writes the counter differences of the search
+ * to 'counters'. */
+static int extend_cert(const prover_ctx_t *ctx,
+                       const config_t *config,
+                       spow_nonce_put_fn put,
+                       unsigned char *cert,
+                       uint32_t cert_first,
+                       uint32_t step,
+                       unsigned char *last_hash,
+                       uint64_t *out_hashes,
+                       uint64_t counters[SPOW_PERF_COUNTERS]) {
+    const prover_t *prover = ctx->prover;
+    hashbuf_t hashbuf;
+    spow_sha256_step_t precomp;
+    const uint64_t nonce_max = start_step(config, step, last_hash, &hashbuf, &precomp);
+
+    uint64_t nonce = 0;
+    if (prover->perf != NULL) {
+        spow_perf_read(prover->perf, counters);
+    }
+    const int result = find_nonce(ctx, config, &precomp, nonce_max, &nonce, out_hashes);
+    if (prover->perf != NULL) {
+        uint64_t after[SPOW_PERF_COUNTERS];
+        spow_perf_read(prover->perf, after);
+        for (unsigned int i = 0; i < SPOW_PERF_COUNTERS; ++i) {
+            counters[i] = after[i] - counters[i];
+        }
+    }
+    if (result == PROVER_OK) {
+        commit_nonce(config, put, cert, cert_first, step, last_hash, &hashbuf, nonce);
+    }
+    return result;
+}
+
+const char *prover_strerror(int result) {
+    switch (result) {
+    case PROVER_OK:
+        return "ok";
+    case PROVER_FAILED:
+        return "failed, would need to backtrack";
+    case PROVER_CANCELLED:
+        return "cancelled";
+    case PROVER_TIMED_OUT:
+        return "timed out";
+    case PROVER_BAD_BUFFER:
+        return "certificate buffer too small";
+    default:
+        return "unknown result";
+    }
+}
+
+uint32_t prover_cert_size(const config_t *config) {
+    return (config->steps * (config->difficulty + config->safety) + 7) / 8;
+}
+
+int find_cert_r(prover_ctx_t *ctx,
+                const config_t *config,
+                unsigned char *cert,
+                size_t cert_capacity) {
+    const uint32_t cert_size = prover_cert_size(config);
+    if (cert_capacity < cert_size) {
+        ctx->step = 0;
+        ctx->hashes = 0;
+        return PROVER_BAD_BUFFER;
+    }
+    /* All nonces are or'd into the certificate, so first clear the memory: */
+    memset(cert, 0, cert_size);
+    ctx->step = 0;
+    ctx->hashes = 0;
+    return find_cert_resume(ctx, config, config->init_hash, cert, cert_capacity);
+}
+
+uint32_t prover_extension_size(const config_t *config, uint32_t steps_done) {
+    return ((config->steps - steps_done) * (config->difficulty + config->safety) + 7) / 8;
+}
+
+/* The steps from ctx->step on, into 'cert', which starts with the nonce of
+ * step 'cert_first'.  An extension is never passed to ctx->save, not even
+ * one that starts at step 0. */
+static int prove_steps(prover_ctx_t *ctx,
+                       const config_t *config,
+                       const unsigned char *resume_hash,
+                       unsigned char *cert,
+                       uint32_t cert_first,
+                       int is_extension) {
+    const prover_t *prover = ctx->prover;
+    /* uint32_t for the alignment, see start_step() */
+    uint32_t last_hash_words[SPOW_HASH_SIZE / 4];
+    unsigned char *last_hash = (unsigned char *)last_hash_words;
+    memcpy(last_hash, resume_hash, SPOW_HASH_SIZE);
+    memcpy(ctx->last_hash, last_hash, SPOW_HASH_SIZE);
+
+    const spow_nonce_put_fn put = spow_nonce_put_for(config->difficulty + config->safety);
+    /* Without a hook, don't even look at the clock. */
+    const uint64_t cert_start_ns = prover->on_step ? prover_now_ns() : 0;
+    uint64_t step_start_ns = cert_start_ns;
+
+    while (ctx->step < config->steps) {
+        uint64_t counters[SPOW_PERF_COUNTERS];
+        uint64_t step_hashes = 0;
+        const int result = extend_cert(ctx, config, put, cert, cert_first, ctx->step, last_hash,
+                                       &step_hashes, counters);
+        if (result != PROVER_OK) {
+            /* Partial work on this step only counts as hashes spent. */
+            ctx->hashes += step_hashes;
+            return result;
+        }
+        /* Theoretically this can overflow.
+         * Practically, this costs 2^64 hash computations. See you in 2080. */
+        ctx->hashes += step_hashes;
+        if (prover->on_step) {
+            report_step(prover, config, ctx->step, step_hashes, ctx->hashes, step_start_ns, cert_start_ns,
+                        prover->perf ? counters : NULL);
+            step_start_ns = prover_now_ns();
+        }
+        ctx->step += 1;
+        memcpy(ctx->last_hash, last_hash, SPOW_HASH_SIZE);
+        if (ctx->save != NULL && !is_extension) {
+            ctx->save(ctx->save_ctx, config, ctx->step, ctx->hashes, last_hash, cert);
+        }
+    }
+    return PROVER_OK;
+}
+
+int find_cert_resume(prover_ctx_t *ctx,
+                     const config_t *config,
+                     const unsigned char *resume_hash,
+                     unsigned char *cert,
+                     size_t cert_capacity) {
+    if (cert_capacity < prover_cert_size(config) || ctx->step > config->steps) {
+        return PROVER_BAD_BUFFER;
+    }
+    return prove_steps(ctx, config, resume_hash, cert, 0, 0);
+}
+
+int find_cert_extend(prover_ctx_t *ctx,
+                     const config_t *config,
+                     const unsigned char *last_hash,
+                     unsigned char *extension,
+                     size_t extension_capacity) {
+    const uint32_t steps_done = ctx->step;
+    if (steps_done > config->steps || extension_capacity < prover_extension_size(config, steps_done)) {
+        return PROVER_BAD_BUFFER;
+    }
+    /* All nonces are or'd into the extension, so first clear the memory: */
+    memset(extension, 0, prover_extension_size(config, steps_done));
+    return prove_steps(ctx, config, last_hash, extension, steps_done, 1);
+}
+
+int find_cert(const prover_t *prover,
+              const config_t *config,
+              unsigned char **out_cert,
+              uint32_t *out_cert_size,
+              size_t *out_hashes) {
+    const uint32_t cert_size = prover_cert_size(config);
+    unsigned char *cert = malloc(cert_size ? cert_size : 1);
+    assert(cert);
+
+    prover_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.prover = prover;
+    if (find_cert_r(&ctx, config, cert, cert_size) != PROVER_OK) {
+        fprintf(stderr, "Failed in step %u, would need to backtrack!\n", ctx.step);
+        /* However, this is sufficiently unlikely.
+         * See README.md, topics "Safety" and "Recommendations". */
+        free(cert);
+        return 0;
+    }
+
+    *out_cert = cert;
+    *out_cert_size = cert_size;
+    *out_hashes = ctx.hashes;
+    return 1;
+}
+
+/* One lane of find_certs_multi(), i.e. one certificate in progress. */
+typedef struct lane_t {
+    uint64_t id;
+    config_t config;
+    spow_nonce_put_fn put;
+    unsigned char *cert;
+    uint32_t cert_size;
+    uint32_t step;
+    /* uint32_t for the alignment */
+    uint32_t last_hash[SPOW_HASH_SIZE / 4];
+    hashbuf_t hashbuf;
+    spow_sha256_step_t precomp;
+    uint64_t nonce_max;
+    size_t hashes;
+    /* Only if prover->on_step is set */
+    uint64_t cert_start_ns;
+    uint64_t step_start_ns;
+} lane_t;
+
+/* Set up the next step, or report the certificate if it's complete. */
+static void advance_lane(lane_t *lane, unsigned int index, spow_sha256_multi_t *multi,
+                         prover_done_fn done, void *done_ctx) {
+    if (lane->step == lane->config.steps) {
+        done(done_ctx, lane->id, &lane->config, lane->cert, lane->cert_size, lane->hashes);
+        free(lane->cert);
+        lane->cert = NULL;
+        multi->active &= ~(1u << index);
+        return;
+    }
+    lane->nonce_max = start_step(&lane->config, lane->step, (const unsigned char *)lane->last_hash,
+                                 &lane->hashbuf, &lane->precomp);
+    const uint32_t lo_last = (lane->nonce_max >> 32) ? UINT32_MAX : (uint32_t)lane->nonce_max;
+    spow_sha256_multi_set_lane(multi, index, &lane->precomp, 0, lo_last);
+}
+
+void find_certs_multi(const prover_t *prover,
+                      prover_next_fn next, void *next_ctx,
+                      prover_done_fn done, void *done_ctx) {
+    assert(prover->multi != NULL);
+    assert(prover->multi_lanes <= SPOW_SHA256_MULTI_LANES_MAX);
+    lane_t lanes[SPOW_SHA256_MULTI_LANES_MAX];
+    spow_sha256_multi_t multi;
+    /* Idle lanes are computed too, so they must at least be initialized. */
+    memset(&multi, 0, sizeof(multi));
+    int more = 1;
+
+    for (;;) {
+        /* Refill idle lanes.  Only wait for a new config if all lanes are
+         * idle, otherwise keep the others busy and try again later. */
+        for (unsigned int i = 0; more && i < prover->multi_lanes; ++i) {
+            if ((multi.active >> i) & 1) {
+                continue;
+            }
+            lane_t *lane = &lanes[i];
+            const int wait = (multi.active == 0);
+            if (!next(next_ctx, wait, &lane->id, &lane->config)) {
+                more = !wait;
+                break;
+            }
+            lane->put = spow_nonce_put_for(lane->config.difficulty + lane->config.safety);
+            lane->cert_size = prover_cert_size(&lane->config);
+            /* All nonces are or'd into the certificate, so start with zeros: */
+            lane->cert = calloc(lane->cert_size ? lane->cert_size : 1, 1);
+            assert(lane->cert);
+            lane->step = 0;
+            memcpy(lane->last_hash, lane->config.init_hash, SPOW_HASH_SIZE);
+            lane->hashes = 0;
+            if (prover->on_step) {
+                lane->cert_start_ns = prover_now_ns();
+                lane->step_start_ns = lane->cert_start_ns;
+            }
+            advance_lane(lane, i, &multi, done, done_ctx);
+        }
+        if (multi.active == 0) {
+            if (!more) {
+                return;
+            }
+            continue;
+        }
+
+        unsigned int found = 0;
+        const unsigned int stopped = prover->multi(&multi, &found);
+        for (unsigned int i = 0; i < prover->multi_lanes; ++i) {
+            if (!((stopped >> i) & 1)) {
+                continue;
+            }
+            lane_t *lane = &lanes[i];
+            const uint32_t hi = lane->precomp.block[8];
+            if ((found >> i) & 1) {
+                const uint64_t nonce = (((uint64_t)hi) << 32) | multi.lo[i];
+                commit_nonce(&lane->config, lane->put, lane->cert, 0, lane->step,
+                             (unsigned char *)lane->last_hash, &lane->hashbuf, nonce);
+                lane->hashes += nonce + 1;
+                if (prover->on_step) {
+                    /* The time includes the other lanes, as they share the
+                     * SHA-256 calls. */
+                    report_step(prover, &lane->config, lane->step, nonce + 1, lane->hashes,
+                                lane->step_start_ns, lane->cert_start_ns, NULL);
+                    lane->step_start_ns = prover_now_ns();
+                }
+                lane->step += 1;
+                advance_lane(lane, i, &multi, done, done_ctx);
+            } else if (hi < (uint32_t)(lane->nonce_max >> 32)) {
+                /* Next run of 2^32 nonces, like spow_sha256_find_nonce(). */
+                spow_sha256_step_set_hi(&lane->precomp, hi + 1);
+                const uint32_t lo_last = (hi + 1 < (uint32_t)(lane->nonce_max >> 32))
+                    ? UINT32_MAX : (uint32_t)lane->nonce_max;
+                spow_sha256_multi_set_lane(&multi, i, &lane->precomp, 0, lo_last);
+            } else {
+                fprintf(stderr, "Failed in step %u, would need to backtrack!\n", lane->step);
+                done(done_ctx, lane->id, &lane->config, NULL, 0, 0);
+                free(lane->cert);
+                lane->cert = NULL;
+                multi.active &= ~(1u << i);
+            }
+        }
+    }
+}
@@ -0,0 +1,226 @@
+/* The prover itself: Finding a certificate for a config_t. */
+
+#ifndef STEPPOW_PROVER_H
+#define STEPPOW_PROVER_H
+
+#include <stdatomic.h>
+#include <stddef.h> /* size_t, offsetof */
+#include <stdint.h>
+
+#include "parallel.h"
+#include "perf.h"
+#include "sha256.h"
+
+/* I don't think this will ever change.  But just in case.
+ * However, you may want to choose a hash which has block size at least
+ * SPOW_HASHBYTES + 1 + 8, because then it probably fits in a block. */
+#define SPOW_HASH_SIZE (256 / 8)
+#define SPOW_TOKEN_SIZE 8
+#define SPOW_DUMMY_BYTES 4
+
+/* The limits of the prover, see extend_cert(): Difficulty from 1 to
+ * PROVER_DIFFICULTY_MAX, and Difficulty + Safety at most
+ * PROVER_NONCE_BITS_MAX. */
+#define PROVER_DIFFICULTY_MAX 32
+#define PROVER_NONCE_BITS_MAX 57
+
+/* hashbuf = last_hash || nonce || token || step */
+typedef struct hashbuf_t {
+    unsigned char last_hash[SPOW_HASH_SIZE];
+    uint64_t nonce;
+    unsigned char token[SPOW_TOKEN_SIZE];
+    uint32_t step;
+#if SPOW_DUMMY_BYTES != 0
+    unsigned char dummy[SPOW_DUMMY_BYTES];
+#endif
+} hashbuf_t;
+#define SPOW_HASHBYTES (SPOW_HASH_SIZE + 8 + SPOW_TOKEN_SIZE + 4)
+typedef char assert_SPOW_hashbuf_size[
+    (sizeof(hashbuf_t) == SPOW_HASHBYTES + SPOW_DUMMY_BYTES) ? 1 : -1];
+typedef char assert_SPOW_hashbuf_offset_last_hash[
+    (offsetof(hashbuf_t, last_hash) == 0) ? 1 : -1];
+typedef char assert_SPOW_hashbuf_offset_nonce[
+    (offsetof(hashbuf_t, nonce) == SPOW_HASH_SIZE) ? 1 : -1];
+typedef char assert_SPOW_hashbuf_offset_token[
+    (offsetof(hashbuf_t, token) == SPOW_HASH_SIZE + 8) ? 1 : -1];
+typedef char assert_SPOW_hashbuf_offset_step[
+    (offsetof(hashbuf_t, step) == SPOW_HASH_SIZE + 8 + SPOW_TOKEN_SIZE) ? 1 : -1];
+#if SPOW_DUMMY_BYTES != 0
+typedef char assert_SPOW_hashbuf_offset_dummy[
+    (offsetof(hashbuf_t, dummy) == SPOW_HASHBYTES) ? 1 : -1];
+#endif
+/* The in-tree SHA-256 is specialized to exactly this length: */
+typedef char assert_SPOW_hashbuf_kernel_size[
+    (SPOW_HASHBYTES == SPOW_SHA256_MSG_BYTES) ? 1 : -1];
+
+typedef struct config_t {
+    unsigned char init_hash[SPOW_HASH_SIZE];
+    unsigned char token[SPOW_TOKEN_SIZE];
+    uint32_t difficulty;
+    uint32_t safety;
+    uint32_t steps;
+} config_t;
+
+/* Reported after each step, see prover_t.on_step. */
+typedef struct prover_step_t {
+    /* Which step just finished, starting at 0, and of how many */
+    uint32_t step;
+    uint32_t steps;
+    uint32_t difficulty;
+    /* Spent on this step */
+    uint64_t hashes;
+    uint64_t nanoseconds;
+    /* Spent on this certificate so far, including this step */
+    uint64_t total_hashes;
+    uint64_t total_nanoseconds;
+    /* Hardware counters around this step's nonce search, if prover_t.perf
+     * is set.  Bit i of counters_valid is set iff counters[i] is valid. */
+    unsigned int counters_valid;
+    uint64_t counters[SPOW_PERF_COUNTERS];
+} prover_step_t;
+
+typedef void (*prover_step_fn)(void *ctx, const prover_step_t *info);
+
+typedef struct prover_t {
+    /* Which nonce search to use, see kernel.h */
+    spow_sha256_search_fn search;
+    /* NULL unless searching a step with several threads, see parallel.h */
+    spow_parallel_t *parallel;
+    /* Below this Difficulty, a step is too short for threads to pay off. */
+    uint32_t parallel_min_difficulty;
+    /* Only for find_certs_multi(): one step per lane, see sha256.h */
+    spow_sha256_multi_fn multi;
+    unsigned int multi_lanes;
+    /* If not NULL, called after each step, e.g. for progress or telemetry,
+     * see telemetry.h.  Possibly from several threads at once in batch mode.
+     * When NULL, nothing is measured at all. */
+    prover_step_fn on_step;
+    void *on_step_ctx;
+    /* NULL unless counting, see perf.h.  The counters only see the thread
+     * that opened them, so this is only for find_cert() on that thread,
+     * without 'parallel'.  The counts go to on_step. */
+    const spow_perf_t *perf;
+} prover_t;
+
+/* Find a certificate.  On success, returns 1 and a malloc'ed certificate,
+ * and the amount of hashes computed.  Otherwise returns 0. */
+int find_cert(const prover_t *prover,
+              const config_t *config,
+              unsigned char **out_cert,
+              uint32_t *out_cert_size,
+              size_t *out_hashes);
+
+/* Results of find_cert_r() */
+#define PROVER_OK 0
+/* The impossible happened: Backtracking needed, but not implemented.
+ * See README.md, topics "Safety" and "Recommendations". */
+#define PROVER_FAILED 1
+#define PROVER_CANCELLED 2
+#define PROVER_TIMED_OUT 3
+/* The certificate buffer is smaller than prover_cert_size(). */
+#define PROVER_BAD_BUFFER 4
+
+/* A human-readable description of a result. */
+const char *prover_strerror(int result);
+
+/* The size of the certificate for this config, in bytes. */
+uint32_t prover_cert_size(const config_t *config);
+
+/* CLOCK_MONOTONIC in nanoseconds, for prover_ctx_t.deadline_ns. */
+uint64_t prover_now_ns(void);
+
+/* Receives the state after a step, which is enough to resume from there
+ * with find_cert_resume(), see checkpoint.h.  'cert' has
+ * prover_cert_size(config) bytes. */
+typedef void (*prover_save_fn)(void *ctx,
+                               const config_t *config,
+                               uint32_t steps_done,
+                               size_t hashes,
+                               const unsigned char *last_hash,
+                               const unsigned char *cert);
+
+/* For embedding the prover: One per proof in progress. */
+typedef struct prover_ctx_t {
+    const prover_t *prover;
+    /* If not NULL, the proof stops soon after this becomes non-zero.
+     * Any thread may set it. */
+    atomic_int *cancel;
+    /* If not 0, the proof stops soon after prover_now_ns() reaches this. */
+    uint64_t deadline_ns;
+    /* If not NULL, called after each step. */
+    prover_save_fn save;
+    void *save_ctx;
+    /* Output: The step at which the proof ended (config->steps on success),
+     * and the hashes computed so far.  Input for find_cert_resume() and
+     * find_cert_extend(). */
+    uint32_t step;
+    size_t hashes;
+    /* Output: The hash of the last step done, e.g. to extend the
+     * certificate later with find_cert_extend(). */
+    unsigned char last_hash[SPOW_HASH_SIZE];
+} prover_ctx_t;
+
+/* Like find_cert(), but reentrant, and without allocating or printing
+ * anything: The certificate goes into 'cert', which must have at least
+ * prover_cert_size() bytes.  ctx->cancel and ctx->deadline_ns are checked
+ * before each step and between runs of 2^18 nonces within a step (2^22 with
+ * ctx->prover->parallel), i.e. every few milliseconds with a SIMD kernel.
+ * Returns a PROVER_* result; ctx->step says where it stopped, e.g.
+ * "timed out at step k". */
+int find_cert_r(prover_ctx_t *ctx,
+                const config_t *config,
+                unsigned char *cert,
+                size_t cert_capacity);
+
+/* Like find_cert_r(), but continue a proof where it was saved (see
+ * prover_save_fn): ctx->step steps are done, with ctx->hashes hashes so far,
+ * 'cert' has their nonces (and zeros after them), and 'last_hash' is the hash
+ * of the last of them.  The result is the same as without the interruption. */
+int find_cert_resume(prover_ctx_t *ctx,
+                     const config_t *config,
+                     const unsigned char *last_hash,
+                     unsigned char *cert,
+                     size_t cert_capacity);
+
+/* The size of the extension by find_cert_extend() from 'steps_done' to
+ * config->steps steps, in bytes. */
+uint32_t prover_extension_size(const config_t *config, uint32_t steps_done);
+
+/* Extend a finished certificate of ctx->step steps to config->steps steps,
+ * starting from 'last_hash', the hash of its last step (see
+ * prover_ctx_t.last_hash).  Each step only depends on the hash before it and
+ * its index, so the certificate for fewer steps is a prefix of the one for
+ * more steps.  So only the nonces of the new steps go into 'extension', as if
+ * it were a certificate of that many steps, which must have at least
+ * prover_extension_size() bytes.  Difficulty and Safety may differ from the
+ * original certificate, to make the new steps harder.  config->init_hash is
+ * not used, and ctx->save is never called.  See spow_verify_chain_extend()
+ * for the verifier's side. */
+int find_cert_extend(prover_ctx_t *ctx,
+                     const config_t *config,
+                     const unsigned char *last_hash,
+                     unsigned char *extension,
+                     size_t extension_capacity);
+
+/* Provides the next config to find_certs_multi().  If 'wait' is set, it may
+ * block until there is one.  Returns 0 if there is none: with 'wait' set,
+ * this means there will never be one again. */
+typedef int (*prover_next_fn)(void *ctx, int wait, uint64_t *out_id, config_t *out_config);
+
+/* Receives each result of find_certs_multi(), with the config it is for.
+ * 'cert' is NULL if no certificate was found, and is only valid during the
+ * call. */
+typedef void (*prover_done_fn)(void *ctx, uint64_t id, const config_t *config,
+                               const unsigned char *cert, uint32_t cert_size,
+                               size_t hashes);
+
+/* Find certificates for many configs at once, one per lane of prover->multi.
+ * Whenever a lane finishes its certificate, it gets the next config.
+ * Each certificate (and hash count) is exactly the one find_cert() would
+ * find.  This is for throughput: a single certificate takes longer than
+ * with find_cert(), because prover->multi only tries one nonce per lane. */
+void find_certs_multi(const prover_t *prover,
+                      prover_next_fn next, void *next_ctx,
+                      prover_done_fn done, void *done_ctx);
+
+#endif /* STEPPOW_PROVER_H */
@@ -0,0 +1,243 @@
+#include "replay-cache.h"
+
+#include <stdatomic.h>
+#include <stdlib.h> /* aligned_alloc, free */
+#include <string.h> /* memcpy, memset */
+
+#define PORTABLE_ENDIAN_NO_UINT_16_T
+
+#include "kernel.h" /* spow_now_ns */
+#include "portable-endian.h"
+#include "sha256.h"
+
+/* Reads of a bucket in spow_replay_lookup() before it gives up */
+#define READ_TRIES 64
+
+/* All fields are atomics, so that readers racing with a writer are well
+ * defined; the sequence number tells them whether to trust what they read. */
+typedef struct entry_t {
+    atomic_uint_least64_t key[2];
+    /* 0 for empty */
+    atomic_uint_least64_t expires_ns;
+} entry_t;
+
+/* Aligned, so that buckets don't share cache lines */
+typedef struct bucket_t {
+    /* Odd while a writer is changing the bucket */
+    atomic_uint seq;
+    entry_t entries[SPOW_REPLAY_WAYS];
+} __attribute__((aligned(128))) bucket_t;
+
+struct spow_replay_cache_t {
+    bucket_t *buckets;
+    size_t buckets_mask;
+    atomic_uint_least64_t hits;
+    atomic_uint_least64_t misses;
+    atomic_uint_least64_t contended;
+    atomic_uint_least64_t claims;
+    atomic_uint_least64_t evicted_live;
+};
+
+spow_replay_cache_t *spow_replay_create(size_t entries) {
+    spow_replay_cache_t *cache = calloc(1, sizeof(*cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    size_t buckets_num = 1;
+    while (buckets_num * SPOW_REPLAY_WAYS < entries) {
+        buckets_num *= 2;
+    }
+    cache->buckets = aligned_alloc(sizeof(bucket_t), buckets_num * sizeof(bucket_t));
+    if (cache->buckets == NULL) {
+        free(cache);
+        return NULL;
+    }
+    /* All zero is all empty, for the atomics, too. */
+    memset(cache->buckets, 0, buckets_num * sizeof(bucket_t));
+    cache->buckets_mask = buckets_num - 1;
+    return cache;
+}
+
+void spow_replay_destroy(spow_replay_cache_t *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    free(cache->buckets);
+    free(cache);
+}
+
+/* Just enough of a general SHA-256 for the key. */
+typedef struct digest_t {
+    uint32_t state[SPOW_SHA256_STATE_WORDS];
+    unsigned char buf[64];
+    size_t buf_len;
+    uint64_t total;
+} digest_t;
+
+static void digest_block(digest_t *digest, const unsigned char *data) {
+    uint32_t block[SPOW_SHA256_BLOCK_WORDS];
+    for (int i = 0; i < SPOW_SHA256_BLOCK_WORDS; ++i) {
+        uint32_t word;
+        memcpy(&word, data + 4 * i, sizeof(word));
+        block[i] = pe_be32toh(word);
+    }
+    spow_sha256_compress(digest->state, block);
+}
+
+static void digest_update(digest_t *digest, const unsigned char *data, size_t size) {
+    digest->total += size;
+    if (digest->buf_len > 0) {
+        const size_t take = (size < 64 - digest->buf_len) ? size : 64 - digest->buf_len;
+        memcpy(digest->buf + digest->buf_len, data, take);
+        digest->buf_len += take;
+        data += take;
+        size -= take;
+        if (digest->buf_len < 64) {
+            return;
+        }
+        digest_block(digest, digest->buf);
+        digest->buf_len = 0;
+    }
+    for (; size >= 64; data += 64, size -= 64) {
+        digest_block(digest, data);
+    }
+    memcpy(digest->buf, data, size);
+    digest->buf_len = size;
+}
+
+static void digest_u32(digest_t *digest, uint32_t value) {
+    const uint32_t be = pe_htobe32(value);
+    digest_update(digest, (const unsigned char *)&be, sizeof(be));
+}
+
+void spow_replay_key(spow_replay_key_t *out_key,
+                     const unsigned char *init_hash,
+                     const unsigned char *token,
+                     uint32_t difficulty,
+                     uint32_t safety,
+                     uint32_t steps,
+                     const unsigned char *cert,
+                     size_t cert_size) {
+    digest_t digest;
+    memcpy(digest.state, SPOW_SHA256_IV, sizeof(SPOW_SHA256_IV));
+    digest.buf_len = 0;
+    digest.total = 0;
+    /* Fixed-size fields first, so that the encoding is unambiguous. */
+    digest_update(&digest, init_hash, 32);
+    digest_update(&digest, token, 8);
+    digest_u32(&digest, difficulty);
+    digest_u32(&digest, safety);
+    digest_u32(&digest, steps);
+    /* Tells "no certificate" apart from an empty one. */
+    digest_u32(&digest, cert != NULL);
+    if (cert != NULL) {
+        digest_update(&digest, cert, cert_size);
+    }
+
+    const uint64_t bits = digest.total * 8;
+    unsigned char pad[72];
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    const size_t pad_len = ((digest.buf_len < 56) ? 56 : 120) - digest.buf_len;
+    const uint64_t bits_be = pe_htobe64(bits);
+    memcpy(pad + pad_len, &bits_be, sizeof(bits_be));
+    digest_update(&digest, pad, pad_len + 8);
+
+    out_key->words[0] = ((uint64_t)digest.state[0] << 32) | digest.state[1];
+    out_key->words[1] = ((uint64_t)digest.state[2] << 32) | digest.state[3];
+}
+
+static bucket_t *bucket_of(const spow_replay_cache_t *cache, const spow_replay_key_t *key) {
+    /* The key is a hash already. */
+    return &cache->buckets[key->words[0] & cache->buckets_mask];
+}
+
+/* Whether 'key' is in the bucket, unexpired.  With the bucket locked, or
+ * inside a read section. */
+static int bucket_has(const bucket_t *bucket, const spow_replay_key_t *key, uint64_t now) {
+    for (int i = 0; i < SPOW_REPLAY_WAYS; ++i) {
+        const entry_t *entry = &bucket->entries[i];
+        if (atomic_load_explicit(&entry->key[0], memory_order_relaxed) == key->words[0]
+                && atomic_load_explicit(&entry->key[1], memory_order_relaxed) == key->words[1]
+                && atomic_load_explicit(&entry->expires_ns, memory_order_relaxed) > now) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int spow_replay_lookup(spow_replay_cache_t *cache, const spow_replay_key_t *key) {
+    const bucket_t *bucket = bucket_of(cache, key);
+    const uint64_t now = spow_now_ns();
+    for (int i = 0; i < READ_TRIES; ++i) {
+        const unsigned int before = atomic_load_explicit(&bucket->seq, memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        const int found = bucket_has(bucket, key, now);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&bucket->seq, memory_order_relaxed) == before) {
+            atomic_fetch_add_explicit(found ? &cache->hits : &cache->misses, 1, memory_order_relaxed);
+            return found ? SPOW_REPLAY_SEEN : SPOW_REPLAY_MISS;
+        }
+    }
+    /* A writer holds the bucket (or keeps changing it), and a miss only
+     * costs a verification, so don't wait for it. */
+    atomic_fetch_add_explicit(&cache->contended, 1, memory_order_relaxed);
+    return SPOW_REPLAY_MISS;
+}
+
+int spow_replay_claim(spow_replay_cache_t *cache, const spow_replay_key_t *key, uint64_t ttl_ns) {
+    bucket_t *bucket = bucket_of(cache, key);
+    const uint64_t now = spow_now_ns();
+
+    /* Lock the bucket: even -> odd */
+    unsigned int seq = atomic_load_explicit(&bucket->seq, memory_order_relaxed);
+    for (;;) {
+        if (seq & 1) {
+            seq = atomic_load_explicit(&bucket->seq, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&bucket->seq, &seq, seq + 1,
+                                                  memory_order_acquire, memory_order_relaxed)) {
+            break;
+        }
+    }
+    atomic_thread_fence(memory_order_release);
+
+    int result = SPOW_REPLAY_SEEN;
+    if (!bucket_has(bucket, key, now)) {
+        /* An expired or empty entry, otherwise the one that expires first */
+        entry_t *victim = &bucket->entries[0];
+        uint64_t victim_expires = UINT64_MAX;
+        for (int i = 0; i < SPOW_REPLAY_WAYS; ++i) {
+            entry_t *entry = &bucket->entries[i];
+            const uint64_t expires = atomic_load_explicit(&entry->expires_ns, memory_order_relaxed);
+            if (expires < victim_expires) {
+                victim = entry;
+                victim_expires = expires;
+            }
+        }
+        if (victim_expires > now) {
+            atomic_fetch_add_explicit(&cache->evicted_live, 1, memory_order_relaxed);
+        }
+        atomic_store_explicit(&victim->key[0], key->words[0], memory_order_relaxed);
+        atomic_store_explicit(&victim->key[1], key->words[1], memory_order_relaxed);
+        /* Never 0, which means empty */
+        atomic_store_explicit(&victim->expires_ns, now + (ttl_ns ? ttl_ns : 1), memory_order_relaxed);
+        atomic_fetch_add_explicit(&cache->claims, 1, memory_order_relaxed);
+        result = SPOW_REPLAY_CLAIMED;
+    }
+
+    /* Unlock: odd -> even */
+    atomic_store_explicit(&bucket->seq, seq + 2, memory_order_release);
+    return result;
+}
+
+void spow_replay_stats(spow_replay_cache_t *cache, spow_replay_stats_t *out_stats) {
+    out_stats->hits = atomic_load_explicit(&cache->hits, memory_order_relaxed);
+    out_stats->misses = atomic_load_explicit(&cache->misses, memory_order_relaxed);
+    out_stats->contended = atomic_load_explicit(&cache->contended, memory_order_relaxed);
+    out_stats->claims = atomic_load_explicit(&cache->claims, memory_order_relaxed);
+    out_stats->evicted_live = atomic_load_explicit(&cache->evicted_live, memory_order_relaxed);
+}
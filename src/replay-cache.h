@@ -0,0 +1,89 @@
+/* Remembering certificates that were already accepted.
+ *
+ * A valid certificate stays valid forever, so a client that retries, or an
+ * attacker that replays, would make the verifier hash all Steps blocks
+ * again.  The cache answers "already accepted" after hashing only the key,
+ * i.e. the certificate once (a few blocks, instead of one block per step).
+ * It also enforces single use: spow_replay_claim() succeeds only once per
+ * key until it expires, even if many threads try at the same time.
+ *
+ * The key is a 128-bit digest (SHA-256, truncated) of the parameters, and
+ * optionally the certificate:
+ * - With the certificate, a hit means "this exact certificate was accepted",
+ *   which is what a retry looks like.  Check this before verifying.
+ * - Without it, the key stands for the challenge, so claiming it after a
+ *   successful verification makes each challenge redeemable only once, no
+ *   matter which certificate is presented.
+ *
+ * The memory is fixed at creation: The cache is set-associative, each key
+ * can only live in one bucket of SPOW_REPLAY_WAYS entries, and a full bucket
+ * replaces the entry that expires first.  If that entry had not expired
+ * yet, it's counted in 'evicted_live', and the key could be claimed again;
+ * so size the cache for the number of claims per TTL.
+ *
+ * Lookups don't take locks: Each bucket has a sequence number, and readers
+ * retry if a writer changed the bucket while they were reading it.  After a
+ * few tries, they give up and report a miss, which at worst means verifying
+ * a certificate once more.  Writers only ever lock that one bucket. */
+
+#ifndef STEPPOW_REPLAY_CACHE_H
+#define STEPPOW_REPLAY_CACHE_H
+
+#include <stddef.h> /* size_t */
+#include <stdint.h>
+
+#define SPOW_REPLAY_WAYS 4
+
+/* Results */
+#define SPOW_REPLAY_MISS 0
+/* Found, and not expired */
+#define SPOW_REPLAY_SEEN 1
+/* spow_replay_claim(): Wasn't there, now it is. */
+#define SPOW_REPLAY_CLAIMED 2
+
+typedef struct spow_replay_key_t {
+    uint64_t words[2];
+} spow_replay_key_t;
+
+typedef struct spow_replay_cache_t spow_replay_cache_t;
+
+typedef struct spow_replay_stats_t {
+    uint64_t hits;
+    uint64_t misses;
+    /* Lookups that gave up because of writers, and reported a miss */
+    uint64_t contended;
+    uint64_t claims;
+    /* Entries that were replaced before they expired */
+    uint64_t evicted_live;
+} spow_replay_stats_t;
+
+/* Room for at least 'entries' keys.  Returns NULL on failure. */
+spow_replay_cache_t *spow_replay_create(size_t entries);
+
+void spow_replay_destroy(spow_replay_cache_t *cache);
+
+/* The key for these parameters, and 'cert' unless it is NULL.
+ * init_hash has 32 bytes and token 8, as for spow_verify(). */
+void spow_replay_key(spow_replay_key_t *out_key,
+                     const unsigned char *init_hash,
+                     const unsigned char *token,
+                     uint32_t difficulty,
+                     uint32_t safety,
+                     uint32_t steps,
+                     const unsigned char *cert,
+                     size_t cert_size);
+
+/* SPOW_REPLAY_SEEN if 'key' is in the cache and hasn't expired, else
+ * SPOW_REPLAY_MISS.  Never waits for a writer: if the bucket keeps changing,
+ * it also returns SPOW_REPLAY_MISS, so use spow_replay_claim() where only
+ * one caller may win. */
+int spow_replay_lookup(spow_replay_cache_t *cache, const spow_replay_key_t *key);
+
+/* Insert 'key' for 'ttl_ns' nanoseconds, unless it is already there.
+ * Returns SPOW_REPLAY_CLAIMED if this call inserted it, and
+ * SPOW_REPLAY_SEEN if it was there already (and leaves its expiry alone). */
+int spow_replay_claim(spow_replay_cache_t *cache, const spow_replay_key_t *key, uint64_t ttl_ns);
+
+void spow_replay_stats(spow_replay_cache_t *cache, spow_replay_stats_t *out_stats);
+
+#endif /* STEPPOW_REPLAY_CACHE_H */
@@ -0,0 +1,240 @@
+/* Multi-lane nonce search, written once for all vector instruction sets.
+ *
+ * This is not a normal header: sha256-simd.c includes it once per
+ * instruction set, after defining:
+ *   LANES           number of 32-bit lanes
+ *   vec_t           the vector type
+ *   V_SET1(x)       broadcast a uint32_t
+ *   V_LANE_INDEX    the vector { 0, 1, …, LANES - 1 }
+ *   V_ADD(x, y)     lane-wise addition
+ *   V_XOR3(x, y, z) lane-wise x ^ y ^ z
+ *   V_SHR(x, n)     lane-wise logical shift right
+ *   V_ROTR(x, n)    lane-wise rotate right
+ *   V_CH(e, f, g)   lane-wise SHA-256 "Ch"
+ *   V_MAJ(a, b, c)  lane-wise SHA-256 "Maj"
+ *   V_GOOD(x, m)    bitmask of the lanes where (x & m) == 0
+ *   V_EQ(x, y)      bitmask of the lanes where x == y
+ *   V_LOAD(p)       load LANES uint32_t from p (unaligned)
+ *   V_STORE(p, x)   store LANES uint32_t to p (unaligned)
+ *   LANES_FN        the name of the search function to define
+ *   LANES_MULTI_FN  the name of the multi-buffer function to define
+ *   LANES_HASH_FN   the name of the multi-buffer full hash to define
+ *   LANES_COMPRESS_FN the name of the multi-buffer compression to define
+ *   LANES_TARGET    attributes for the functions, e.g. the target ISA
+ *
+ * In LANES_FN, lane i tries the nonce lo + i of the same step.  In
+ * LANES_MULTI_FN, each lane works on its own step, see spow_sha256_multi_t.
+ * Either way, the rest works exactly like finish_word0() in sha256.c.
+ * LANES_HASH_FN is plain SHA-256 of one block per lane, for the verifier.
+ * LANES_COMPRESS_FN is the same from any state, for HMAC in challenge.c. */
+
+#define L_BSIG0(x) V_XOR3(V_ROTR((x), 2), V_ROTR((x), 13), V_ROTR((x), 22))
+#define L_BSIG1(x) V_XOR3(V_ROTR((x), 6), V_ROTR((x), 11), V_ROTR((x), 25))
+#define L_SSIG0(x) V_XOR3(V_ROTR((x), 7), V_ROTR((x), 18), V_SHR((x), 3))
+#define L_SSIG1(x) V_XOR3(V_ROTR((x), 17), V_ROTR((x), 19), V_SHR((x), 10))
+
+#define L_ROUND(a, b, c, d, e, f, g, h, t) do { \
+        const vec_t t1 = V_ADD(V_ADD((h), L_BSIG1(e)), \
+                               V_ADD(V_CH((e), (f), (g)), V_ADD(V_SET1(SPOW_SHA256_K[t]), w[t]))); \
+        (d) = V_ADD((d), t1); \
+        (h) = V_ADD(t1, V_ADD(L_BSIG0(a), V_MAJ((a), (b), (c)))); \
+    } while (0)
+
+#define L_ROUNDS8(t) do { \
+        L_ROUND(a, b, c, d, e, f, g, h, (t) + 0); \
+        L_ROUND(h, a, b, c, d, e, f, g, (t) + 1); \
+        L_ROUND(g, h, a, b, c, d, e, f, (t) + 2); \
+        L_ROUND(f, g, h, a, b, c, d, e, (t) + 3); \
+        L_ROUND(e, f, g, h, a, b, c, d, (t) + 4); \
+        L_ROUND(d, e, f, g, h, a, b, c, (t) + 5); \
+        L_ROUND(c, d, e, f, g, h, a, b, (t) + 6); \
+        L_ROUND(b, c, d, e, f, g, h, a, (t) + 7); \
+    } while (0)
+
+/* Computes 'a' for the nonce low halves 'lo'.  Expects w[0..15] to be set
+ * up already (except w[9]), and L_WPART(t) and L_STATE10(i) to be defined. */
+#define L_FINISH_WORD0(lo) do { \
+        w[9] = (lo); \
+        w[16] = V_ADD(L_WPART(16), (lo)); \
+        w[17] = L_WPART(17); \
+        w[18] = V_ADD(L_WPART(18), L_SSIG1(w[16])); \
+        w[19] = L_WPART(19); \
+        w[20] = V_ADD(L_WPART(20), L_SSIG1(w[18])); \
+        w[21] = L_WPART(21); \
+        w[22] = V_ADD(L_WPART(22), L_SSIG1(w[20])); \
+        w[23] = V_ADD(L_WPART(23), w[16]); \
+        w[24] = V_ADD(L_WPART(24), V_ADD(L_SSIG1(w[22]), L_SSIG0(lo))); \
+        w[25] = V_ADD(V_ADD(L_WPART(25), L_SSIG1(w[23])), V_ADD(w[18], (lo))); \
+        w[26] = V_ADD(L_WPART(26), L_SSIG1(w[24])); \
+        w[27] = V_ADD(V_ADD(L_WPART(27), L_SSIG1(w[25])), w[20]); \
+        w[28] = V_ADD(L_WPART(28), L_SSIG1(w[26])); \
+        w[29] = V_ADD(V_ADD(L_WPART(29), L_SSIG1(w[27])), w[22]); \
+        w[30] = V_ADD(V_ADD(L_WPART(30), L_SSIG1(w[28])), w[23]); \
+        w[31] = V_ADD(V_ADD(L_WPART(31), L_SSIG1(w[29])), V_ADD(w[24], L_SSIG0(w[16]))); \
+        for (int t = 32; t < 64; ++t) { \
+            w[t] = V_ADD(V_ADD(L_SSIG1(w[t - 2]), w[t - 7]), V_ADD(L_SSIG0(w[t - 15]), w[t - 16])); \
+        } \
+        g = V_ADD(L_STATE10(0), (lo)); h = L_STATE10(1); \
+        a = L_STATE10(2); b = L_STATE10(3); \
+        c = V_ADD(L_STATE10(4), (lo)); d = L_STATE10(5); \
+        e = L_STATE10(6); f = L_STATE10(7); \
+        L_ROUND(g, h, a, b, c, d, e, f, 10); \
+        L_ROUND(f, g, h, a, b, c, d, e, 11); \
+        L_ROUND(e, f, g, h, a, b, c, d, 12); \
+        L_ROUND(d, e, f, g, h, a, b, c, 13); \
+        L_ROUND(c, d, e, f, g, h, a, b, 14); \
+        L_ROUND(b, c, d, e, f, g, h, a, 15); \
+        for (int t = 16; t < 64; t += 8) { \
+            L_ROUNDS8(t); \
+        } \
+    } while (0)
+
+#define L_WPART(t) V_SET1(step->wpart[(t) - 16])
+#define L_STATE10(i) V_SET1(step->state10[i])
+
+LANES_TARGET
+int LANES_FN(const spow_sha256_step_t *step,
+             uint32_t lo_first, uint32_t lo_last,
+             uint32_t *out_lo) {
+    const vec_t zero_mask = V_SET1(step->zero_mask);
+    vec_t w[64];
+    for (int t = 0; t < SPOW_SHA256_BLOCK_WORDS; ++t) {
+        w[t] = V_SET1(step->block[t]);
+    }
+
+    for (uint32_t lo_base = lo_first; ; lo_base += LANES) {
+        const vec_t lo = V_ADD(V_SET1(lo_base), V_LANE_INDEX);
+        vec_t a, b, c, d, e, f, g, h;
+        L_FINISH_WORD0(lo);
+
+        unsigned int good = V_GOOD(V_ADD(a, V_SET1(SPOW_SHA256_IV[0])), zero_mask);
+        /* Lanes past lo_last don't count. */
+        const uint32_t remaining = lo_last - lo_base;
+        if (remaining < LANES - 1) {
+            good &= (2u << remaining) - 1;
+        }
+        if (good != 0) {
+            /* The lowest lane has the smallest nonce, which is what the
+             * scalar search would have found first. */
+            *out_lo = lo_base + (uint32_t)__builtin_ctz(good);
+            return 1;
+        }
+        if (remaining < LANES) {
+            return 0;
+        }
+    }
+}
+
+#undef L_WPART
+#undef L_STATE10
+
+/* Everything is per lane, so load it instead of broadcasting it. */
+#define L_WPART(t) wpart[(t) - 16]
+#define L_STATE10(i) state10[i]
+
+LANES_TARGET
+unsigned int LANES_MULTI_FN(spow_sha256_multi_t *multi, unsigned int *out_found) {
+    const unsigned int active = multi->active;
+    if (active == 0) {
+        *out_found = 0;
+        return 0;
+    }
+    const vec_t zero_mask = V_LOAD(multi->zero_mask);
+    const vec_t lo_last = V_LOAD(multi->lo_last);
+    vec_t w[64], wpart[16], state10[SPOW_SHA256_STATE_WORDS];
+    for (int t = 0; t < SPOW_SHA256_BLOCK_WORDS; ++t) {
+        w[t] = V_LOAD(multi->block[t]);
+    }
+    for (int t = 0; t < 16; ++t) {
+        wpart[t] = V_LOAD(multi->wpart[t]);
+    }
+    for (int i = 0; i < SPOW_SHA256_STATE_WORDS; ++i) {
+        state10[i] = V_LOAD(multi->state10[i]);
+    }
+
+    for (vec_t lo = V_LOAD(multi->lo); ; lo = V_ADD(lo, V_SET1(1))) {
+        vec_t a, b, c, d, e, f, g, h;
+        L_FINISH_WORD0(lo);
+
+        const unsigned int found = V_GOOD(V_ADD(a, V_SET1(SPOW_SHA256_IV[0])), zero_mask) & active;
+        const unsigned int stopped = found | (V_EQ(lo, lo_last) & active);
+        if (stopped != 0) {
+            /* Stopped lanes keep the nonce they stopped at, all others
+             * continue with the next one. */
+            V_STORE(multi->lo, lo);
+            for (unsigned int lane = 0; lane < LANES; ++lane) {
+                if (!((stopped >> lane) & 1)) {
+                    multi->lo[lane] += 1;
+                }
+            }
+            *out_found = found;
+            return stopped;
+        }
+    }
+}
+
+#undef L_WPART
+#undef L_STATE10
+
+LANES_TARGET
+void LANES_HASH_FN(uint32_t digest[SPOW_SHA256_STATE_WORDS][SPOW_SHA256_MULTI_LANES_MAX],
+                   const uint32_t block[SPOW_SHA256_BLOCK_WORDS][SPOW_SHA256_MULTI_LANES_MAX]) {
+    vec_t w[64];
+    for (int t = 0; t < SPOW_SHA256_BLOCK_WORDS; ++t) {
+        w[t] = V_LOAD(block[t]);
+    }
+    for (int t = 16; t < 64; ++t) {
+        w[t] = V_ADD(V_ADD(L_SSIG1(w[t - 2]), w[t - 7]), V_ADD(L_SSIG0(w[t - 15]), w[t - 16]));
+    }
+    vec_t a = V_SET1(SPOW_SHA256_IV[0]), b = V_SET1(SPOW_SHA256_IV[1]);
+    vec_t c = V_SET1(SPOW_SHA256_IV[2]), d = V_SET1(SPOW_SHA256_IV[3]);
+    vec_t e = V_SET1(SPOW_SHA256_IV[4]), f = V_SET1(SPOW_SHA256_IV[5]);
+    vec_t g = V_SET1(SPOW_SHA256_IV[6]), h = V_SET1(SPOW_SHA256_IV[7]);
+    for (int t = 0; t < 64; t += 8) {
+        L_ROUNDS8(t);
+    }
+    V_STORE(digest[0], V_ADD(a, V_SET1(SPOW_SHA256_IV[0])));
+    V_STORE(digest[1], V_ADD(b, V_SET1(SPOW_SHA256_IV[1])));
+    V_STORE(digest[2], V_ADD(c, V_SET1(SPOW_SHA256_IV[2])));
+    V_STORE(digest[3], V_ADD(d, V_SET1(SPOW_SHA256_IV[3])));
+    V_STORE(digest[4], V_ADD(e, V_SET1(SPOW_SHA256_IV[4])));
+    V_STORE(digest[5], V_ADD(f, V_SET1(SPOW_SHA256_IV[5])));
+    V_STORE(digest[6], V_ADD(g, V_SET1(SPOW_SHA256_IV[6])));
+    V_STORE(digest[7], V_ADD(h, V_SET1(SPOW_SHA256_IV[7])));
+}
+
+LANES_TARGET
+void LANES_COMPRESS_FN(uint32_t state[SPOW_SHA256_STATE_WORDS][SPOW_SHA256_MULTI_LANES_MAX],
+                       const uint32_t block[SPOW_SHA256_BLOCK_WORDS][SPOW_SHA256_MULTI_LANES_MAX]) {
+    vec_t w[64];
+    for (int t = 0; t < SPOW_SHA256_BLOCK_WORDS; ++t) {
+        w[t] = V_LOAD(block[t]);
+    }
+    for (int t = 16; t < 64; ++t) {
+        w[t] = V_ADD(V_ADD(L_SSIG1(w[t - 2]), w[t - 7]), V_ADD(L_SSIG0(w[t - 15]), w[t - 16]));
+    }
+    const vec_t a0 = V_LOAD(state[0]), b0 = V_LOAD(state[1]);
+    const vec_t c0 = V_LOAD(state[2]), d0 = V_LOAD(state[3]);
+    const vec_t e0 = V_LOAD(state[4]), f0 = V_LOAD(state[5]);
+    const vec_t g0 = V_LOAD(state[6]), h0 = V_LOAD(state[7]);
+    vec_t a = a0, b = b0, c = c0, d = d0, e = e0, f = f0, g = g0, h = h0;
+    for (int t = 0; t < 64; t += 8) {
+        L_ROUNDS8(t);
+    }
+    V_STORE(state[0], V_ADD(a, a0));
+    V_STORE(state[1], V_ADD(b, b0));
+    V_STORE(state[2], V_ADD(c, c0));
+    V_STORE(state[3], V_ADD(d, d0));
+    V_STORE(state[4], V_ADD(e, e0));
+    V_STORE(state[5], V_ADD(f, f0));
+    V_STORE(state[6], V_ADD(g, g0));
+    V_STORE(state[7], V_ADD(h, h0));
+}
+
+#undef L_BSIG0
+#undef L_BSIG1
+#undef L_SSIG0
+#undef L_SSIG1
+#undef L_ROUND
+#undef L_ROUNDS8
+#undef L_FINISH_WORD0
@@ -0,0 +1,123 @@
+/* Nonce search with the x86 SHA extensions (sha256rnds2, sha256msg1/2).
+ *
+ * The SHA instructions keep the state as two vectors {A, B, E, F} and
+ * {C, D, G, H}, and the message as vectors of four consecutive words.
+ * Everything up to round 10 comes from the per-step precomputation, just
+ * like for the other searches.  msg1 for W0..W7 only reads W0..W8, so it
+ * is also the same for every nonce. */
+
+#include "sha256.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define SHANI_TARGET __attribute__((target("sha,sse4.1")))
+
+/* sha256rnds2 has a long latency, but each round depends on the previous
+ * one.  So work on several nonces at once, to keep the SHA unit busy. */
+#define STREAMS 4
+
+#define KV(t) _mm_loadu_si128((const __m128i *)&SPOW_SHA256_K[t])
+
+/* Rounds t..t+3, which read 'cur'.  Meanwhile, finish the next message
+ * vector, and start the one after next (which overwrites 'prev'). */
+#define QROUND_FULL(t, cur, next, prev) do { \
+        for (int j = 0; j < STREAMS; ++j) { \
+            __m128i msg = _mm_add_epi32((cur)[j], KV(t)); \
+            s1[j] = _mm_sha256rnds2_epu32(s1[j], s0[j], msg); \
+            (next)[j] = _mm_sha256msg2_epu32( \
+                _mm_add_epi32((next)[j], _mm_alignr_epi8((cur)[j], (prev)[j], 4)), (cur)[j]); \
+            msg = _mm_shuffle_epi32(msg, 0x0E); \
+            s0[j] = _mm_sha256rnds2_epu32(s0[j], s1[j], msg); \
+            (prev)[j] = _mm_sha256msg1_epu32((prev)[j], (cur)[j]); \
+        } \
+    } while (0)
+
+/* Same, but the message vector after next won't be needed. */
+#define QROUND_MSG2(t, cur, next, prev) do { \
+        for (int j = 0; j < STREAMS; ++j) { \
+            __m128i msg = _mm_add_epi32((cur)[j], KV(t)); \
+            s1[j] = _mm_sha256rnds2_epu32(s1[j], s0[j], msg); \
+            (next)[j] = _mm_sha256msg2_epu32( \
+                _mm_add_epi32((next)[j], _mm_alignr_epi8((cur)[j], (prev)[j], 4)), (cur)[j]); \
+            msg = _mm_shuffle_epi32(msg, 0x0E); \
+            s0[j] = _mm_sha256rnds2_epu32(s0[j], s1[j], msg); \
+        } \
+    } while (0)
+
+#define QROUND_LAST(t, cur) do { \
+        for (int j = 0; j < STREAMS; ++j) { \
+            __m128i msg = _mm_add_epi32((cur)[j], KV(t)); \
+            s1[j] = _mm_sha256rnds2_epu32(s1[j], s0[j], msg); \
+            msg = _mm_shuffle_epi32(msg, 0x0E); \
+            s0[j] = _mm_sha256rnds2_epu32(s0[j], s1[j], msg); \
+        } \
+    } while (0)
+
+SHANI_TARGET
+int spow_sha256_search_shani(const spow_sha256_step_t *step,
+                             uint32_t lo_first, uint32_t lo_last,
+                             uint32_t *out_lo) {
+    const uint32_t *st = step->state10;
+    const uint32_t *w = step->block;
+    const __m128i abef10 = _mm_set_epi32((int)st[0], (int)st[1], (int)st[4], (int)st[5]);
+    const __m128i cdgh10 = _mm_set_epi32((int)st[2], (int)st[3], (int)st[6], (int)st[7]);
+    const __m128i kw10 = _mm_set_epi32(0, 0,
+        (int)(SPOW_SHA256_K[11] + w[11]), (int)(SPOW_SHA256_K[10] + w[10]));
+    const __m128i w0 = _mm_loadu_si128((const __m128i *)&w[0]);
+    const __m128i w4 = _mm_loadu_si128((const __m128i *)&w[4]);
+    const __m128i w8 = _mm_loadu_si128((const __m128i *)&w[8]);
+    const __m128i w12 = _mm_loadu_si128((const __m128i *)&w[12]);
+    const __m128i m0_init = _mm_sha256msg1_epu32(w0, w4);
+    const __m128i m1_init = _mm_sha256msg1_epu32(w4, w8);
+    const uint32_t zero_mask = step->zero_mask;
+
+    for (uint32_t lo_base = lo_first; ; lo_base += STREAMS) {
+        __m128i s0[STREAMS], s1[STREAMS];
+        __m128i m0[STREAMS], m1[STREAMS], m2[STREAMS], m3[STREAMS];
+        for (int j = 0; j < STREAMS; ++j) {
+            const uint32_t lo = lo_base + (uint32_t)j;
+            /* Rounds 10 and 11.  Remember that 'lo' enters A and E. */
+            s1[j] = _mm_add_epi32(abef10, _mm_set_epi32((int)lo, 0, (int)lo, 0));
+            s0[j] = _mm_sha256rnds2_epu32(cdgh10, s1[j], kw10);
+            m0[j] = m0_init;
+            m1[j] = m1_init;
+            m2[j] = _mm_insert_epi32(w8, (int)lo, 1);
+            m3[j] = w12;
+        }
+
+        QROUND_FULL(12, m3, m0, m2);
+        QROUND_FULL(16, m0, m1, m3);
+        QROUND_FULL(20, m1, m2, m0);
+        QROUND_FULL(24, m2, m3, m1);
+        QROUND_FULL(28, m3, m0, m2);
+        QROUND_FULL(32, m0, m1, m3);
+        QROUND_FULL(36, m1, m2, m0);
+        QROUND_FULL(40, m2, m3, m1);
+        QROUND_FULL(44, m3, m0, m2);
+        QROUND_FULL(48, m0, m1, m3);
+        QROUND_MSG2(52, m1, m2, m0);
+        QROUND_MSG2(56, m2, m3, m1);
+        QROUND_LAST(60, m3);
+
+        /* Streams past lo_last don't count. */
+        const uint32_t remaining = lo_last - lo_base;
+        for (uint32_t j = 0; j < STREAMS && j <= remaining; ++j) {
+            /* A is the highest word of {A, B, E, F}. */
+            const uint32_t word0 = (uint32_t)_mm_extract_epi32(s0[j], 3) + SPOW_SHA256_IV[0];
+            if ((word0 & zero_mask) == 0) {
+                *out_lo = lo_base + j;
+                return 1;
+            }
+        }
+        if (remaining < STREAMS) {
+            return 0;
+        }
+    }
+}
+
+#else /* x86 */
+/* ISO C forbids an empty translation unit. */
+typedef int spow_sha256_shani_unavailable;
+#endif /* x86 */
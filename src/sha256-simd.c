@@ -0,0 +1,101 @@
+/* Vectorized nonce search: several consecutive nonces at once, one per lane,
+ * or several independent steps at once, one per lane.
+ * See sha256-lanes.h for the actual algorithm.
+ *
+ * Everything is compiled regardless of -march, because kernel.c decides at
+ * runtime which of these the CPU can actually run. */
+
+#include "sha256.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define LANES 8
+#define vec_t __m256i
+#define V_SET1(x) _mm256_set1_epi32((int)(x))
+#define V_LANE_INDEX _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)
+#define V_ADD(x, y) _mm256_add_epi32((x), (y))
+#define V_XOR3(x, y, z) _mm256_xor_si256(_mm256_xor_si256((x), (y)), (z))
+#define V_SHR(x, n) _mm256_srli_epi32((x), (n))
+#define V_ROTR(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+#define V_CH(e, f, g) _mm256_xor_si256((g), _mm256_and_si256((e), _mm256_xor_si256((f), (g))))
+#define V_MAJ(a, b, c) _mm256_or_si256(_mm256_and_si256((a), (b)), \
+                                       _mm256_and_si256((c), _mm256_or_si256((a), (b))))
+#define V_GOOD(x, m) ((unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps( \
+        _mm256_cmpeq_epi32(_mm256_and_si256((x), (m)), _mm256_setzero_si256()))))
+#define V_EQ(x, y) ((unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32((x), (y)))))
+#define V_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define V_STORE(p, x) _mm256_storeu_si256((__m256i *)(p), (x))
+#define LANES_FN spow_sha256_search_avx2
+#define LANES_MULTI_FN spow_sha256_multi_avx2
+#define LANES_HASH_FN spow_sha256_hash_lanes_avx2
+#define LANES_COMPRESS_FN spow_sha256_compress_lanes_avx2
+#define LANES_TARGET __attribute__((target("avx2")))
+#include "sha256-lanes.h"
+#undef LANES
+#undef vec_t
+#undef V_SET1
+#undef V_LANE_INDEX
+#undef V_ADD
+#undef V_XOR3
+#undef V_SHR
+#undef V_ROTR
+#undef V_CH
+#undef V_MAJ
+#undef V_GOOD
+#undef V_EQ
+#undef V_LOAD
+#undef V_STORE
+#undef LANES_FN
+#undef LANES_MULTI_FN
+#undef LANES_HASH_FN
+#undef LANES_COMPRESS_FN
+#undef LANES_TARGET
+
+/* AVX-512 has proper rotates, and vpternlogd does any three-input
+ * boolean function in one go. */
+#define LANES 16
+#define vec_t __m512i
+#define V_SET1(x) _mm512_set1_epi32((int)(x))
+#define V_LANE_INDEX _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+#define V_ADD(x, y) _mm512_add_epi32((x), (y))
+#define V_XOR3(x, y, z) _mm512_ternarylogic_epi32((x), (y), (z), 0x96)
+#define V_SHR(x, n) _mm512_srli_epi32((x), (n))
+#define V_ROTR(x, n) _mm512_ror_epi32((x), (n))
+#define V_CH(e, f, g) _mm512_ternarylogic_epi32((e), (f), (g), 0xCA)
+#define V_MAJ(a, b, c) _mm512_ternarylogic_epi32((a), (b), (c), 0xE8)
+#define V_GOOD(x, m) ((unsigned int)_mm512_testn_epi32_mask((x), (m)))
+#define V_EQ(x, y) ((unsigned int)_mm512_cmpeq_epi32_mask((x), (y)))
+#define V_LOAD(p) _mm512_loadu_si512((const void *)(p))
+#define V_STORE(p, x) _mm512_storeu_si512((void *)(p), (x))
+#define LANES_FN spow_sha256_search_avx512
+#define LANES_MULTI_FN spow_sha256_multi_avx512
+#define LANES_HASH_FN spow_sha256_hash_lanes_avx512
+#define LANES_COMPRESS_FN spow_sha256_compress_lanes_avx512
+#define LANES_TARGET __attribute__((target("avx512f")))
+#include "sha256-lanes.h"
+#undef LANES
+#undef vec_t
+#undef V_SET1
+#undef V_LANE_INDEX
+#undef V_ADD
+#undef V_XOR3
+#undef V_SHR
+#undef V_ROTR
+#undef V_CH
+#undef V_MAJ
+#undef V_GOOD
+#undef V_EQ
+#undef V_LOAD
+#undef V_STORE
+#undef LANES_FN
+#undef LANES_MULTI_FN
+#undef LANES_HASH_FN
+#undef LANES_COMPRESS_FN
+#undef LANES_TARGET
+
+#else /* x86 */
+/* ISO C forbids an empty translation unit. */
+typedef int spow_sha256_simd_unavailable;
+#endif /* x86 */
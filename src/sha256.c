@@ -0,0 +1,261 @@
+#include "sha256.h"
+
+#include <string.h> /* memcpy */
+
+#define PORTABLE_ENDIAN_NO_UINT_16_T
+
+#include "portable-endian.h"
+
+typedef char assert_SPOW_sha256_single_block[
+    (SPOW_SHA256_MSG_BYTES + 1 + 8 <= SPOW_SHA256_BLOCK_WORDS * 4) ? 1 : -1];
+typedef char assert_SPOW_sha256_word_aligned[
+    (SPOW_SHA256_MSG_BYTES % 4 == 0) ? 1 : -1];
+
+const uint32_t SPOW_SHA256_IV[SPOW_SHA256_STATE_WORDS] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+const uint32_t SPOW_SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/* The message length is a compile-time constant, so is the padding. */
+const uint32_t SPOW_SHA256_PAD[SPOW_SHA256_BLOCK_WORDS - SPOW_SHA256_MSG_WORDS] = {
+    0x80000000, 0x00000000, SPOW_SHA256_MSG_BYTES * 8
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define BSIG0(x) (ROTR((x), 2) ^ ROTR((x), 13) ^ ROTR((x), 22))
+#define BSIG1(x) (ROTR((x), 6) ^ ROTR((x), 11) ^ ROTR((x), 25))
+#define SSIG0(x) (ROTR((x), 7) ^ ROTR((x), 18) ^ ((x) >> 3))
+#define SSIG1(x) (ROTR((x), 17) ^ ROTR((x), 19) ^ ((x) >> 10))
+#define CH(e, f, g) ((g) ^ ((e) & ((f) ^ (g))))
+#define MAJ(a, b, c) (((a) & (b)) | ((c) & ((a) | (b))))
+
+/* One round.  Instead of shifting all eight variables around, the caller
+ * rotates the argument order. */
+#define ROUND(a, b, c, d, e, f, g, h, kw) do { \
+        const uint32_t t1 = (h) + BSIG1(e) + CH((e), (f), (g)) + (kw); \
+        (d) += t1; \
+        (h) = t1 + BSIG0(a) + MAJ((a), (b), (c)); \
+    } while (0)
+
+#define ROUNDS8(t, w) do { \
+        ROUND(a, b, c, d, e, f, g, h, SPOW_SHA256_K[(t) + 0] + (w)[(t) + 0]); \
+        ROUND(h, a, b, c, d, e, f, g, SPOW_SHA256_K[(t) + 1] + (w)[(t) + 1]); \
+        ROUND(g, h, a, b, c, d, e, f, SPOW_SHA256_K[(t) + 2] + (w)[(t) + 2]); \
+        ROUND(f, g, h, a, b, c, d, e, SPOW_SHA256_K[(t) + 3] + (w)[(t) + 3]); \
+        ROUND(e, f, g, h, a, b, c, d, SPOW_SHA256_K[(t) + 4] + (w)[(t) + 4]); \
+        ROUND(d, e, f, g, h, a, b, c, SPOW_SHA256_K[(t) + 5] + (w)[(t) + 5]); \
+        ROUND(c, d, e, f, g, h, a, b, SPOW_SHA256_K[(t) + 6] + (w)[(t) + 6]); \
+        ROUND(b, c, d, e, f, g, h, a, SPOW_SHA256_K[(t) + 7] + (w)[(t) + 7]); \
+    } while (0)
+
+void spow_sha256_compress(uint32_t state[SPOW_SHA256_STATE_WORDS],
+                          const uint32_t block[SPOW_SHA256_BLOCK_WORDS]) {
+    uint32_t w[64];
+    memcpy(w, block, SPOW_SHA256_BLOCK_WORDS * sizeof(uint32_t));
+    for (int t = 16; t < 64; ++t) {
+        w[t] = SSIG1(w[t - 2]) + w[t - 7] + SSIG0(w[t - 15]) + w[t - 16];
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int t = 0; t < 64; t += 8) {
+        ROUNDS8(t, w);
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static void load_block(uint32_t block[SPOW_SHA256_BLOCK_WORDS],
+                       const unsigned char *msg) {
+    for (int i = 0; i < SPOW_SHA256_MSG_WORDS; ++i) {
+        uint32_t word;
+        memcpy(&word, msg + 4 * i, sizeof(word));
+        block[i] = pe_be32toh(word);
+    }
+    memcpy(&block[SPOW_SHA256_MSG_WORDS], SPOW_SHA256_PAD, sizeof(SPOW_SHA256_PAD));
+}
+
+void spow_sha256_hash52(unsigned char *digest, const unsigned char *msg) {
+    uint32_t block[SPOW_SHA256_BLOCK_WORDS];
+    load_block(block, msg);
+
+    uint32_t state[SPOW_SHA256_STATE_WORDS];
+    memcpy(state, SPOW_SHA256_IV, sizeof(state));
+    spow_sha256_compress(state, block);
+
+    for (int i = 0; i < SPOW_SHA256_STATE_WORDS; ++i) {
+        const uint32_t word = pe_htobe32(state[i]);
+        memcpy(digest + 4 * i, &word, sizeof(word));
+    }
+}
+
+void spow_sha256_step_init(spow_sha256_step_t *step,
+                           const unsigned char *msg,
+                           uint32_t zero_bits) {
+    load_block(step->block, msg);
+    step->block[9] = 0;
+    step->zero_mask = (zero_bits == 0) ? 0 : (UINT32_MAX << (32 - zero_bits));
+
+    uint32_t a = SPOW_SHA256_IV[0], b = SPOW_SHA256_IV[1];
+    uint32_t c = SPOW_SHA256_IV[2], d = SPOW_SHA256_IV[3];
+    uint32_t e = SPOW_SHA256_IV[4], f = SPOW_SHA256_IV[5];
+    uint32_t g = SPOW_SHA256_IV[6], h = SPOW_SHA256_IV[7];
+    ROUNDS8(0, step->block);
+    step->state8[0] = a; step->state8[1] = b; step->state8[2] = c; step->state8[3] = d;
+    step->state8[4] = e; step->state8[5] = f; step->state8[6] = g; step->state8[7] = h;
+
+    spow_sha256_step_set_hi(step, 0);
+}
+
+/* Only W16..W31 are stored. */
+#define WPART(t) (step->wpart[(t) - 16])
+
+void spow_sha256_step_set_hi(spow_sha256_step_t *step, uint32_t nonce_hi) {
+    uint32_t *w = step->block;
+    w[8] = nonce_hi;
+
+    /* Rounds 8 and 9, with W9 = 0. */
+    uint32_t a = step->state8[0], b = step->state8[1], c = step->state8[2], d = step->state8[3];
+    uint32_t e = step->state8[4], f = step->state8[5], g = step->state8[6], h = step->state8[7];
+    ROUND(a, b, c, d, e, f, g, h, SPOW_SHA256_K[8] + w[8]);
+    ROUND(h, a, b, c, d, e, f, g, SPOW_SHA256_K[9] + 0);
+    step->state10[0] = g; step->state10[1] = h; step->state10[2] = a; step->state10[3] = b;
+    step->state10[4] = c; step->state10[5] = d; step->state10[6] = e; step->state10[7] = f;
+
+    /* W[t] = SSIG1(W[t-2]) + W[t-7] + SSIG0(W[t-15]) + W[t-16], and every
+     * schedule word that (transitively) reads W9 is left out here. */
+    WPART(16) = SSIG1(w[14]) + SSIG0(w[1]) + w[0];
+    WPART(17) = SSIG1(w[15]) + w[10] + SSIG0(w[2]) + w[1];
+    WPART(18) = w[11] + SSIG0(w[3]) + w[2];
+    WPART(19) = SSIG1(WPART(17)) + w[12] + SSIG0(w[4]) + w[3];
+    WPART(20) = w[13] + SSIG0(w[5]) + w[4];
+    WPART(21) = SSIG1(WPART(19)) + w[14] + SSIG0(w[6]) + w[5];
+    WPART(22) = w[15] + SSIG0(w[7]) + w[6];
+    WPART(23) = SSIG1(WPART(21)) + SSIG0(w[8]) + w[7];
+    WPART(24) = WPART(17) + w[8];
+    WPART(25) = SSIG0(w[10]);
+    WPART(26) = WPART(19) + SSIG0(w[11]) + w[10];
+    WPART(27) = SSIG0(w[12]) + w[11];
+    WPART(28) = WPART(21) + SSIG0(w[13]) + w[12];
+    WPART(29) = SSIG0(w[14]) + w[13];
+    WPART(30) = SSIG0(w[15]) + w[14];
+    WPART(31) = w[15];
+}
+
+/* Word 0 of the digest (host order) for the low half 'lo'. */
+static inline uint32_t finish_word0(const spow_sha256_step_t *step, uint32_t lo) {
+    uint32_t w[64];
+    memcpy(w, step->block, sizeof(step->block));
+    w[9] = lo;
+    w[16] = WPART(16) + lo;
+    w[17] = WPART(17);
+    w[18] = WPART(18) + SSIG1(w[16]);
+    w[19] = WPART(19);
+    w[20] = WPART(20) + SSIG1(w[18]);
+    w[21] = WPART(21);
+    w[22] = WPART(22) + SSIG1(w[20]);
+    w[23] = WPART(23) + w[16];
+    w[24] = WPART(24) + SSIG1(w[22]) + SSIG0(lo);
+    w[25] = WPART(25) + SSIG1(w[23]) + w[18] + lo;
+    w[26] = WPART(26) + SSIG1(w[24]);
+    w[27] = WPART(27) + SSIG1(w[25]) + w[20];
+    w[28] = WPART(28) + SSIG1(w[26]);
+    w[29] = WPART(29) + SSIG1(w[27]) + w[22];
+    w[30] = WPART(30) + SSIG1(w[28]) + w[23];
+    w[31] = WPART(31) + SSIG1(w[29]) + w[24] + SSIG0(w[16]);
+    for (int t = 32; t < 64; ++t) {
+        w[t] = SSIG1(w[t - 2]) + w[t - 7] + SSIG0(w[t - 15]) + w[t - 16];
+    }
+
+    /* Name the variables as ROUNDS8 expects them in round 10. */
+    uint32_t g = step->state10[0] + lo, h = step->state10[1];
+    uint32_t a = step->state10[2], b = step->state10[3];
+    uint32_t c = step->state10[4] + lo, d = step->state10[5];
+    uint32_t e = step->state10[6], f = step->state10[7];
+    ROUND(g, h, a, b, c, d, e, f, SPOW_SHA256_K[10] + w[10]);
+    ROUND(f, g, h, a, b, c, d, e, SPOW_SHA256_K[11] + w[11]);
+    ROUND(e, f, g, h, a, b, c, d, SPOW_SHA256_K[12] + w[12]);
+    ROUND(d, e, f, g, h, a, b, c, SPOW_SHA256_K[13] + w[13]);
+    ROUND(c, d, e, f, g, h, a, b, SPOW_SHA256_K[14] + w[14]);
+    ROUND(b, c, d, e, f, g, h, a, SPOW_SHA256_K[15] + w[15]);
+    for (int t = 16; t < 64; t += 8) {
+        ROUNDS8(t, w);
+    }
+    /* Everything else only feeds into the other digest words, and the
+     * compiler is free to drop it. */
+    return a + SPOW_SHA256_IV[0];
+}
+
+int spow_sha256_search_scalar(const spow_sha256_step_t *step,
+                              uint32_t lo_first, uint32_t lo_last,
+                              uint32_t *out_lo) {
+    for (uint32_t lo = lo_first; ; ++lo) {
+        if ((finish_word0(step, lo) & step->zero_mask) == 0) {
+            *out_lo = lo;
+            return 1;
+        }
+        if (lo == lo_last) {
+            return 0;
+        }
+    }
+}
+
+int spow_sha256_find_nonce(spow_sha256_step_t *step,
+                           spow_sha256_search_fn search,
+                           uint64_t nonce_max,
+                           uint64_t *out_nonce) {
+    return spow_sha256_find_nonce_range(step, search, 0, nonce_max, out_nonce);
+}
+
+int spow_sha256_find_nonce_range(spow_sha256_step_t *step,
+                                 spow_sha256_search_fn search,
+                                 uint64_t nonce_first,
+                                 uint64_t nonce_last,
+                                 uint64_t *out_nonce) {
+    const uint32_t hi_last = (uint32_t)(nonce_last >> 32);
+    for (uint32_t hi = (uint32_t)(nonce_first >> 32); ; ++hi) {
+        if (step->block[8] != hi) {
+            spow_sha256_step_set_hi(step, hi);
+        }
+        const uint32_t lo_first = (hi == (uint32_t)(nonce_first >> 32)) ? (uint32_t)nonce_first : 0;
+        const uint32_t lo_last = (hi == hi_last) ? (uint32_t)nonce_last : UINT32_MAX;
+        uint32_t lo;
+        if (search(step, lo_first, lo_last, &lo)) {
+            *out_nonce = (((uint64_t)hi) << 32) | lo;
+            return 1;
+        }
+        if (hi == hi_last) {
+            return 0;
+        }
+    }
+}
+
+void spow_sha256_multi_set_lane(spow_sha256_multi_t *multi, unsigned int lane,
+                                const spow_sha256_step_t *step,
+                                uint32_t lo_first, uint32_t lo_last) {
+    for (int t = 0; t < SPOW_SHA256_BLOCK_WORDS; ++t) {
+        multi->block[t][lane] = step->block[t];
+    }
+    for (int i = 0; i < SPOW_SHA256_STATE_WORDS; ++i) {
+        multi->state10[i][lane] = step->state10[i];
+    }
+    for (int t = 0; t < 16; ++t) {
+        multi->wpart[t][lane] = step->wpart[t];
+    }
+    multi->zero_mask[lane] = step->zero_mask;
+    multi->lo[lane] = lo_first;
+    multi->lo_last[lane] = lo_last;
+    multi->active |= 1u << lane;
+}
@@ -0,0 +1,181 @@
+/* Fixed-length SHA-256, specialized for steppow's hash buffer.
+ *
+ * The prover and verifier only ever hash exactly 52 bytes:
+ *     last_hash || nonce || token || step
+ * Together with the padding, this is always exactly one 64-byte block,
+ * and the padding is always the same.  So there is no need for any of the
+ * generic machinery (contexts, length counters, buffering, finalization);
+ * it's just a single compression function call on a mostly-known block. */
+
+#ifndef STEPPOW_SHA256_H
+#define STEPPOW_SHA256_H
+
+#include <stdint.h>
+
+#define SPOW_SHA256_DIGEST_BYTES 32
+#define SPOW_SHA256_BLOCK_WORDS 16
+#define SPOW_SHA256_STATE_WORDS 8
+/* Length of the message, i.e., SPOW_HASHBYTES. */
+#define SPOW_SHA256_MSG_BYTES 52
+#define SPOW_SHA256_MSG_WORDS (SPOW_SHA256_MSG_BYTES / 4)
+
+extern const uint32_t SPOW_SHA256_IV[SPOW_SHA256_STATE_WORDS];
+extern const uint32_t SPOW_SHA256_K[64];
+/* Block words 13, 14, 15: the 0x80 terminator, zeros, and the bit length. */
+extern const uint32_t SPOW_SHA256_PAD[SPOW_SHA256_BLOCK_WORDS - SPOW_SHA256_MSG_WORDS];
+
+/* Plain SHA-256 compression of a single block (host-order words). */
+void spow_sha256_compress(uint32_t state[SPOW_SHA256_STATE_WORDS],
+                          const uint32_t block[SPOW_SHA256_BLOCK_WORDS]);
+
+/* digest := SHA256(msg), where msg is exactly SPOW_SHA256_MSG_BYTES long.
+ * 'digest' and 'msg' may overlap. */
+void spow_sha256_hash52(unsigned char *digest, const unsigned char *msg);
+
+/* Nonce search.
+ *
+ * Within a step, only the nonce changes, which is block word 8 (high half)
+ * and word 9 (low half).  Rounds 0-7 only read last_hash, and round 8 only
+ * additionally reads the high half, which practically never changes.
+ * Much of the message schedule doesn't depend on the nonce at all.
+ * So all of that is computed once per step (or once per 2^32 nonces), and
+ * the search loop only finishes the remaining rounds.  The search also only
+ * computes the first word of the digest, because that's all it needs. */
+typedef struct spow_sha256_step_t {
+    /* The message block, with W9 set to zero. */
+    uint32_t block[SPOW_SHA256_BLOCK_WORDS];
+    /* State after rounds 0-7. */
+    uint32_t state8[SPOW_SHA256_STATE_WORDS];
+    /* State after rounds 8-9, assuming a low half of 0.  W9 only enters the
+     * state through T1 of round 9, so for any other low half 'lo',
+     * it's enough to add 'lo' to A and E. */
+    uint32_t state10[SPOW_SHA256_STATE_WORDS];
+    /* Schedule words W16..W31, without the terms that depend on W9. */
+    uint32_t wpart[16];
+    /* The digest is good iff (digest word 0, host order) & zero_mask == 0. */
+    uint32_t zero_mask;
+} spow_sha256_step_t;
+
+/* Prepare the search for msg with any nonce.  The nonce in msg is ignored,
+ * and the high half starts out as 0.  zero_bits is the difficulty. */
+void spow_sha256_step_init(spow_sha256_step_t *step,
+                           const unsigned char *msg,
+                           uint32_t zero_bits);
+
+/* Switch to nonces (nonce_hi << 32) | lo. */
+void spow_sha256_step_set_hi(spow_sha256_step_t *step, uint32_t nonce_hi);
+
+/* Find the smallest lo in [lo_first, lo_last] that results in a good digest.
+ * Returns 1 and writes *out_lo if found, 0 otherwise.
+ * All implementations must agree exactly, so that certificates and hash
+ * counts don't depend on the machine. */
+typedef int (*spow_sha256_search_fn)(const spow_sha256_step_t *step,
+                                     uint32_t lo_first, uint32_t lo_last,
+                                     uint32_t *out_lo);
+int spow_sha256_search_scalar(const spow_sha256_step_t *step,
+                              uint32_t lo_first, uint32_t lo_last,
+                              uint32_t *out_lo);
+#if defined(__x86_64__) || defined(__i386__)
+/* These may only be called if the CPU supports them, see kernel.h. */
+/* 8 nonces at once, see sha256-simd.c */
+int spow_sha256_search_avx2(const spow_sha256_step_t *step,
+                            uint32_t lo_first, uint32_t lo_last,
+                            uint32_t *out_lo);
+/* 16 nonces at once, see sha256-simd.c */
+int spow_sha256_search_avx512(const spow_sha256_step_t *step,
+                              uint32_t lo_first, uint32_t lo_last,
+                              uint32_t *out_lo);
+/* SHA extensions, see sha256-shani.c */
+int spow_sha256_search_shani(const spow_sha256_step_t *step,
+                             uint32_t lo_first, uint32_t lo_last,
+                             uint32_t *out_lo);
+#endif
+
+/* Multi-buffer nonce search.
+ *
+ * Here each lane works on a different step, usually of a different
+ * certificate.  This is the same data as in spow_sha256_step_t, but
+ * transposed (field[word][lane]), so that a kernel can load one word of all
+ * lanes at once.  Each lane still tries its nonces in increasing order, so it
+ * finds exactly the same nonce as the single-step search would. */
+#define SPOW_SHA256_MULTI_LANES_MAX 16
+typedef struct spow_sha256_multi_t {
+    uint32_t block[SPOW_SHA256_BLOCK_WORDS][SPOW_SHA256_MULTI_LANES_MAX];
+    uint32_t state10[SPOW_SHA256_STATE_WORDS][SPOW_SHA256_MULTI_LANES_MAX];
+    uint32_t wpart[16][SPOW_SHA256_MULTI_LANES_MAX];
+    uint32_t zero_mask[SPOW_SHA256_MULTI_LANES_MAX];
+    /* The next low half to try, and the last one to try. */
+    uint32_t lo[SPOW_SHA256_MULTI_LANES_MAX];
+    uint32_t lo_last[SPOW_SHA256_MULTI_LANES_MAX];
+    /* Bitmask of the lanes that have a step to work on. */
+    unsigned int active;
+} spow_sha256_multi_t;
+
+/* Start working on nonces [lo_first, lo_last] of 'step' in 'lane'. */
+void spow_sha256_multi_set_lane(spow_sha256_multi_t *multi, unsigned int lane,
+                                const spow_sha256_step_t *step,
+                                uint32_t lo_first, uint32_t lo_last);
+
+/* Continue all active lanes until at least one lane either finds a good
+ * nonce, or has tried its lo_last.  Returns the bitmask of these lanes, and
+ * writes the bitmask of lanes that found a good nonce to *out_found.
+ * The lo[] of the returned lanes is the nonce they stopped at; all other
+ * lanes will continue where they left off.  The caller must update or
+ * deactivate the returned lanes before the next call. */
+typedef unsigned int (*spow_sha256_multi_fn)(spow_sha256_multi_t *multi,
+                                             unsigned int *out_found);
+#if defined(__x86_64__) || defined(__i386__)
+/* 8 lanes, see sha256-simd.c */
+unsigned int spow_sha256_multi_avx2(spow_sha256_multi_t *multi, unsigned int *out_found);
+/* 16 lanes, see sha256-simd.c */
+unsigned int spow_sha256_multi_avx512(spow_sha256_multi_t *multi, unsigned int *out_found);
+#endif
+
+/* Plain SHA-256 of one block per lane, starting from the IV.  Both 'block'
+ * and 'digest' are transposed like in spow_sha256_multi_t, and have the
+ * digest as host-order words.  The lanes are independent, so unused ones
+ * just compute garbage. */
+typedef void (*spow_sha256_hash_lanes_fn)(
+    uint32_t digest[SPOW_SHA256_STATE_WORDS][SPOW_SHA256_MULTI_LANES_MAX],
+    const uint32_t block[SPOW_SHA256_BLOCK_WORDS][SPOW_SHA256_MULTI_LANES_MAX]);
+#if defined(__x86_64__) || defined(__i386__)
+/* See sha256-simd.c */
+void spow_sha256_hash_lanes_avx2(
+    uint32_t digest[SPOW_SHA256_STATE_WORDS][SPOW_SHA256_MULTI_LANES_MAX],
+    const uint32_t block[SPOW_SHA256_BLOCK_WORDS][SPOW_SHA256_MULTI_LANES_MAX]);
+void spow_sha256_hash_lanes_avx512(
+    uint32_t digest[SPOW_SHA256_STATE_WORDS][SPOW_SHA256_MULTI_LANES_MAX],
+    const uint32_t block[SPOW_SHA256_BLOCK_WORDS][SPOW_SHA256_MULTI_LANES_MAX]);
+#endif
+
+/* spow_sha256_compress() of one block per lane, from each lane's 'state',
+ * transposed the same way. */
+typedef void (*spow_sha256_compress_lanes_fn)(
+    uint32_t state[SPOW_SHA256_STATE_WORDS][SPOW_SHA256_MULTI_LANES_MAX],
+    const uint32_t block[SPOW_SHA256_BLOCK_WORDS][SPOW_SHA256_MULTI_LANES_MAX]);
+#if defined(__x86_64__) || defined(__i386__)
+/* See sha256-simd.c */
+void spow_sha256_compress_lanes_avx2(
+    uint32_t state[SPOW_SHA256_STATE_WORDS][SPOW_SHA256_MULTI_LANES_MAX],
+    const uint32_t block[SPOW_SHA256_BLOCK_WORDS][SPOW_SHA256_MULTI_LANES_MAX]);
+void spow_sha256_compress_lanes_avx512(
+    uint32_t state[SPOW_SHA256_STATE_WORDS][SPOW_SHA256_MULTI_LANES_MAX],
+    const uint32_t block[SPOW_SHA256_BLOCK_WORDS][SPOW_SHA256_MULTI_LANES_MAX]);
+#endif
+
+/* Find the smallest nonce in [0, nonce_max] that results in a good digest,
+ * using 'search' for each run of 2^32 nonces.
+ * Returns 1 and writes *out_nonce if found, 0 otherwise. */
+int spow_sha256_find_nonce(spow_sha256_step_t *step,
+                           spow_sha256_search_fn search,
+                           uint64_t nonce_max,
+                           uint64_t *out_nonce);
+
+/* The same, but only for nonces in [nonce_first, nonce_last]. */
+int spow_sha256_find_nonce_range(spow_sha256_step_t *step,
+                                 spow_sha256_search_fn search,
+                                 uint64_t nonce_first,
+                                 uint64_t nonce_last,
+                                 uint64_t *out_nonce);
+
+#endif /* STEPPOW_SHA256_H */
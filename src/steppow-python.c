@@ -0,0 +1,153 @@
+/* Compile:
+ * make bin/_steppow.so
+ * Use:
+ * PYTHONPATH=bin python3 -c 'import _steppow; help(_steppow)'
+ *
+ * libsteppow's verifier as a CPython extension module, for src/verify.py,
+ * which uses it automatically if it can import it.  try_verify() takes the
+ * same arguments as the one in src/verify.py, and gives the same answer.
+ * verify() also says why a certificate is rejected (one of the VERIFY_*
+ * results), and for a bad step, which one and what was hashed for it, so
+ * that verify.py can print the same diagnostics either way.  For both:
+ * - The certificate (and the other byte arguments) can be anything that
+ *   supports the buffer protocol, e.g. bytes, bytearray, memoryview, or mmap,
+ *   and is read in place, without a copy.
+ * - The GIL is released while hashing, so several Python threads really
+ *   verify in parallel.  While it runs, a bytearray certificate cannot be
+ *   resized, as the buffer is exported for the whole call. */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdint.h>
+
+#include "verifier.h"
+
+/* Converter for PyArg_ParseTuple(), like "I", but with a range check. */
+static int parse_uint32(PyObject *obj, void *out) {
+    const unsigned long long value = PyLong_AsUnsignedLongLong(obj);
+    if (value == (unsigned long long)-1 && PyErr_Occurred()) {
+        return 0;
+    }
+    if (value > UINT32_MAX) {
+        PyErr_SetString(PyExc_OverflowError, "must fit into 32 bits");
+        return 0;
+    }
+    *(uint32_t *)out = (uint32_t)value;
+    return 1;
+}
+
+/* The arguments of try_verify() and verify(), with the buffers acquired. */
+typedef struct py_verify_args_t {
+    Py_buffer init_hash;
+    Py_buffer token;
+    uint32_t difficulty;
+    uint32_t safety;
+    uint32_t steps;
+    Py_buffer cert;
+} py_verify_args_t;
+
+static void release_verify_args(py_verify_args_t *a) {
+    PyBuffer_Release(&a->cert);
+    PyBuffer_Release(&a->token);
+    PyBuffer_Release(&a->init_hash);
+}
+
+/* Returns 0 with an exception set on failure, like PyArg_ParseTuple(). */
+static int parse_verify_args(PyObject *args, const char *format, py_verify_args_t *a) {
+    if (!PyArg_ParseTuple(args, format, &a->init_hash, &a->token,
+                          parse_uint32, &a->difficulty, parse_uint32, &a->safety,
+                          parse_uint32, &a->steps, &a->cert)) {
+        return 0;
+    }
+    if (a->init_hash.len != SPOW_VERIFY_INIT_HASH_BYTES
+        || a->token.len != SPOW_VERIFY_TOKEN_BYTES) {
+        PyErr_Format(PyExc_ValueError, "init_hash must have %d bytes and token %d bytes",
+                     SPOW_VERIFY_INIT_HASH_BYTES, SPOW_VERIFY_TOKEN_BYTES);
+        release_verify_args(a);
+        return 0;
+    }
+    return 1;
+}
+
+static PyObject *py_try_verify(PyObject *self, PyObject *args) {
+    (void)self;
+    py_verify_args_t a;
+    if (!parse_verify_args(args, "y*y*O&O&O&y*:try_verify", &a)) {
+        return NULL;
+    }
+
+    int result;
+    Py_BEGIN_ALLOW_THREADS
+    result = spow_verify(a.init_hash.buf, a.token.buf, a.difficulty, a.safety, a.steps,
+                         a.cert.buf, (size_t)a.cert.len);
+    Py_END_ALLOW_THREADS
+
+    release_verify_args(&a);
+    return PyBool_FromLong(result == SPOW_VERIFY_OK);
+}
+
+static PyObject *py_verify(PyObject *self, PyObject *args) {
+    (void)self;
+    py_verify_args_t a;
+    if (!parse_verify_args(args, "y*y*O&O&O&y*:verify", &a)) {
+        return NULL;
+    }
+
+    uint32_t failed_step = 0;
+    unsigned char failed_input[SPOW_VERIFY_STEP_INPUT_BYTES];
+    int result;
+    Py_BEGIN_ALLOW_THREADS
+    result = spow_verify(a.init_hash.buf, a.token.buf, a.difficulty, a.safety, a.steps,
+                         a.cert.buf, (size_t)a.cert.len);
+    /* Only rejected certificates pay for finding the step. */
+    if (result == SPOW_VERIFY_BAD_STEP) {
+        result = spow_verify_explain(a.init_hash.buf, a.token.buf, a.difficulty, a.safety,
+                                     a.steps, a.cert.buf, (size_t)a.cert.len,
+                                     &failed_step, failed_input);
+    }
+    Py_END_ALLOW_THREADS
+
+    release_verify_args(&a);
+    if (result != SPOW_VERIFY_BAD_STEP) {
+        return Py_BuildValue("(iOO)", result, Py_None, Py_None);
+    }
+    return Py_BuildValue("(iky#)", result, (unsigned long)failed_step,
+                         (const char *)failed_input, (Py_ssize_t)SPOW_VERIFY_STEP_INPUT_BYTES);
+}
+
+static PyMethodDef STEPPOW_METHODS[] = {
+    {"try_verify", py_try_verify, METH_VARARGS,
+     "try_verify(init_hash, token, difficulty, safety, steps, certificate) -> bool\n\n"
+     "Whether certificate is valid, like try_verify() in verify.py.  Releases the GIL while hashing."},
+    {"verify", py_verify, METH_VARARGS,
+     "verify(init_hash, token, difficulty, safety, steps, certificate) -> (result, step, input)\n\n"
+     "One of the VERIFY_* results, and for VERIFY_BAD_STEP also the index of the failed step\n"
+     "and the bytes that were hashed for it (otherwise None and None).  Releases the GIL while hashing."},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef STEPPOW_MODULE = {
+    PyModuleDef_HEAD_INIT,
+    "_steppow",
+    "Native steppow verifier, see src/steppow-python.c.",
+    -1,
+    STEPPOW_METHODS,
+    NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit__steppow(void) {
+    PyObject *module = PyModule_Create(&STEPPOW_MODULE);
+    if (module == NULL) {
+        return NULL;
+    }
+    if (PyModule_AddIntConstant(module, "VERIFY_OK", SPOW_VERIFY_OK) < 0
+        || PyModule_AddIntConstant(module, "VERIFY_BAD_PARAMS", SPOW_VERIFY_BAD_PARAMS) < 0
+        || PyModule_AddIntConstant(module, "VERIFY_BAD_LENGTH", SPOW_VERIFY_BAD_LENGTH) < 0
+        || PyModule_AddIntConstant(module, "VERIFY_BAD_PADDING", SPOW_VERIFY_BAD_PADDING) < 0
+        || PyModule_AddIntConstant(module, "VERIFY_BAD_STEP", SPOW_VERIFY_BAD_STEP) < 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
@@ -0,0 +1,155 @@
+#include "telemetry.h"
+
+#include <inttypes.h> /* PRIu64 and similar */
+#include <math.h> /* ldexp */
+#include <string.h> /* memset */
+
+#define SUB_BUCKETS (1u << SPOW_HISTOGRAM_SUB_BITS)
+
+static unsigned int bucket_index(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return (unsigned int)value;
+    }
+    const unsigned int exponent = 63 - (unsigned int)__builtin_clzll(value);
+    const unsigned int shift = exponent - SPOW_HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << SPOW_HISTOGRAM_SUB_BITS)
+        | (unsigned int)((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+/* The largest value that lands in this bucket. */
+static uint64_t bucket_highest(unsigned int index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    const unsigned int shift = (index >> SPOW_HISTOGRAM_SUB_BITS) - 1;
+    const uint64_t lowest = ((uint64_t)(SUB_BUCKETS | (index & (SUB_BUCKETS - 1)))) << shift;
+    return lowest + ((((uint64_t)1) << shift) - 1);
+}
+
+void spow_histogram_init(spow_histogram_t *histogram) {
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->min = UINT64_MAX;
+}
+
+void spow_histogram_record(spow_histogram_t *histogram, uint64_t value) {
+    histogram->counts[bucket_index(value)] += 1;
+    histogram->total += 1;
+    histogram->sum += (double)value;
+    if (value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+uint64_t spow_histogram_quantile(const spow_histogram_t *histogram, double quantile) {
+    if (histogram->total == 0) {
+        return 0;
+    }
+    uint64_t wanted = (uint64_t)(quantile * (double)histogram->total + 0.5);
+    if (wanted < 1) {
+        wanted = 1;
+    }
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < SPOW_HISTOGRAM_BUCKETS; ++i) {
+        seen += histogram->counts[i];
+        if (seen >= wanted) {
+            const uint64_t value = bucket_highest(i);
+            return (value > histogram->max) ? histogram->max : value;
+        }
+    }
+    return histogram->max;
+}
+
+double spow_histogram_mean(const spow_histogram_t *histogram) {
+    return histogram->total ? histogram->sum / (double)histogram->total : 0;
+}
+
+void spow_telemetry_init(spow_telemetry_t *telemetry, FILE *log) {
+    spow_histogram_init(&telemetry->nanoseconds);
+    spow_histogram_init(&telemetry->hashes);
+    telemetry->expected_hashes = 0;
+    telemetry->counters_valid = 0;
+    memset(telemetry->counters, 0, sizeof(telemetry->counters));
+    telemetry->counted_hashes = 0;
+    telemetry->log = log;
+    pthread_mutex_init(&telemetry->lock, NULL);
+}
+
+void spow_telemetry_destroy(spow_telemetry_t *telemetry) {
+    pthread_mutex_destroy(&telemetry->lock);
+}
+
+/* Cycles per hash, IPC, and misses per hash.  Only the valid ones. */
+static void print_counters(FILE *out, unsigned int valid, const uint64_t *counters, uint64_t hashes) {
+    if ((valid & (1u << SPOW_PERF_CYCLES)) && hashes) {
+        fprintf(out, ", %.1f cycles/hash", (double)counters[SPOW_PERF_CYCLES] / (double)hashes);
+    }
+    if ((valid & (1u << SPOW_PERF_CYCLES)) && (valid & (1u << SPOW_PERF_INSTRUCTIONS))
+            && counters[SPOW_PERF_CYCLES]) {
+        fprintf(out, ", IPC %.2f",
+            (double)counters[SPOW_PERF_INSTRUCTIONS] / (double)counters[SPOW_PERF_CYCLES]);
+    }
+    for (unsigned int i = SPOW_PERF_BRANCH_MISSES; i <= SPOW_PERF_L1_MISSES; ++i) {
+        if ((valid & (1u << i)) && hashes) {
+            fprintf(out, ", %.4f %s/hash", (double)counters[i] / (double)hashes, SPOW_PERF_NAMES[i]);
+        }
+    }
+}
+
+void spow_telemetry_on_step(void *ctx, const prover_step_t *info) {
+    spow_telemetry_t *telemetry = ctx;
+    pthread_mutex_lock(&telemetry->lock);
+    spow_histogram_record(&telemetry->nanoseconds, info->nanoseconds);
+    spow_histogram_record(&telemetry->hashes, info->hashes);
+    telemetry->expected_hashes += ldexp(1, (int)info->difficulty);
+    if (info->counters_valid) {
+        telemetry->counters_valid |= info->counters_valid;
+        for (unsigned int i = 0; i < SPOW_PERF_COUNTERS; ++i) {
+            telemetry->counters[i] += info->counters[i];
+        }
+        telemetry->counted_hashes += info->hashes;
+    }
+    if (telemetry->log != NULL) {
+        /* Hashes per nanosecond is GH/s, so times 1000 is MH/s. */
+        const double rate = info->total_nanoseconds
+            ? 1e3 * (double)info->total_hashes / (double)info->total_nanoseconds : 0;
+        fprintf(telemetry->log, "Step %" PRIu32 "/%" PRIu32 ": %" PRIu64 " hashes in %.3f ms, %.2f MH/s so far",
+            info->step + 1, info->steps, info->hashes, (double)info->nanoseconds * 1e-6, rate);
+        print_counters(telemetry->log, info->counters_valid, info->counters, info->hashes);
+        fprintf(telemetry->log, ".\n");
+    }
+    pthread_mutex_unlock(&telemetry->lock);
+}
+
+static void print_histogram(FILE *out, const char *name, const spow_histogram_t *histogram, double scale) {
+    fprintf(out, "%s: mean %.3f, min %.3f, p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+        name, spow_histogram_mean(histogram) * scale,
+        (double)histogram->min * scale,
+        (double)spow_histogram_quantile(histogram, 0.5) * scale,
+        (double)spow_histogram_quantile(histogram, 0.9) * scale,
+        (double)spow_histogram_quantile(histogram, 0.99) * scale,
+        (double)histogram->max * scale);
+}
+
+void spow_telemetry_print(spow_telemetry_t *telemetry, FILE *out) {
+    pthread_mutex_lock(&telemetry->lock);
+    if (telemetry->hashes.total == 0) {
+        fprintf(out, "Telemetry: no steps.\n");
+    } else {
+        fprintf(out, "Telemetry over %" PRIu64 " steps:\n", telemetry->hashes.total);
+        print_histogram(out, "\tMilliseconds per step", &telemetry->nanoseconds, 1e-6);
+        print_histogram(out, "\tHashes per step", &telemetry->hashes, 1);
+        /* For a geometric distribution, the mean is about 2^Difficulty. */
+        fprintf(out, "\tHashes: %.0f, expected about %.0f, %.2f MH/s\n",
+            telemetry->hashes.sum, telemetry->expected_hashes,
+            telemetry->nanoseconds.sum ? 1e3 * telemetry->hashes.sum / telemetry->nanoseconds.sum : 0);
+        if (telemetry->counters_valid) {
+            fprintf(out, "\tHardware counters over %" PRIu64 " hashes", telemetry->counted_hashes);
+            print_counters(out, telemetry->counters_valid, telemetry->counters, telemetry->counted_hashes);
+            fprintf(out, "\n");
+        }
+    }
+    pthread_mutex_unlock(&telemetry->lock);
+}
@@ -0,0 +1,70 @@
+/* Step-level telemetry for the prover.
+ *
+ * The prover reports every finished step to prover_t.on_step, see
+ * prover.h.  That alone is enough for a progress bar ("step x of y").
+ * spow_telemetry_on_step() is a ready-made on_step that additionally keeps
+ * histograms of the time and hashes per step, sums up the hardware counters
+ * (if any, see perf.h), and optionally logs each step.
+ *
+ * The number of hashes in a step is geometrically distributed with mean
+ * about 2^Difficulty, so a whole certificate is roughly
+ * Erlang(k = Steps, lambda = 2^-Difficulty).  Comparing the histograms to
+ * that shows whether a machine is slow, or just unlucky. */
+
+#ifndef STEPPOW_TELEMETRY_H
+#define STEPPOW_TELEMETRY_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "prover.h"
+
+/* Like HdrHistogram: Each power of two is split into 2^SUB_BITS buckets of
+ * equal width, so every value is recorded with a relative error below
+ * 2^-SUB_BITS, from 1 up to UINT64_MAX, in a fixed amount of memory. */
+#define SPOW_HISTOGRAM_SUB_BITS 4
+#define SPOW_HISTOGRAM_BUCKETS ((64 - SPOW_HISTOGRAM_SUB_BITS + 1) << SPOW_HISTOGRAM_SUB_BITS)
+
+typedef struct spow_histogram_t {
+    uint64_t counts[SPOW_HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+} spow_histogram_t;
+
+void spow_histogram_init(spow_histogram_t *histogram);
+void spow_histogram_record(spow_histogram_t *histogram, uint64_t value);
+/* The smallest recorded value (up to the bucket width) such that a fraction
+ * 'quantile' of all values is at most that.  0 if nothing was recorded. */
+uint64_t spow_histogram_quantile(const spow_histogram_t *histogram, double quantile);
+double spow_histogram_mean(const spow_histogram_t *histogram);
+
+typedef struct spow_telemetry_t {
+    /* Per step */
+    spow_histogram_t nanoseconds;
+    spow_histogram_t hashes;
+    /* Sum of 2^Difficulty over all steps, to compare with hashes.sum */
+    double expected_hashes;
+    /* Sums of the hardware counters, and of the hashes of the steps that
+     * had them, see prover_step_t.counters */
+    unsigned int counters_valid;
+    uint64_t counters[SPOW_PERF_COUNTERS];
+    uint64_t counted_hashes;
+    /* If not NULL, one line per step goes here. */
+    FILE *log;
+    /* on_step may be called from several threads at once. */
+    pthread_mutex_t lock;
+} spow_telemetry_t;
+
+void spow_telemetry_init(spow_telemetry_t *telemetry, FILE *log);
+void spow_telemetry_destroy(spow_telemetry_t *telemetry);
+
+/* For prover_t.on_step, with a spow_telemetry_t as the context. */
+void spow_telemetry_on_step(void *ctx, const prover_step_t *info);
+
+/* Summary of the histograms, human-readable. */
+void spow_telemetry_print(spow_telemetry_t *telemetry, FILE *out);
+
+#endif /* STEPPOW_TELEMETRY_H */
@@ -0,0 +1,514 @@
+#include "verifier.h"
+
+#include <string.h> /* memcpy, memset */
+
+#define PORTABLE_ENDIAN_NO_UINT_16_T
+
+#include "compact.h"
+#include "kernel.h"
+#include "nonce.h"
+#include "portable-endian.h"
+#include "sha256.h"
+
+/* Block word layout: last_hash || nonce || token || step, see hashbuf_t */
+#define W_LAST_HASH 0
+#define W_NONCE_HI 8
+#define W_NONCE_LO 9
+#define W_TOKEN 10
+#define W_STEP 12
+#define W_PAD 13
+typedef char assert_SPOW_verifier_layout[
+    (W_PAD == SPOW_SHA256_MSG_WORDS
+     && (W_TOKEN - W_NONCE_HI) * 4 == 8
+     && (W_STEP - W_TOKEN) * 4 == SPOW_VERIFY_TOKEN_BYTES
+     && W_NONCE_HI * 4 == SPOW_VERIFY_INIT_HASH_BYTES
+     && W_PAD * 4 == SPOW_VERIFY_STEP_INPUT_BYTES) ? 1 : -1];
+
+const char *spow_verify_strerror(int result) {
+    switch (result) {
+    case SPOW_VERIFY_PENDING:
+        return "Incomplete";
+    case SPOW_VERIFY_OK:
+        return "Valid";
+    case SPOW_VERIFY_BAD_PARAMS:
+        return "Bad parameters";
+    case SPOW_VERIFY_BAD_LENGTH:
+        return "Bad length";
+    case SPOW_VERIFY_BAD_PADDING:
+        return "Bad padding";
+    case SPOW_VERIFY_BAD_STEP:
+        return "Not enough zeros in some step";
+    case SPOW_VERIFY_BAD_ENCODING:
+        return "Bad compact encoding";
+    case SPOW_VERIFY_BAD_CONTEXT:
+        return "Bad challenge context";
+    case SPOW_VERIFY_EXPIRED:
+        return "Challenge expired";
+    default:
+        return "Unknown result";
+    }
+}
+
+/* Everything that can be checked without hashing. */
+static int check_shape(uint32_t difficulty, uint32_t safety, uint32_t steps, size_t cert_size) {
+    const uint64_t bits_per_step = (uint64_t)difficulty + safety;
+    if (bits_per_step < 1 || bits_per_step > 64 || steps < 1) {
+        return SPOW_VERIFY_BAD_PARAMS;
+    }
+    const uint64_t bits = bits_per_step * steps;
+    if (cert_size != (bits + 7) / 8) {
+        return SPOW_VERIFY_BAD_LENGTH;
+    }
+    return SPOW_VERIFY_OK;
+}
+
+static int check_padding(uint32_t difficulty, uint32_t safety, uint32_t steps,
+                         const unsigned char *cert, size_t cert_size) {
+    const uint32_t remaining = (uint32_t)((8 - (((uint64_t)difficulty + safety) * steps) % 8) % 8);
+    if (cert[cert_size - 1] & ((1u << remaining) - 1)) {
+        return SPOW_VERIFY_BAD_PADDING;
+    }
+    return SPOW_VERIFY_OK;
+}
+
+static void fill_block(uint32_t block[SPOW_SHA256_BLOCK_WORDS],
+                       const uint32_t last_hash[SPOW_SHA256_STATE_WORDS],
+                       uint64_t nonce,
+                       const uint32_t token[2],
+                       uint32_t step) {
+    memcpy(&block[W_LAST_HASH], last_hash, SPOW_SHA256_STATE_WORDS * sizeof(uint32_t));
+    block[W_NONCE_HI] = (uint32_t)(nonce >> 32);
+    block[W_NONCE_LO] = (uint32_t)nonce;
+    block[W_TOKEN] = token[0];
+    block[W_TOKEN + 1] = token[1];
+    block[W_STEP] = step;
+    memcpy(&block[W_PAD], SPOW_SHA256_PAD, sizeof(SPOW_SHA256_PAD));
+}
+
+/* Whether the first 'difficulty' bits of the digest are zero. */
+static int check_difficulty(const uint32_t digest[SPOW_SHA256_STATE_WORDS], uint32_t difficulty) {
+    uint32_t i = 0;
+    for (; difficulty >= 32; ++i, difficulty -= 32) {
+        if (digest[i] != 0) {
+            return 0;
+        }
+    }
+    return difficulty == 0 || (digest[i] >> (32 - difficulty)) == 0;
+}
+
+static void load_words(uint32_t *words, const unsigned char *bytes, size_t num_words) {
+    for (size_t i = 0; i < num_words; ++i) {
+        uint32_t word;
+        memcpy(&word, bytes + 4 * i, sizeof(word));
+        words[i] = pe_be32toh(word);
+    }
+}
+
+int spow_verify_precheck(uint32_t difficulty,
+                         uint32_t safety,
+                         uint32_t steps,
+                         const unsigned char *cert,
+                         size_t cert_size) {
+    const int result = check_shape(difficulty, safety, steps, cert_size);
+    if (result != SPOW_VERIFY_OK) {
+        return result;
+    }
+    return check_padding(difficulty, safety, steps, cert, cert_size);
+}
+
+/* Everything up to the first hash. */
+static int start_job(const spow_verify_job_t *job,
+                     uint32_t last_hash[SPOW_SHA256_STATE_WORDS],
+                     uint32_t token[2]) {
+    const int result = spow_verify_precheck(job->difficulty, job->safety, job->steps,
+                                            job->cert, job->cert_size);
+    load_words(last_hash, job->init_hash, SPOW_SHA256_STATE_WORDS);
+    load_words(token, job->token, 2);
+    return result;
+}
+
+/* All steps of a certificate, or of an extension whose first step is
+ * 'first_step'.  Always inlined, so that each call with a constant 'get'
+ * becomes a loop specialized for that nonce width. */
+static inline __attribute__((always_inline))
+int verify_steps(const spow_verify_job_t *job,
+                 uint32_t last_hash[SPOW_SHA256_STATE_WORDS],
+                 const uint32_t token[2],
+                 uint32_t first_step,
+                 spow_nonce_get_fn get) {
+    const uint32_t bits = job->difficulty + job->safety;
+    for (uint32_t step = 0; step < job->steps; ++step) {
+        const uint64_t nonce = get(job->cert, job->cert_size, bits, step);
+        uint32_t block[SPOW_SHA256_BLOCK_WORDS];
+        fill_block(block, last_hash, nonce, token, first_step + step);
+        memcpy(last_hash, SPOW_SHA256_IV, sizeof(SPOW_SHA256_IV));
+        spow_sha256_compress(last_hash, block);
+        if (!check_difficulty(last_hash, job->difficulty)) {
+            return SPOW_VERIFY_BAD_STEP;
+        }
+    }
+    return SPOW_VERIFY_OK;
+}
+
+/* verify_steps() for any nonce width */
+static int verify_steps_any(const spow_verify_job_t *job,
+                            uint32_t last_hash[SPOW_SHA256_STATE_WORDS],
+                            const uint32_t token[2],
+                            uint32_t first_step) {
+    switch (job->difficulty + job->safety) {
+    case 16:
+        return verify_steps(job, last_hash, token, first_step, spow_nonce_get_16);
+    case 20:
+        return verify_steps(job, last_hash, token, first_step, spow_nonce_get_20);
+    case 24:
+        return verify_steps(job, last_hash, token, first_step, spow_nonce_get_24);
+    case 32:
+        return verify_steps(job, last_hash, token, first_step, spow_nonce_get_32);
+    default:
+        return verify_steps(job, last_hash, token, first_step, spow_nonce_get_any);
+    }
+}
+
+int spow_verify(const unsigned char *init_hash,
+                const unsigned char *token,
+                uint32_t difficulty,
+                uint32_t safety,
+                uint32_t steps,
+                const unsigned char *cert,
+                size_t cert_size) {
+    spow_verify_job_t job = {init_hash, token, difficulty, safety, steps, cert, cert_size, 0};
+    uint32_t last_hash[SPOW_SHA256_STATE_WORDS];
+    uint32_t token_words[2];
+    const int result = start_job(&job, last_hash, token_words);
+    if (result != SPOW_VERIFY_OK) {
+        return result;
+    }
+    return verify_steps_any(&job, last_hash, token_words, 0);
+}
+
+static void store_words(unsigned char *bytes, const uint32_t *words, size_t num_words) {
+    for (size_t i = 0; i < num_words; ++i) {
+        const uint32_t word = pe_htobe32(words[i]);
+        memcpy(bytes + 4 * i, &word, sizeof(word));
+    }
+}
+
+int spow_verify_explain(const unsigned char *init_hash,
+                        const unsigned char *token,
+                        uint32_t difficulty,
+                        uint32_t safety,
+                        uint32_t steps,
+                        const unsigned char *cert,
+                        size_t cert_size,
+                        uint32_t *failed_step,
+                        unsigned char failed_input[SPOW_VERIFY_STEP_INPUT_BYTES]) {
+    spow_verify_job_t job = {init_hash, token, difficulty, safety, steps, cert, cert_size, 0};
+    uint32_t last_hash[SPOW_SHA256_STATE_WORDS];
+    uint32_t token_words[2];
+    const int result = start_job(&job, last_hash, token_words);
+    if (result != SPOW_VERIFY_OK) {
+        return result;
+    }
+    /* verify_steps(), but keeping the block of the failed step */
+    const uint32_t bits = difficulty + safety;
+    for (uint32_t step = 0; step < steps; ++step) {
+        uint32_t block[SPOW_SHA256_BLOCK_WORDS];
+        fill_block(block, last_hash, spow_nonce_get_any(cert, cert_size, bits, step),
+                   token_words, step);
+        memcpy(last_hash, SPOW_SHA256_IV, sizeof(SPOW_SHA256_IV));
+        spow_sha256_compress(last_hash, block);
+        if (!check_difficulty(last_hash, difficulty)) {
+            *failed_step = step;
+            store_words(failed_input, block, W_PAD);
+            return SPOW_VERIFY_BAD_STEP;
+        }
+    }
+    return SPOW_VERIFY_OK;
+}
+
+int spow_verify_chain_start(spow_verify_chain_t *chain,
+                            const unsigned char *init_hash,
+                            const unsigned char *token,
+                            uint32_t difficulty,
+                            uint32_t safety,
+                            uint32_t steps,
+                            const unsigned char *cert,
+                            size_t cert_size) {
+    spow_verify_job_t job = {init_hash, token, difficulty, safety, steps, cert, cert_size, 0};
+    uint32_t last_hash[SPOW_SHA256_STATE_WORDS];
+    uint32_t token_words[2];
+    int result = start_job(&job, last_hash, token_words);
+    if (result == SPOW_VERIFY_OK) {
+        result = verify_steps_any(&job, last_hash, token_words, 0);
+    }
+    if (result == SPOW_VERIFY_OK) {
+        store_words(chain->last_hash, last_hash, SPOW_SHA256_STATE_WORDS);
+        memcpy(chain->token, token, SPOW_VERIFY_TOKEN_BYTES);
+        chain->steps = steps;
+    }
+    return result;
+}
+
+int spow_verify_chain_extend(spow_verify_chain_t *chain,
+                             uint32_t difficulty,
+                             uint32_t safety,
+                             uint32_t steps,
+                             const unsigned char *extension,
+                             size_t extension_size) {
+    /* Step indices are 32 bits. */
+    if (steps > UINT32_MAX - chain->steps) {
+        return SPOW_VERIFY_BAD_PARAMS;
+    }
+    /* Checked exactly like a certificate of 'steps' steps, only starting
+     * from the chain's last hash and step. */
+    spow_verify_job_t job = {chain->last_hash, chain->token, difficulty, safety, steps,
+        extension, extension_size, 0};
+    uint32_t last_hash[SPOW_SHA256_STATE_WORDS];
+    uint32_t token_words[2];
+    int result = start_job(&job, last_hash, token_words);
+    if (result == SPOW_VERIFY_OK) {
+        result = verify_steps_any(&job, last_hash, token_words, chain->steps);
+    }
+    if (result == SPOW_VERIFY_OK) {
+        store_words(chain->last_hash, last_hash, SPOW_SHA256_STATE_WORDS);
+        chain->steps += steps;
+    }
+    return result;
+}
+
+int spow_verify_compact(const unsigned char *init_hash,
+                        const unsigned char *token,
+                        uint32_t difficulty,
+                        uint32_t safety,
+                        uint32_t steps,
+                        const unsigned char *compact,
+                        size_t compact_size) {
+    const uint64_t bits_per_step = (uint64_t)difficulty + safety;
+    if (bits_per_step < 1 || bits_per_step > 64 || steps < 1) {
+        return SPOW_VERIFY_BAD_PARAMS;
+    }
+    /* The cap comes first, so that junk costs nothing. */
+    if (compact_size < SPOW_COMPACT_HEADER_BYTES
+            || compact_size > spow_compact_max_size(difficulty, safety, steps)) {
+        return SPOW_VERIFY_BAD_LENGTH;
+    }
+    if (compact[0] != SPOW_COMPACT_VERSION) {
+        return SPOW_VERIFY_BAD_ENCODING;
+    }
+
+    uint32_t last_hash[SPOW_SHA256_STATE_WORDS];
+    uint32_t token_words[2];
+    load_words(last_hash, init_hash, SPOW_SHA256_STATE_WORDS);
+    load_words(token_words, token, 2);
+    spow_compact_reader_t reader = {compact, compact_size, SPOW_COMPACT_HEADER_BYTES * 8};
+    const uint64_t end = (uint64_t)compact_size * 8;
+    for (uint32_t step = 0; step < steps; ++step) {
+        uint64_t nonce;
+        if (!spow_compact_next(&reader, difficulty, safety, &nonce)) {
+            return SPOW_VERIFY_BAD_ENCODING;
+        }
+        if (reader.pos > end) {
+            return SPOW_VERIFY_BAD_LENGTH;
+        }
+        uint32_t block[SPOW_SHA256_BLOCK_WORDS];
+        fill_block(block, last_hash, nonce, token_words, step);
+        memcpy(last_hash, SPOW_SHA256_IV, sizeof(SPOW_SHA256_IV));
+        spow_sha256_compress(last_hash, block);
+        if (!check_difficulty(last_hash, difficulty)) {
+            return SPOW_VERIFY_BAD_STEP;
+        }
+    }
+    /* Only the padding of the last byte may be left, and it must be zero. */
+    if ((end - reader.pos) >= 8) {
+        return SPOW_VERIFY_BAD_LENGTH;
+    }
+    if (spow_compact_peek(&reader, reader.pos) != 0) {
+        return SPOW_VERIFY_BAD_PADDING;
+    }
+    return SPOW_VERIFY_OK;
+}
+
+/* One lane of spow_verify_batch(), i.e. one certificate in progress. */
+typedef struct lane_t {
+    spow_verify_job_t *job;
+    /* For this certificate's nonce width */
+    spow_nonce_get_fn get;
+    uint32_t last_hash[SPOW_SHA256_STATE_WORDS];
+    uint32_t token[2];
+    uint32_t step;
+} lane_t;
+
+void spow_verify_batch(spow_verify_job_t *jobs, size_t jobs_num) {
+    const spow_kernel_t *kernel = spow_kernel_best_multi();
+    if (kernel == NULL) {
+        for (size_t i = 0; i < jobs_num; ++i) {
+            spow_verify_job_t *job = &jobs[i];
+            job->result = spow_verify(job->init_hash, job->token, job->difficulty, job->safety,
+                                      job->steps, job->cert, job->cert_size);
+        }
+        return;
+    }
+
+    const unsigned int lanes_num = kernel->multi_lanes;
+    lane_t lanes[SPOW_SHA256_MULTI_LANES_MAX];
+    uint32_t block[SPOW_SHA256_BLOCK_WORDS][SPOW_SHA256_MULTI_LANES_MAX];
+    uint32_t digest[SPOW_SHA256_STATE_WORDS][SPOW_SHA256_MULTI_LANES_MAX];
+    /* Idle lanes are hashed too, so they must at least be initialized. */
+    memset(block, 0, sizeof(block));
+    unsigned int active = 0;
+    size_t next = 0;
+
+    for (;;) {
+        /* Give each idle lane the next certificate that needs hashing. */
+        for (unsigned int i = 0; i < lanes_num && next < jobs_num; ++i) {
+            if ((active >> i) & 1) {
+                continue;
+            }
+            while (next < jobs_num) {
+                lane_t *lane = &lanes[i];
+                lane->job = &jobs[next++];
+                lane->job->result = start_job(lane->job, lane->last_hash, lane->token);
+                if (lane->job->result == SPOW_VERIFY_OK) {
+                    lane->get = spow_nonce_get_for(lane->job->difficulty + lane->job->safety);
+                    lane->step = 0;
+                    active |= 1u << i;
+                    break;
+                }
+            }
+        }
+        if (active == 0) {
+            return;
+        }
+
+        for (unsigned int i = 0; i < lanes_num; ++i) {
+            if (!((active >> i) & 1)) {
+                continue;
+            }
+            const lane_t *lane = &lanes[i];
+            const uint32_t bits = lane->job->difficulty + lane->job->safety;
+            const uint64_t nonce = lane->get(lane->job->cert, lane->job->cert_size, bits, lane->step);
+            uint32_t lane_block[SPOW_SHA256_BLOCK_WORDS];
+            fill_block(lane_block, lane->last_hash, nonce, lane->token, lane->step);
+            for (int t = 0; t < SPOW_SHA256_BLOCK_WORDS; ++t) {
+                block[t][i] = lane_block[t];
+            }
+        }
+
+        kernel->hash_lanes(digest, (const uint32_t (*)[SPOW_SHA256_MULTI_LANES_MAX])block);
+
+        for (unsigned int i = 0; i < lanes_num; ++i) {
+            if (!((active >> i) & 1)) {
+                continue;
+            }
+            lane_t *lane = &lanes[i];
+            for (int j = 0; j < SPOW_SHA256_STATE_WORDS; ++j) {
+                lane->last_hash[j] = digest[j][i];
+            }
+            if (!check_difficulty(lane->last_hash, lane->job->difficulty)) {
+                lane->job->result = SPOW_VERIFY_BAD_STEP;
+                active &= ~(1u << i);
+                continue;
+            }
+            lane->step += 1;
+            if (lane->step == lane->job->steps) {
+                active &= ~(1u << i);
+            }
+        }
+    }
+}
+
+int spow_verify_stream_init(spow_verify_stream_t *stream,
+                            const unsigned char *init_hash,
+                            const unsigned char *token,
+                            uint32_t difficulty,
+                            uint32_t safety,
+                            uint32_t steps) {
+    memset(stream, 0, sizeof(*stream));
+    stream->difficulty = difficulty;
+    stream->safety = safety;
+    stream->steps = steps;
+    load_words(stream->last_hash, init_hash, SPOW_SHA256_STATE_WORDS);
+    load_words(stream->token, token, 2);
+    const uint64_t bits_per_step = (uint64_t)difficulty + safety;
+    if (bits_per_step < 1 || bits_per_step > 64 || steps < 1) {
+        stream->result = SPOW_VERIFY_BAD_PARAMS;
+        return stream->result;
+    }
+    stream->cert_size = (size_t)((bits_per_step * steps + 7) / 8);
+    stream->result = SPOW_VERIFY_PENDING;
+    return stream->result;
+}
+
+/* Consume one byte, most significant bit first. */
+static int stream_byte(spow_verify_stream_t *stream, unsigned char byte) {
+    const uint32_t bits = stream->difficulty + stream->safety;
+    uint32_t byte_bits = 8;
+    while (byte_bits > 0) {
+        if (stream->step == stream->steps) {
+            /* Only padding is left, which must be zero. */
+            if (byte & ((1u << byte_bits) - 1)) {
+                return SPOW_VERIFY_BAD_PADDING;
+            }
+            return SPOW_VERIFY_PENDING;
+        }
+        uint32_t take = bits - stream->nonce_bits;
+        if (take > byte_bits) {
+            take = byte_bits;
+        }
+        const uint32_t chunk = (byte >> (byte_bits - take)) & ((1u << take) - 1);
+        /* nonce_bits + take <= bits <= 64, so nothing is shifted out. */
+        stream->nonce = (stream->nonce << take) | chunk;
+        stream->nonce_bits += take;
+        byte_bits -= take;
+        if (stream->nonce_bits < bits) {
+            continue;
+        }
+
+        uint32_t block[SPOW_SHA256_BLOCK_WORDS];
+        fill_block(block, stream->last_hash, stream->nonce, stream->token, stream->step);
+        memcpy(stream->last_hash, SPOW_SHA256_IV, sizeof(SPOW_SHA256_IV));
+        spow_sha256_compress(stream->last_hash, block);
+        if (!check_difficulty(stream->last_hash, stream->difficulty)) {
+            return SPOW_VERIFY_BAD_STEP;
+        }
+        stream->step += 1;
+        stream->nonce = 0;
+        stream->nonce_bits = 0;
+    }
+    return SPOW_VERIFY_PENDING;
+}
+
+int spow_verify_stream_push(spow_verify_stream_t *stream,
+                            const unsigned char *data,
+                            size_t size) {
+    if (stream->result == SPOW_VERIFY_OK && size > 0) {
+        stream->result = SPOW_VERIFY_BAD_LENGTH;
+    }
+    if (stream->result != SPOW_VERIFY_PENDING) {
+        return stream->result;
+    }
+    /* Reject oversized certificates before even looking at them. */
+    if (size > stream->cert_size - stream->received) {
+        stream->result = SPOW_VERIFY_BAD_LENGTH;
+        return stream->result;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        const int result = stream_byte(stream, data[i]);
+        if (result != SPOW_VERIFY_PENDING) {
+            stream->result = result;
+            return stream->result;
+        }
+    }
+    stream->received += size;
+    if (stream->received == stream->cert_size) {
+        stream->result = SPOW_VERIFY_OK;
+    }
+    return stream->result;
+}
+
+int spow_verify_stream_finish(spow_verify_stream_t *stream) {
+    if (stream->result == SPOW_VERIFY_PENDING) {
+        stream->result = SPOW_VERIFY_BAD_LENGTH;
+    }
+    return stream->result;
+}
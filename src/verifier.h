@@ -0,0 +1,198 @@
+/* libsteppow: Verifying certificates in C.
+ *
+ * This checks exactly what try_verify() in verify.py checks, but without
+ * the overhead of Python: the certificate length, the padding bits, and for
+ * each step whether the hash has enough leading zeros.
+ *
+ * spow_verify_batch() verifies many certificates at once: Each SIMD lane
+ * works on a different certificate, so one SHA-256 call computes a step of
+ * up to 16 certificates.  Whenever a certificate is done (or has failed),
+ * its lane gets the next one.
+ *
+ * spow_verify_stream_t verifies a certificate while it arrives, e.g. from a
+ * socket: Each step is checked as soon as its bits are there, so garbage
+ * is rejected after the first bad step, and nothing needs to be buffered.
+ *
+ * spow_verify_compact() takes certificates in the optional compact format
+ * instead, see compact.h.
+ *
+ * spow_verify_chain_t remembers where an accepted certificate ended, so that
+ * it can be extended with more steps later, and only those are verified. */
+
+#ifndef STEPPOW_VERIFIER_H
+#define STEPPOW_VERIFIER_H
+
+#include <stddef.h> /* size_t */
+#include <stdint.h>
+
+#define SPOW_VERIFY_INIT_HASH_BYTES 32
+#define SPOW_VERIFY_TOKEN_BYTES 8
+/* last_hash || nonce || token || step, the input of each step's hash */
+#define SPOW_VERIFY_STEP_INPUT_BYTES 52
+
+/* Results */
+/* Only for spow_verify_stream_t: Good so far, but needs more bytes. */
+#define SPOW_VERIFY_PENDING (-1)
+#define SPOW_VERIFY_OK 0
+/* Difficulty + Safety must be between 1 and 64, and Steps at least 1. */
+#define SPOW_VERIFY_BAD_PARAMS 1
+/* Also: more bytes were pushed than the certificate can have. */
+#define SPOW_VERIFY_BAD_LENGTH 2
+/* The unused bits after the last nonce must be zero. */
+#define SPOW_VERIFY_BAD_PADDING 3
+/* Some step doesn't have enough zeros. */
+#define SPOW_VERIFY_BAD_STEP 4
+/* Only for compact certificates: An unknown version, or a nonce that is
+ * wider than Difficulty + Safety bits. */
+#define SPOW_VERIFY_BAD_ENCODING 5
+/* Only for spow_challenge_verify(), see challenge.h: A context with the
+ * wrong size or version, or a challenge that is too old. */
+#define SPOW_VERIFY_BAD_CONTEXT 6
+#define SPOW_VERIFY_EXPIRED 7
+
+/* A human-readable description of a result. */
+const char *spow_verify_strerror(int result);
+
+/* Returns SPOW_VERIFY_OK iff 'cert' is a valid certificate for these
+ * parameters.  init_hash has SPOW_VERIFY_INIT_HASH_BYTES bytes, token has
+ * SPOW_VERIFY_TOKEN_BYTES bytes. */
+int spow_verify(const unsigned char *init_hash,
+                const unsigned char *token,
+                uint32_t difficulty,
+                uint32_t safety,
+                uint32_t steps,
+                const unsigned char *cert,
+                size_t cert_size);
+
+/* The same, and if a step doesn't have enough zeros, also which one, and
+ * what was hashed for it, e.g. to print it as verify.py does.  Slower than
+ * spow_verify(), so only call it for a certificate that it rejected.
+ * 'failed_step' and 'failed_input' are only set for SPOW_VERIFY_BAD_STEP. */
+int spow_verify_explain(const unsigned char *init_hash,
+                        const unsigned char *token,
+                        uint32_t difficulty,
+                        uint32_t safety,
+                        uint32_t steps,
+                        const unsigned char *cert,
+                        size_t cert_size,
+                        uint32_t *failed_step,
+                        unsigned char failed_input[SPOW_VERIFY_STEP_INPUT_BYTES]);
+
+/* Only the checks that don't need any hashing: the parameters, the length
+ * and the padding bits.  Returns SPOW_VERIFY_OK if the certificate is worth
+ * hashing, i.e. if spow_verify() might accept it.  Costs nothing compared to
+ * a single step, so use it to turn away junk before queueing it. */
+int spow_verify_precheck(uint32_t difficulty,
+                         uint32_t safety,
+                         uint32_t steps,
+                         const unsigned char *cert,
+                         size_t cert_size);
+
+/* The same for a certificate in the compact format (see compact.h), which
+ * is decoded step by step while verifying.  Certificates longer than
+ * spow_compact_max_size() are rejected before anything is decoded.  Gives
+ * the same result as spow_verify() on the fixed-width certificate, except
+ * for malformed encodings. */
+int spow_verify_compact(const unsigned char *init_hash,
+                        const unsigned char *token,
+                        uint32_t difficulty,
+                        uint32_t safety,
+                        uint32_t steps,
+                        const unsigned char *compact,
+                        size_t compact_size);
+
+typedef struct spow_verify_job_t {
+    const unsigned char *init_hash;
+    const unsigned char *token;
+    uint32_t difficulty;
+    uint32_t safety;
+    uint32_t steps;
+    const unsigned char *cert;
+    size_t cert_size;
+    /* Output: Same as the return value of spow_verify() */
+    int result;
+} spow_verify_job_t;
+
+/* Verify all jobs, and set their 'result'. */
+void spow_verify_batch(spow_verify_job_t *jobs, size_t jobs_num);
+
+/* An accepted certificate that may be extended later, e.g. to raise the cost
+ * for a suspicious client: Each step only depends on the hash before it and
+ * its index, so more steps can follow the last one (see find_cert_extend()).
+ * This keeps the hash of the last step instead of the certificate, so the
+ * new steps are verified without the old ones, with as many hashes as there
+ * are new steps. */
+typedef struct spow_verify_chain_t {
+    unsigned char last_hash[SPOW_VERIFY_INIT_HASH_BYTES];
+    unsigned char token[SPOW_VERIFY_TOKEN_BYTES];
+    /* Accepted so far */
+    uint32_t steps;
+} spow_verify_chain_t;
+
+/* The same as spow_verify(), and if the certificate is valid, also start
+ * 'chain' with it.  Otherwise 'chain' is left alone. */
+int spow_verify_chain_start(spow_verify_chain_t *chain,
+                            const unsigned char *init_hash,
+                            const unsigned char *token,
+                            uint32_t difficulty,
+                            uint32_t safety,
+                            uint32_t steps,
+                            const unsigned char *cert,
+                            size_t cert_size);
+
+/* Verify 'steps' more steps, which follow the last accepted one.  The
+ * extension has the nonces of only these steps, and exactly the size and
+ * padding of a certificate of 'steps' steps; Difficulty and Safety may
+ * differ from the ones before.  With the same ones, the certificate and its
+ * extension together are the certificate for all steps, bit by bit.  If the
+ * extension is valid, the chain now ends with it.  Otherwise the chain is
+ * left alone, and the result says why, as for spow_verify(). */
+int spow_verify_chain_extend(spow_verify_chain_t *chain,
+                             uint32_t difficulty,
+                             uint32_t safety,
+                             uint32_t steps,
+                             const unsigned char *extension,
+                             size_t extension_size);
+
+typedef struct spow_verify_stream_t {
+    uint32_t last_hash[8];
+    uint32_t token[2];
+    uint32_t difficulty;
+    uint32_t safety;
+    uint32_t steps;
+    size_t cert_size;
+    size_t received;
+    /* The next step to check */
+    uint32_t step;
+    /* The first 'nonce_bits' bits of the current step's nonce */
+    uint64_t nonce;
+    uint32_t nonce_bits;
+    int result;
+} spow_verify_stream_t;
+
+/* Start verifying a certificate for these parameters.  Returns
+ * SPOW_VERIFY_PENDING, or SPOW_VERIFY_BAD_PARAMS.  No cleanup needed. */
+int spow_verify_stream_init(spow_verify_stream_t *stream,
+                            const unsigned char *init_hash,
+                            const unsigned char *token,
+                            uint32_t difficulty,
+                            uint32_t safety,
+                            uint32_t steps);
+
+/* Feed the next 'size' bytes of the certificate.  Returns
+ * SPOW_VERIFY_PENDING if everything so far is good and more is needed,
+ * SPOW_VERIFY_OK if the certificate is complete and valid, or the reason
+ * why it is invalid.  Once it isn't SPOW_VERIFY_PENDING, the result is
+ * final, and further pushes only return it again (or SPOW_VERIFY_BAD_LENGTH
+ * for more bytes after a complete certificate).
+ * The result is the same as with spow_verify() on the whole certificate,
+ * except that which error is reported may differ. */
+int spow_verify_stream_push(spow_verify_stream_t *stream,
+                            const unsigned char *data,
+                            size_t size);
+
+/* The end of the certificate.  Returns the final result, which is
+ * SPOW_VERIFY_BAD_LENGTH if the certificate is incomplete. */
+int spow_verify_stream_finish(spow_verify_stream_t *stream);
+
+#endif /* STEPPOW_VERIFIER_H */
@@ -0,0 +1,421 @@
+#include "verify-queue.h"
+
+#include <pthread.h>
+#include <stdlib.h> /* calloc, free */
+
+#include "kernel.h" /* spow_now_ns */
+
+/* Jobs per worker per round, at most one spow_verify_batch() call's worth */
+#define TAKE_MAX 16
+/* Idle sources to look at for one that can be forgotten, oldest first */
+#define EVICT_SCAN 8
+
+typedef struct source_t {
+    uint64_t id;
+    /* Hash table chain */
+    struct source_t *next;
+    /* Active list, i.e. sources with queued jobs */
+    struct source_t *next_active;
+    /* Idle list, i.e. sources with nothing queued, least recently used first */
+    struct source_t *idle_prev;
+    struct source_t *idle_next;
+    /* Ring buffer of max_queued jobs */
+    spow_verify_job_t **jobs;
+    size_t head;
+    size_t size;
+    /* Deficit round robin, in hashes */
+    uint64_t deficit;
+    /* Token bucket, in hashes */
+    double budget;
+    uint64_t budget_ns;
+} source_t;
+
+struct spow_vqueue_t {
+    spow_vqueue_config_t config;
+    spow_vqueue_done_fn done;
+    void *done_ctx;
+    pthread_t *workers;
+    unsigned int workers_started;
+
+    pthread_mutex_t lock;
+    /* Signalled when a source becomes active (or on shutdown) */
+    pthread_cond_t wake;
+    int shutdown;
+    source_t **buckets;
+    size_t buckets_num;
+    source_t *active_head;
+    source_t *active_tail;
+    size_t active_num;
+    source_t *idle_head;
+    source_t *idle_tail;
+    spow_vqueue_stats_t stats;
+};
+
+void spow_vqueue_config_default(spow_vqueue_config_t *config) {
+    config->threads = 1;
+    config->max_queued = 64;
+    config->budget_per_second = 1000000;
+    config->budget_burst = 1000000;
+    config->max_sources = 4096;
+    config->quantum = 4096;
+}
+
+static size_t bucket_of(const spow_vqueue_t *queue, uint64_t id) {
+    /* Fibonacci hashing; buckets_num is a power of two. */
+    return (size_t)((id * 0x9E3779B97F4A7C15ull) >> 32) & (queue->buckets_num - 1);
+}
+
+static source_t *find_source(const spow_vqueue_t *queue, uint64_t id) {
+    for (source_t *source = queue->buckets[bucket_of(queue, id)]; source != NULL; source = source->next) {
+        if (source->id == id) {
+            return source;
+        }
+    }
+    return NULL;
+}
+
+static void refill(const spow_vqueue_t *queue, source_t *source, uint64_t now) {
+    if (now <= source->budget_ns) {
+        return;
+    }
+    const double burst = (double)queue->config.budget_burst;
+    source->budget += (double)(now - source->budget_ns) * 1e-9 * (double)queue->config.budget_per_second;
+    if (source->budget > burst) {
+        source->budget = burst;
+    }
+    source->budget_ns = now;
+}
+
+static void free_source(source_t *source) {
+    free(source->jobs);
+    free(source);
+}
+
+static void push_idle(spow_vqueue_t *queue, source_t *source) {
+    source->idle_prev = queue->idle_tail;
+    source->idle_next = NULL;
+    if (queue->idle_tail != NULL) {
+        queue->idle_tail->idle_next = source;
+    } else {
+        queue->idle_head = source;
+    }
+    queue->idle_tail = source;
+}
+
+static void remove_idle(spow_vqueue_t *queue, source_t *source) {
+    if (source->idle_prev != NULL) {
+        source->idle_prev->idle_next = source->idle_next;
+    } else {
+        queue->idle_head = source->idle_next;
+    }
+    if (source->idle_next != NULL) {
+        source->idle_next->idle_prev = source->idle_prev;
+    } else {
+        queue->idle_tail = source->idle_prev;
+    }
+}
+
+/* Forget one source that is as good as new: nothing queued, full budget.
+ * The ones idle for longest have refilled the most, so only a few of those
+ * are looked at, which keeps this cheap under the lock. */
+static int evict_idle_source(spow_vqueue_t *queue, uint64_t now) {
+    source_t *source = queue->idle_head;
+    for (size_t i = 0; i < EVICT_SCAN && source != NULL; ++i, source = source->idle_next) {
+        refill(queue, source, now);
+        if (source->budget < (double)queue->config.budget_burst) {
+            continue;
+        }
+        source_t **link = &queue->buckets[bucket_of(queue, source->id)];
+        while (*link != source) {
+            link = &(*link)->next;
+        }
+        *link = source->next;
+        remove_idle(queue, source);
+        free_source(source);
+        queue->stats.sources -= 1;
+        return 1;
+    }
+    return 0;
+}
+
+static source_t *get_source(spow_vqueue_t *queue, uint64_t id, uint64_t now) {
+    source_t *source = find_source(queue, id);
+    if (source != NULL) {
+        refill(queue, source, now);
+        if (source->size == 0) {
+            remove_idle(queue, source);
+        }
+        return source;
+    }
+    if (queue->stats.sources >= queue->config.max_sources && !evict_idle_source(queue, now)) {
+        return NULL;
+    }
+    source = calloc(1, sizeof(*source));
+    if (source == NULL) {
+        return NULL;
+    }
+    source->jobs = calloc(queue->config.max_queued, sizeof(source->jobs[0]));
+    if (source->jobs == NULL) {
+        free(source);
+        return NULL;
+    }
+    source->id = id;
+    source->budget = (double)queue->config.budget_burst;
+    source->budget_ns = now;
+    const size_t bucket = bucket_of(queue, id);
+    source->next = queue->buckets[bucket];
+    queue->buckets[bucket] = source;
+    queue->stats.sources += 1;
+    return source;
+}
+
+static void push_active(spow_vqueue_t *queue, source_t *source) {
+    source->next_active = NULL;
+    if (queue->active_tail != NULL) {
+        queue->active_tail->next_active = source;
+    } else {
+        queue->active_head = source;
+    }
+    queue->active_tail = source;
+    queue->active_num += 1;
+}
+
+static source_t *pop_active(spow_vqueue_t *queue) {
+    source_t *source = queue->active_head;
+    queue->active_head = source->next_active;
+    if (queue->active_head == NULL) {
+        queue->active_tail = NULL;
+    }
+    queue->active_num -= 1;
+    return source;
+}
+
+static uint64_t job_cost(const spow_verify_job_t *job) {
+    return job->steps;
+}
+
+/* If no active source can be served in this round, skip ahead to the first
+ * round where one can, instead of going around (cost / quantum) times. */
+static void skip_rounds(spow_vqueue_t *queue) {
+    const uint64_t quantum = queue->config.quantum;
+    uint64_t rounds = UINT64_MAX;
+    for (const source_t *source = queue->active_head; source != NULL; source = source->next_active) {
+        const uint64_t cost = job_cost(source->jobs[source->head]);
+        const uint64_t missing = (cost > source->deficit) ? cost - source->deficit : 0;
+        const uint64_t needed = (missing + quantum - 1) / quantum;
+        if (needed < rounds) {
+            rounds = needed;
+        }
+    }
+    if (rounds <= 1) {
+        return;
+    }
+    for (source_t *source = queue->active_head; source != NULL; source = source->next_active) {
+        source->deficit += (rounds - 1) * quantum;
+    }
+}
+
+/* Deficit round robin: Take up to 'max' jobs.  Called with the lock held. */
+static size_t take_jobs(spow_vqueue_t *queue, spow_verify_job_t **out_jobs, size_t max) {
+    size_t taken = 0;
+    size_t visits_without_job = 0;
+    while (taken < max && queue->active_head != NULL) {
+        if (visits_without_job == queue->active_num) {
+            skip_rounds(queue);
+            visits_without_job = 0;
+        }
+        source_t *source = pop_active(queue);
+        spow_verify_job_t *job = source->jobs[source->head];
+        const uint64_t cost = job_cost(job);
+        if (source->deficit < cost) {
+            source->deficit += queue->config.quantum;
+        }
+        if (source->deficit >= cost) {
+            source->deficit -= cost;
+            source->head = (source->head + 1) % queue->config.max_queued;
+            source->size -= 1;
+            queue->stats.queued -= 1;
+            queue->stats.queued_hashes -= cost;
+            out_jobs[taken++] = job;
+            visits_without_job = 0;
+        } else {
+            visits_without_job += 1;
+        }
+        if (source->size != 0) {
+            push_active(queue, source);
+        } else {
+            /* Like in DRR: An idle source doesn't save up. */
+            source->deficit = 0;
+            push_idle(queue, source);
+        }
+    }
+    return taken;
+}
+
+static void *worker_main(void *arg) {
+    spow_vqueue_t *queue = arg;
+    spow_verify_job_t *taken[TAKE_MAX];
+    spow_verify_job_t jobs[TAKE_MAX];
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        while (queue->active_head == NULL && !queue->shutdown) {
+            pthread_cond_wait(&queue->wake, &queue->lock);
+        }
+        /* Leave some for the other workers, but batch under load. */
+        const unsigned int threads = queue->config.threads;
+        size_t max = (queue->stats.queued + threads - 1) / threads;
+        max = (max > TAKE_MAX) ? TAKE_MAX : max;
+        const size_t num = take_jobs(queue, taken, max ? max : 1);
+        /* submit() only wakes a worker when a source becomes active, so
+         * pass on whatever this one left. */
+        if (queue->active_head != NULL) {
+            pthread_cond_signal(&queue->wake);
+        }
+        pthread_mutex_unlock(&queue->lock);
+        if (num == 0) {
+            /* Shut down, and nothing left */
+            return NULL;
+        }
+
+        for (size_t i = 0; i < num; ++i) {
+            jobs[i] = *taken[i];
+        }
+        spow_verify_batch(jobs, num);
+
+        pthread_mutex_lock(&queue->lock);
+        for (size_t i = 0; i < num; ++i) {
+            if (jobs[i].result == SPOW_VERIFY_OK) {
+                queue->stats.valid += 1;
+            } else {
+                queue->stats.invalid += 1;
+            }
+            /* As charged to the budget; invalid ones may have stopped earlier. */
+            queue->stats.hashes += job_cost(&jobs[i]);
+        }
+        pthread_mutex_unlock(&queue->lock);
+        for (size_t i = 0; i < num; ++i) {
+            taken[i]->result = jobs[i].result;
+            queue->done(queue->done_ctx, taken[i], jobs[i].result);
+        }
+    }
+}
+
+spow_vqueue_t *spow_vqueue_create(const spow_vqueue_config_t *config,
+                                  spow_vqueue_done_fn done,
+                                  void *done_ctx) {
+    if (config->threads == 0 || config->max_queued == 0 || config->max_sources == 0
+            || config->quantum == 0) {
+        return NULL;
+    }
+    spow_vqueue_t *queue = calloc(1, sizeof(*queue));
+    if (queue == NULL) {
+        return NULL;
+    }
+    queue->config = *config;
+    queue->done = done;
+    queue->done_ctx = done_ctx;
+    queue->buckets_num = 16;
+    while (queue->buckets_num < config->max_sources) {
+        queue->buckets_num *= 2;
+    }
+    queue->buckets = calloc(queue->buckets_num, sizeof(queue->buckets[0]));
+    queue->workers = calloc(config->threads, sizeof(pthread_t));
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->wake, NULL);
+    if (queue->buckets == NULL || queue->workers == NULL) {
+        spow_vqueue_destroy(queue);
+        return NULL;
+    }
+    for (unsigned int i = 0; i < config->threads; ++i) {
+        if (0 != pthread_create(&queue->workers[i], NULL, worker_main, queue)) {
+            spow_vqueue_destroy(queue);
+            return NULL;
+        }
+        queue->workers_started += 1;
+    }
+    return queue;
+}
+
+void spow_vqueue_destroy(spow_vqueue_t *queue) {
+    if (queue == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&queue->lock);
+    queue->shutdown = 1;
+    pthread_cond_broadcast(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+    for (unsigned int i = 0; i < queue->workers_started; ++i) {
+        pthread_join(queue->workers[i], NULL);
+    }
+    for (size_t i = 0; queue->buckets != NULL && i < queue->buckets_num; ++i) {
+        while (queue->buckets[i] != NULL) {
+            source_t *source = queue->buckets[i];
+            queue->buckets[i] = source->next;
+            free_source(source);
+        }
+    }
+    pthread_cond_destroy(&queue->wake);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->buckets);
+    free(queue->workers);
+    free(queue);
+}
+
+static int reject(spow_vqueue_t *queue, const spow_verify_job_t *job, int reason) {
+    queue->stats.rejected[reason] += 1;
+    queue->stats.rejected_hashes += job_cost(job);
+    return reason;
+}
+
+int spow_vqueue_submit(spow_vqueue_t *queue, uint64_t source_id, spow_verify_job_t *job) {
+    /* Outside the lock, it only reads the job. */
+    job->result = spow_verify_precheck(job->difficulty, job->safety, job->steps,
+                                       job->cert, job->cert_size);
+    const uint64_t cost = job_cost(job);
+
+    pthread_mutex_lock(&queue->lock);
+    /* Under the lock, so that the sources' times never go back. */
+    const uint64_t now = spow_now_ns();
+    int result = SPOW_VQUEUE_ACCEPTED;
+    source_t *source = NULL;
+    if (job->result != SPOW_VERIFY_OK) {
+        result = reject(queue, job, SPOW_VQUEUE_REJECT_PRECHECK);
+    } else if ((source = get_source(queue, source_id, now)) == NULL) {
+        result = reject(queue, job, SPOW_VQUEUE_REJECT_SOURCES);
+    } else if (source->size == queue->config.max_queued) {
+        result = reject(queue, job, SPOW_VQUEUE_REJECT_FULL);
+    } else if (source->budget < (double)cost) {
+        result = reject(queue, job, SPOW_VQUEUE_REJECT_BUDGET);
+    } else {
+        source->budget -= (double)cost;
+        source->jobs[(source->head + source->size) % queue->config.max_queued] = job;
+        source->size += 1;
+        queue->stats.accepted += 1;
+        queue->stats.queued += 1;
+        queue->stats.queued_hashes += cost;
+        if (source->size == 1) {
+            push_active(queue, source);
+            pthread_cond_signal(&queue->wake);
+        }
+    }
+    /* get_source() took it off the idle list, in case it stays idle. */
+    if (source != NULL && source->size == 0) {
+        push_idle(queue, source);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return result;
+}
+
+void spow_vqueue_stats(spow_vqueue_t *queue, spow_vqueue_stats_t *out_stats) {
+    pthread_mutex_lock(&queue->lock);
+    *out_stats = queue->stats;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+size_t spow_vqueue_source_queued(spow_vqueue_t *queue, uint64_t source_id) {
+    pthread_mutex_lock(&queue->lock);
+    const source_t *source = find_source(queue, source_id);
+    const size_t queued = (source != NULL) ? source->size : 0;
+    pthread_mutex_unlock(&queue->lock);
+    return queued;
+}
@@ -0,0 +1,102 @@
+/* A verification service: Certificates from many sources (clients, IP
+ * addresses, ...) go into one queue, and worker threads verify them.
+ *
+ * Verifying costs Steps hashes per certificate, so a flood of maximal junk
+ * could keep the workers busy while honest clients wait.  Three things
+ * prevent that:
+ * - Pre-check: spow_verify_precheck() runs in spow_vqueue_submit() itself,
+ *   so certificates with a wrong length or padding never cost a hash.
+ * - Admission: Each source may have at most 'max_queued' certificates
+ *   waiting, and has a budget of hashes (Steps per certificate) that refills
+ *   at 'budget_per_second' up to 'budget_burst'.  Beyond that,
+ *   spow_vqueue_submit() rejects right away, instead of queueing.
+ * - Fairness: The workers serve the sources with deficit round robin,
+ *   weighted by hashes.  A source with a long queue of big certificates
+ *   only gets its share of the workers, so the latency for everybody else
+ *   is bounded by the number of busy sources, not by the flood.
+ *
+ * The queue does not copy the certificates: Everything a job points to must
+ * stay valid until its 'done' is called.  The counters in
+ * spow_vqueue_stats_t are meant for tuning the budgets from real traffic. */
+
+#ifndef STEPPOW_VERIFY_QUEUE_H
+#define STEPPOW_VERIFY_QUEUE_H
+
+#include <stddef.h> /* size_t */
+#include <stdint.h>
+
+#include "verifier.h"
+
+/* Results of spow_vqueue_submit() */
+#define SPOW_VQUEUE_ACCEPTED 0
+/* The pre-check failed; see the spow_verify_precheck() result. */
+#define SPOW_VQUEUE_REJECT_PRECHECK 1
+/* The source already has 'max_queued' certificates waiting. */
+#define SPOW_VQUEUE_REJECT_FULL 2
+/* The source has not enough budget left for Steps hashes. */
+#define SPOW_VQUEUE_REJECT_BUDGET 3
+/* Already 'max_sources' sources with queued work or a used budget. */
+#define SPOW_VQUEUE_REJECT_SOURCES 4
+
+typedef struct spow_vqueue_t spow_vqueue_t;
+
+/* Called by a worker thread when a job is verified, with the same result as
+ * spow_verify() would give. */
+typedef void (*spow_vqueue_done_fn)(void *ctx, spow_verify_job_t *job, int result);
+
+typedef struct spow_vqueue_config_t {
+    unsigned int threads;
+    /* Per source */
+    size_t max_queued;
+    uint64_t budget_per_second;
+    uint64_t budget_burst;
+    /* When a new source needs room, one that has nothing queued and a
+     * full budget again is forgotten (among the few idle for longest), so
+     * this only limits the sources that are active right now. */
+    size_t max_sources;
+    /* Hashes per round of deficit round robin.  Smaller is fairer, but
+     * costs more time under the lock. */
+    uint64_t quantum;
+} spow_vqueue_config_t;
+
+/* Sensible defaults: one thread, 64 queued and 10^6 hashes per second per
+ * source (1 second of burst), 4096 sources, and a quantum of 4096. */
+void spow_vqueue_config_default(spow_vqueue_config_t *config);
+
+typedef struct spow_vqueue_stats_t {
+    /* Right now */
+    size_t queued;
+    uint64_t queued_hashes;
+    size_t sources;
+    /* Since spow_vqueue_create() */
+    uint64_t accepted;
+    uint64_t valid;
+    uint64_t invalid;
+    uint64_t hashes;
+    /* Indexed by SPOW_VQUEUE_REJECT_* */
+    uint64_t rejected[SPOW_VQUEUE_REJECT_SOURCES + 1];
+    /* Steps of the rejected certificates, i.e. hashes not spent */
+    uint64_t rejected_hashes;
+} spow_vqueue_stats_t;
+
+/* Start the worker threads.  Returns NULL on failure. */
+spow_vqueue_t *spow_vqueue_create(const spow_vqueue_config_t *config,
+                                  spow_vqueue_done_fn done,
+                                  void *done_ctx);
+
+/* Verify all accepted jobs, then stop the threads. */
+void spow_vqueue_destroy(spow_vqueue_t *queue);
+
+/* Queue 'job' for verification on behalf of 'source'.  Thread-safe and
+ * never blocks on the workers.  Returns SPOW_VQUEUE_ACCEPTED, in which case
+ * 'done' will be called for it, or one of the SPOW_VQUEUE_REJECT_* reasons,
+ * in which case it won't.  On SPOW_VQUEUE_REJECT_PRECHECK, job->result says
+ * why. */
+int spow_vqueue_submit(spow_vqueue_t *queue, uint64_t source, spow_verify_job_t *job);
+
+void spow_vqueue_stats(spow_vqueue_t *queue, spow_vqueue_stats_t *out_stats);
+
+/* The number of certificates 'source' has waiting. */
+size_t spow_vqueue_source_queued(spow_vqueue_t *queue, uint64_t source);
+
+#endif /* STEPPOW_VERIFY_QUEUE_H */
@@ -0,0 +1,929 @@
+/* Compile:
+ * clang -Wall -O3 -pthread src/verify.c src/verifier.c src/verify-queue.c src/replay-cache.c src/archive.c src/challenge.c src/kernel.c src/sha256.c src/sha256-simd.c src/sha256-shani.c -o bin/verify
+ * Run:
+ * ./bin/verify
+ * Runs the same checks as src/verify.py, but against libsteppow (see
+ * src/verifier.h): with spow_verify(), spow_verify_batch(),
+ * spow_verify_stream_t, and for the valid ones spow_verify_compact().  Then
+ * all of them once more from an archive, with spow_archive_audit(). */
+
+#include <fcntl.h> /* open */
+#include <inttypes.h> /* PRIu32 and similar */
+#include <stdint.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h> /* mkstemp */
+#include <string.h> /* memcmp, memset */
+#include <unistd.h> /* close, pwrite, unlink, usleep */
+
+#include "archive.h"
+#include "challenge.h"
+#include "compact.h"
+#include "nonce.h"
+#include "replay-cache.h"
+#include "sha256.h"
+#include "verifier.h"
+#include "verify-queue.h"
+
+typedef struct verify_selftest_t {
+    const char *name;
+    const unsigned char *init_hash;
+    const unsigned char *token;
+    uint32_t difficulty;
+    uint32_t safety;
+    uint32_t steps;
+    const unsigned char *cert;
+    uint32_t cert_size;
+    int valid;
+} verify_selftest_t;
+
+#define STEPPOW_STRING(x) ((const unsigned char *)x)
+#define STEPPOW_STRING_AND_SIZE(x) ((const unsigned char *)x), ((uint32_t)(sizeof(x)-1))
+static const verify_selftest_t VERIFY_SELFTESTS[] = {
+    /* Generated from TEST_CERTS in src/verify.py */
+    /* verify.py expects #0 to be valid, but its own try_verify() rejects it,
+     * too: The good nonce for this step is 0x030B, see #1. */
+    {
+        "verify.py #0",
+        STEPPOW_STRING("\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01"),
+        STEPPOW_STRING("\x02\x02\x02\x02\x02\x02\x02\x02"), 8, 8, 1,
+        STEPPOW_STRING_AND_SIZE("\x00\xf7"),
+        0
+    },
+    {
+        "verify.py #1",
+        STEPPOW_STRING("\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01"),
+        STEPPOW_STRING("\x02\x02\x02\x02\x02\x02\x02\x02"), 8, 8, 1,
+        STEPPOW_STRING_AND_SIZE("\x03\x0b"),
+        1
+    },
+    {
+        "verify.py #2",
+        STEPPOW_STRING("\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01"),
+        STEPPOW_STRING("\x02\x02\x02\x02\x02\x02\x02\x02"), 8, 8, 20,
+        STEPPOW_STRING_AND_SIZE("\x03\x0b\x00\x7f\x00\x54\x01\x81\x00\x2e\x01\xfe\x00\x96\x00\x6a\x00\xbc\x01\x37\x00\x37\x00\x6a\x00\x34\x03\x92\x00\x4a\x00\x1c\x00\x3f\x01\xc4\x00\xfd\x00\x38"),
+        1
+    },
+    {
+        "verify.py #3",
+        STEPPOW_STRING("\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"),
+        STEPPOW_STRING("\x00\x00\x00\x00\x00\x00\x00\x00"), 7, 7, 800,
+        STEPPOW_STRING_AND_SIZE("\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"),
+        0
+    },
+    {
+        "verify.py #4",
+        STEPPOW_STRING("\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"),
+        STEPPOW_STRING("\x00\x00\x00\x00\x00\x00\x00\x00"), 7, 7, 800,
+        STEPPOW_STRING_AND_SIZE("\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"),
+        0
+    },
+    {
+        "verify.py #5",
+        STEPPOW_STRING("\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"),
+        STEPPOW_STRING("\x00\x00\x00\x00\x00\x00\x00\x00"), 7, 7, 33,
+        STEPPOW_STRING_AND_SIZE("\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"),
+        0
+    },
+    {
+        "verify.py #6",
+        STEPPOW_STRING("\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"),
+        STEPPOW_STRING("\x00\x00\x00\x00\x00\x00\x00\x00"), 7, 7, 33,
+        STEPPOW_STRING_AND_SIZE("\x02\x98\x07\xa0\x5c\x80\xc9\x02\x40\x02\xd0\x14\x00\x35\x00\xac\x02\x00\x15\x40\x0c\x01\x50\x04\x00\x14\x00\xcb\x00\xbc\x06\x50\x2a\x40\x63\x00\x6c\x01\x50\x04\x40\x42\x03\x2c\x04\x40\x23\x00\x2e\x01\x54\x03\x60\x00\x80\x2e\x00\xd4"),
+        1
+    },
+    {
+        "verify.py #7",
+        STEPPOW_STRING("\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01\x01"),
+        STEPPOW_STRING("\x00\x00\x00\x00\x00\x00\x00\x00"), 7, 7, 33,
+        STEPPOW_STRING_AND_SIZE("\x02\x98\x07\xa0\x5c\x80\xc9\x02\x40\x02\xd0\x14\x00\x35\x00\xac\x02\x00\x15\x40\x0c\x01\x50\x04\x00\x14\x00\xcb\x00\xbc\x06\x50\x2a\x40\x63\x00\x6c\x01\x50\x04\x40\x42\x03\x2c\x04\x40\x23\x00\x2e\x01\x54\x03\x60\x00\x80\x2e\x00\xd4"),
+        0
+    },
+    {
+        "verify.py #8",
+        STEPPOW_STRING("\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"),
+        STEPPOW_STRING("\x01\x01\x01\x01\x01\x01\x01\x01"), 7, 7, 33,
+        STEPPOW_STRING_AND_SIZE("\x02\x98\x07\xa0\x5c\x80\xc9\x02\x40\x02\xd0\x14\x00\x35\x00\xac\x02\x00\x15\x40\x0c\x01\x50\x04\x00\x14\x00\xcb\x00\xbc\x06\x50\x2a\x40\x63\x00\x6c\x01\x50\x04\x40\x42\x03\x2c\x04\x40\x23\x00\x2e\x01\x54\x03\x60\x00\x80\x2e\x00\xd4"),
+        0
+    },
+    {
+        "verify.py #9",
+        STEPPOW_STRING("\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"),
+        STEPPOW_STRING("\x00\x00\x00\x00\x00\x00\x00\x00"), 7, 7, 33,
+        STEPPOW_STRING_AND_SIZE("\x02\x98\x07\xa0\x5c\x80\xc9\x02\x40\x02\xd0\x14\x00\x35\x00\xac\x02\x00\x15\x40\x0c\x01\x50\x04\x00\x14\x00\xcb\x00\xbc\x06\x50\x2a\x40\x63\x00\x6c\x01\x50\x04\x40\x42\x03\x2c\x04\x40\x22\x00\x2e\x01\x54\x03\x60\x00\x80\x2e\x00\xd4"),
+        0
+    },
+    {
+        "verify.py #10",
+        STEPPOW_STRING("\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"),
+        STEPPOW_STRING("\x00\x00\x00\x00\x00\x00\x00\x00"), 7, 7, 33,
+        STEPPOW_STRING_AND_SIZE("\x02\x98\x07\xa0\x5c\x80\xc9\x02\x40\x02\xd0\x14\x00\x35\x00\xac\x02\x00\x15\x40\x0c\x01\x50\x04\x00\x14\x00\xcb\x00\xbc\x06\x50\x2a\x40\x63\x00\x6c\x01\x50\x04\x40\x42\x03\x2c\x04\x40\x23\x00\x2e\x01\x54\x03\x60\x00\x80\x2e\x00\xd5"),
+        0
+    },
+    {
+        "verify.py #11",
+        STEPPOW_STRING("\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a"),
+        STEPPOW_STRING("\x5a\x5a\x5a\x5a\x5a\x5a\x5a\x5a"), 8, 7, 100,
+        STEPPOW_STRING_AND_SIZE("\x05\x92\x00\xbc\x07\xe0\x0f\xc0\x59\xa0\x0c\x00\x03\x00\x13\x00\xee\x00\x30\x0e\x58\x0c\x50\x07\x00\x84\x40\x54\x00\x85\x01\xcc\x00\x18\x03\xf8\x15\x50\x03\x60\x2c\x40\x30\x00\x69\x00\x02\x01\xd4\x0e\x00\x15\xe0\x03\xa0\x1b\x80\xb1\x80\xa4\x00\x2c\x04\x38\x10\xe8\x1c\x10\x13\x80\x74\xc0\x55\x00\x5c\x01\x1a\x03\x08\x05\xf0\x01\x00\x29\xc0\x50\x00\xa2\x82\x15\x05\x5e\x07\xa0\x01\x40\x04\xd0\x18\x40\x63\x40\xc6\x80\xdc\x00\x90\x00\xfc\x04\x20\x19\x40\x17\x80\x3a\x00\x6c\x00\xbc\x00\xe8\x01\x18\x13\xa8\x01\x60\x0a\xa0\x11\x01\x46\x00\x7b\x00\x36\x00\x50\x02\x50\x15\xf0\x03\x20\x8d\xc0\x18\x80\xe2\x00\x06\x03\x84\x12\xe8\x1b\x90\x19\x60\x29\x01\xd1\x02\x67\x00\x6a\x02\x8c\x02\xe8\x24\x80\x18\x40\x08\x80\x6f\x80\xb2\x02\x14\x00\x8c\x08\xc8\x07\xd0"),
+        1
+    },
+    {
+        "verify.py #12",
+        STEPPOW_STRING("\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f"),
+        STEPPOW_STRING("\x48\x69\x20\x6d\x61\x74\x65\x21"), 12, 7, 122,
+        STEPPOW_STRING_AND_SIZE("\x00\x6f\x80\x01\x3c\x03\x34\x82\xd9\x60\x38\x18\x02\xab\x40\x05\xe0\x38\x48\x03\x6c\xc0\x02\xbc\x0d\x65\x00\xe9\xf0\x02\x98\x02\xe5\x00\xdb\xa0\x1a\x4b\x02\x60\x00\xa1\x1c\x04\x24\x01\x2f\x00\x12\xca\x06\x94\x00\xef\x28\x18\x2b\x01\x13\xc0\x38\xa0\x02\x1c\x00\xdb\x70\x00\x26\x09\xd7\xc0\x7a\x40\x08\x9f\x00\x5e\xa0\x94\xb8\x06\xd2\x02\x1c\xc0\x19\x84\x0f\xa2\x01\x26\x38\x20\x81\x00\x40\x80\x0d\x7c\x05\xa1\x82\x3e\xf0\x2f\x94\x03\x7c\x80\x9f\xd8\x12\x93\x02\xb2\xc0\x32\x30\x01\xcd\x01\x24\x50\x3d\x44\x05\xdb\x40\x3c\x10\x0a\x3b\x01\xa8\x40\x5f\x14\x00\xc6\x00\xfe\x20\x5f\x34\x0a\x07\xc0\x0f\x18\x1c\xaa\x00\x97\x00\x38\x24\x0e\xf5\x80\xf5\xf0\x3e\x28\x07\x6f\xc3\xd6\x60\x00\x29\x02\x61\xa0\x30\xcc\x1b\xe3\x80\x3a\xa0\x06\xe0\x00\x1e\x40\x52\xb8\x2c\x90\x00\x3c\x40\x49\xf0\x16\x01\x00\x1d\xd0\x03\x04\x04\xb9\x40\x41\x90\x0b\x04\x06\x31\x80\x01\x9c\x10\xde\x01\x9e\x70\x0f\x2a\x01\x9f\xc0\x1c\xd0\x3e\xde\x01\xb0\x00\x0c\x10\x05\x13\x81\x78\x20\x1b\x86\x03\x6e\x40\x0e\x48\x1c\x42\x03\xc8\xc0\x85\xbc\x07\xd1\x01\x9c\x50\xb7\xf6\x00\x3d\x80\x0c\x18\x0d\x9d\x06\x0c\xa0\x0b\xe4\x03\x0c\x00\x63\xf0\x16\xee\x01\x1e\x40\x63\xa8\x00\xf8\x00\x07\x60\x06\x88"),
+        1
+    },
+    {
+        "verify.py #13",
+        STEPPOW_STRING("\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f"),
+        STEPPOW_STRING("\x48\x69\x20\x6d\x61\x74\x65\x3f"), 12, 7, 122,
+        STEPPOW_STRING_AND_SIZE("\x00\x6f\x80\x01\x3c\x03\x34\x82\xd9\x60\x38\x18\x02\xab\x40\x05\xe0\x38\x48\x03\x6c\xc0\x02\xbc\x0d\x65\x00\xe9\xf0\x02\x98\x02\xe5\x00\xdb\xa0\x1a\x4b\x02\x60\x00\xa1\x1c\x04\x24\x01\x2f\x00\x12\xca\x06\x94\x00\xef\x28\x18\x2b\x01\x13\xc0\x38\xa0\x02\x1c\x00\xdb\x70\x00\x26\x09\xd7\xc0\x7a\x40\x08\x9f\x00\x5e\xa0\x94\xb8\x06\xd2\x02\x1c\xc0\x19\x84\x0f\xa2\x01\x26\x38\x20\x81\x00\x40\x80\x0d\x7c\x05\xa1\x82\x3e\xf0\x2f\x94\x03\x7c\x80\x9f\xd8\x12\x93\x02\xb2\xc0\x32\x30\x01\xcd\x01\x24\x50\x3d\x44\x05\xdb\x40\x3c\x10\x0a\x3b\x01\xa8\x40\x5f\x14\x00\xc6\x00\xfe\x20\x5f\x34\x0a\x07\xc0\x0f\x18\x1c\xaa\x00\x97\x00\x38\x24\x0e\xf5\x80\xf5\xf0\x3e\x28\x07\x6f\xc3\xd6\x60\x00\x29\x02\x61\xa0\x30\xcc\x1b\xe3\x80\x3a\xa0\x06\xe0\x00\x1e\x40\x52\xb8\x2c\x90\x00\x3c\x40\x49\xf0\x16\x01\x00\x1d\xd0\x03\x04\x04\xb9\x40\x41\x90\x0b\x04\x06\x31\x80\x01\x9c\x10\xde\x01\x9e\x70\x0f\x2a\x01\x9f\xc0\x1c\xd0\x3e\xde\x01\xb0\x00\x0c\x10\x05\x13\x81\x78\x20\x1b\x86\x03\x6e\x40\x0e\x48\x1c\x42\x03\xc8\xc0\x85\xbc\x07\xd1\x01\x9c\x50\xb7\xf6\x00\x3d\x80\x0c\x18\x0d\x9d\x06\x0c\xa0\x0b\xe4\x03\x0c\x00\x63\xf0\x16\xee\x01\x1e\x40\x63\xa8\x00\xf8\x00\x07\x60\x06\x88"),
+        0
+    },
+    {
+        "verify.py #14",
+        STEPPOW_STRING("\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f"),
+        STEPPOW_STRING("\x48\x69\x20\x6d\x61\x74\x65\x21"), 11, 8, 122,
+        STEPPOW_STRING_AND_SIZE("\x00\x6f\x80\x01\x3c\x03\x34\x82\xd9\x60\x38\x18\x02\xab\x40\x05\xe0\x38\x48\x03\x6c\xc0\x02\xbc\x0d\x65\x00\xe9\xf0\x02\x98\x02\xe5\x00\xdb\xa0\x1a\x4b\x02\x60\x00\xa1\x1c\x04\x24\x01\x2f\x00\x12\xca\x06\x94\x00\xef\x28\x18\x2b\x01\x13\xc0\x38\xa0\x02\x1c\x00\xdb\x70\x00\x26\x09\xd7\xc0\x7a\x40\x08\x9f\x00\x5e\xa0\x94\xb8\x06\xd2\x02\x1c\xc0\x19\x84\x0f\xa2\x01\x26\x38\x20\x81\x00\x40\x80\x0d\x7c\x05\xa1\x82\x3e\xf0\x2f\x94\x03\x7c\x80\x9f\xd8\x12\x93\x02\xb2\xc0\x32\x30\x01\xcd\x01\x24\x50\x3d\x44\x05\xdb\x40\x3c\x10\x0a\x3b\x01\xa8\x40\x5f\x14\x00\xc6\x00\xfe\x20\x5f\x34\x0a\x07\xc0\x0f\x18\x1c\xaa\x00\x97\x00\x38\x24\x0e\xf5\x80\xf5\xf0\x3e\x28\x07\x6f\xc3\xd6\x60\x00\x29\x02\x61\xa0\x30\xcc\x1b\xe3\x80\x3a\xa0\x06\xe0\x00\x1e\x40\x52\xb8\x2c\x90\x00\x3c\x40\x49\xf0\x16\x01\x00\x1d\xd0\x03\x04\x04\xb9\x40\x41\x90\x0b\x04\x06\x31\x80\x01\x9c\x10\xde\x01\x9e\x70\x0f\x2a\x01\x9f\xc0\x1c\xd0\x3e\xde\x01\xb0\x00\x0c\x10\x05\x13\x81\x78\x20\x1b\x86\x03\x6e\x40\x0e\x48\x1c\x42\x03\xc8\xc0\x85\xbc\x07\xd1\x01\x9c\x50\xb7\xf6\x00\x3d\x80\x0c\x18\x0d\x9d\x06\x0c\xa0\x0b\xe4\x03\x0c\x00\x63\xf0\x16\xee\x01\x1e\x40\x63\xa8\x00\xf8\x00\x07\x60\x06\x88"),
+        1
+    },
+    {
+        "verify.py #15",
+        STEPPOW_STRING("\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f\x0f"),
+        STEPPOW_STRING("\x48\x69\x20\x6d\x61\x74\x65\x21"), 13, 6, 122,
+        STEPPOW_STRING_AND_SIZE("\x00\x6f\x80\x01\x3c\x03\x34\x82\xd9\x60\x38\x18\x02\xab\x40\x05\xe0\x38\x48\x03\x6c\xc0\x02\xbc\x0d\x65\x00\xe9\xf0\x02\x98\x02\xe5\x00\xdb\xa0\x1a\x4b\x02\x60\x00\xa1\x1c\x04\x24\x01\x2f\x00\x12\xca\x06\x94\x00\xef\x28\x18\x2b\x01\x13\xc0\x38\xa0\x02\x1c\x00\xdb\x70\x00\x26\x09\xd7\xc0\x7a\x40\x08\x9f\x00\x5e\xa0\x94\xb8\x06\xd2\x02\x1c\xc0\x19\x84\x0f\xa2\x01\x26\x38\x20\x81\x00\x40\x80\x0d\x7c\x05\xa1\x82\x3e\xf0\x2f\x94\x03\x7c\x80\x9f\xd8\x12\x93\x02\xb2\xc0\x32\x30\x01\xcd\x01\x24\x50\x3d\x44\x05\xdb\x40\x3c\x10\x0a\x3b\x01\xa8\x40\x5f\x14\x00\xc6\x00\xfe\x20\x5f\x34\x0a\x07\xc0\x0f\x18\x1c\xaa\x00\x97\x00\x38\x24\x0e\xf5\x80\xf5\xf0\x3e\x28\x07\x6f\xc3\xd6\x60\x00\x29\x02\x61\xa0\x30\xcc\x1b\xe3\x80\x3a\xa0\x06\xe0\x00\x1e\x40\x52\xb8\x2c\x90\x00\x3c\x40\x49\xf0\x16\x01\x00\x1d\xd0\x03\x04\x04\xb9\x40\x41\x90\x0b\x04\x06\x31\x80\x01\x9c\x10\xde\x01\x9e\x70\x0f\x2a\x01\x9f\xc0\x1c\xd0\x3e\xde\x01\xb0\x00\x0c\x10\x05\x13\x81\x78\x20\x1b\x86\x03\x6e\x40\x0e\x48\x1c\x42\x03\xc8\xc0\x85\xbc\x07\xd1\x01\x9c\x50\xb7\xf6\x00\x3d\x80\x0c\x18\x0d\x9d\x06\x0c\xa0\x0b\xe4\x03\x0c\x00\x63\xf0\x16\xee\x01\x1e\x40\x63\xa8\x00\xf8\x00\x07\x60\x06\x88"),
+        0
+    },
+    {
+        "verify.py #16",
+        STEPPOW_STRING("\x61\x62\x63\x64\x65\x66\x67\x68\x69\x6a\x6b\x6c\x6d\x6e\x6f\x70\x71\x72\x73\x74\x75\x76\x77\x78\x79\x7a\x31\x32\x33\x34\x35\x36"),
+        STEPPOW_STRING("\x31\x32\x33\x34\x35\x36\x37\x38"), 9, 7, 200,
+        STEPPOW_STRING_AND_SIZE("\x01\x35\x05\x17\x02\x1a\x05\xae\x04\xb5\x04\xba\x01\xcb\x00\xff\x02\x00\x04\x9e\x04\x4d\x05\x17\x00\x8a\x00\xec\x00\x2a\x03\x58\x05\x0c\x02\x29\x03\x21\x01\x01\x00\xe5\x04\x2a\x00\x40\x02\xc9\x00\x1c\x01\x58\x02\x78\x02\x8d\x04\x3b\x02\xaa\x03\xcb\x00\xf3\x00\xc2\x00\x12\x01\x58\x05\xfd\x01\x42\x06\x71\x00\x71\x05\xa4\x00\x34\x03\x5e\x00\x5b\x00\xde\x01\x84\x00\x8b\x00\x60\x02\xc8\x01\xe7\x02\xa7\x00\x91\x03\x59\x03\x35\x01\x7b\x05\xd9\x03\x9b\x00\xa7\x01\x77\x01\x7a\x00\x4a\x00\x3a\x01\xef\x00\xfe\x04\x8b\x01\x06\x00\x13\x02\xf8\x01\x04\x01\x6d\x00\xd2\x01\x07\x00\x6d\x01\x2e\x01\x0a\x04\x0b\x01\x5c\x05\xf6\x04\xf9\x00\x4e\x01\x76\x03\x4c\x04\xa5\x00\xe9\x01\xde\x04\xfd\x03\x60\x01\x2e\x00\x52\x00\x8a\x01\x35\x01\x4b\x02\x81\x00\x47\x04\xef\x00\x61\x00\x9a\x00\xde\x01\x30\x02\x1b\x02\xcf\x00\x89\x05\x1d\x01\x83\x01\x84\x01\x72\x01\x2a\x00\x84\x02\xd8\x01\xbd\x00\xf6\x00\x87\x04\x15\x00\x15\x02\x5c\x02\x4c\x01\x1c\x02\x09\x02\xc5\x04\x34\x01\x46\x00\x2f\x01\x2d\x02\x30\x02\x34\x01\x8a\x00\x2a\x00\xda\x00\x2c\x0b\xd2\x02\x1f\x02\x70\x03\x00\x03\x81\x01\xf1\x02\x42\x00\x99\x00\xf2\x00\xc0\x03\x8b\x04\x1e\x01\x54\x03\x52\x00\x29\x04\x9f\x02\x84\x00\xf4\x00\x7c\x00\xe0\x00\xee\x03\x0d\x00\xa0\x01\x92\x04\x49\x00\x5b\x04\x10\x02\xcd\x01\xac\x02\x0b\x01\x43\x01\xd8\x02\xc7\x02\x1d\x05\x21\x00\x69\x01\x56\x01\x52\x00\xd9\x00\xe7\x04\xa8\x00\xdc\x00\xee\x00\x7c\x02\x65\x02\x3b\x05\x11\x00\x1b\x00\xea\x04\x76\x00\x9a\x02\x6a\x01\x27\x01\xda\x01\x8a\x00\xc0\x04\x9c\x01\x13\x00\x12\x05\xbf\x00\x3d\x00\x49\x02\xa2\x02\x8c\x01\x7a\x02\xaa\x03\xa1\x00\x99\x00\xb2\x08\xf2\x01\x41\x05\x17"),
+        1
+    },
+    {
+        "verify.py #17",
+        STEPPOW_STRING("\x61\x62\x63\x64\x65\x66\x67\x68\x69\x6a\x6b\x6c\x6d\x6e\x6f\x70\x71\x72\x73\x74\x75\x76\x77\x78\x79\x7a\x31\x32\x33\x34\x35\x36"),
+        STEPPOW_STRING("\x38\x37\x36\x35\x34\x33\x32\x31"), 17, 7, 160,
+        STEPPOW_STRING_AND_SIZE("\x00\xd2\x7b\x02\x9a\xb1\x00\x41\x79\x00\xe0\x93\x01\xd6\xb1\x00\x99\x28\x00\x84\x68\x05\x45\x94\x00\x72\xe9\x02\xa6\xba\x01\x4c\xf5\x00\x0f\x67\x00\x43\x4c\x00\xdd\x1c\x02\x78\xeb\x00\xeb\x90\x02\xe6\xe4\x01\x0b\x04\x00\x15\xa8\x0c\x23\x50\x00\x17\x69\x00\x0a\xdb\x00\x6a\xe8\x02\x62\xe3\x01\x61\x35\x00\xa1\x75\x02\xa2\x67\x01\x5d\xe8\x03\x4a\x08\x03\xf4\x6c\x0d\xe5\x72\x04\x4c\xa1\x07\x27\x80\x00\x5a\x61\x00\xe1\x9a\x07\x4f\x7f\x02\x8a\xb7\x00\x88\x34\x02\x56\x71\x00\x3b\xbc\x00\x09\x46\x06\x39\xbb\x00\x67\xe1\x01\x18\xb8\x00\x01\x5f\x04\x9b\x60\x00\x1d\x3d\x05\x30\xc6\x02\x01\x35\x02\x6d\x21\x04\x48\x70\x00\x5d\xcb\x03\x3e\x60\x02\x3d\xa5\x01\x53\xf7\x01\x62\x29\x04\xf7\x74\x02\x46\x1d\x03\x93\x47\x03\x6d\xfe\x06\xac\xb0\x00\x69\xc7\x04\x0c\x78\x01\x78\xe7\x09\x2a\x1a\x03\x50\x5b\x01\x7a\x06\x02\x3c\xc9\x03\xc0\xe8\x01\xc4\x40\x09\x22\x21\x04\x69\x7b\x01\xc2\x9e\x01\x66\xe9\x01\xdd\x04\x00\x12\x86\x05\x50\x94\x00\x4e\xdc\x01\x8e\xed\x00\x53\x45\x05\x4e\x35\x00\x37\xab\x0c\x51\x6f\x02\x40\x54\x00\x16\xf5\x01\xc4\x20\x00\x14\xfa\x01\x5d\x89\x01\x79\x42\x02\x50\xab\x01\x83\x15\x01\x54\xa0\x00\xe8\x6f\x00\x22\x56\x03\xbe\xbd\x00\x44\x71\x01\x34\xe0\x01\x82\xd9\x01\x29\xb3\x00\x23\x4e\x01\xa4\xce\x02\x9f\xda\x01\xac\x59\x00\x59\x2f\x02\xcf\x33\x01\x47\x1e\x00\x75\xf2\x00\xb8\xdf\x04\x7c\xa0\x01\x80\x95\x03\x97\x70\x03\x45\x8a\x00\x8b\x96\x00\xee\x08\x03\x8a\xc3\x00\xa8\x60\x01\xd2\x61\x01\xa0\x92\x00\x23\x5c\x05\x30\x96\x01\x55\x56\x00\x77\xcd\x00\x0b\x1d\x01\xd1\x5b\x00\x32\x5e\x02\x1e\x9d\x00\xb3\x67\x03\x27\xa1\x02\xcc\xe2\x00\xbc\x52\x01\x8e\xdb\x03\xae\xcb\x01\x76\xb9\x08\xf5\xf7\x03\x35\x22\x00\x52\x52\x00\x89\xe4\x00\x67\x34\x00\x8a\x21\x00\xa3\x8e\x03\x61\x0a\x00\x04\x75\x04\x06\xe6\x01\x5f\xb9\x03\x4b\x8f\x04\x9a\x31\x01\x44\xcc\x01\xb7\xcf\x01\x0a\x96\x01\x8d\x9a\x01\x3d\xbe\x05\x2c\xa5\x00\x6c\x96\x00\xf5\x3e\x00\x1b\xbf\x05\x52\x40\x00\xad\x62\x02\x9e\x2f\x00\xe9\xfd\x08\xeb\xea"),
+        1
+    },
+    {
+        "verify.py #18",
+        STEPPOW_STRING("\x61\x62\x63\x64\x65\x66\x67\x68\x69\x6a\x6b\x6c\x6d\x6e\x6f\x70\x71\x72\x73\x74\x75\x76\x77\x78\x79\x7a\x31\x32\x33\x34\x35\x36"),
+        STEPPOW_STRING("\x6c\x61\x38\x61\x57\x34\x7a\x50"), 24, 8, 10,
+        STEPPOW_STRING_AND_SIZE("\x02\xa3\x0a\x20\x00\xf6\x1c\x17\x00\x04\x9d\x05\x00\xfb\x8d\x00\x02\x04\x41\xcf\x00\x72\x11\x1a\x00\x7a\x16\x24\x00\x09\x4b\xb4\x00\x15\x57\x4c\x00\xbf\x28\x44"),
+        1
+    },
+    {
+        "verify.py #19",
+        STEPPOW_STRING("\x61\x62\x63\x64\x65\x66\x67\x68\x69\x6a\x6b\x6c\x6d\x6e\x6f\x70\x71\x72\x73\x74\x75\x76\x77\x78\x79\x7a\x31\x32\x33\x34\x35\x36"),
+        STEPPOW_STRING("\x6c\x61\x38\x61\x57\x34\x7a\x50"), 24, 8, 10,
+        STEPPOW_STRING_AND_SIZE("\x02\xa3\x0a\x20\x00\xf6\x1c\x17\x00\x04\x9d\x05\x00\xfb\x8d\x00\x02\x04\x41\xcf\x00\x72\x11\x1a\x00\x7a\x16\x24\x00\x09\x4b\xb4\x00\x15\x57\x4c\x00\xbe\x28\x44"),
+        0
+    }
+};
+#define VERIFY_SELFTESTS_NUM (sizeof(VERIFY_SELFTESTS) / sizeof(VERIFY_SELFTESTS[0]))
+
+static int check_result(const verify_selftest_t *selftest, const char *how, int result) {
+    if ((result == SPOW_VERIFY_OK) != selftest->valid) {
+        printf("Selftest \"%s\" failed with %s: %s, but expected %s!\n",
+            selftest->name, how, spow_verify_strerror(result),
+            selftest->valid ? "valid" : "invalid");
+        return 0;
+    }
+    return 1;
+}
+
+static int stream_in_chunks(const verify_selftest_t *selftest, uint32_t chunk_size) {
+    spow_verify_stream_t stream;
+    int result = spow_verify_stream_init(&stream, selftest->init_hash, selftest->token,
+        selftest->difficulty, selftest->safety, selftest->steps);
+    for (uint32_t i = 0; i < selftest->cert_size && result == SPOW_VERIFY_PENDING; i += chunk_size) {
+        const uint32_t left = selftest->cert_size - i;
+        result = spow_verify_stream_push(&stream, selftest->cert + i, left < chunk_size ? left : chunk_size);
+    }
+    return spow_verify_stream_finish(&stream);
+}
+
+/* The compact encoding only has the nonces, so this is only meaningful for
+ * valid certificates: invalid padding, for example, is lost. */
+static int verify_as_compact(const verify_selftest_t *selftest) {
+    unsigned char compact[4096];
+    const size_t compact_size = spow_compact_encode(compact, sizeof(compact), selftest->difficulty,
+        selftest->safety, selftest->steps, selftest->cert, selftest->cert_size);
+    if (compact_size == 0) {
+        return SPOW_VERIFY_BAD_LENGTH;
+    }
+    return spow_verify_compact(selftest->init_hash, selftest->token, selftest->difficulty,
+        selftest->safety, selftest->steps, compact, compact_size);
+}
+
+/* Malformed compact certificates must be rejected, and cheaply. */
+static int run_compact_selftest(void) {
+    const char *name = "malformed compact certificates";
+    /* verify.py #16, profile S, 200 steps */
+    const verify_selftest_t *good = &VERIFY_SELFTESTS[16];
+    unsigned char compact[512];
+    const size_t max_size = spow_compact_max_size(good->difficulty, good->safety, good->steps);
+    const size_t size = spow_compact_encode(compact, sizeof(compact), good->difficulty,
+        good->safety, good->steps, good->cert, good->cert_size);
+    if (size == 0 || size >= good->cert_size) {
+        printf("Selftest \"%s\" failed: Encoded into %zu bytes instead of %" PRIu32 "!\n",
+            name, size, good->cert_size);
+        return 0;
+    }
+    const int last_padding = (int)(size * 8 - 1);
+    static const struct {
+        const char *what;
+        int expected;
+    } CASES[] = {
+        {"unknown version", SPOW_VERIFY_BAD_ENCODING},
+        {"truncated", SPOW_VERIFY_BAD_LENGTH},
+        {"trailing byte", SPOW_VERIFY_BAD_LENGTH},
+        {"longer than the cap", SPOW_VERIFY_BAD_LENGTH},
+        {"nonzero padding", SPOW_VERIFY_BAD_PADDING},
+        {"nonce too wide", SPOW_VERIFY_BAD_ENCODING},
+        {"flipped bit", SPOW_VERIFY_BAD_STEP},
+    };
+    for (size_t i = 0; i < sizeof(CASES) / sizeof(CASES[0]); ++i) {
+        unsigned char bad[512];
+        size_t bad_size = size;
+        memcpy(bad, compact, size);
+        memset(bad + size, 0, sizeof(bad) - size);
+        switch (i) {
+        case 0:
+            bad[0] = SPOW_COMPACT_VERSION + 1;
+            break;
+        case 1:
+            bad_size -= 1;
+            break;
+        case 2:
+            bad_size += 1;
+            break;
+        case 3:
+            bad_size = max_size + 1;
+            break;
+        case 4:
+            /* Only if there is padding at all; 200 steps of ~10.6 bits leave some. */
+            bad[last_padding / 8] |= 1;
+            break;
+        case 5:
+            /* 2^Safety ones: the nonce of step 0 would need Difficulty + Safety + 1 bits. */
+            memset(bad + 1, 0xFF, 16);
+            break;
+        default:
+            bad[size / 2] ^= 0x10;
+            break;
+        }
+        const int result = spow_verify_compact(good->init_hash, good->token, good->difficulty,
+            good->safety, good->steps, bad, bad_size);
+        if (result != CASES[i].expected) {
+            printf("Selftest \"%s\" failed: %s gave %s!\n", name, CASES[i].what, spow_verify_strerror(result));
+            return 0;
+        }
+    }
+    printf("Selftest \"%s\" passed (%zu bytes instead of %" PRIu32 ").\n", name, size, good->cert_size);
+    return 1;
+}
+
+/* What only the streaming verifier can do. */
+static int run_stream_selftest(void) {
+    const char *name = "streaming early abort";
+    /* verify.py #1, a valid single step */
+    const verify_selftest_t *valid = &VERIFY_SELFTESTS[1];
+    /* verify.py #4, 1400 bytes of garbage */
+    const verify_selftest_t *garbage = &VERIFY_SELFTESTS[4];
+    spow_verify_stream_t stream;
+    int result;
+
+    spow_verify_stream_init(&stream, valid->init_hash, valid->token,
+        valid->difficulty, valid->safety, valid->steps);
+    result = spow_verify_stream_push(&stream, valid->cert, valid->cert_size + 1);
+    if (result != SPOW_VERIFY_BAD_LENGTH) {
+        printf("Selftest \"%s\" failed: Oversized push gave %s!\n", name, spow_verify_strerror(result));
+        return 0;
+    }
+    spow_verify_stream_init(&stream, valid->init_hash, valid->token,
+        valid->difficulty, valid->safety, valid->steps);
+    spow_verify_stream_push(&stream, valid->cert, valid->cert_size);
+    result = spow_verify_stream_push(&stream, valid->cert, 1);
+    if (result != SPOW_VERIFY_BAD_LENGTH) {
+        printf("Selftest \"%s\" failed: Trailing byte gave %s!\n", name, spow_verify_strerror(result));
+        return 0;
+    }
+
+    /* The first step is complete after two bytes, and already wrong. */
+    spow_verify_stream_init(&stream, garbage->init_hash, garbage->token,
+        garbage->difficulty, garbage->safety, garbage->steps);
+    result = spow_verify_stream_push(&stream, garbage->cert, 2);
+    if (result != SPOW_VERIFY_BAD_STEP) {
+        printf("Selftest \"%s\" failed: Garbage gave %s!\n", name, spow_verify_strerror(result));
+        return 0;
+    }
+    printf("Selftest \"%s\" passed.\n", name);
+    return 1;
+}
+
+/* The nonce functions for the common widths must agree with the generic
+ * ones, also on where each nonce starts and ends. */
+static int run_nonce_selftest(void) {
+    const char *name = "specialized nonce widths";
+    static const uint32_t WIDTHS[] = {16, 20, 24, 32};
+    for (uint32_t w = 0; w < sizeof(WIDTHS) / sizeof(WIDTHS[0]); ++w) {
+        const uint32_t bits = WIDTHS[w];
+        const spow_nonce_get_fn get = spow_nonce_get_for(bits);
+        const spow_nonce_put_fn put = spow_nonce_put_for(bits);
+        if (get == spow_nonce_get_any || put == spow_nonce_put_any) {
+            printf("Selftest \"%s\" failed: No specialization for %" PRIu32 " bits!\n", name, bits);
+            return 0;
+        }
+        /* An odd number of steps, so that 20 bits end in the middle of a byte. */
+        const uint32_t steps = 7;
+        const size_t cert_size = (bits * steps + 7) / 8;
+        unsigned char special[32];
+        unsigned char generic[32];
+        memset(special, 0, sizeof(special));
+        memset(generic, 0, sizeof(generic));
+        uint64_t nonces[7];
+        uint64_t x = 0x9E3779B97F4A7C15ull;
+        for (uint32_t step = 0; step < steps; ++step) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            nonces[step] = x >> (64 - bits);
+        }
+        /* All ones in the first and last step, to catch spills into the neighbours. */
+        nonces[0] = (1ull << bits) - 1;
+        nonces[steps - 1] = (1ull << bits) - 1;
+        for (uint32_t step = 0; step < steps; ++step) {
+            put(special, bits, step, nonces[step]);
+            spow_nonce_put_any(generic, bits, step, nonces[step]);
+        }
+        if (0 != memcmp(special, generic, sizeof(special))) {
+            printf("Selftest \"%s\" failed: put() disagrees for %" PRIu32 " bits!\n", name, bits);
+            return 0;
+        }
+        for (uint32_t step = 0; step < steps; ++step) {
+            if (get(special, cert_size, bits, step) != nonces[step]
+                    || spow_nonce_get_any(special, cert_size, bits, step) != nonces[step]) {
+                printf("Selftest \"%s\" failed: get() disagrees for %" PRIu32 " bits, step %" PRIu32 "!\n",
+                    name, bits, step);
+                return 0;
+            }
+        }
+    }
+    printf("Selftest \"%s\" passed.\n", name);
+    return 1;
+}
+
+typedef struct vqueue_selftest_t {
+    uint32_t valid;
+    uint32_t invalid;
+} vqueue_selftest_t;
+
+/* Only called by the single worker thread. */
+static void vqueue_selftest_done(void *arg, spow_verify_job_t *job, int result) {
+    vqueue_selftest_t *ctx = arg;
+    (void)job;
+    if (result == SPOW_VERIFY_OK) {
+        ctx->valid += 1;
+    } else {
+        ctx->invalid += 1;
+    }
+}
+
+/* Three sources, one certificate each, but only room for two sources.  Each
+ * is taken by the worker before the next comes.  Returns the result of the
+ * third submit. */
+static int vqueue_selftest_third_source(const verify_selftest_t *good, uint64_t budget_per_second) {
+    spow_vqueue_config_t config;
+    spow_vqueue_config_default(&config);
+    config.max_sources = 2;
+    config.budget_burst = 1000;
+    config.budget_per_second = budget_per_second;
+    vqueue_selftest_t ctx = {0, 0};
+    spow_vqueue_t *queue = spow_vqueue_create(&config, vqueue_selftest_done, &ctx);
+    if (queue == NULL) {
+        return -1;
+    }
+    spow_verify_job_t jobs[3];
+    int result = -1;
+    for (uint32_t i = 0; i < 3; ++i) {
+        spow_verify_job_t job = {good->init_hash, good->token, good->difficulty,
+            good->safety, good->steps, good->cert, good->cert_size, -1};
+        jobs[i] = job;
+        result = spow_vqueue_submit(queue, 1 + i, &jobs[i]);
+        while (spow_vqueue_source_queued(queue, 1 + i) != 0) {
+            usleep(1000);
+        }
+    }
+    spow_vqueue_destroy(queue);
+    return result;
+}
+
+static int run_vqueue_selftest(void) {
+    const char *name = "verification queue admission";
+    /* verify.py #16, profile S, 200 steps */
+    const verify_selftest_t *good = &VERIFY_SELFTESTS[16];
+    /* verify.py #10, bad padding */
+    const verify_selftest_t *bad_padding = &VERIFY_SELFTESTS[10];
+    spow_vqueue_config_t config;
+    spow_vqueue_config_default(&config);
+    config.max_queued = 4;
+    /* Five certificates of 200 steps, and no refill worth mentioning */
+    config.budget_burst = 1000;
+    config.budget_per_second = 1;
+    vqueue_selftest_t ctx = {0, 0};
+    spow_vqueue_t *queue = spow_vqueue_create(&config, vqueue_selftest_done, &ctx);
+    if (queue == NULL) {
+        printf("Selftest \"%s\" failed: Cannot start the queue!\n", name);
+        return 0;
+    }
+    spow_verify_job_t jobs[16];
+    uint32_t results[SPOW_VQUEUE_REJECT_SOURCES + 1] = {0};
+    for (uint32_t i = 0; i < 16; ++i) {
+        const verify_selftest_t *selftest = (i == 0) ? bad_padding : good;
+        spow_verify_job_t job = {selftest->init_hash, selftest->token, selftest->difficulty,
+            selftest->safety, selftest->steps, selftest->cert, selftest->cert_size, -1};
+        jobs[i] = job;
+        /* Each source is one client, #1 floods. */
+        const int result = spow_vqueue_submit(queue, (i < 12) ? 1 : 2 + i, &jobs[i]);
+        results[result] += 1;
+    }
+    spow_vqueue_destroy(queue);
+
+    /* Source 1: One fails the pre-check, then at most 4 in the queue (the
+     * worker may have taken some by then), and at most 5 within the budget.
+     * The other four sources get one each. */
+    const uint32_t accepted = results[SPOW_VQUEUE_ACCEPTED];
+    if (results[SPOW_VQUEUE_REJECT_PRECHECK] != 1
+            || jobs[0].result != SPOW_VERIFY_BAD_PADDING
+            || accepted < 4 + 4 || accepted > 5 + 4
+            || results[SPOW_VQUEUE_REJECT_FULL] + results[SPOW_VQUEUE_REJECT_BUDGET] != 15 - accepted
+            || ctx.valid != accepted || ctx.invalid != 0) {
+        printf("Selftest \"%s\" failed: %" PRIu32 " accepted, %" PRIu32 " valid, %" PRIu32 " invalid!\n",
+            name, accepted, ctx.valid, ctx.invalid);
+        return 0;
+    }
+
+    /* Idle sources are only forgotten once their budget is full again. */
+    int result = vqueue_selftest_third_source(good, 1);
+    if (result != SPOW_VQUEUE_REJECT_SOURCES) {
+        printf("Selftest \"%s\" failed: A source with a used budget was forgotten (%d)!\n",
+            name, result);
+        return 0;
+    }
+    result = vqueue_selftest_third_source(good, 1000000000);
+    if (result != SPOW_VQUEUE_ACCEPTED) {
+        printf("Selftest \"%s\" failed: No idle source was forgotten (%d)!\n", name, result);
+        return 0;
+    }
+    printf("Selftest \"%s\" passed.\n", name);
+    return 1;
+}
+
+#define REPLAY_SELFTEST_THREADS 4
+#define REPLAY_SELFTEST_KEYS 1000
+
+typedef struct replay_selftest_t {
+    spow_replay_cache_t *cache;
+    uint32_t claimed;
+} replay_selftest_t;
+
+/* All threads race to claim the same keys. */
+static void *replay_selftest_thread(void *arg) {
+    replay_selftest_t *ctx = arg;
+    const unsigned char zeros[32] = {0};
+    for (uint32_t i = 0; i < REPLAY_SELFTEST_KEYS; ++i) {
+        spow_replay_key_t key;
+        spow_replay_key(&key, zeros, zeros, 1, 1, i + 1, NULL, 0);
+        if (spow_replay_claim(ctx->cache, &key, 60 * (uint64_t)1000000000) == SPOW_REPLAY_CLAIMED) {
+            ctx->claimed += 1;
+        }
+    }
+    return NULL;
+}
+
+static int run_replay_selftest(void) {
+    const char *name = "replay cache";
+    /* verify.py #11 and #12 */
+    const verify_selftest_t *a = &VERIFY_SELFTESTS[11];
+    const verify_selftest_t *b = &VERIFY_SELFTESTS[12];
+    spow_replay_key_t key_a, key_b, key_challenge;
+    spow_replay_key(&key_a, a->init_hash, a->token, a->difficulty, a->safety, a->steps, a->cert, a->cert_size);
+    spow_replay_key(&key_b, b->init_hash, b->token, b->difficulty, b->safety, b->steps, b->cert, b->cert_size);
+    spow_replay_key(&key_challenge, a->init_hash, a->token, a->difficulty, a->safety, a->steps, NULL, 0);
+    /* Room for exactly one bucket */
+    spow_replay_cache_t *cache = spow_replay_create(SPOW_REPLAY_WAYS);
+    const uint64_t minute_ns = 60 * (uint64_t)1000000000;
+    if (cache == NULL
+            || spow_replay_lookup(cache, &key_a) != SPOW_REPLAY_MISS
+            || spow_replay_claim(cache, &key_a, minute_ns) != SPOW_REPLAY_CLAIMED
+            || spow_replay_claim(cache, &key_a, minute_ns) != SPOW_REPLAY_SEEN
+            || spow_replay_lookup(cache, &key_a) != SPOW_REPLAY_SEEN
+            || spow_replay_lookup(cache, &key_b) != SPOW_REPLAY_MISS
+            || spow_replay_lookup(cache, &key_challenge) != SPOW_REPLAY_MISS) {
+        printf("Selftest \"%s\" failed: Wrong answers for the basics!\n", name);
+        spow_replay_destroy(cache);
+        return 0;
+    }
+    /* Expires right away */
+    if (spow_replay_claim(cache, &key_b, 1) != SPOW_REPLAY_CLAIMED
+            || spow_replay_lookup(cache, &key_b) != SPOW_REPLAY_MISS) {
+        printf("Selftest \"%s\" failed: No expiry!\n", name);
+        spow_replay_destroy(cache);
+        return 0;
+    }
+    /* Fill the bucket and then some: The oldest live entry goes. */
+    for (uint32_t i = 0; i < SPOW_REPLAY_WAYS; ++i) {
+        spow_replay_key_t key;
+        spow_replay_key(&key, a->init_hash, a->token, a->difficulty, a->safety, i + 1, NULL, 0);
+        spow_replay_claim(cache, &key, minute_ns);
+    }
+    spow_replay_stats_t stats;
+    spow_replay_stats(cache, &stats);
+    spow_replay_destroy(cache);
+    if (stats.evicted_live != 1) {
+        printf("Selftest \"%s\" failed: %" PRIu64 " live evictions instead of 1!\n", name, stats.evicted_live);
+        return 0;
+    }
+
+    /* Each key is claimed exactly once, however many threads try. */
+    replay_selftest_t ctx[REPLAY_SELFTEST_THREADS];
+    pthread_t threads[REPLAY_SELFTEST_THREADS];
+    cache = spow_replay_create(64 * REPLAY_SELFTEST_KEYS);
+    uint32_t claimed = 0;
+    for (int i = 0; i < REPLAY_SELFTEST_THREADS; ++i) {
+        ctx[i].cache = cache;
+        ctx[i].claimed = 0;
+        pthread_create(&threads[i], NULL, replay_selftest_thread, &ctx[i]);
+    }
+    for (int i = 0; i < REPLAY_SELFTEST_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+        claimed += ctx[i].claimed;
+    }
+    spow_replay_stats(cache, &stats);
+    spow_replay_destroy(cache);
+    if (claimed != REPLAY_SELFTEST_KEYS || stats.evicted_live != 0) {
+        printf("Selftest \"%s\" failed: %" PRIu32 " of %d keys claimed!\n", name, claimed, REPLAY_SELFTEST_KEYS);
+        return 0;
+    }
+    printf("Selftest \"%s\" passed.\n", name);
+    return 1;
+}
+
+static void archive_selftest_invalid(void *arg, uint64_t record, uint64_t offset, int result) {
+    (void)record;
+    (void)offset;
+    (void)result;
+    *(uint64_t *)arg += 1;
+}
+
+/* All selftests into an archive, and a valid one once more as compact and
+ * as truncated compact certificate.  The audit must find the same invalid
+ * ones, with and without the index. */
+static int run_archive_selftest(void) {
+    const char *name = "archive append and audit";
+    char path[] = "/tmp/steppow-archive-XXXXXX";
+    char index[sizeof(path) + 4];
+    const int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("Selftest \"%s\" failed: No temporary file!\n", name);
+        return 0;
+    }
+    close(fd);
+    snprintf(index, sizeof(index), "%s.idx", path);
+
+    spow_archive_t archive;
+    uint64_t expected_invalid = 0;
+    int ok = spow_archive_open(&archive, path) == 0;
+    for (uint32_t i = 0; ok && i < VERIFY_SELFTESTS_NUM; ++i) {
+        const verify_selftest_t *selftest = &VERIFY_SELFTESTS[i];
+        expected_invalid += !selftest->valid;
+        ok = spow_archive_append(&archive, selftest->init_hash, selftest->token, selftest->difficulty,
+            selftest->safety, selftest->steps, SPOW_ARCHIVE_FIXED, selftest->cert, selftest->cert_size) == 0;
+    }
+    /* verify.py #16, profile S */
+    const verify_selftest_t *good = &VERIFY_SELFTESTS[16];
+    unsigned char compact[512];
+    const size_t compact_size = spow_compact_encode(compact, sizeof(compact), good->difficulty,
+        good->safety, good->steps, good->cert, good->cert_size);
+    ok = ok && compact_size > 0
+        && spow_archive_append(&archive, good->init_hash, good->token, good->difficulty, good->safety,
+            good->steps, SPOW_ARCHIVE_COMPACT, compact, (uint32_t)compact_size) == 0
+        /* Truncated, which the audit can't decode */
+        && spow_archive_append(&archive, good->init_hash, good->token, good->difficulty, good->safety,
+            good->steps, SPOW_ARCHIVE_COMPACT, compact, (uint32_t)compact_size - 1) == 0
+        && spow_archive_sync(&archive) == 0;
+    expected_invalid += 1;
+    const uint64_t records = archive.records;
+    const uint64_t size = archive.size;
+    spow_archive_close(&archive);
+    if (!ok) {
+        printf("Selftest \"%s\" failed: Could not write %s!\n", name, path);
+        unlink(path);
+        unlink(index);
+        return 0;
+    }
+
+    /* Half a record, as if appending crashed: Reopening cuts it off. */
+    const int archive_fd = open(path, O_WRONLY);
+    ok = archive_fd >= 0 && pwrite(archive_fd, good->init_hash, 32, (off_t)size) == 32;
+    if (archive_fd >= 0) {
+        close(archive_fd);
+    }
+    ok = ok && spow_archive_open(&archive, path) == 0;
+    if (ok) {
+        ok = archive.records == records && archive.size == size;
+        spow_archive_close(&archive);
+    }
+    if (!ok) {
+        printf("Selftest \"%s\" failed: A torn record was not cut off!\n", name);
+        unlink(path);
+        unlink(index);
+        return 0;
+    }
+
+    for (int scan = 0; scan < 2; ++scan) {
+        if (scan) {
+            unlink(index);
+        }
+        spow_archive_stats_t stats;
+        uint64_t reported = 0;
+        if (spow_archive_audit(path, 2, archive_selftest_invalid, &reported, &stats) != 0
+                || stats.records != records || stats.invalid != expected_invalid
+                || reported != expected_invalid || stats.valid != records - expected_invalid
+                || stats.scanned != scan) {
+            printf("Selftest \"%s\" failed%s: %" PRIu64 " of %" PRIu64 " records invalid!\n",
+                name, scan ? " without the index" : "", reported, records);
+            unlink(path);
+            unlink(index);
+            return 0;
+        }
+    }
+    unlink(path);
+    unlink(index);
+    printf("Selftest \"%s\" passed (%" PRIu64 " records, %" PRIu64 " bytes).\n", name, records, size);
+    return 1;
+}
+
+/* A certificate for easy parameters (Difficulty + Safety = 8, so one byte
+ * per step), by trying each nonce in turn, like the prover would. */
+static void solve_tiny(const spow_challenge_t *challenge, unsigned char *cert) {
+    unsigned char msg[SPOW_SHA256_MSG_BYTES];
+    memcpy(msg, challenge->init_hash, 32);
+    memset(msg + 32, 0, 8);
+    memcpy(msg + 40, challenge->token, 8);
+    for (uint32_t step = 0; step < challenge->steps; ++step) {
+        const unsigned char step_be[4] = {(unsigned char)(step >> 24), (unsigned char)(step >> 16),
+            (unsigned char)(step >> 8), (unsigned char)step};
+        memcpy(msg + 48, step_be, 4);
+        unsigned char digest[SPOW_SHA256_DIGEST_BYTES];
+        for (unsigned int nonce = 0; nonce < 256; ++nonce) {
+            msg[39] = (unsigned char)nonce;
+            spow_sha256_hash52(digest, msg);
+            if ((digest[0] >> (8 - challenge->difficulty)) == 0) {
+                break;
+            }
+        }
+        cert[step] = msg[39];
+        memcpy(msg, digest, 32);
+    }
+}
+
+/* Against Python's hmac and hashlib, for the key bytes(range(32)) */
+static int run_challenge_selftest(void) {
+    const char *name = "challenge derivation";
+    static const struct {
+        uint64_t timestamp;
+        uint64_t client_id;
+        uint64_t nonce;
+        const unsigned char *init_hash;
+        const unsigned char *token;
+    } VECTORS[] = {
+        {1700000000, 42, 1,
+            STEPPOW_STRING("\xa6\x81\x82\xf0\xc2\x9e\x26\x8a\x1e\x46\x81\xeb\x0e\x5e\x94\xc1"
+                           "\xec\xa9\x37\xd0\x3d\xf7\xa7\x9b\x42\x58\xcf\x23\x94\x2e\x94\x27"),
+            STEPPOW_STRING("\x64\xcc\xdf\x1b\xdf\xf3\xa3\x3b")},
+        {1700000060, 7, 2,
+            STEPPOW_STRING("\xcd\x0b\x04\xfb\x21\x9a\x81\x90\x97\x3f\xfb\xe3\xd4\x4d\x1a\x89"
+                           "\x51\x46\xe7\x53\x0c\xf7\x15\xb1\x64\x40\x5f\x71\xe9\x8f\x19\x52"),
+            STEPPOW_STRING("\xda\x6b\xbf\xd1\x4c\xa6\x2d\x1b")},
+    };
+    unsigned char secret[32];
+    for (int i = 0; i < 32; ++i) {
+        secret[i] = (unsigned char)i;
+    }
+    spow_challenge_key_t key;
+    spow_challenge_key_init(&key, secret, sizeof(secret));
+
+    /* Few at once, and enough for all lanes, with some left over */
+    spow_challenge_t challenges[2 * SPOW_SHA256_MULTI_LANES_MAX + 3];
+    const size_t nums[] = {2, sizeof(challenges) / sizeof(challenges[0])};
+    for (size_t n = 0; n < sizeof(nums) / sizeof(nums[0]); ++n) {
+        memset(challenges, 0, sizeof(challenges));
+        for (size_t i = 0; i < nums[n]; ++i) {
+            challenges[i].timestamp = VECTORS[i % 2].timestamp;
+            challenges[i].client_id = VECTORS[i % 2].client_id;
+            challenges[i].nonce = VECTORS[i % 2].nonce;
+            challenges[i].difficulty = 9;
+            challenges[i].safety = 7;
+            challenges[i].steps = 200;
+        }
+        spow_challenge_derive(&key, challenges, nums[n]);
+        for (size_t i = 0; i < nums[n]; ++i) {
+            if (memcmp(challenges[i].init_hash, VECTORS[i % 2].init_hash, 32) != 0
+                    || memcmp(challenges[i].token, VECTORS[i % 2].token, 8) != 0) {
+                printf("Selftest \"%s\" failed: Challenge %zu of %zu is wrong!\n", name, i, nums[n]);
+                return 0;
+            }
+        }
+    }
+
+    /* Round trip through the context, with a real certificate */
+    spow_challenge_t challenge = challenges[0];
+    challenge.difficulty = 2;
+    challenge.safety = 6;
+    challenge.steps = 8;
+    spow_challenge_derive(&key, &challenge, 1);
+    unsigned char cert[8];
+    solve_tiny(&challenge, cert);
+    unsigned char context[SPOW_CHALLENGE_CONTEXT_BYTES];
+    spow_challenge_encode(context, &challenge);
+    const uint64_t now = challenge.timestamp + 60;
+    int result = spow_challenge_verify(&key, context, sizeof(context), now, 300, cert, sizeof(cert));
+    if (result != SPOW_VERIFY_OK) {
+        printf("Selftest \"%s\" failed: Own challenge: %s!\n", name, spow_verify_strerror(result));
+        return 0;
+    }
+    static const struct {
+        const char *what;
+        int expected;
+    } CASES[] = {
+        {"expired", SPOW_VERIFY_EXPIRED},
+        {"truncated context", SPOW_VERIFY_BAD_CONTEXT},
+        {"unknown version", SPOW_VERIFY_BAD_CONTEXT},
+        {"easier difficulty", SPOW_VERIFY_BAD_STEP},
+        {"other client", SPOW_VERIFY_BAD_STEP},
+    };
+    for (size_t i = 0; i < sizeof(CASES) / sizeof(CASES[0]); ++i) {
+        unsigned char bad[SPOW_CHALLENGE_CONTEXT_BYTES];
+        size_t bad_size = sizeof(bad);
+        uint64_t bad_now = now;
+        memcpy(bad, context, sizeof(bad));
+        switch (i) {
+        case 0:
+            bad_now = challenge.timestamp + 301;
+            break;
+        case 1:
+            bad_size -= 1;
+            break;
+        case 2:
+            bad[0] = SPOW_CHALLENGE_VERSION + 1;
+            break;
+        case 3:
+            /* Difficulty 1, with Safety 7 to keep the certificate size */
+            bad[28] = 1;
+            bad[32] = 7;
+            break;
+        default:
+            bad[16] ^= 1;
+            break;
+        }
+        result = spow_challenge_verify(&key, bad, bad_size, bad_now, 300, cert, sizeof(cert));
+        if (result != CASES[i].expected) {
+            printf("Selftest \"%s\" failed: %s gave %s!\n", name, CASES[i].what, spow_verify_strerror(result));
+            return 0;
+        }
+    }
+    printf("Selftest \"%s\" passed.\n", name);
+    return 1;
+}
+
+/* A certificate split in two must verify as a certificate and its
+ * extension, and end at the same hash. */
+static int run_chain_selftest(void) {
+    const char *name = "extendable certificates";
+    /* verify.py #16, profile S, 200 steps of 16 bits */
+    const verify_selftest_t *good = &VERIFY_SELFTESTS[16];
+    const uint32_t first_steps = 120;
+    const size_t first_size = first_steps * 2;
+    spow_verify_chain_t whole;
+    spow_verify_chain_t chain;
+    int result = spow_verify_chain_start(&whole, good->init_hash, good->token, good->difficulty,
+        good->safety, good->steps, good->cert, good->cert_size);
+    if (result == SPOW_VERIFY_OK) {
+        result = spow_verify_chain_start(&chain, good->init_hash, good->token, good->difficulty,
+            good->safety, first_steps, good->cert, first_size);
+    }
+    if (result == SPOW_VERIFY_OK) {
+        result = spow_verify_chain_extend(&chain, good->difficulty, good->safety,
+            good->steps - first_steps, good->cert + first_size, good->cert_size - first_size);
+    }
+    if (result != SPOW_VERIFY_OK) {
+        printf("Selftest \"%s\" failed: %s!\n", name, spow_verify_strerror(result));
+        return 0;
+    }
+    if (chain.steps != good->steps || memcmp(chain.last_hash, whole.last_hash, sizeof(whole.last_hash)) != 0) {
+        printf("Selftest \"%s\" failed: Extended chain differs from the whole certificate!\n", name);
+        return 0;
+    }
+
+    /* Bad extensions leave the chain alone. */
+    unsigned char bad[32];
+    memcpy(bad, good->cert + first_size, sizeof(bad));
+    bad[5] ^= 1;
+    result = spow_verify_chain_start(&chain, good->init_hash, good->token, good->difficulty,
+        good->safety, first_steps, good->cert, first_size);
+    const spow_verify_chain_t before = chain;
+    static const struct {
+        const char *what;
+        int expected;
+    } CASES[] = {
+        {"flipped bit", SPOW_VERIFY_BAD_STEP},
+        {"wrong length", SPOW_VERIFY_BAD_LENGTH},
+        {"too many steps", SPOW_VERIFY_BAD_PARAMS},
+    };
+    for (size_t i = 0; i < sizeof(CASES) / sizeof(CASES[0]); ++i) {
+        const uint32_t steps = (i == 2) ? UINT32_MAX : sizeof(bad) / 2;
+        const size_t size = (i == 1) ? sizeof(bad) - 1 : sizeof(bad);
+        result = spow_verify_chain_extend(&chain, good->difficulty, good->safety, steps, bad, size);
+        if (result != CASES[i].expected || memcmp(&chain, &before, sizeof(chain)) != 0) {
+            printf("Selftest \"%s\" failed: %s gave %s!\n", name, CASES[i].what, spow_verify_strerror(result));
+            return 0;
+        }
+    }
+    printf("Selftest \"%s\" passed.\n", name);
+    return 1;
+}
+
+int main(void) {
+    spow_verify_job_t jobs[VERIFY_SELFTESTS_NUM];
+    for (uint32_t i = 0; i < VERIFY_SELFTESTS_NUM; ++i) {
+        const verify_selftest_t *selftest = &VERIFY_SELFTESTS[i];
+        jobs[i].init_hash = selftest->init_hash;
+        jobs[i].token = selftest->token;
+        jobs[i].difficulty = selftest->difficulty;
+        jobs[i].safety = selftest->safety;
+        jobs[i].steps = selftest->steps;
+        jobs[i].cert = selftest->cert;
+        jobs[i].cert_size = selftest->cert_size;
+        jobs[i].result = -1;
+    }
+    spow_verify_batch(jobs, VERIFY_SELFTESTS_NUM);
+
+    uint32_t tests_passed = 0;
+    for (uint32_t i = 0; i < VERIFY_SELFTESTS_NUM; ++i) {
+        const verify_selftest_t *selftest = &VERIFY_SELFTESTS[i];
+        const int result = spow_verify(selftest->init_hash, selftest->token,
+            selftest->difficulty, selftest->safety, selftest->steps,
+            selftest->cert, selftest->cert_size);
+        int passed = check_result(selftest, "spow_verify", result);
+        passed = check_result(selftest, "spow_verify_batch", jobs[i].result) && passed;
+        passed = check_result(selftest, "bytewise stream", stream_in_chunks(selftest, 1)) && passed;
+        passed = check_result(selftest, "chunked stream", stream_in_chunks(selftest, 7)) && passed;
+        uint32_t failed_step;
+        unsigned char failed_input[SPOW_VERIFY_STEP_INPUT_BYTES];
+        passed = check_result(selftest, "spow_verify_explain", spow_verify_explain(
+            selftest->init_hash, selftest->token, selftest->difficulty, selftest->safety,
+            selftest->steps, selftest->cert, selftest->cert_size,
+            &failed_step, failed_input)) && passed;
+        if (selftest->valid) {
+            passed = check_result(selftest, "spow_verify_compact", verify_as_compact(selftest)) && passed;
+        }
+        if (passed) {
+            printf("Selftest \"%s\" passed: %s.\n", selftest->name, spow_verify_strerror(result));
+            tests_passed += 1;
+        }
+    }
+    if (run_stream_selftest()) {
+        tests_passed += 1;
+    }
+    if (run_nonce_selftest()) {
+        tests_passed += 1;
+    }
+    if (run_vqueue_selftest()) {
+        tests_passed += 1;
+    }
+    if (run_replay_selftest()) {
+        tests_passed += 1;
+    }
+    if (run_compact_selftest()) {
+        tests_passed += 1;
+    }
+    if (run_archive_selftest()) {
+        tests_passed += 1;
+    }
+    if (run_challenge_selftest()) {
+        tests_passed += 1;
+    }
+    if (run_chain_selftest()) {
+        tests_passed += 1;
+    }
+    const uint32_t tests_total = VERIFY_SELFTESTS_NUM + 8;
+    printf("Test results: passed %" PRIu32 ", failed %" PRIu32 ", %" PRIu32 " total.\n",
+        tests_passed, tests_total - tests_passed, tests_total);
+    return tests_passed != tests_total;
+}
@@ -1,9 +1,11 @@
 #!/usr/bin/env python3
 
+import io
 import sys
 
+from contextlib import redirect_stdout
 from hashlib import sha256
-from math import ceil, log2
+from math import ceil, exp, lgamma, log, log2
 from struct import Struct
 
 TEST_CERTS = [
@@ -64,6 +66,56 @@ HASHBYTES = H_STEP_OFF + H_STEP_LEN
 assert HASHBYTES == H_LAST_HASH_LEN + H_STEP_LEN + H_TOKEN_LEN + H_NONCE_LEN
 
 
+def gamma_cdf(k, x):
+    """Regularized lower and upper incomplete gamma function, P(k, x) and
+    Q(k, x), each computed directly, so that the smaller one is accurate.
+    See src/plan.c, also for the iteration limits."""
+    if x <= 0:
+        return 0.0, 1.0
+    prefix = exp(k * log(x) - x - lgamma(k))
+    if x < k + 1:
+        term = total = 1 / k
+        for n in range(1, 100000):
+            term *= x / (k + n)
+            total += term
+            if term < total * 1e-16:
+                break
+        return total * prefix, 1 - total * prefix
+    b = x + 1 - k
+    c = 1e300
+    d = h = 1 / b
+    for n in range(1, 100000):
+        a = -n * (n - k)
+        b += 2
+        d = 1 / ((a * d + b) or 1e-300)
+        c = (b + a / c) or 1e-300
+        h *= d * c
+        if abs(d * c - 1) < 1e-16:
+            break
+    return 1 - h * prefix, h * prefix
+
+
+def erlang_quantile(steps, difficulty, q):
+    """The q-quantile of the number of hashes, which is
+    Erlang(k=steps, lambda=2^-difficulty) distributed."""
+    lo, hi = 0.0, steps + 1.0
+    # Doubling past the largest float takes about 1000 rounds.
+    for _ in range(1100):
+        if gamma_cdf(steps, hi)[0] >= q:
+            break
+        lo, hi = hi, hi * 2
+    for _ in range(200):
+        if hi - lo <= hi * 1e-13:
+            break
+        mid = (lo + hi) / 2
+        p, upper = gamma_cdf(steps, mid)
+        if (p < q) if q <= 0.5 else (upper > 1 - q):
+            lo = mid
+        else:
+            hi = mid
+    return (lo + hi) / 2 * 2 ** difficulty
+
+
 def analyze_params(init_hash, token, difficulty, safety, steps, hashes_actual):
     print('Initial hash: {}'.format(init_hash))
     print('Token: {}'.format(token))
@@ -78,6 +130,9 @@ def analyze_params(init_hash, token, difficulty, safety, steps, hashes_actual):
     print('Probability of impossibility: < 2^({})'.format(
         log2(steps) - 2 ** safety))
     print('E[num hashes]: {}'.format(steps * (2 ** difficulty)))
+    print('Quantiles of num hashes: {}'.format(', '.join(
+        '{}%: {:.0f}'.format(q * 100, erlang_quantile(steps, difficulty, q))
+        for q in (0.001, 0.01, 0.1, 0.9, 0.99, 0.999))))
     print('Actual num hashes: {}'.format(hashes_actual))
     print('Certificate byte length: {}'.format(
         ceil(steps * (difficulty + safety) / 8)))
@@ -96,11 +151,29 @@ def extract_nonce(cert, cert_off, bits):
     for bit in range(0, bits):
         certbit = (cert[(cert_off + bit) // 8] << ((cert_off + bit) % 8)) & 0x80
         nonce[(nonce_off + bit) // 8] |= certbit >> ((nonce_off + bit) % 8)
-    assert nonce != bytearray(H_NONCE_LEN), (cert, bits, cert_off, nonce_off)
     return nonce
 
 
-def try_verify(init_hash, token, difficulty, safety, steps, certificate):
+def check_params(init_hash, token, difficulty, safety, steps):
+    """What both verifiers check before looking at the certificate."""
+    if len(init_hash) != H_LAST_HASH_LEN or len(token) != H_TOKEN_LEN:
+        raise ValueError('init_hash must have {} bytes and token {} bytes'.format(
+            H_LAST_HASH_LEN, H_TOKEN_LEN))
+    if (difficulty < 0 or safety < 0 or not 1 <= difficulty + safety <= 64
+            or not 1 <= steps <= 0xFFFFFFFF):
+        print('Bad parameters.')
+        return False
+    return True
+
+
+def print_failed_step(i, hashbuf, last_hash):
+    print('Failed at step {}, with buf {}, resulting in hash {}'.format(
+        i, hashbuf, last_hash))
+
+
+def try_verify_python(init_hash, token, difficulty, safety, steps, certificate):
+    if not check_params(init_hash, token, difficulty, safety, steps):
+        return False
     if len(certificate) != ceil(steps * (difficulty + safety) / 8):
         print('Bad length.')
         return False
@@ -125,12 +198,40 @@ def try_verify(init_hash, token, difficulty, safety, steps, certificate):
         assert len(hashbuf) == HASHBYTES
         last_hash, success = check_difficulty(hashbuf, difficulty)
         if not success:
-            print('Failed at step {}, with buf {}, resulting in hash {}'.format(
-                i, hashbuf, last_hash))
+            print_failed_step(i, hashbuf, last_hash)
             return False
     return True
 
 
+# The native module (make bin/_steppow.so, see src/steppow-python.c) gives
+# the same answers and diagnostics, many times faster, without copying the
+# certificate, and without holding the GIL while hashing.
+try:
+    import _steppow
+except ImportError:
+    _steppow = None
+
+
+def try_verify_native(init_hash, token, difficulty, safety, steps, certificate):
+    if not check_params(init_hash, token, difficulty, safety, steps):
+        return False
+    result, i, hashbuf = _steppow.verify(
+        init_hash, token, difficulty, safety, steps, certificate)
+    if result == _steppow.VERIFY_BAD_LENGTH:
+        print('Bad length.')
+    elif result == _steppow.VERIFY_BAD_PADDING:
+        print('Bad padding.')
+    elif result == _steppow.VERIFY_BAD_STEP:
+        print_failed_step(i, bytearray(hashbuf), sha256(hashbuf).digest())
+    return result == _steppow.VERIFY_OK
+
+
+def try_verify(init_hash, token, difficulty, safety, steps, certificate):
+    if _steppow is not None:
+        return try_verify_native(init_hash, token, difficulty, safety, steps, certificate)
+    return try_verify_python(init_hash, token, difficulty, safety, steps, certificate)
+
+
 def run_on(init_hash, token, difficulty, safety, steps, certificate, hashes_actual, valid_expect):
     analyze_params(init_hash, token, difficulty, safety, steps, hashes_actual)
     valid_actual = try_verify(init_hash, token, difficulty, safety, steps, certificate)
@@ -144,6 +245,52 @@ def run_on(init_hash, token, difficulty, safety, steps, certificate, hashes_actu
     return True
 
 
+# Inputs on which both verifiers must agree, including what they print:
+# (init_hash, token, difficulty, safety, steps, certificate, valid), where
+# valid is None if the arguments themselves are rejected with a ValueError.
+EDGE_CASES = [
+    (b'\x00' * 32, b'\x00' * 8, 7, 7, 0, b'', False),  # No steps
+    (b'\x00' * 32, b'\x00' * 8, 0, 0, 1, b'', False),  # No bits per step
+    (b'\x00' * 32, b'\x00' * 8, 60, 5, 1, b'\x00' * 9, False),  # 65 bits per step
+    (b'\x00' * 32, b'\x00' * 8, 0xFFFFFFFF, 1, 1, b'\x00' * 8, False),  # 2^32 bits per step
+    (b'\x00' * 32, b'\x00' * 8, 7, 7, 1 << 32, b'', False),  # Too many steps
+    (b'\x00' * 31, b'\x00' * 8, 7, 7, 1, b'\x00' * 2, None),  # Short init_hash
+    (b'\x00' * 32, b'\x00' * 9, 7, 7, 1, b'\x00' * 2, None),  # Long token
+    (b'\x00' * 32, b'\x00' * 8, 7, 7, 33, b'\x00' * 57, False),  # Short certificate
+    (b'\x00' * 32, b'\x00' * 8, 7, 7, 1, b'\x00\x01', False),  # Bad padding
+    (b'\x01' * 32, b'\x02' * 8, 8, 8, 1, b'\x00\xF7', False),  # Bad step
+    (b'\x01' * 32, b'\x02' * 8, 8, 8, 1, b'\x03\x0B', True),
+    (b'\x00' * 32, b'\x00' * 8, 1, 7, 1, b'\x00', True),  # Zero nonce
+    (b'\x00' * 32, b'\x00' * 8, 64, 0, 1, b'\x00' * 7 + b'\x01', False),  # 64 zeros
+]
+
+
+def run_edge_cases(cases):
+    """Run both verifiers on each case, and compare their verdicts and output."""
+    if _steppow is None:
+        print('Skipping the edge cases: only the pure Python verifier is available.')
+        return True
+    good = 0
+    for i, case in enumerate(cases):
+        *args, valid_expect = case
+        outcomes = []
+        for verifier in (try_verify_python, try_verify_native):
+            output = io.StringIO()
+            try:
+                with redirect_stdout(output):
+                    valid = verifier(*args)
+            except ValueError:
+                valid = None
+            outcomes.append((valid, output.getvalue()))
+        if outcomes[0] == outcomes[1] and outcomes[0][0] == valid_expect:
+            good += 1
+        else:
+            print('Edge case #{}: expected {}, but Python gave {}, and native gave {}'.format(
+                i, valid_expect, outcomes[0], outcomes[1]))
+    print('Edge cases where both verifiers agree as expected: {} of {}'.format(good, len(cases)))
+    return good == len(cases)
+
+
 SELFTEST_FORMAT = '''\
     {{
         "{name}",
@@ -179,7 +326,8 @@ def print_selftests(certificates):
 
 
 def run_all(certificates):
-    all_good = True
+    print('Using the {} verifier.'.format('native' if _steppow is not None else 'pure Python'))
+    all_good = run_edge_cases(EDGE_CASES)
     for i, args in enumerate(certificates):
         print('========================================')
         print('Checking cert #{} ({} bytes)'.format(i, len(args[5])))